@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(_MIOSIX) && (defined(__ARM_ARCH_7M__) || \
+    defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__))
+#define TSCPP_BENCH_DWT
+#else
+#include <chrono>
+#endif
+
+//Counts CPU cycles with the DWT unit of Cortex-M3/M4/M7/M33, or nanoseconds
+//with std::chrono on hosts and on cores without DWT
+class CycleCounter
+{
+public:
+    CycleCounter()
+    {
+#ifdef TSCPP_BENCH_DWT
+        demcr()|=1u<<24;  //TRCENA, enable the DWT and ITM units
+        cyccnt()=0;
+        dwtCtrl()|=1u;    //CYCCNTENA
+#endif
+    }
+
+    //Current count, wraps around every 2^32 units
+    uint32_t now() const
+    {
+#ifdef TSCPP_BENCH_DWT
+        return cyccnt();
+#else
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(
+            steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    //Unit of the counts
+    static const char *unit()
+    {
+#ifdef TSCPP_BENCH_DWT
+        return "cycles";
+#else
+        return "ns";
+#endif
+    }
+
+private:
+#ifdef TSCPP_BENCH_DWT
+    static volatile uint32_t& demcr()
+    {
+        return *reinterpret_cast<volatile uint32_t*>(0xe000edfc);
+    }
+    static volatile uint32_t& dwtCtrl()
+    {
+        return *reinterpret_cast<volatile uint32_t*>(0xe0001000);
+    }
+    static volatile uint32_t& cyccnt()
+    {
+        return *reinterpret_cast<volatile uint32_t*>(0xe0001004);
+    }
+#endif
+};
@@ -0,0 +1,315 @@
+//Benchmark of the buffer API for Miosix boards, also runs on hosts
+//
+//Reports the time per serialize()/unserialize()/unserializeUnknown() record,
+//in cycles read from the DWT cycle counter on Cortex-M or in nanoseconds
+//elsewhere, and the heap and stack used by a TypePoolBuffer with
+//TSCPP_BENCH_TYPES registered types, also when swapping the bytes of records
+//written with the opposite endianness. For the code size, build it with
+//different values of TSCPP_BENCH_TYPES and compare the text section printed
+//by arm-none-eabi-size (or size on hosts).
+//
+//On Miosix add this file and tscpp/buffer.cpp to the sources of the kernel
+//Makefile, on hosts build the tscpp_embedded_bench CMake target.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <new>
+#include <tscpp/buffer.h>
+#include "cycles.h"
+
+#ifndef TSCPP_BENCH_TYPES
+#define TSCPP_BENCH_TYPES 32
+#endif
+
+#ifndef TSCPP_BENCH_STACK
+#define TSCPP_BENCH_STACK 2048
+#endif
+
+using namespace std;
+using namespace tscpp;
+
+//
+// Heap accounting, every allocation of the program goes through here
+//
+
+static size_t heapBytes=0;
+static size_t heapAllocations=0;
+static const size_t heapHeader=alignof(max_align_t);
+
+void *operator new(size_t size)
+{
+    char *p=static_cast<char*>(malloc(size+heapHeader));
+    if(p==nullptr) abort(); //Running out of memory ends the benchmark
+    *reinterpret_cast<size_t*>(p)=size;
+    heapBytes+=size;
+    heapAllocations++;
+    return p+heapHeader;
+}
+
+void operator delete(void *p) noexcept
+{
+    if(p==nullptr) return;
+    char *q=static_cast<char*>(p)-heapHeader;
+    heapBytes-=*reinterpret_cast<size_t*>(q);
+    free(q);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+//
+// Stack accounting, an area below the current stack pointer is painted and
+// the bytes overwritten by a call are counted. The result is approximate, as
+// the frames of paintStack() and usedStack() are not exactly the same.
+//
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((noinline)) static void paintStack()
+{
+    volatile uint8_t area[TSCPP_BENCH_STACK];
+    for(int i=0;i<TSCPP_BENCH_STACK;i++) area[i]=0xa5;
+}
+
+__attribute__((noinline)) static int usedStack()
+{
+    volatile uint8_t area[TSCPP_BENCH_STACK];
+    int untouched=0;
+    while(untouched<TSCPP_BENCH_STACK && area[untouched]==0xa5) untouched++;
+    return TSCPP_BENCH_STACK-untouched;
+}
+
+#pragma GCC diagnostic pop
+
+//Not inlined, so that the call uses the stack below the caller frame
+template<typename F>
+__attribute__((noinline)) static void call(F& f)
+{
+    f();
+}
+
+template<typename F>
+static int measureStack(F f)
+{
+    paintStack();
+    call(f);
+    return usedStack();
+}
+
+//Keeps the compiler from removing or merging the loops being measured
+static inline void clobber()
+{
+    asm volatile("" : : : "memory");
+}
+
+//
+// Types, sized like the sensor samples logged on the boards
+//
+
+class Pressure
+{
+public:
+    uint64_t timestamp=0;
+    float pressure=0;
+};
+
+class Imu
+{
+public:
+    uint64_t timestamp=0;
+    float accel[3]={}, gyro[3]={}, mag[3]={};
+};
+
+class Block
+{
+public:
+    char data[256]={};
+};
+
+//Distinct types, to fill the registry
+template<int I>
+class Tagged
+{
+public:
+    uint32_t value=I;
+};
+
+template<int I>
+struct TaggedTypes
+{
+    static void registerAll(TypePoolBuffer& tp, int& found)
+    {
+        TaggedTypes<I-1>::registerAll(tp,found);
+        tp.registerType<Tagged<I-1>>([&found](Tagged<I-1>&) { found++; });
+    }
+
+    static int serializeAll(char *buffer, int size)
+    {
+        int used=TaggedTypes<I-1>::serializeAll(buffer,size);
+        return used+serialize(buffer+used,size-used,Tagged<I-1>());
+    }
+};
+
+template<>
+struct TaggedTypes<0>
+{
+    static void registerAll(TypePoolBuffer&, int&) {}
+    static int serializeAll(char*, int) { return 0; }
+};
+
+//
+// Benchmarks
+//
+
+static const int runs=5;       //The best run is reported
+static const int records=100;  //Records per run
+static char buffer[8192];
+
+template<typename T>
+static void benchmarkRecord(const CycleCounter& cc, const char *name)
+{
+    T t;
+    uint32_t bestSerialize=UINT32_MAX, bestUnserialize=UINT32_MAX;
+    int size=0;
+    for(int r=0;r<runs;r++)
+    {
+        uint32_t start=cc.now();
+        for(int i=0;i<records;i++)
+        {
+            size=serialize(buffer,sizeof(buffer),t);
+            clobber();
+        }
+        uint32_t middle=cc.now();
+        for(int i=0;i<records;i++)
+        {
+            unserialize(t,buffer,size);
+            clobber();
+        }
+        uint32_t end=cc.now();
+        if(middle-start<bestSerialize) bestSerialize=middle-start;
+        if(end-middle<bestUnserialize) bestUnserialize=end-middle;
+    }
+    int serializeStack=measureStack([&]{
+        serialize(buffer,sizeof(buffer),t);
+    });
+    int unserializeStack=measureStack([&]{ unserialize(t,buffer,size); });
+    printf("%-8s %4d bytes  serialize %6lu  unserialize %6lu %s/record"
+           "  stack %4d %4d\n",name,size,
+           static_cast<unsigned long>(bestSerialize/records),
+           static_cast<unsigned long>(bestUnserialize/records),cc.unit(),
+           serializeStack,unserializeStack);
+}
+
+static void benchmarkPool(const CycleCounter& cc)
+{
+    const int n=TSCPP_BENCH_TYPES;
+    printf("\nTypePoolBuffer with %d types\n",n);
+    printf("sizeof(TypePoolBuffer)           %4d\n",
+           static_cast<int>(sizeof(TypePoolBuffer)));
+    printf("sizeof(std::function)            %4d\n",
+           static_cast<int>(sizeof(function<void(const void*)>)));
+    printf("sizeof(std::string)              %4d\n",
+           static_cast<int>(sizeof(string)));
+
+    //The first type also allocates the registry, a callback that does not fit
+    //the small buffer of std::function costs an allocation per type
+    {
+        TypePoolBuffer tp;
+        size_t bytes=heapBytes, allocations=heapAllocations;
+        tp.registerType<Pressure>([](Pressure&) {});
+        size_t smallBytes=heapBytes-bytes;
+        size_t smallAllocations=heapAllocations-allocations;
+        Imu large;
+        bytes=heapBytes;
+        allocations=heapAllocations;
+        tp.registerType<Imu>([large](Imu&) { (void)large; });
+        printf("heap, first type                 %4d bytes %2d allocations\n",
+               static_cast<int>(smallBytes),static_cast<int>(smallAllocations));
+        printf("heap, type with a %2d B callback  %4d bytes %2d allocations\n",
+               static_cast<int>(sizeof(large)),
+               static_cast<int>(heapBytes-bytes),
+               static_cast<int>(heapAllocations-allocations));
+    }
+
+    size_t bytes=heapBytes, allocations=heapAllocations;
+    TypePoolBuffer *tp=new TypePoolBuffer;
+    int found=0;
+    TaggedTypes<n>::registerAll(*tp,found);
+    size_t poolBytes=heapBytes-bytes;
+    size_t poolAllocations=heapAllocations-allocations;
+    printf("heap, pool with all the types    %4d bytes %2d allocations, "
+           "%d bytes per type\n",static_cast<int>(poolBytes),
+           static_cast<int>(poolAllocations),static_cast<int>(poolBytes/n));
+
+    int size=TaggedTypes<n>::serializeAll(buffer,sizeof(buffer));
+    uint32_t best=UINT32_MAX;
+    for(int r=0;r<runs;r++)
+    {
+        uint32_t start=cc.now();
+        for(int pos=0;pos<size;)
+        {
+            pos+=unserializeUnknown(*tp,buffer+pos,size-pos);
+            clobber();
+        }
+        uint32_t elapsed=cc.now()-start;
+        if(elapsed<best) best=elapsed;
+    }
+    int stack=measureStack([&]{ unserializeUnknown(*tp,buffer,size); });
+    printf("unserializeUnknown               %6lu %s/record, stack %4d\n",
+           static_cast<unsigned long>(best/n),cc.unit(),stack);
+    if(found!=runs*n+1) printf("wrong number of records unserialized\n");
+    delete tp;
+}
+
+//Byte swapped records are copied in a chunk on the stack of a function that
+//is only called when swapping, so the stack of the other records is the same
+static void benchmarkSwap(const CycleCounter& cc)
+{
+    TypePoolBuffer tp;
+    int found=0;
+    tp.registerType<Imu>([&found](Imu&) { found++; });
+    tp.setLayout<Imu>({TSCPP_FIELD(Imu,timestamp),TSCPP_FIELD(Imu,accel),
+                       TSCPP_FIELD(Imu,gyro),TSCPP_FIELD(Imu,mag)});
+    tp.setByteSwap(true);
+    Imu imu;
+    int size=serialize(buffer,sizeof(buffer),imu);
+    size_t allocations=heapAllocations;
+    uint32_t best=UINT32_MAX;
+    for(int r=0;r<runs;r++)
+    {
+        uint32_t start=cc.now();
+        for(int i=0;i<records;i++)
+        {
+            unserializeUnknown(tp,buffer,size);
+            clobber();
+        }
+        uint32_t elapsed=cc.now()-start;
+        if(elapsed<best) best=elapsed;
+    }
+    int stack=measureStack([&]{ unserializeUnknown(tp,buffer,size); });
+    printf("unserializeUnknown, byte swapped %6lu %s/record, stack %4d, "
+           "%d allocations\n",static_cast<unsigned long>(best/records),
+           cc.unit(),stack,static_cast<int>(heapAllocations-allocations));
+    if(found!=runs*records+1) printf("wrong number of records unserialized\n");
+}
+
+int main()
+{
+    CycleCounter cc;
+    printf("Buffer API, best of %d runs of %d records\n",runs,records);
+    benchmarkRecord<Pressure>(cc,"Pressure");
+    benchmarkRecord<Imu>(cc,"Imu");
+    benchmarkRecord<Block>(cc,"Block");
+    benchmarkPool(cc);
+    benchmarkSwap(cc);
+    return 0;
+}
@@ -0,0 +1,423 @@
+#include <benchmark/benchmark.h>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <tscpp/buffer.h>
+#include <tscpp/stream.h>
+#include <tscpp/type_list.h>
+#include <tscpp/shm.h>
+#include <tscpp/packet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace tscpp;
+
+//Payloads of any size
+template<int N>
+class Payload
+{
+public:
+    char data[N]={};
+};
+
+//Wrappers that make the name of a type longer without changing its size
+template<typename T>
+class Wrap
+{
+public:
+    T t;
+};
+
+template<typename T, int Depth>
+struct Nest
+{
+    typedef Wrap<typename Nest<T,Depth-1>::type> type;
+};
+
+template<typename T>
+struct Nest<T,0>
+{
+    typedef T type;
+};
+
+//Distinct types of the same size, to fill the registries
+template<int I>
+class Tagged
+{
+public:
+    int64_t value[4]={I};
+};
+
+template<int I>
+struct TaggedTypes
+{
+    template<typename Pool>
+    static void registerAll(Pool& tp, int& found)
+    {
+        TaggedTypes<I-1>::registerAll(tp,found);
+        tp.template registerType<Tagged<I-1>>([&found](Tagged<I-1>&) {
+            found++;
+        });
+    }
+
+    static void serializeAll(vector<char>& buffer)
+    {
+        TaggedTypes<I-1>::serializeAll(buffer);
+        Tagged<I-1> t;
+        int size=typeName<Tagged<I-1>>().size+1+sizeof(t);
+        buffer.resize(buffer.size()+size);
+        serialize(&buffer[buffer.size()-size],size,t);
+    }
+};
+
+template<>
+struct TaggedTypes<0>
+{
+    template<typename Pool>
+    static void registerAll(Pool&, int&) {}
+    static void serializeAll(vector<char>&) {}
+};
+
+//TypeList of Tagged<0> to Tagged<I-1>
+template<int I, typename... Ts>
+struct TaggedList
+{
+    typedef typename TaggedList<I-1,Tagged<I-1>,Ts...>::type type;
+};
+
+template<typename... Ts>
+struct TaggedList<0,Ts...>
+{
+    typedef TypeList<Ts...> type;
+};
+
+class CountingVisitor
+{
+public:
+    template<typename T>
+    void operator()(T&) { found++; }
+
+    int found=0;
+};
+
+//A stream buffer that discards everything, to measure only the archive
+class NullBuffer : public streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    streamsize xsputn(const char*, streamsize n) override { return n; }
+};
+
+//Each iteration processes one record, so the time reported is per record,
+//and bytes_per_second is the throughput of the serialized records
+static void setCounters(benchmark::State& state, int recordSize, int nameSize)
+{
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations()*recordSize);
+    state.counters["record"]=recordSize;
+    state.counters["name"]=nameSize;
+}
+
+template<typename T>
+static int recordSize()
+{
+    return typeName<T>().size+1+sizeof(T);
+}
+
+//
+// Buffer API
+//
+
+template<typename T>
+static void BM_Serialize(benchmark::State& state)
+{
+    T t;
+    vector<char> buffer(recordSize<T>());
+    for(auto _ : state)
+    {
+        benchmark::DoNotOptimize(serialize(buffer.data(),buffer.size(),t));
+        benchmark::ClobberMemory();
+    }
+    setCounters(state,recordSize<T>(),typeName<T>().size);
+}
+
+template<typename T>
+static void BM_Unserialize(benchmark::State& state)
+{
+    T t;
+    vector<char> buffer(recordSize<T>());
+    serialize(buffer.data(),buffer.size(),t);
+    for(auto _ : state)
+    {
+        benchmark::DoNotOptimize(unserialize(t,buffer.data(),buffer.size()));
+        benchmark::ClobberMemory();
+    }
+    setCounters(state,recordSize<T>(),typeName<T>().size);
+}
+
+//Decode records of Types distinct types, all registered in the pool
+template<int Types>
+static void BM_UnserializeUnknown(benchmark::State& state)
+{
+    TypePoolBuffer tp;
+    int found=0;
+    TaggedTypes<Types>::registerAll(tp,found);
+    vector<char> buffer;
+    TaggedTypes<Types>::serializeAll(buffer);
+    int pos=0, size=buffer.size();
+    for(auto _ : state)
+    {
+        pos+=unserializeUnknown(tp,buffer.data()+pos,size-pos);
+        if(pos>=size) pos=0;
+    }
+    benchmark::DoNotOptimize(found);
+    setCounters(state,size/Types,typeName<Tagged<0>>().size);
+    state.counters["types"]=Types;
+}
+
+//Same records as BM_UnserializeUnknown, decoded through a TypeList
+template<int Types>
+static void BM_UnserializeTypeList(benchmark::State& state)
+{
+    typename TaggedList<Types>::type types;
+    CountingVisitor visitor;
+    vector<char> buffer;
+    TaggedTypes<Types>::serializeAll(buffer);
+    int pos=0, size=buffer.size();
+    for(auto _ : state)
+    {
+        pos+=unserializeUnknown(types,visitor,buffer.data()+pos,size-pos);
+        if(pos>=size) pos=0;
+    }
+    benchmark::DoNotOptimize(visitor.found);
+    setCounters(state,size/Types,typeName<Tagged<0>>().size);
+    state.counters["types"]=Types;
+}
+
+//One record through a shared memory ring, from the writer to a reader
+template<typename T>
+static void BM_ShmRing(benchmark::State& state)
+{
+    string name="/tscpp_bench_"+to_string(getpid());
+    ShmRingWriter writer(name,1<<16);
+    ShmRingReader reader(name);
+    TypePoolBuffer tp;
+    int found=0;
+    tp.registerType<T>([&found](T&) { found++; });
+    T t;
+    for(auto _ : state)
+    {
+        writer.serialize(t);
+        benchmark::DoNotOptimize(reader.unserializeUnknown(tp));
+    }
+    benchmark::DoNotOptimize(found);
+    setCounters(state,recordSize<T>(),typeName<T>().size);
+}
+
+//A UDP socket connected to another one on the loopback that is never read,
+//so that packets are dropped by the kernel instead of blocking
+class UdpDiscard
+{
+public:
+    UdpDiscard()
+    {
+        sockaddr_in addr={};
+        addr.sin_family=AF_INET;
+        addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+        socklen_t size=sizeof(addr);
+        receiver=socket(AF_INET,SOCK_DGRAM,0);
+        sender=socket(AF_INET,SOCK_DGRAM,0);
+        if(bind(receiver,reinterpret_cast<sockaddr*>(&addr),size)!=0 ||
+           getsockname(receiver,reinterpret_cast<sockaddr*>(&addr),&size)!=0 ||
+           connect(sender,reinterpret_cast<sockaddr*>(&addr),size)!=0)
+            sender=-1;
+    }
+
+    ~UdpDiscard()
+    {
+        close(receiver);
+        close(sender);
+    }
+
+    int receiver, sender;
+};
+
+//One send() per record, the baseline of BM_PacketWriter
+template<typename T>
+static void BM_SendPerRecord(benchmark::State& state)
+{
+    UdpDiscard udp;
+    if(udp.sender<0) return state.SkipWithError("no loopback socket");
+    T t;
+    vector<char> buffer(recordSize<T>());
+    for(auto _ : state)
+    {
+        int size=serialize(buffer.data(),buffer.size(),t);
+        benchmark::DoNotOptimize(send(udp.sender,buffer.data(),size,0));
+    }
+    setCounters(state,recordSize<T>(),typeName<T>().size);
+}
+
+template<typename T>
+static void BM_PacketWriter(benchmark::State& state)
+{
+    UdpDiscard udp;
+    if(udp.sender<0) return state.SkipWithError("no loopback socket");
+    PacketWriter writer(udp.sender);
+    T t;
+    for(auto _ : state) benchmark::DoNotOptimize(writer.serialize(t));
+    setCounters(state,recordSize<T>(),typeName<T>().size);
+    state.counters["packets"]=writer.sent();
+}
+
+//
+// Stream API
+//
+
+template<typename T>
+static void BM_OutputArchive(benchmark::State& state)
+{
+    T t;
+    NullBuffer nb;
+    ostream os(&nb);
+    OutputArchive oa(os);
+    for(auto _ : state)
+    {
+        oa<<t;
+        benchmark::ClobberMemory();
+    }
+    setCounters(state,recordSize<T>(),typeName<T>().size);
+}
+
+template<typename T>
+static void BM_InputArchive(benchmark::State& state)
+{
+    const int records=1024;
+    T t;
+    stringstream ss;
+    {
+        OutputArchive oa(ss);
+        for(int i=0;i<records;i++) oa<<t;
+    }
+    string data=ss.str();
+    istringstream is(data);
+    InputArchive ia(is);
+    int i=0;
+    for(auto _ : state)
+    {
+        ia>>t;
+        benchmark::ClobberMemory();
+        if(++i<records) continue;
+        state.PauseTiming();
+        is.clear();
+        is.seekg(0);
+        i=0;
+        state.ResumeTiming();
+    }
+    setCounters(state,recordSize<T>(),typeName<T>().size);
+}
+
+//Read a record as the wrong type, as when trying the types of a mixed stream
+//in turn, reporting the error with an exception or with ArchiveResult
+static void BM_InputArchiveWrongType(benchmark::State& state)
+{
+    stringstream ss;
+    {
+        OutputArchive oa(ss);
+        oa<<Payload<64>();
+    }
+    InputArchive ia(ss);
+    Payload<8> t;
+    for(auto _ : state)
+    {
+        try {
+            ia>>t;
+        } catch(TscppException& ex) {
+            benchmark::DoNotOptimize(ex.name().size());
+        }
+    }
+    setCounters(state,recordSize<Payload<64>>(),typeName<Payload<8>>().size);
+}
+
+static void BM_InputArchiveTryWrongType(benchmark::State& state)
+{
+    stringstream ss;
+    {
+        OutputArchive oa(ss);
+        oa<<Payload<64>();
+    }
+    InputArchive ia(ss);
+    Payload<8> t;
+    for(auto _ : state)
+        benchmark::DoNotOptimize(ia.tryRead(t).nameSize);
+    setCounters(state,recordSize<Payload<64>>(),typeName<Payload<8>>().size);
+}
+
+template<int Types>
+static void BM_UnknownInputArchive(benchmark::State& state)
+{
+    TypePoolStream tp;
+    int found=0;
+    TaggedTypes<Types>::registerAll(tp,found);
+    vector<char> buffer;
+    TaggedTypes<Types>::serializeAll(buffer);
+    //Repeat the records so that the stream is rewound rarely
+    string data;
+    while(data.size()<64*1024) data.append(buffer.begin(),buffer.end());
+    int records=data.size()/buffer.size()*Types;
+    istringstream is(data);
+    UnknownInputArchive ia(is,tp);
+    int i=0;
+    for(auto _ : state)
+    {
+        ia.unserialize();
+        if(++i<records) continue;
+        state.PauseTiming();
+        is.clear();
+        is.seekg(0);
+        i=0;
+        state.ResumeTiming();
+    }
+    benchmark::DoNotOptimize(found);
+    setCounters(state,buffer.size()/Types,typeName<Tagged<0>>().size);
+    state.counters["types"]=Types;
+}
+
+//Payload sizes from 8B to 4KiB, and name lengths for a 64B payload
+#define PAYLOAD_BENCHMARKS(bm)                                 \
+    BENCHMARK_TEMPLATE(bm, Payload<8>);                        \
+    BENCHMARK_TEMPLATE(bm, Payload<64>);                       \
+    BENCHMARK_TEMPLATE(bm, Payload<512>);                      \
+    BENCHMARK_TEMPLATE(bm, Payload<4096>);                     \
+    BENCHMARK_TEMPLATE(bm, Nest<Payload<64>, 8>::type);        \
+    BENCHMARK_TEMPLATE(bm, Nest<Payload<64>, 32>::type)
+
+//Registries from 1 to 256 types
+#define REGISTRY_BENCHMARKS(bm)                                \
+    BENCHMARK_TEMPLATE(bm, 1);                                 \
+    BENCHMARK_TEMPLATE(bm, 16);                                \
+    BENCHMARK_TEMPLATE(bm, 64);                                \
+    BENCHMARK_TEMPLATE(bm, 256)
+
+PAYLOAD_BENCHMARKS(BM_Serialize);
+PAYLOAD_BENCHMARKS(BM_Unserialize);
+REGISTRY_BENCHMARKS(BM_UnserializeUnknown);
+REGISTRY_BENCHMARKS(BM_UnserializeTypeList);
+PAYLOAD_BENCHMARKS(BM_ShmRing);
+BENCHMARK_TEMPLATE(BM_SendPerRecord, Payload<8>);
+BENCHMARK_TEMPLATE(BM_SendPerRecord, Payload<64>);
+BENCHMARK_TEMPLATE(BM_SendPerRecord, Payload<512>);
+BENCHMARK_TEMPLATE(BM_PacketWriter, Payload<8>);
+BENCHMARK_TEMPLATE(BM_PacketWriter, Payload<64>);
+BENCHMARK_TEMPLATE(BM_PacketWriter, Payload<512>);
+PAYLOAD_BENCHMARKS(BM_OutputArchive);
+PAYLOAD_BENCHMARKS(BM_InputArchive);
+BENCHMARK(BM_InputArchiveWrongType);
+BENCHMARK(BM_InputArchiveTryWrongType);
+REGISTRY_BENCHMARKS(BM_UnknownInputArchive);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,77 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <cassert>
+#include <tscpp/stream.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+int main()
+{
+    //Declare some types
+    Point2d p2d(1,2);
+    Point3d p3d(3,4,5);
+    const int n=100;
+    
+    //The buffered archive writes the same bytes as the unbuffered one
+    stringstream expected;
+    {
+        OutputArchive oa(expected,CompactHeader);
+        for(int i=0;i<n;i++) oa<<p2d<<p3d;
+    }
+    
+    //Nothing written until a block is full, then only whole blocks
+    {
+        stringstream ss;
+        alignas(8) char block[64];
+        {
+            BufferedOutputArchive oa(ss,block,sizeof(block),CompactHeader);
+            oa<<p2d;
+            assert(ss.str().empty());
+            for(int i=0;i<n;i++)
+            {
+                if(i>0) oa<<p2d;
+                oa<<p3d;
+                assert(ss.str().size()%sizeof(block)==0);
+            }
+        }
+        //The destructor flushes the last block
+        assert(ss.str()==expected.str());
+        
+        InputArchive ia(ss);
+        for(int i=0;i<n;i++)
+        {
+            Point2d q2;
+            Point3d q3;
+            ia>>q2>>q3;
+            assert(q2==p2d && q3==p3d);
+        }
+    }
+    
+    //Write callback, explicit flush
+    {
+        vector<int> sizes;
+        string data;
+        char block[512];
+        BufferedOutputArchive oa([&](const char *b, int size)
+        {
+            sizes.push_back(size);
+            data.append(b,size);
+        },block,sizeof(block),CompactHeader);
+        for(int i=0;i<n;i++) oa<<p2d<<p3d;
+        oa.flush();
+        assert(data==expected.str());
+        for(size_t i=0;i+1<sizes.size();i++) assert(sizes[i]==sizeof(block));
+        assert(sizes.back()>0 && sizes.back()<=(int)sizeof(block));
+        
+        //Flushing again writes nothing
+        size_t count=sizes.size();
+        oa.flush();
+        assert(sizes.size()==count);
+    }
+    
+    cout<<"Test passed"<<endl;
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <cassert>
+#include <tscpp/pipeline.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+//Unserialize all the blocks written by a pipeline, return the count per thread
+static vector<int> decode(const string& data, int blockSize, int threads)
+{
+    vector<int> found(threads,0);
+    TypePoolBuffer tp;
+    tp.registerType<Point3d>([&](Point3d& t) {
+        assert(t.z==-t.y);
+        found.at(t.x)++;
+    });
+    assert(data.size()%blockSize==0);
+    for(size_t block=0;block<data.size();block+=blockSize)
+    {
+        const char *buf=data.data()+block;
+        int readSize=0;
+        while(readSize<blockSize)
+        {
+            int result=unserializeUnknown(tp,buf+readSize,blockSize-readSize);
+            if(result<0)
+            {
+                //Only the '\0' tail of the block is left
+                for(int i=readSize;i<blockSize;i++) assert(buf[i]==0);
+                break;
+            }
+            readSize+=result;
+        }
+    }
+    return found;
+}
+
+int main()
+{
+    //Many producers, every object is either written or counted as dropped
+    {
+        const int threads=4, n=10000, blockSize=512;
+        string data;
+        LogPipeline lp([&](const char *b, int size) {
+            assert(size==blockSize);
+            data.append(b,size);
+        },8,blockSize);
+        vector<thread> producers;
+        vector<int> logged(threads,0);
+        for(int i=0;i<threads;i++) producers.emplace_back([&,i]{
+            for(int j=0;j<n;j++) if(lp.log(Point3d(i,j,-j))) logged[i]++;
+        });
+        for(auto& t : producers) t.join();
+        lp.stop();
+        vector<int> found=decode(data,blockSize,threads);
+        int total=0;
+        for(int i=0;i<threads;i++)
+        {
+            assert(found[i]==logged[i]);
+            total+=found[i];
+        }
+        assert(total+lp.drops()==threads*n);
+        assert(lp.highWaterMark()>=1 && lp.highWaterMark()<=8);
+    }
+    
+    //A stalled writer causes drops, but never blocks the producer
+    {
+        const int blockSize=64;
+        atomic<bool> stall(true);
+        string data;
+        LogPipeline lp([&](const char *b, int size) {
+            while(stall) this_thread::yield();
+            data.append(b,size);
+        },2,blockSize);
+        int logged=0;
+        for(int i=0;i<100;i++) if(lp.log(Point3d(0,i,-i))) logged++;
+        assert(logged<100 && lp.drops()==(unsigned int)(100-logged));
+        assert(lp.highWaterMark()==2);
+        
+        //Objects larger than a buffer are always dropped
+        char big[blockSize]={0};
+        assert(lp.log(big)==false);
+        stall=false;
+        lp.stop();
+        assert(decode(data,blockSize,1)[0]==logged);
+    }
+    
+    cout<<"Test passed"<<endl;
+    return 0;
+}
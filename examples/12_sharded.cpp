@@ -0,0 +1,63 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cassert>
+#include <tscpp/pipeline.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+int main()
+{
+    //Each producer has its own ring, the order of each producer is kept
+    const int threads=4, n=20000, blockSize=512;
+    string data;
+    vector<int> sizes;
+    ShardedLogPipeline lp([&](const char *b, int size) {
+        sizes.push_back(size);
+        data.append(b,size);
+    },threads,256,blockSize);
+    vector<thread> producers;
+    vector<int> logged(threads,0);
+    vector<LogProducer*> p(threads);
+    for(int i=0;i<threads;i++)
+    {
+        p[i]=lp.producer();
+        assert(p[i]);
+    }
+    assert(lp.producer()==nullptr);
+    for(int i=0;i<threads;i++) producers.emplace_back([&,i]{
+        for(int j=0;j<n;j++) if(p[i]->log(Point3d(i,j,-j))) logged[i]++;
+    });
+    for(auto& t : producers) t.join();
+    lp.stop();
+    
+    for(size_t i=0;i+1<sizes.size();i++) assert(sizes[i]==blockSize);
+    vector<int> found(threads,0), last(threads,-1);
+    TypePoolBuffer tp;
+    tp.registerType<Point3d>([&](Point3d& t) {
+        assert(t.z==-t.y && t.y>last.at(t.x));
+        last[t.x]=t.y;
+        found[t.x]++;
+    });
+    int readSize=0;
+    while(readSize<(int)data.size())
+    {
+        int result=unserializeUnknown(tp,data.data()+readSize,data.size()-readSize);
+        assert(result>0);
+        readSize+=result;
+    }
+    unsigned int drops=0;
+    for(int i=0;i<threads;i++)
+    {
+        assert(found[i]==logged[i]);
+        assert(p[i]->drops()==(unsigned int)(n-logged[i]));
+        drops+=p[i]->drops();
+    }
+    assert(lp.drops()==drops);
+    
+    cout<<"Test passed"<<endl;
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cassert>
+#include <system_error>
+#include <tscpp/stream.h>
+#include <tscpp/mmap.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+int main()
+{
+    //Declare some types
+    Point2d p2d(1,2);
+    Point3d p3d(3,4,5);
+    const int n=1000;
+    const char *path="13_mmap.dat";
+    
+    //Write a log with the stream API, including some trailing padding
+    {
+        ofstream os(path,ios::binary);
+        OutputArchive oa(os);
+        for(int i=0;i<n;i++) oa<<p2d<<p3d;
+        OutputArchive oa2(os,CompactHeader);
+        oa2<<p3d<<p3d;
+        os.write("\0\0\0\0",4);
+    }
+    
+    //Read it back through the mapped file
+    {
+        int found2=0, found3=0;
+        TypePoolBuffer tp;
+        tp.registerType<Point2d>([&](Point2d& t) { assert(t==p2d); found2++; });
+        tp.registerType<Point3d>([&](Point3d& t) { assert(t==p3d); found3++; });
+        MmapReader reader(path);
+        TypeDictionary td;
+        int result;
+        while((result=reader.unserializeUnknown(tp,td))>0) ;
+        assert(result==0 && reader.position()==reader.size());
+        assert(found2==n && found3==n+2);
+        
+        //Without the dictionary the compact part can't be decoded
+        reader.seek(0);
+        for(int i=0;i<2*n;i++) assert(reader.unserializeUnknown(tp)>0);
+        size_t pos=reader.position();
+        assert(reader.unserializeUnknown(tp)==UnknownType);
+        assert(reader.position()==pos);
+    }
+    
+    //Missing and empty files
+    try {
+        MmapReader reader("13_mmap.missing");
+        assert(false);
+    } catch(system_error&) {}
+    {
+        ofstream os(path,ios::binary);
+    }
+    {
+        TypePoolBuffer tp;
+        MmapReader reader(path);
+        assert(reader.size()==0 && reader.unserializeUnknown(tp)==0);
+    }
+    remove(path);
+    
+    cout<<"Test passed"<<endl;
+    return 0;
+}
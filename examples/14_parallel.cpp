@@ -0,0 +1,98 @@
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <cassert>
+#include <tscpp/buffer.h>
+#include <tscpp/parallel.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+int main()
+{
+    //Serialize single objects, batches and a compact part
+    const int n=10000;
+    vector<char> buffer(64*n);
+    int writeSize=0, halfSize=0;
+    TypeDictionary td;
+    for(int i=0;i<n;i++)
+    {
+        Point2d p2d(i,-i);
+        Point3d p3d[2]={Point3d(2*i,0,0),Point3d(2*i+1,0,0)};
+        int result;
+        if(i<n/2)
+        {
+            result=serialize(&buffer[writeSize],buffer.size()-writeSize,p2d);
+            assert(result>0);
+            writeSize+=result;
+            result=serializeArray(&buffer[writeSize],buffer.size()-writeSize,p3d,2);
+        } else {
+            result=serialize(td,&buffer[writeSize],buffer.size()-writeSize,p2d);
+            assert(result>0);
+            writeSize+=result;
+            result=serializeArray(td,&buffer[writeSize],buffer.size()-writeSize,p3d,2);
+        }
+        assert(result>0);
+        writeSize+=result;
+        if(i==n/2-1) halfSize=writeSize;
+    }
+    
+    //Any order, callbacks are concurrent
+    {
+        atomic<long long> sum2(0), sum3(0);
+        TypePoolBuffer tp;
+        tp.registerType<Point2d>([&](Point2d& t) { assert(t.y==-t.x); sum2+=t.x; });
+        tp.registerTypeArray<Point3d>([&](const Point3d *t, int count) {
+            for(int i=0;i<count;i++) sum3+=t[i].x;
+        });
+        ParallelDecoder pd(tp);
+        TypeDictionary td2;
+        assert(pd.scan(td2,buffer.data(),writeSize)==0);
+        assert(pd.scannedSize()==(size_t)writeSize && pd.size()==2*n);
+        pd.decode(4,ParallelDecoder::AnyOrder,100);
+        assert(sum2==(long long)n*(n-1)/2);
+        assert(sum3==(long long)2*n*(2*n-1)/2);
+    }
+    
+    //Type order, each type is unserialized in order by one thread, also with
+    //more threads than types and types not found in the buffer
+    for(int threads : {2,4})
+    {
+        vector<int> order2, order3;
+        TypePoolBuffer tp;
+        tp.registerType<MiscData>([&](MiscData&) { assert(false); });
+        tp.registerType<Point2d>([&](Point2d& t) { order2.push_back(t.x); });
+        tp.registerType<Point3d>([&](Point3d& t) { order3.push_back(t.x); });
+        ParallelDecoder pd(tp);
+        TypeDictionary td2;
+        assert(pd.scan(td2,buffer.data(),writeSize)==0);
+        pd.decode(threads,ParallelDecoder::TypeOrder);
+        assert(order2.size()==n && order3.size()==2*n);
+        for(int i=0;i<n;i++) assert(order2[i]==i);
+        for(int i=0;i<2*n;i++) assert(order3[i]==i);
+    }
+    
+    //Errors stop the scan, the types found before are kept
+    {
+        int found=0;
+        TypePoolBuffer tp;
+        tp.registerType<Point2d>([&](Point2d&) { found++; });
+        ParallelDecoder pd(tp);
+        assert(pd.scan(buffer.data(),writeSize)==UnknownType);
+        assert(pd.size()==1 && pd.scannedSize()>0);
+        pd.decode(1);
+        assert(found==1);
+        
+        //Trailing padding is accepted, truncated types are not
+        tp.registerType<Point3d>([&](Point3d&) {});
+        vector<char> padded(buffer.begin(),buffer.begin()+halfSize);
+        padded.resize(padded.size()+16,0);
+        assert(pd.scan(padded.data(),padded.size())==0);
+        assert(pd.scannedSize()==padded.size() && pd.size()==n);
+        assert(pd.scan(buffer.data(),halfSize-1)==BufferTooSmall);
+    }
+    
+    cout<<"Test passed"<<endl;
+    return 0;
+}
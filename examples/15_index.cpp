@@ -0,0 +1,78 @@
+#include <iostream>
+#include <sstream>
+#include <cassert>
+#include <stdexcept>
+#include <tscpp/buffer.h>
+#include <tscpp/stream.h>
+#include <tscpp/index.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+int main()
+{
+    //Write a log with a sidecar index, using the x of Point2d as timestamp
+    const int n=1000, blockSize=512;
+    stringstream log, sidecar;
+    {
+        char block[blockSize];
+        BufferedOutputArchive oa(log,block,sizeof(block),CompactHeader);
+        LogIndexWriter index(oa,sidecar,blockSize);
+        index.registerKey<Point2d>([](const Point2d& p) { return p.x; });
+        for(int i=0;i<n;i++)
+        {
+            oa<<Point2d(i,0);
+            if(i%10==0) oa<<Point3d(i,0,0);
+        }
+        assert(oa.written()>=n*(sizeof(Point2d)+1));
+    }
+    string data=log.str();
+    
+    LogIndex index(sidecar);
+    assert(index.granularity()==blockSize);
+    const vector<uint64_t>& offsets=index.offsets<Point2d>();
+    assert(offsets.size()>=data.size()/blockSize);
+    for(size_t i=1;i<offsets.size();i++)
+        assert(offsets[i]/blockSize>offsets[i-1]/blockSize);
+    assert(index.offsets<Point3d>().size()>0);
+    assert(index.offsets<MiscData>().empty());
+    assert(index.find<MiscData>(0)==LogIndex::npos);
+    
+    //Jump close to the first Point2d after a given timestamp
+    for(int key : {0,1,500,700,998})
+    {
+        uint64_t offset=index.find<Point2d>(key);
+        assert(offset<data.size());
+        int first=-1, found=-1;
+        TypePoolBuffer tp;
+        tp.registerType<Point2d>([&](Point2d& p) {
+            if(first<0) first=p.x;
+            if(found<0 && p.x>key) found=p.x;
+        });
+        tp.registerType<Point3d>([&](Point3d&) {});
+        TypeDictionary td;
+        index.prepare(td,offset);
+        int readSize=offset;
+        while(found<0)
+        {
+            int result=unserializeUnknown(tp,td,data.data()+readSize,
+                                          data.size()-readSize);
+            assert(result>0);
+            readSize+=result;
+        }
+        assert(found==key+1 && first<=key && readSize-offset<3*blockSize);
+    }
+    assert(index.find<Point2d>(0)==0);
+
+    //Errors
+    try {
+        stringstream log, idx;
+        OutputArchive oa(log);
+        LogIndexWriter iw(oa,idx,0);
+        assert(false);
+    } catch(invalid_argument&) {}
+    
+    cout<<"Test passed"<<endl;
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cassert>
+#include <tscpp/frame.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+//Write n Point3d, return the log and the offset of each frame
+static string writeLog(int n, bool crc, vector<size_t>& frames)
+{
+    string log;
+    char buffer[256];
+    FrameWriter fw([&](const char *b, int size) {
+        frames.push_back(log.size());
+        log.append(b,size);
+    },buffer,sizeof(buffer),crc,CompactHeader);
+    for(int i=0;i<n;i++) assert(fw.serialize(Point3d(i,0,0))>0);
+    char big[256];
+    assert(fw.serialize(big)==BufferTooSmall);
+    return log;
+}
+
+//Unserialize a log, return the x of all the Point3d found
+static vector<int> readLog(const string& log, size_t& skipped)
+{
+    vector<int> found;
+    TypePoolBuffer tp;
+    tp.registerType<Point3d>([&](Point3d& p) { found.push_back(p.x); });
+    FrameReader fr(log.data(),log.size());
+    int result;
+    while((result=fr.unserializeFrame(tp))!=0) assert(result>0);
+    assert(fr.position()==log.size());
+    skipped=fr.skipped();
+    return found;
+}
+
+int main()
+{
+    assert(crc32("123456789",9)==0xcbf43926);
+    assert(crc32("6789",4,crc32("12345",5))==0xcbf43926);
+    
+    const int n=1000;
+    for(bool crc : {true,false})
+    {
+        vector<size_t> frames;
+        string log=writeLog(n,crc,frames);
+        size_t skipped;
+        vector<int> found=readLog(log,skipped);
+        assert(found.size()==n && skipped==0);
+        for(int i=0;i<n;i++) assert(found[i]==i);
+        
+        //Damage the sync word of a frame, only that frame is lost, and
+        //without CRC also the preceding one
+        string damaged=log;
+        damaged[frames[3]]^=1;
+        found=readLog(damaged,skipped);
+        int lost=n-found.size();
+        assert(lost>0 && lost<40 && skipped==frames[4]-frames[crc ? 3 : 2]);
+        for(size_t i=1;i<found.size();i++) assert(found[i]>found[i-1]);
+        
+        //Damage the length of a frame
+        damaged=log;
+        damaged[frames[5]+4]^=0x01;
+        found=readLog(damaged,skipped);
+        assert(n-found.size()<20 && skipped==frames[6]-frames[5]);
+        
+        //Truncated last frame, as after a power loss, with some padding
+        damaged=log.substr(0,log.size()-10)+string(8,'\0');
+        found=readLog(damaged,skipped);
+        assert(found.size()<n && found.size()>n-20);
+    }
+    
+    //The CRC detects damage in the payload
+    {
+        vector<size_t> frames;
+        string log=writeLog(n,true,frames);
+        log[frames[7]+40]^=0x20;
+        size_t skipped;
+        vector<int> found=readLog(log,skipped);
+        assert(found.size()<n && found.size()>n-20 && skipped>0);
+    }
+    
+    cout<<"Test passed"<<endl;
+    return 0;
+}
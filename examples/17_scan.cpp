@@ -0,0 +1,99 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cassert>
+#include <tscpp/buffer.h>
+#include <tscpp/scan.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+int main()
+{
+    //The vectorized kernels agree with the scalar ones
+    srand(0);
+    for(int size=0;size<300;size++)
+    {
+        vector<char> buf(size);
+        for(int pos=0;pos<=size;pos++)
+        {
+            for(int i=0;i<size;i++) buf[i]=1+rand()%255;
+            if(pos<size) buf[pos]=0;
+            assert(findByte(buf.data(),size,0)==findByteScalar(buf.data(),size,0));
+            assert(findByte(buf.data(),size,0)==(size_t)pos);
+            for(int i=0;i<size;i++) buf[i]=i<pos ? 0 : 1+rand()%255;
+            assert(skipByte(buf.data(),size,0)==skipByteScalar(buf.data(),size,0));
+            assert(skipByte(buf.data(),size,0)==(size_t)pos);
+        }
+    }
+    
+    //Serialize some types, with padding and batches
+    const int n=100;
+    vector<char> buffer(64*n);
+    vector<size_t> offsets;
+    int writeSize=0;
+    for(int i=0;i<n;i++)
+    {
+        Point3d p3d[2]={Point3d(i,0,0),Point3d(i,1,0)};
+        offsets.push_back(writeSize);
+        int result=serialize(&buffer[writeSize],buffer.size()-writeSize,Point2d(i,0));
+        assert(result>0);
+        writeSize+=result;
+        offsets.push_back(writeSize);
+        if(i%2) result=serializeArray(&buffer[writeSize],buffer.size()-writeSize,p3d,2);
+        else result=serializeAligned(&buffer[writeSize],buffer.size()-writeSize,p3d[0]);
+        assert(result>0);
+        writeSize+=result;
+    }
+    
+    //Iterate over the types, without and with unserializing them
+    int found2=0, found3=0;
+    TypePoolBuffer tp;
+    tp.registerType<Point2d>([&](Point2d& p) { assert(p.x==found2); found2++; });
+    tp.registerType<Point3d>([&](Point3d&) { found3++; });
+    {
+        RecordIterator it(tp,buffer.data(),writeSize);
+        int count=0;
+        while(it.next()>0)
+        {
+            assert(it.offset()==offsets.at(count) || count%2);
+            assert(tp.registeredName(it.type().type)==
+                   (count%2 ? typeid(Point3d).name() : typeid(Point2d).name()));
+            it.unserialize();
+            count++;
+        }
+        assert(count==2*n && it.skipped()==0);
+        assert(found2==n && found3==n+n/2);
+    }
+    
+    //Damaged buffer, without resync the iterator stops, with resync it skips
+    {
+        vector<char> damaged(buffer.begin(),buffer.begin()+writeSize);
+        for(int i=0;i<30;i++) damaged[offsets[10]+i]='x';
+        RecordIterator it(tp,damaged.data(),damaged.size());
+        int count=0, result;
+        while((result=it.next())>0) count++;
+        assert(result==UnknownType && count==10);
+        
+        RecordIterator it2(tp,damaged.data(),damaged.size(),true);
+        found2=found3=count=0;
+        while(it2.next()>0) count++;
+        assert(count>2*n-5 && count<2*n);
+        assert(it2.skipped()>=30 && it2.skipped()<64);
+        
+        //The compact header format is accepted with a dictionary
+        TypeDictionary td;
+        vector<char> compact(256);
+        int size=serialize(td,compact.data(),compact.size(),Point2d(0,0));
+        size+=serialize(td,compact.data()+size,compact.size()-size,Point2d(1,0));
+        TypeDictionary td2;
+        RecordIterator it3(tp,td2,compact.data(),size);
+        count=0;
+        while(it3.next()>0) count++;
+        assert(count==2);
+    }
+    
+    cout<<"Test passed"<<endl;
+    return 0;
+}
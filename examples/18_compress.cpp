@@ -0,0 +1,241 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cassert>
+#include <stdexcept>
+#include <tscpp/compress.h>
+#include <tscpp/stream.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+//Compress a block and check that it decompresses to the same data
+static int roundTrip(BlockCompressor& bc, const vector<char>& data, int stride)
+{
+    vector<char> block(compressBound(data.size()));
+    int size=bc.compress(data.data(),data.size(),block.data(),block.size(),
+                         stride);
+    assert(size>=blockHeaderSize);
+    int rawSize;
+    assert(blockSize(block.data(),size,rawSize)==size);
+    assert(rawSize==static_cast<int>(data.size()));
+    vector<char> raw(data.size());
+    assert(decompressBlock(block.data(),size,raw.data(),raw.size())==rawSize);
+    assert(raw==data);
+    //A buffer too small for the result, and a truncated block
+    if(rawSize>0)
+    {
+        assert(decompressBlock(block.data(),size,raw.data(),rawSize-1)<0);
+        assert(decompressBlock(block.data(),size-1,raw.data(),rawSize)<0);
+    }
+    return size;
+}
+
+//Run length codec, as pairs of count and byte
+class RunLengthCodec : public BlockCodec
+{
+public:
+    int method() const override { return CustomBlock; }
+
+    int compress(const char *src, int srcSize, char *dst,
+                 int dstSize) override
+    {
+        int size=0;
+        for(int i=0;i<srcSize;)
+        {
+            int run=1;
+            while(run<255 && i+run<srcSize && src[i+run]==src[i]) run++;
+            if(dstSize-size<2) return BufferTooSmall;
+            dst[size++]=run;
+            dst[size++]=src[i];
+            i+=run;
+        }
+        return size;
+    }
+
+    int decompress(const char *src, int srcSize, char *dst,
+                   int dstSize) const override
+    {
+        int size=0;
+        for(int i=0;i+1<srcSize;i+=2)
+        {
+            int run=static_cast<unsigned char>(src[i]);
+            if(dstSize-size<run) return BufferTooSmall;
+            for(int j=0;j<run;j++) dst[size++]=src[i+1];
+        }
+        return size==dstSize ? size : BufferTooSmall;
+    }
+};
+
+int main()
+{
+    BlockCompressor bc;
+    mt19937 gen(42);
+    
+    //Random data is stored, repetitive data is compressed
+    vector<char> data(10000);
+    for(auto& c : data) c=gen();
+    assert(roundTrip(bc,data,0)==blockHeaderSize+10000);
+    for(int i=0;i<10000;i++) data[i]="abcdefgh"[i%7];
+    assert(roundTrip(bc,data,0)<200);
+    for(int size : {0,1,5,12,13,20,100}) roundTrip(bc,vector<char>(size,'x'),0);
+    
+    //Slowly changing records compress better with the delta filter
+    int stride=serializedSize<Point3d>();
+    vector<char> records;
+    for(int i=0;i<1000;i++)
+    {
+        char buffer[64];
+        Point3d p(100000+3*i,i/10,-5000+gen()%16);
+        assert(serialize(buffer,sizeof(buffer),p)==stride);
+        records.insert(records.end(),buffer,buffer+stride);
+    }
+    int plain=roundTrip(bc,records,0);
+    int filtered=roundTrip(bc,records,stride);
+    assert(filtered<plain);
+    
+    //Corrupted blocks are rejected, not decoded past the buffers
+    vector<char> block(compressBound(records.size()));
+    int size=bc.compress(records.data(),records.size(),block.data(),
+                         block.size());
+    vector<char> raw(records.size());
+    for(int i=blockHeaderSize;i<size;i++)
+    {
+        vector<char> damaged(block.begin(),block.begin()+size);
+        damaged[i]^=0x55;
+        decompressBlock(damaged.data(),size,raw.data(),raw.size());
+    }
+    block[10]=2;
+    assert(decompressBlock(block.data(),size,raw.data(),raw.size())<0);
+    
+    //A custom codec is selected by the method in the block header
+    {
+        RunLengthCodec rlc;
+        BlockCompressor rc(&rlc);
+        vector<char> runs(5000,'a');
+        runs.insert(runs.end(),300,'b');
+        vector<char> block(compressBound(runs.size()));
+        int size=rc.compress(runs.data(),runs.size(),block.data(),
+                             block.size());
+        assert(size<blockHeaderSize+100 && block[10]==CustomBlock);
+        vector<char> raw(runs.size());
+        assert(decompressBlock(block.data(),size,raw.data(),raw.size())==
+               UnknownType);
+        assert(decompressBlock(block.data(),size,raw.data(),raw.size(),
+                               &rlc)==static_cast<int>(raw.size()));
+        assert(raw==runs);
+        //Blocks that don't shrink are still stored
+        for(auto& c : data) c=gen();
+        block.resize(compressBound(data.size()));
+        size=rc.compress(data.data(),data.size(),block.data(),block.size());
+        assert(size==blockHeaderSize+10000 && block[10]==StoredBlock);
+
+        stringstream ss;
+        {
+            CompressedOutputStream cos(ss,4096,0,&rlc);
+            OutputArchive oa(cos);
+            for(int i=0;i<300;i++) oa<<Point3d(0,0,i/100);
+        }
+        CompressedInputStream cis(ss,&rlc);
+        InputArchive ia(cis);
+        for(int i=0;i<300;i++)
+        {
+            Point3d p;
+            ia>>p;
+            assert(p==Point3d(0,0,i/100));
+        }
+    }
+
+    //Stream API, with blocks smaller than some of the serialized types
+    stringstream ss;
+    {
+        CompressedOutputStream cos(ss,16,stride);
+        OutputArchive oa(cos);
+        for(int i=0;i<300;i++)
+        {
+            oa<<Point3d(i,2*i,3*i);
+            if(i%100==0) oa<<MiscData();
+        }
+        oa<<Point2d(1,2);
+    }
+    stringstream cs(ss.str());
+    {
+        CompressedInputStream cis(cs);
+        InputArchive ia(cis);
+        for(int i=0;i<300;i++)
+        {
+            Point3d p;
+            ia>>p;
+            assert(p.x==i && p.y==2*i && p.z==3*i);
+            if(i%100==0)
+            {
+                //A wrong type seeks back and can then be read
+                Point2d q;
+                try {
+                    ia>>q;
+                    assert(false);
+                } catch(TscppException& ex) {
+                    assert(string(ex.what())=="wrong type");
+                }
+                MiscData m;
+                ia>>m;
+            }
+        }
+    }
+    cs.clear();
+    cs.seekg(0);
+    {
+        CompressedInputStream cis(cs);
+        TypePoolStream tp;
+        int points=0;
+        tp.registerType<Point3d>([&](Point3d& p) {
+            assert(p.x==points);
+            points++;
+        });
+        tp.registerType<MiscData>([&](MiscData&) {});
+        UnknownInputArchive ia(cis,tp);
+        for(int i=0;i<303;i++) ia.unserialize();
+        auto pos=cis.tellg();
+        try {
+            ia.unserialize();
+            assert(false);
+        } catch(TscppException& ex) {
+            assert(string(ex.what())=="unknown type");
+            assert(cis.tellg()==pos);
+        }
+        assert(points==300);
+    }
+    
+    //A corrupted stream throws
+    string damaged=ss.str();
+    damaged[blockHeaderSize+1000]^=0x55;
+    damaged.resize(damaged.size()-3);
+    stringstream ds(damaged);
+    {
+        CompressedInputStream cis(ds);
+        InputArchive ia(cis);
+        try {
+            for(;;)
+            {
+                Point3d p;
+                ia>>p;
+            }
+        } catch(TscppException&) {}
+    }
+    
+    //Methods of the built in formats can't be used by a codec
+    class BadCodec : public RunLengthCodec
+    {
+    public:
+        int method() const override { return CompressedBlock; }
+    } bad;
+    try {
+        stringstream ss;
+        CompressedOutputStream cos(ss,4096,0,&bad);
+        assert(false);
+    } catch(invalid_argument&) {}
+    cout<<"Test passed"<<endl;
+}
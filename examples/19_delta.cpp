@@ -0,0 +1,193 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <cassert>
+#include <tscpp/buffer.h>
+#include <tscpp/stream.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+//A slowly changing sample, only x changes at every step
+static Point3d sample(int i)
+{
+    return Point3d(1000+i,i/16,-1);
+}
+
+int main()
+{
+    const int n=100;
+    
+    //Buffer API, interleaving a type which is not delta encoded
+    for(bool compact : {false,true})
+    {
+        vector<char> buffer(10000);
+        vector<int> offsets;
+        TypeDictionary wtd;
+        DeltaState ws;
+        ws.enable<Point3d>(10);
+        int used=0;
+        for(int i=0;i<n;i++)
+        {
+            offsets.push_back(used);
+            Point3d p=sample(i);
+            //A buffer too small leaves the state untouched
+            assert(serialize(wtd,ws,&buffer[used],3,p)==BufferTooSmall);
+            int result=compact ? serialize(wtd,ws,&buffer[used],10000-used,p)
+                               : serialize(ws,&buffer[used],10000-used,p);
+            assert(result>0);
+            //Keyframes store all the bytes, deltas only the changed ones
+            char full[64];
+            int fullSize=serialize(full,sizeof(full),p);
+            int keyframeSize=sizeof(Point3d)+deltaMaskSize(sizeof(Point3d));
+            if(i%10==0) assert(result>keyframeSize);
+            else assert(result<fullSize);
+            used+=result;
+            if(i%25==0)
+            {
+                result=compact ? serialize(wtd,ws,&buffer[used],10000-used,
+                                           Point2d(i,i))
+                               : serialize(ws,&buffer[used],10000-used,
+                                           Point2d(i,i));
+                char full[64];
+                assert(compact ||
+                       result==serialize(full,sizeof(full),Point2d(i,i)));
+                used+=result;
+            }
+        }
+        
+        //Known type and scan functions don't decode deltas
+        Point3d p;
+        TypePoolBuffer tp;
+        ScannedType st;
+        assert(compact || unserialize(p,&buffer[offsets[1]],used)==WrongType);
+        assert(compact || scanUnknown(tp,&buffer[offsets[1]],used,st)==
+                          UnknownType);
+        assert(compact || unserializeUnknown(tp,&buffer[offsets[1]],used)==
+                          UnknownType);
+        
+        //From the start every object is rebuilt, from the middle objects
+        //are found from the next keyframe. With compact headers the middle
+        //of a session can't be read, as type ids are not known
+        for(int start : {0,15})
+        {
+            if(compact && start>0) continue;
+            vector<Point3d> found;
+            int points2d=0;
+            tp.registerType<Point3d>([&](Point3d& p) { found.push_back(p); });
+            tp.registerType<Point2d>([&](Point2d&) { points2d++; });
+            TypeDictionary rtd;
+            DeltaState rs;
+            for(int i=offsets[start];i<used;)
+            {
+                int result=compact
+                    ? unserializeUnknown(tp,rtd,rs,&buffer[i],used-i)
+                    : unserializeUnknown(tp,rs,&buffer[i],used-i);
+                assert(result>0);
+                i+=result;
+            }
+            int first=start==0 ? 0 : 20;
+            assert(rs.missing()==static_cast<uint64_t>(first-start));
+            assert(static_cast<int>(found.size())==n-first);
+            for(int i=first;i<n;i++) assert(found[i-first]==sample(i));
+            assert(points2d==(start==0 ? 4 : 3));
+        }
+    }
+    
+    //Stream API, the log is smaller and reads back the same
+    for(auto format : {FullNameHeader,CompactHeader})
+    {
+        stringstream plain, ss;
+        OutputArchive pa(plain,format);
+        OutputArchive oa(ss,format);
+        oa.enableDelta<Point3d>(8);
+        for(int i=0;i<n;i++)
+        {
+            pa<<sample(i);
+            oa<<sample(i);
+            if(i%30==0)
+            {
+                pa<<MiscData();
+                oa<<MiscData();
+            }
+        }
+        assert(ss.str().size()<plain.str().size()*3/4);
+        
+        {
+            stringstream is(ss.str());
+            InputArchive ia(is);
+            for(int i=0;i<n;i++)
+            {
+                Point3d p;
+                ia>>p;
+                assert(p==sample(i));
+                if(i%30==0)
+                {
+                    MiscData m;
+                    ia>>m;
+                    assert(m==MiscData());
+                }
+            }
+        }
+        {
+            stringstream is(ss.str());
+            TypePoolStream tp;
+            int count=0;
+            tp.registerType<Point3d>([&](Point3d& p) {
+                assert(p==sample(count));
+                count++;
+            });
+            tp.registerType<MiscData>([&](MiscData& m) {
+                assert(m==MiscData());
+            });
+            UnknownInputArchive ia(is,tp);
+            for(int i=0;i<n+4;i++) ia.unserialize();
+            assert(count==n && ia.missingDeltas()==0);
+        }
+    }
+    
+    //Reading from the middle of a stream, known types need a keyframe
+    {
+        stringstream ss;
+        OutputArchive oa(ss);
+        oa.enableDelta<Point3d>(4);
+        oa<<sample(0);
+        auto pos=ss.tellp();
+        for(int i=1;i<n;i++) oa<<sample(i);
+        stringstream is(ss.str());
+        is.seekg(pos);
+        InputArchive ia(is);
+        Point3d p;
+        for(int i=1;i<4;i++)
+        {
+            try {
+                ia>>p;
+                assert(false);
+            } catch(TscppException& ex) {
+                assert(string(ex.what())=="missing keyframe");
+            }
+        }
+        for(int i=4;i<n;i++)
+        {
+            ia>>p;
+            assert(p==sample(i));
+        }
+    }
+    
+    try {
+        DeltaState ds;
+        ds.enable<Point3d>(0);
+        assert(false);
+    } catch(invalid_argument& ex) {
+        assert(string(ex.what())=="invalid keyframe interval");
+    }
+    try {
+        DeltaState ds;
+        ds.enable(typeid(Point3d).name(),0,4);
+        assert(false);
+    } catch(invalid_argument& ex) {
+        assert(string(ex.what())=="invalid delta encoded type size");
+    }
+    cout<<"Test passed"<<endl;
+}
@@ -0,0 +1,172 @@
+#include <iostream>
+#include <sstream>
+#include <cstddef>
+#include <cassert>
+#include <tscpp/buffer.h>
+#include <tscpp/stream.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+//The current version of a type, and the one found in old logs
+class Sample
+{
+public:
+    int a=0;
+    int b=0;
+    short c=0;
+};
+
+class SampleV1
+{
+public:
+    int a;
+    short c;
+};
+
+//Same size and alignment, fields in a different order
+class Swapped { public: int x; short y; short z; };
+class Reordered { public: short y; short z; int x; };
+
+namespace tscpp {
+template<> struct TypeLayout<Swapped>
+{
+    static const uint32_t value=layoutHash(offsetof(Swapped,x),
+                                           offsetof(Swapped,y),
+                                           offsetof(Swapped,z));
+};
+template<> struct TypeLayout<Reordered>
+{
+    static const uint32_t value=layoutHash(offsetof(Reordered,x),
+                                           offsetof(Reordered,y),
+                                           offsetof(Reordered,z));
+};
+}
+
+//The name of Sample, with the fingerprint of SampleV1, as an old writer wrote
+static TypeName oldName()
+{
+    return TypeName(typeid(Sample).name(),fingerprint<SampleV1>());
+}
+
+int main()
+{
+    static_assert(fingerprint<Sample>()!=0,"fingerprints are never 0");
+    assert(fingerprint<Point2d>()!=fingerprint<Point3d>());
+    assert(fingerprint<Sample>()!=fingerprint<SampleV1>());
+    assert(fingerprint<Swapped>()!=fingerprint<Reordered>());
+    assert(typeName<Sample>().fingerprint==fingerprint<Sample>());
+    
+    Sample s;
+    s.a=1; s.b=2; s.c=3;
+    SampleV1 old;
+    old.a=4; old.c=5;
+    char buffer[128];
+    
+    //A fingerprint is only a few bytes more, and is checked by the known
+    //type functions, with and without the compact header
+    int size=serializeWithFingerprint(buffer,sizeof(buffer),s);
+    assert(size==serialize(buffer+64,64,s)+fingerprintPrefixSize);
+    Sample t;
+    assert(unserialize(t,buffer,size)==size);
+    assert(t.a==1 && t.b==2 && t.c==3);
+    const Sample *view;
+    assert(unserializeView(view,t,buffer,size)==size && view->c==3);
+    int oldSize=serializeWithFingerprintImpl(buffer,sizeof(buffer),oldName(),
+                                             &old,sizeof(old));
+    assert(unserialize(t,buffer,oldSize)==WrongType);
+    assert(peekTypeName(buffer,oldSize)==typeid(Sample).name());
+    {
+        TypeDictionary wtd, rtd;
+        size=serializeWithFingerprint(wtd,buffer,sizeof(buffer),s);
+        assert(unserialize(rtd,t,buffer,size)==size && t.c==3);
+        size=serializeWithFingerprint(wtd,buffer,sizeof(buffer),s);
+        assert(size==1+fingerprintPrefixSize+static_cast<int>(sizeof(s)));
+        assert(unserialize(rtd,t,buffer,size)==size);
+    }
+    
+    //Without upgrades old objects are a wrong type, with an upgrade they
+    //reach the callback of the current type
+    TypePoolBuffer tp;
+    int found=0;
+    tp.registerType<Sample>([&](Sample& u) {
+        t=u;
+        found++;
+    });
+    oldSize=serializeWithFingerprintImpl(buffer,sizeof(buffer),oldName(),
+                                         &old,sizeof(old));
+    assert(unserializeUnknown(tp,buffer,oldSize)==WrongType && found==0);
+    ScannedType st;
+    assert(scanUnknown(tp,buffer,oldSize,st)==WrongType);
+    bool added=tp.registerUpgrade<Sample,SampleV1>([](const SampleV1& o,
+                                                      Sample& u) {
+        u.a=o.a;
+        u.b=-1;
+        u.c=o.c;
+    });
+    assert(added);
+    assert(unserializeUnknown(tp,buffer,oldSize)==oldSize && found==1);
+    assert(t.a==4 && t.b==-1 && t.c==5);
+    assert(unserializeUnknown(tp,buffer,oldSize-1)==BufferTooSmall);
+    size=serializeWithFingerprint(buffer,sizeof(buffer),s);
+    assert(unserializeUnknown(tp,buffer,size)==size && found==2 && t.b==2);
+    assert(scanUnknown(tp,buffer,size,st)==size);
+    //Objects without fingerprint are accepted as before
+    size=serialize(buffer,sizeof(buffer),s);
+    assert(unserializeUnknown(tp,buffer,size)==size && found==3);
+    //Upgrades need the type to be registered first
+    {
+        TypePoolBuffer empty;
+        added=empty.registerUpgrade<Sample,SampleV1>([](const SampleV1&,
+                                                        Sample&) {});
+        assert(added==false);
+        assert(unserializeUnknown(empty,buffer,size)==UnknownType);
+    }
+    
+    //Stream API
+    {
+        stringstream ss;
+        OutputArchive oa(ss,CompactHeader);
+        oa.setFingerprints(true);
+        oa<<s<<s;
+        oa.serializeImpl(oldName(),&old,sizeof(old));
+        oa<<Point2d(1,2);
+        
+        InputArchive ia(ss);
+        ia>>t>>t;
+        assert(t.a==1 && t.b==2 && t.c==3);
+        auto pos=ss.tellg();
+        try {
+            ia>>t;
+            assert(false);
+        } catch(TscppException& ex) {
+            assert(string(ex.what())=="wrong type");
+            assert(ex.name()==typeid(Sample).name());
+            assert(ss.tellg()==pos);
+        }
+    }
+    {
+        stringstream ss;
+        OutputArchive oa(ss);
+        oa.setFingerprints(true);
+        oa<<s;
+        oa.serializeImpl(oldName(),&old,sizeof(old));
+        
+        TypePoolStream tps;
+        found=0;
+        tps.registerType<Sample>([&](Sample&) { found++; });
+        UnknownInputArchive ia(ss,tps);
+        ia.unserialize();
+        auto pos=ss.tellg();
+        try {
+            ia.unserialize();
+            assert(false);
+        } catch(TscppException& ex) {
+            assert(string(ex.what())=="wrong type");
+            assert(ss.tellg()==pos);
+        }
+        assert(found==1);
+    }
+    cout<<"Test passed"<<endl;
+}
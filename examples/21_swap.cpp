@@ -0,0 +1,184 @@
+#include <iostream>
+#include <sstream>
+#include <cstddef>
+#include <cstring>
+#include <cassert>
+#include <tscpp/buffer.h>
+#include <tscpp/stream.h>
+
+using namespace std;
+using namespace tscpp;
+
+//A type as written by a big endian machine
+class Telemetry
+{
+public:
+    uint32_t id=0;
+    uint8_t flags=0;
+    uint16_t status=0;
+    float samples[5]={};
+    double time=0;
+};
+
+static FieldLayout telemetryLayout()
+{
+    return {TSCPP_FIELD(Telemetry,id),
+            TSCPP_FIELD(Telemetry,flags),
+            TSCPP_FIELD(Telemetry,status),
+            TSCPP_FIELD(Telemetry,samples),
+            TSCPP_FIELD(Telemetry,time)};
+}
+
+static Telemetry makeTelemetry(int i)
+{
+    Telemetry t;
+    t.id=0x01020304+i;
+    t.flags=0x80;
+    t.status=0x0a0b;
+    for(int j=0;j<5;j++) t.samples[j]=i+j*0.5f;
+    t.time=i*1.25;
+    return t;
+}
+
+static bool sameTelemetry(const Telemetry& a, const Telemetry& b)
+{
+    return a.id==b.id && a.flags==b.flags && a.status==b.status &&
+           memcmp(a.samples,b.samples,sizeof(a.samples))==0 && a.time==b.time;
+}
+
+//Swap the payload at the end of a serialized buffer, as a foreign writer
+//would have produced it
+static void toForeign(char *payload, int count)
+{
+    telemetryLayout().swap(payload,count,sizeof(Telemetry));
+}
+
+static void testKernels()
+{
+    //Odd counts, to exercise both the vector loop and the scalar tail
+    for(int size : {2,4,8})
+    {
+        for(int count : {0,1,7,8,9,33})
+        {
+            vector<char> data(size*count),expected(size*count);
+            for(size_t i=0;i<data.size();i++) data[i]=static_cast<char>(i*7);
+            for(int i=0;i<count;i++)
+                for(int j=0;j<size;j++)
+                    expected[i*size+j]=data[i*size+size-1-j];
+            swapBytes(data.data(),count,size);
+            assert(data==expected);
+        }
+    }
+    //Other sizes are reversed, one byte fields are unchanged
+    char odd[]={1,2,3,4,5,6};
+    swapBytes(odd,2,3);
+    assert(odd[0]==3 && odd[2]==1 && odd[3]==6 && odd[5]==4);
+    swapBytes(odd,6,1);
+    assert(odd[0]==3);
+}
+
+static void testLayout()
+{
+    //Contiguous fields of the same size are merged, bytes are dropped
+    FieldLayout layout=telemetryLayout();
+    assert(layout.fields().size()==4);
+    assert(layout.fields()[0].offset==0 && layout.fields()[0].size==4);
+    assert(layout.fields()[2].size==4 && layout.fields()[2].count==5);
+    FieldLayout floats;
+    floats.add(0,4);
+    floats.add(4,4,3);
+    floats.add(16,4);
+    assert(floats.fields().size()==1 && floats.fields()[0].count==5);
+    assert(FieldLayout().empty() && !floats.empty());
+
+    //Swapping twice restores the object
+    Telemetry t=makeTelemetry(3),u=t;
+    layout.swap(&u,1,sizeof(u));
+    assert(u.id==0x07030201 && u.flags==0x80 && u.status==0x0b0a);
+    layout.swap(&u,1,sizeof(u));
+    assert(sameTelemetry(t,u));
+}
+
+static void testBuffer()
+{
+    char buffer[256];
+    Telemetry t=makeTelemetry(1);
+    int size=serialize(buffer,sizeof(buffer),t);
+    toForeign(buffer+size-sizeof(t),1);
+
+    TypePoolBuffer tp;
+    int found=0;
+    Telemetry u;
+    tp.registerType<Telemetry>([&](Telemetry& v) { found++; u=v; });
+    //Without a layout or with swapping disabled the bytes are passed as-is
+    tp.setByteSwap(true);
+    assert(unserializeUnknown(tp,buffer,size)==size && found==1);
+    assert(!sameTelemetry(t,u));
+    assert(tp.setLayout<Telemetry>(telemetryLayout()));
+    tp.setByteSwap(false);
+    assert(unserializeUnknown(tp,buffer,size)==size && found==2);
+    assert(!sameTelemetry(t,u));
+    tp.setByteSwap(true);
+    assert(unserializeUnknown(tp,buffer,size)==size && found==3);
+    assert(sameTelemetry(t,u));
+
+    //Arrays are swapped in a copy, the buffer is left unchanged
+    Telemetry array[40];
+    for(int i=0;i<40;i++) array[i]=makeTelemetry(i);
+    vector<char> big(4096);
+    size=serializeArray(big.data(),big.size(),array,40);
+    assert(size>0);
+    toForeign(big.data()+size-sizeof(array),40);
+    vector<char> copy=big;
+    int next=0;
+    tp.registerType<Telemetry>([&](Telemetry& v) {
+        assert(sameTelemetry(v,array[next++]));
+    });
+    tp.setLayout<Telemetry>(telemetryLayout());
+    assert(unserializeUnknown(tp,big.data(),size)==size && next==40);
+    assert(copy==big);
+
+    //Layouts need the type to be registered first
+    TypePoolBuffer empty;
+    assert(empty.setLayout<Telemetry>(telemetryLayout())==false);
+    assert(unserializeUnknown(empty,big.data(),size)==UnknownType);
+}
+
+static void testStream()
+{
+    stringstream ss;
+    Telemetry array[3];
+    for(int i=0;i<3;i++) array[i]=makeTelemetry(i+10);
+    string data;
+    {
+        OutputArchive oa(ss);
+        oa<<array[0];
+        data=ss.str();
+        toForeign(&data[data.size()-sizeof(Telemetry)],1);
+        ss.str("");
+        oa.writeBatch(array,3);
+        string batch=ss.str();
+        toForeign(&batch[batch.size()-sizeof(array)],3);
+        data+=batch;
+    }
+    stringstream in(data);
+    InputArchive ia(in);
+    ia.setByteSwap(true);
+    ia.setLayout<Telemetry>(telemetryLayout());
+    Telemetry t;
+    ia>>t;
+    assert(sameTelemetry(t,array[0]));
+    Telemetry u[3];
+    assert(ia.readBatch(u,3)==3);
+    for(int i=0;i<3;i++) assert(sameTelemetry(u[i],array[i]));
+}
+
+int main()
+{
+    testKernels();
+    testLayout();
+    testBuffer();
+    testStream();
+    cout<<"Test passed"<<endl;
+    return 0;
+}
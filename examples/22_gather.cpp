@@ -0,0 +1,149 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdio>
+#include <cassert>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+#include <tscpp/buffer.h>
+#include <tscpp/stream.h>
+#include <tscpp/sink.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+static vector<char> readFile(const char *path)
+{
+    ifstream is(path,ios::binary);
+    return vector<char>(istreambuf_iterator<char>(is),
+                        istreambuf_iterator<char>());
+}
+
+int main()
+{
+    Point2d p2d(1,2);
+    Point3d p3d(3,4,5);
+    MiscData md(p2d,p3d,6,7.5f);
+    Point3d array[100];
+    for(int i=0;i<100;i++) array[i]=Point3d(i,i+1,i+2);
+    const char *path="22_gather.dat";
+
+    //The header alone, followed by the object, is what serialize() writes
+    {
+        char full[64], header[64];
+        int size=serialize(full,sizeof(full),p3d);
+        int headerSize=serializeHeader(header,sizeof(header),
+                                       typeName<Point3d>());
+        assert(headerSize+static_cast<int>(sizeof(p3d))==size);
+        assert(equal(header,header+headerSize,full));
+        assert(serializeHeader(header,headerSize-1,
+                               typeName<Point3d>())==BufferTooSmall);
+    }
+
+    //Buffer API, with small limits so that batches are written often
+    {
+        int fd=open(path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+        assert(fd>=0);
+        GatherSink sink(fd,4,64);
+        int total=0;
+        for(int i=0;i<10;i++)
+        {
+            total+=serialize(sink,p2d);
+            total+=serialize(sink,p3d);
+        }
+        total+=serializeArray(sink,array,100);
+        TypeDictionary td;
+        for(int i=0;i<10;i++) total+=serialize(td,sink,md);
+        total+=serializeArray(td,sink,array,100);
+        assert(sink.written()+sink.pending()==static_cast<uint64_t>(total));
+        sink.flush();
+        assert(sink.pending()==0);
+        assert(sink.written()==static_cast<uint64_t>(total));
+        close(fd);
+
+        vector<char> data=readFile(path);
+        assert(data.size()==static_cast<size_t>(total));
+        int found2=0, found3=0, foundMisc=0;
+        TypePoolBuffer tp;
+        tp.registerType<Point2d>([&](Point2d& t) { assert(t==p2d); found2++; });
+        tp.registerType<Point3d>([&](Point3d& t) {
+            assert(found3<10 ? t==p3d : t==array[(found3-10)%100]);
+            found3++;
+        });
+        tp.registerType<MiscData>([&](MiscData& t) { assert(t==md); foundMisc++; });
+        TypeDictionary rd;
+        int pos=0,result;
+        while(pos<total && (result=unserializeUnknown(tp,rd,data.data()+pos,
+                                                      total-pos))>0)
+            pos+=result;
+        assert(pos==total);
+        assert(found2==10 && found3==210 && foundMisc==10);
+    }
+
+    //Headers that don't fit in the copy buffer are written right away
+    {
+        int fd=open(path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+        assert(fd>=0);
+        {
+            GatherSink sink(fd,2,4);
+            for(int i=0;i<5;i++) serialize(sink,p3d);
+        }
+        close(fd);
+        vector<char> data=readFile(path);
+        char expected[64];
+        int size=serialize(expected,sizeof(expected),p3d);
+        assert(data.size()==5u*size);
+        for(int i=0;i<5;i++) assert(equal(expected,expected+size,&data[i*size]));
+    }
+
+    //Stream API, delta encoded objects are copied as they are temporaries
+    {
+        int fd=open(path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+        assert(fd>=0);
+        GatherSink sink(fd,8,128);
+        OutputArchive oa(sink,CompactHeader);
+        oa.enableDelta<MiscData>(4);
+        vector<MiscData> mds;
+        for(int i=0;i<10;i++) mds.push_back(MiscData(p2d,p3d,i,7.5f));
+        for(auto& m : mds) oa<<p2d<<m;
+        oa.writeBatch(array,100);
+        oa.flush();
+        assert(sink.written()==oa.written());
+        close(fd);
+
+        ifstream is(path,ios::binary);
+        InputArchive ia(is);
+        for(int i=0;i<10;i++)
+        {
+            Point2d q;
+            MiscData m;
+            ia>>q>>m;
+            assert(q==p2d && m==mds[i]);
+        }
+        Point3d read[100];
+        assert(ia.readBatch(read,100)==100);
+        for(int i=0;i<100;i++) assert(read[i]==array[i]);
+    }
+    remove(path);
+
+    //Errors
+    try {
+        GatherSink sink(1,0);
+        assert(false);
+    } catch(invalid_argument&) {}
+    {
+        GatherSink sink(-1);
+        serialize(sink,p2d);
+        try {
+            sink.flush();
+            assert(false);
+        } catch(system_error&) {}
+        assert(sink.pending()==0 && sink.written()==0);
+    }
+
+    cout<<"Test passed"<<endl;
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <stdexcept>
+#include <system_error>
+#include <tscpp/stream.h>
+#include <tscpp/aio.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+static vector<char> readFile(const char *path)
+{
+    ifstream is(path,ios::binary);
+    return vector<char>(istreambuf_iterator<char>(is),
+                        istreambuf_iterator<char>());
+}
+
+//Write numbered blocks with both backends, acquiring them directly
+static void testBlocks(AsyncBackend backend, const char *path)
+{
+    const int blockSize=4096, blocks=20;
+    {
+        AsyncBlockWriter writer(path,blockSize,4,false,backend);
+        assert(backend==AutoBackend || writer.backend()==backend);
+        atomic<int> completions(0);
+        writer.setCompletion([&](uint64_t offset, int size, int error) {
+            assert(offset%blockSize==0 && size==blockSize && error==0);
+            completions++;
+        });
+        for(int i=0;i<blocks;i++)
+        {
+            char *block=writer.acquire();
+            assert(reinterpret_cast<uintptr_t>(block)%
+                   AsyncBlockWriter::alignment==0);
+            memset(block,i,blockSize);
+            writer.submit(block,blockSize);
+        }
+        assert(writer.flush());
+        assert(writer.inFlight()==0 && completions==blocks);
+        assert(writer.completed()==static_cast<uint64_t>(blocks)*blockSize);
+
+        //Back-pressure, all the blocks taken and none in flight
+        char *taken[4];
+        for(int i=0;i<4;i++) assert((taken[i]=writer.tryAcquire())!=nullptr);
+        assert(writer.tryAcquire()==nullptr);
+        for(int i=0;i<4;i++) writer.submit(taken[i],0);
+        assert(writer.tryAcquire()!=nullptr);
+    }
+    vector<char> data=readFile(path);
+    assert(data.size()==static_cast<size_t>(blocks)*blockSize);
+    for(int i=0;i<blocks;i++)
+        for(int j=0;j<blockSize;j++) assert(data[i*blockSize+j]==i);
+}
+
+//Use the writer as the sink of a buffered archive
+static void testArchive(AsyncBackend backend, bool direct, const char *path)
+{
+    const int n=3000;
+    uint64_t written;
+    {
+        AsyncBlockWriter writer(path,4096,8,direct,backend);
+        vector<char> block(4096);
+        BufferedOutputArchive oa([&](const char *data, int size) {
+            assert(writer.write(data,size));
+        },block.data(),block.size());
+        for(int i=0;i<n;i++) oa<<Point3d(i,i+1,i+2)<<Point2d(i,-i);
+        oa.flush();
+        written=oa.written();
+    }
+    vector<char> data=readFile(path);
+    assert(data.size()==written);
+    ifstream is(path,ios::binary);
+    InputArchive ia(is);
+    for(int i=0;i<n;i++)
+    {
+        Point3d p;
+        Point2d q;
+        ia>>p>>q;
+        assert(p==Point3d(i,i+1,i+2) && q==Point2d(i,-i));
+    }
+}
+
+int main()
+{
+    const char *path="23_async.dat";
+    testBlocks(ThreadBackend,path);
+    testBlocks(AutoBackend,path);
+    testArchive(ThreadBackend,false,path);
+    testArchive(AutoBackend,false,path);
+
+    //O_DIRECT and io_uring may not be supported by the system
+    try {
+        testArchive(AutoBackend,true,path);
+        testArchive(ThreadBackend,true,path);
+    } catch(system_error&) {}
+    try {
+        testBlocks(IoUringBackend,path);
+    } catch(system_error&) {}
+    remove(path);
+
+    //Errors
+    try {
+        AsyncBlockWriter writer(path,0);
+        assert(false);
+    } catch(invalid_argument&) {}
+    try {
+        AsyncBlockWriter writer(path,1000,4,true);
+        assert(false);
+    } catch(invalid_argument&) {}
+    try {
+        AsyncBlockWriter writer("23_async.missing/log.dat",4096);
+        assert(false);
+    } catch(system_error&) {}
+
+    cout<<"Test passed"<<endl;
+    return 0;
+}
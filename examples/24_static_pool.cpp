@@ -0,0 +1,117 @@
+#include <iostream>
+#include <cstdlib>
+#include <cassert>
+#include <new>
+#include <tscpp/buffer.h>
+#include <tscpp/static_pool.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+//Count the allocations, to check that the pool never uses the heap
+static int allocations=0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p=malloc(size);
+    if(p==nullptr) throw bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+class Found
+{
+public:
+    int p2d=0, p3d=0;
+};
+
+static void onPoint2d(Point2d& p, void *context)
+{
+    assert(p==Point2d(1,2));
+    static_cast<Found*>(context)->p2d++;
+}
+
+int main()
+{
+    Point2d p2d(1,2);
+    Point3d p3d(3,4,5);
+    MiscData md(p2d,p3d,6,7.5f);
+    Point3d array[10];
+    for(int i=0;i<10;i++) array[i]=Point3d(i,i+1,i+2);
+    char buffer[1024];
+    int size=0;
+    size+=serialize(buffer+size,sizeof(buffer)-size,p2d);
+    size+=serialize(buffer+size,sizeof(buffer)-size,p3d);
+    size+=serializeArray(buffer+size,sizeof(buffer)-size,array,10);
+    int known=size;
+    size+=serialize(buffer+size,sizeof(buffer)-size,md);
+
+    Found found;
+    auto onPoint3d=[&](Point3d& p) {
+        assert(p==p3d || (p.y==p.x+1 && p.z==p.x+2));
+        found.p3d++;
+    };
+    int before=allocations;
+    StaticTypePoolBuffer<2> tp;
+    assert(tp.registerType<Point2d>(onPoint2d,&found));
+    assert(tp.registerType<Point3d>(onPoint3d));
+    assert(tp.registerType<Point3d>(onPoint3d)); //Replaced, not added
+    assert(tp.registeredTypes()==2);
+    assert(tp.registerType<MiscData>([](MiscData&, void*) {})==false);
+
+    int pos=0, result;
+    while(pos<known && (result=unserializeUnknown(tp,buffer+pos,size-pos))>0)
+        pos+=result;
+    assert(pos==known && found.p2d==1 && found.p3d==11);
+    assert(unserializeUnknown(tp,buffer+known,size-known)==UnknownType);
+    assert(unserializeUnknown(tp,buffer,known-1)>0);
+    assert(unserializeUnknown(tp,buffer+known,5)==BufferTooSmall);
+    assert(allocations==before);
+
+    //Partial objects and batches are not unserialized
+    size=serialize(buffer,sizeof(buffer),p3d);
+    assert(unserializeUnknown(tp,buffer,size-1)==BufferTooSmall);
+    size=serializeArray(buffer,sizeof(buffer),array,10);
+    assert(unserializeUnknown(tp,buffer,size-1)==BufferTooSmall);
+    assert(found.p3d==11);
+
+    //The name of Point2d with the fingerprint of another type
+    TypeName wrongName(typeid(Point2d).name(),fingerprint<Point3d>());
+    size=serializeWithFingerprintImpl(buffer,sizeof(buffer),wrongName,
+                                      &p2d,sizeof(p2d));
+    assert(unserializeUnknown(tp,buffer,size)==WrongType);
+    size=serializeWithFingerprint(buffer,sizeof(buffer),p2d);
+    assert(unserializeUnknown(tp,buffer,size)==size && found.p2d==3);
+    assert(allocations==before);
+
+    //Compact headers, the dictionary allocates only for new types
+    {
+        TypeDictionary td, rd;
+        size=0;
+        int second=0;
+        for(int i=0;i<3;i++)
+        {
+            if(i==1) second=size;
+            size+=serialize(td,buffer+size,sizeof(buffer)-size,p2d);
+            size+=serialize(td,buffer+size,sizeof(buffer)-size,p3d);
+        }
+        found=Found();
+        pos=0;
+        while(pos<size && (result=unserializeUnknown(tp,rd,buffer+pos,
+                                                     size-pos))>0)
+            pos+=result;
+        assert(pos==size && found.p2d==3 && found.p3d==3);
+        before=allocations;
+        assert(unserializeUnknown(tp,rd,buffer+second,size-second)>0);
+        assert(allocations==before && found.p3d==3);
+    }
+
+    cout<<"Test passed"<<endl;
+    return 0;
+}
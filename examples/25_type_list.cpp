@@ -0,0 +1,94 @@
+#include <iostream>
+#include <cassert>
+#include <tscpp/buffer.h>
+#include <tscpp/type_list.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+class Visitor
+{
+public:
+    void operator()(Point2d& p) { assert(p==Point2d(1,2)); p2d++; }
+    void operator()(Point3d& p) { last=p; p3d++; }
+    void operator()(MiscData& m) { assert(m.r==6); md++; }
+
+    int p2d=0, p3d=0, md=0;
+    Point3d last;
+};
+
+int main()
+{
+    Point2d p2d(1,2);
+    Point3d p3d(3,4,5);
+    MiscData md(p2d,p3d,6,7.5f);
+    Point3d array[10];
+    for(int i=0;i<10;i++) array[i]=Point3d(i,i+1,i+2);
+    char buffer[1024];
+    int size=0;
+    size+=serialize(buffer+size,sizeof(buffer)-size,p2d);
+    size+=serialize(buffer+size,sizeof(buffer)-size,md);
+    size+=serialize(buffer+size,sizeof(buffer)-size,p3d);
+    size+=serializeArray(buffer+size,sizeof(buffer)-size,array,10);
+    size+=serializeWithFingerprint(buffer+size,sizeof(buffer)-size,p2d);
+    int known=size;
+    size+=serialize(buffer+size,sizeof(buffer)-size,1.5);
+
+    //Decoding runs through the list, in any order
+    TypeList<MiscData,Point3d,Point2d> types;
+    assert(types.size==3);
+    assert(types.find(typeName<Point2d>().str,typeName<Point2d>().size,
+                      hashTypeName(typeName<Point2d>().str,
+                                   typeName<Point2d>().size))==2);
+    assert(types.find("x",1,hashTypeName("x",1))==-1);
+    Visitor v;
+    int pos=0, result;
+    while(pos<known && (result=unserializeUnknown(types,v,buffer+pos,
+                                                  size-pos))>0)
+        pos+=result;
+    assert(pos==known);
+    assert(v.p2d==2 && v.p3d==11 && v.md==1 && v.last==array[9]);
+    assert(unserializeUnknown(types,v,buffer+known,size-known)==UnknownType);
+    assert(unserializeUnknown(types,v,buffer,3)==BufferTooSmall);
+
+    //Partial batches and wrong fingerprints
+    size=serializeArray(buffer,sizeof(buffer),array,10);
+    assert(unserializeUnknown(types,v,buffer,size-1)==BufferTooSmall);
+    TypeName wrongName(typeid(Point2d).name(),fingerprint<Point3d>());
+    size=serializeWithFingerprintImpl(buffer,sizeof(buffer),wrongName,
+                                      &p2d,sizeof(p2d));
+    assert(unserializeUnknown(types,v,buffer,size)==WrongType);
+    assert(v.p2d==2 && v.p3d==11);
+
+    //A list with a single type, and compact headers
+    {
+        TypeDictionary td, rd;
+        size=0;
+        for(int i=0;i<3;i++)
+        {
+            size+=serialize(td,buffer+size,sizeof(buffer)-size,p2d);
+            size+=serialize(td,buffer+size,sizeof(buffer)-size,p3d);
+        }
+        TypeList<Point2d> one;
+        Visitor w;
+        pos=0;
+        while(pos<size)
+        {
+            result=unserializeUnknown(one,rd,w,buffer+pos,size-pos);
+            if(result==UnknownType)
+            {
+                //Skip the Point3d, the dictionary knows its name anyway
+                RecordHeader h;
+                result=parseRecordHeader(rd,buffer+pos,size-pos,h);
+                result+=sizeof(Point3d);
+            }
+            assert(result>0);
+            pos+=result;
+        }
+        assert(w.p2d==3 && w.p3d==0);
+    }
+
+    cout<<"Test passed"<<endl;
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <cassert>
+#include <tscpp/buffer.h>
+#include <tscpp/stream.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+//Built with TSCPP_ENABLE_STATS for all the translation units
+
+static const TypeStats *find(const StatsSnapshot& s, const TypeName& name)
+{
+    for(auto& t : s.types) if(t.name==name.str) return &t;
+    return nullptr;
+}
+
+static uint64_t histogramTotal(const StatsSnapshot& s)
+{
+    uint64_t total=0;
+    for(int i=0;i<StatsSnapshot::latencyBuckets;i++) total+=s.latency[i];
+    return total;
+}
+
+int main()
+{
+    static_assert(Stats::enabled,"Build with -DTSCPP_ENABLE_STATS");
+    Point2d p2d(1,2);
+    Point3d p3d(3,4,5);
+    Point3d array[10];
+
+    //Buffer API, errors are counted by kind
+    {
+        char buffer[256];
+        int size=0;
+        size+=serialize(buffer+size,sizeof(buffer)-size,p2d);
+        size+=serialize(buffer+size,sizeof(buffer)-size,p3d);
+        size+=serializeArray(buffer+size,sizeof(buffer)-size,array,10);
+        int known=size;
+        size+=serialize(buffer+size,sizeof(buffer)-size,MiscData());
+
+        TypePoolBuffer tp;
+        tp.registerType<Point2d>([](Point2d&) {});
+        tp.registerType<Point3d>([](Point3d&) {});
+        tp.stats().setTiming(true);
+        for(int pos=0;pos<known;) pos+=unserializeUnknown(tp,buffer+pos,size-pos);
+        assert(unserializeUnknown(tp,buffer+known,size-known)==UnknownType);
+        assert(unserializeUnknown(tp,buffer,3)==BufferTooSmall);
+
+        StatsSnapshot s=tp.stats().snapshot();
+        assert(s.types.size()==2);
+        const TypeStats *t2=find(s,typeName<Point2d>());
+        const TypeStats *t3=find(s,typeName<Point3d>());
+        assert(t2 && t2->records==1 && t2->objects==1);
+        assert(t2->bytes==typeName<Point2d>().size+1+sizeof(Point2d));
+        assert(t3 && t3->records==2 && t3->objects==11);
+        assert(t2->bytes+t3->bytes==static_cast<uint64_t>(known));
+        assert(s.errors[UnknownTypeError]==1 && s.errors[BufferTooSmallError]==1);
+        assert(s.errors[WrongTypeError]==0);
+        assert(histogramTotal(s)==3);
+
+        tp.stats().reset();
+        s=tp.stats().snapshot();
+        assert(s.types.size()==2 && s.types[0].records==0);
+        assert(s.errors[UnknownTypeError]==0 && histogramTotal(s)==0);
+    }
+
+    //Stream API
+    {
+        stringstream ss;
+        OutputArchive oa(ss,CompactHeader);
+        oa.enableDelta<Point3d>(4);
+        for(int i=0;i<8;i++) oa<<p2d<<Point3d(i,4,5);
+        oa.writeBatch(array,10);
+        StatsSnapshot so=oa.stats().snapshot();
+        assert(so.types.size()==2);
+        assert(find(so,typeName<Point2d>())->records==8);
+        assert(find(so,typeName<Point3d>())->objects==18);
+        assert(find(so,typeName<Point2d>())->bytes+
+               find(so,typeName<Point3d>())->bytes==oa.written());
+        assert(histogramTotal(so)==0); //Timing not enabled
+        string data=ss.str();
+
+        istringstream is(data);
+        InputArchive ia(is);
+        ia.stats().setTiming(true);
+        for(int i=0;i<8;i++)
+        {
+            Point2d q;
+            Point3d r;
+            ia>>q>>r;
+        }
+        Point3d read[5];
+        try {
+            ia.readBatch(read,5);
+            assert(false);
+        } catch(TscppException&) {}
+        try {
+            ia>>p2d;
+            assert(false);
+        } catch(TscppException&) {}
+        StatsSnapshot si=ia.stats().snapshot();
+        assert(si.errors[BatchTooLargeError]==1 && si.errors[WrongTypeError]==1);
+        assert(find(si,typeName<Point3d>())->objects==8);
+        assert(find(si,typeName<Point2d>())->bytes==
+               find(so,typeName<Point2d>())->bytes);
+        assert(histogramTotal(si)==16);
+
+        //Unknown types and eof, snapshots taken from another thread
+        istringstream is2(data);
+        TypePoolStream tps;
+        tps.registerType<Point3d>([](Point3d&) {});
+        UnknownInputArchive ua(is2,tps);
+        try {
+            ua.unserialize();
+            assert(false);
+        } catch(TscppException&) {}
+        StatsSnapshot su;
+        thread t([&]{ su=ua.stats().snapshot(); });
+        t.join();
+        assert(su.errors[UnknownTypeError]==1 && su.types.empty());
+
+        istringstream is3(data.substr(0,data.size()-1));
+        TypePoolStream all;
+        all.registerType<Point2d>([](Point2d&) {});
+        all.registerType<Point3d>([](Point3d&) {});
+        UnknownInputArchive ua2(is3,all);
+        try {
+            for(;;) ua2.unserialize();
+        } catch(TscppException&) {}
+        su=ua2.stats().snapshot();
+        assert(su.errors[BufferTooSmallError]==1);
+        assert(find(su,typeName<Point2d>())->records==8);
+        assert(find(su,typeName<Point3d>())->objects==8);
+        assert(find(su,typeName<Point2d>())->bytes==
+               find(so,typeName<Point2d>())->bytes);
+    }
+
+    cout<<"Test passed"<<endl;
+    return 0;
+}
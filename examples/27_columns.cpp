@@ -0,0 +1,116 @@
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <stdexcept>
+#include <tscpp/buffer.h>
+#include <tscpp/columns.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+class Imu
+{
+public:
+    uint64_t timestamp;
+    float accel[3], gyro[3];
+    int16_t temperature;
+    bool valid;
+};
+
+int main()
+{
+    const int n=1000;
+    vector<char> buffer(200*n);
+    int size=0;
+    for(int i=0;i<n;i++)
+    {
+        Imu imu;
+        memset(&imu,0,sizeof(imu)); //Deterministic padding
+        imu.timestamp=1000*i;
+        for(int j=0;j<3;j++)
+        {
+            imu.accel[j]=i+0.25f*j;
+            imu.gyro[j]=-i-0.5f*j;
+        }
+        imu.temperature=i%100-50;
+        imu.valid=i%2;
+        size+=serialize(buffer.data()+size,buffer.size()-size,imu);
+        if(i%100==0)
+            size+=serialize(buffer.data()+size,buffer.size()-size,Point2d(i,-i));
+    }
+    Point3d array[10];
+    for(int i=0;i<10;i++) array[i]=Point3d(i,2*i,3*i);
+    size+=serializeArray(buffer.data()+size,buffer.size()-size,array,10);
+
+    ColumnarDecoder cd;
+    cd.registerType<Imu>({TSCPP_COLUMN(Imu,timestamp),TSCPP_COLUMN(Imu,accel),
+                          TSCPP_COLUMN(Imu,gyro),TSCPP_COLUMN(Imu,temperature),
+                          TSCPP_COLUMN(Imu,valid)});
+    cd.registerType<Point3d>({TSCPP_COLUMN(Point3d,x),TSCPP_COLUMN(Point3d,y),
+                              TSCPP_COLUMN(Point3d,z)});
+    //Other types can share the pool
+    int found2d=0;
+    cd.pool().registerType<Point2d>([&](Point2d& p) {
+        assert(p.x==-p.y);
+        found2d++;
+    });
+    int pos=0, result;
+    while(pos<size && (result=unserializeUnknown(cd.pool(),buffer.data()+pos,
+                                                 size-pos))>0)
+        pos+=result;
+    assert(pos==size && found2d==10);
+
+    const ColumnTable *imu=cd.table<Imu>();
+    assert(imu && imu->rows()==n && imu->columns()==9);
+    assert(imu->column(1).name=="accel[0]" && imu->column(6).name=="gyro[2]");
+    assert(imu->column(0).type==UInt64Column && imu->column(1).type==Float32Column);
+    assert(imu->column(7).type==Int16Column && imu->column(8).type==UInt8Column);
+    assert(string(arrowFormat(imu->column(1).type))=="f");
+    assert(imu->find("temperature")==7 && imu->find("mag")==-1);
+    assert(imu->values<double>(1)==nullptr);
+    const uint64_t *ts=imu->values<uint64_t>(0);
+    const int16_t *temp=imu->values<int16_t>(7);
+    const uint8_t *valid=imu->values<uint8_t>(8);
+    for(int c=0;c<imu->columns();c++)
+        assert(reinterpret_cast<uintptr_t>(imu->data(c))%64==0);
+    for(int i=0;i<n;i++)
+    {
+        assert(ts[i]==1000u*i && temp[i]==i%100-50 && valid[i]==i%2);
+        for(int j=0;j<3;j++)
+        {
+            assert(imu->values<float>(1+j)[i]==i+0.25f*j);
+            assert(imu->values<float>(4+j)[i]==-i-0.5f*j);
+        }
+    }
+
+    //Batches are transposed at once
+    const ColumnTable *p3d=cd.table<Point3d>();
+    assert(p3d && p3d->rows()==10 && cd.table<Point2d>()==nullptr);
+    for(int i=0;i<10;i++)
+    {
+        assert(p3d->values<int>(0)[i]==i && p3d->values<int>(1)[i]==2*i);
+        assert(p3d->values<int>(2)[i]==3*i);
+    }
+    assert(cd.tables().size()==2 && cd.tables()[0]==imu);
+
+    //Keeping the memory, rows are appended again
+    cd.clear();
+    assert(imu->rows()==0);
+    for(int i=0;i<3;i++)
+        assert(unserializeUnknown(cd.pool(),buffer.data(),size)>0);
+    assert(imu->rows()==3 && imu->values<uint64_t>(0)[2]==0);
+
+    //Columns outside of the type
+    ColumnLayout wrong;
+    wrong.add(ColumnLayout::Field("x",sizeof(Point2d)-2,4,1,Int32Column));
+    try {
+        cd.registerType<Point2d>(wrong);
+        assert(false);
+    } catch(invalid_argument&) {}
+
+    cout<<"Test passed"<<endl;
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <cassert>
+#include <stdexcept>
+#include <tscpp/buffer.h>
+#include <tscpp/stream.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+int main()
+{
+    Point2d p2d(1,2);
+    Point3d p3d(3,4,5);
+    MiscData md(p2d,p3d,6,7.5f);
+    Point3d array[10];
+    for(int i=0;i<10;i++) array[i]=Point3d(i,i+1,i+2);
+
+    //Buffer API, only Point2d is wanted
+    {
+        char buffer[1024];
+        int size=0;
+        for(int i=0;i<3;i++)
+        {
+            size+=serialize(buffer+size,sizeof(buffer)-size,p2d);
+            size+=serialize(buffer+size,sizeof(buffer)-size,p3d);
+            size+=serialize(buffer+size,sizeof(buffer)-size,md);
+        }
+        size+=serializeArray(buffer+size,sizeof(buffer)-size,array,10);
+        size+=serializeWithFingerprint(buffer+size,sizeof(buffer)-size,p3d);
+
+        TypePoolBuffer tp;
+        int found=0;
+        tp.registerType<Point2d>([&](Point2d& p) { assert(p==p2d); found++; });
+        int pos=0, result;
+        while(pos<size && (result=unserializeUnknown(tp,buffer+pos,size-pos))>0)
+            pos+=result;
+        assert(found==1 && result==UnknownType); //Stuck at the first Point3d
+
+        tp.registerSkip<Point3d>();
+        tp.registerSkip(typeid(MiscData).name(),sizeof(MiscData));
+        found=0;
+        pos=0;
+        while(pos<size && (result=unserializeUnknown(tp,buffer+pos,size-pos))>0)
+            pos+=result;
+        assert(pos==size && found==3);
+
+        //The size of a skipped type must still match its fingerprint
+        TypeName wrongName(typeid(Point3d).name(),fingerprint<Point2d>());
+        int wrongSize=serializeWithFingerprintImpl(buffer,sizeof(buffer),
+            wrongName,&p2d,sizeof(p2d));
+        assert(unserializeUnknown(tp,buffer,wrongSize)==WrongType);
+
+        //Scanning steps over them too
+        size=serialize(buffer,sizeof(buffer),p3d);
+        ScannedType st;
+        assert(scanUnknown(tp,buffer,size,st)==size);
+        tp.unserializeScanned(st,buffer);
+        assert(found==3);
+    }
+
+    //Delta encoded objects of skipped types, with compact headers
+    {
+        char buffer[1024];
+        TypeDictionary td, rd;
+        DeltaState ds, rs;
+        ds.enable<MiscData>(4);
+        ds.enable<Point2d>(4);
+        int size=0;
+        for(int i=0;i<8;i++)
+        {
+            MiscData m(p2d,p3d,i,7.5f);
+            size+=serialize(td,ds,buffer+size,sizeof(buffer)-size,m);
+            size+=serialize(td,ds,buffer+size,sizeof(buffer)-size,
+                            Point2d(i,i));
+        }
+        TypePoolBuffer tp;
+        tp.registerSkip<MiscData>();
+        int found=0;
+        tp.registerType<Point2d>([&](Point2d& p) {
+            assert(p.x==found && p.y==found);
+            found++;
+        });
+        int pos=0, result;
+        while(pos<size && (result=unserializeUnknown(tp,rd,rs,buffer+pos,
+                                                     size-pos))>0)
+            pos+=result;
+        assert(pos==size && found==8);
+    }
+
+    //Stream API, skipped types no longer throw
+    {
+        stringstream ss;
+        {
+            OutputArchive oa(ss,CompactHeader);
+            oa.enableDelta<MiscData>(4);
+            for(int i=0;i<5;i++) oa<<p3d<<MiscData(p2d,p3d,i,7.5f)<<p2d;
+            oa.writeBatch(array,10);
+        }
+        TypePoolStream tp;
+        int found=0;
+        tp.registerType<Point2d>([&](Point2d& p) { assert(p==p2d); found++; });
+        tp.registerSkip<Point3d>();
+        tp.registerSkip(typeid(MiscData).name(),sizeof(MiscData));
+        UnknownInputArchive ia(ss,tp);
+        try {
+            for(;;) ia.unserialize();
+        } catch(TscppException& ex) {
+            assert(string(ex.what())=="eof");
+        }
+        assert(found==5 && ia.skipped()==11);
+    }
+
+    //Errors
+    {
+        TypePoolBuffer tp;
+        assert(tp.registerSkip(typeid(MiscData).name(),0)==false);
+    }
+    try {
+        TypePoolStream tp;
+        tp.registerSkip(typeid(MiscData).name(),-1);
+        assert(false);
+    } catch(invalid_argument&) {}
+
+    cout<<"Test passed"<<endl;
+    return 0;
+}
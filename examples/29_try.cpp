@@ -0,0 +1,167 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <new>
+#include <tscpp/stream.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+//Count the allocations, the error path must not allocate
+static int allocations=0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p=malloc(size);
+    if(p==nullptr) throw bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+static bool isName(const ArchiveResult& r, const char *name)
+{
+    return r.nameSize==static_cast<int>(strlen(name)) && strcmp(r.name,name)==0;
+}
+
+int main()
+{
+    Point2d p2d(1,2);
+    Point3d p3d(3,4,5);
+    MiscData md(p2d,p3d,6,7.5f);
+    Point3d array[10];
+    for(int i=0;i<10;i++) array[i]=Point3d(i,i+1,i+2);
+
+    //Known types, with both header formats
+    for(auto format : {FullNameHeader,CompactHeader})
+    {
+        stringstream ss;
+        {
+            OutputArchive oa(ss,format);
+            oa.enableDelta<Point2d>(4);
+            for(int i=0;i<3;i++) oa<<p3d<<md;
+            oa.writeBatch(array,10);
+            oa<<p2d;
+        }
+        InputArchive ia(ss);
+        Point3d p;
+        MiscData m;
+        Point2d q;
+        int count;
+        for(int i=0;i<3;i++)
+        {
+            //Wrong types leave the stream at the type found, and the object
+            //unchanged
+            MiscData before=m;
+            ArchiveResult r=ia.tryRead(m);
+            assert(!r && r.error==ArchiveWrongType && string(r.what())=="wrong type");
+            assert(isName(r,typeid(Point3d).name()) && m==before);
+            int allocated=allocations;
+            for(int j=0;j<100;j++) assert(ia.tryRead(m).error==ArchiveWrongType);
+            assert(allocations==allocated);
+            assert(ia.tryRead(p) && p==p3d);
+            r=ia.tryRead(p);
+            assert(r.error==ArchiveWrongType && isName(r,typeid(MiscData).name()));
+            assert(ia.tryRead(m) && m==md);
+        }
+        Point3d small[5], read[10];
+        ArchiveResult r=ia.tryReadBatch(small,5,count);
+        assert(r.error==ArchiveBatchTooLarge && count==0);
+        assert(isName(r,typeid(Point3d).name()));
+        r=ia.tryRead(p); //A batch is not a single object
+        assert(r.error==ArchiveWrongType && isName(r,typeid(Point3d).name()));
+        assert(ia.tryReadBatch(read,10,count) && count==10);
+        for(int i=0;i<10;i++) assert(read[i]==array[i]);
+        assert(ia.tryRead(q) && q==p2d);
+        r=ia.tryRead(q);
+        assert(r.error==ArchiveEof && r.nameSize==0 && string(r.what())=="eof");
+    }
+
+    //Fingerprints and missing keyframes
+    {
+        stringstream ss;
+        {
+            OutputArchive oa(ss);
+            oa.setFingerprints(true);
+            oa.serializeImpl(TypeName(typeid(Point2d).name(),fingerprint<Point3d>()),
+                             &p2d,sizeof(p2d));
+        }
+        InputArchive ia(ss);
+        Point2d q;
+        ArchiveResult r=ia.tryRead(q);
+        assert(r.error==ArchiveWrongType && isName(r,typeid(Point2d).name()));
+        assert(ss.tellg()==0);
+    }
+    {
+        stringstream ss;
+        {
+            OutputArchive oa(ss);
+            oa.enableDelta<Point3d>(4);
+            for(int i=0;i<4;i++) oa<<Point3d(i,1,2);
+        }
+        ss.seekg(0);
+        InputArchive whole(ss);
+        Point3d p;
+        for(int i=0;i<4;i++) assert(whole.tryRead(p) && p==Point3d(i,1,2));
+
+        //Start after the keyframe
+        ss.clear();
+        ss.seekg(0);
+        InputArchive first(ss);
+        assert(first.tryRead(p));
+        InputArchive rest(ss);
+        ArchiveResult r=rest.tryRead(p);
+        assert(r.error==ArchiveMissingKeyframe && isName(r,typeid(Point3d).name()));
+    }
+
+    //Unknown types
+    for(auto format : {FullNameHeader,CompactHeader})
+    {
+        stringstream ss;
+        {
+            OutputArchive oa(ss,format);
+            for(int i=0;i<3;i++) oa<<p2d<<md;
+            oa.writeBatch(array,10);
+        }
+        TypePoolStream tp;
+        int found=0;
+        tp.registerType<Point2d>([&](Point2d& p) { assert(p==p2d); found++; });
+        tp.registerSkip<Point3d>();
+        UnknownInputArchive ia(ss,tp);
+        InputArchive known(ss);
+        for(int i=0;i<3;i++)
+        {
+            assert(ia.tryUnserialize());
+            auto pos=ss.tellg();
+            ArchiveResult r=ia.tryUnserialize();
+            assert(r.error==ArchiveUnknownType && isName(r,typeid(MiscData).name()));
+            assert(ss.tellg()==pos);
+            MiscData m;
+            assert(known.tryRead(m) && m==md);
+        }
+        assert(ia.tryUnserialize() && ia.skipped()==1);
+        assert(found==3);
+        ArchiveResult r=ia.tryUnserialize();
+        assert(r.error==ArchiveEof && string(r.what())=="eof");
+
+        //The throwing API reports the same errors
+        ss.clear();
+        ss.seekg(0);
+        InputArchive again(ss);
+        MiscData m;
+        try {
+            again>>m;
+            assert(false);
+        } catch(TscppException& ex) {
+            assert(string(ex.what())=="wrong type" && ex.name()==typeid(Point2d).name());
+        }
+    }
+
+    cout<<"Test passed"<<endl;
+    return 0;
+}
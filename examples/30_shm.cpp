@@ -0,0 +1,165 @@
+#include <iostream>
+#include <string>
+#include <memory>
+#include <vector>
+#include <cerrno>
+#include <cassert>
+#include <stdexcept>
+#include <system_error>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <tscpp/buffer.h>
+#include <tscpp/shm.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+int main()
+{
+    const string name="/tscpp_30_shm_"+to_string(getpid());
+    Point2d p2d(1,2);
+    Point3d p3d(3,4,5);
+    MiscData md(p2d,p3d,6,7.5f);
+    Point3d array[10];
+    for(int i=0;i<10;i++) array[i]=Point3d(i,i+1,i+2);
+
+    //Readers have their own position, and records are aligned in the ring
+    {
+        ShmRingWriter writer(name,4096);
+        ShmRingReader first(name), second(name);
+        assert(writer.readers()==2);
+        TypePoolBuffer tp;
+        int found2=0, found3=0;
+        tp.registerType<Point2d>([&](Point2d& p) { assert(p==p2d); found2++; });
+        tp.registerType<Point3d>([&](Point3d& p) {
+            assert(reinterpret_cast<uintptr_t>(&p)%alignof(Point3d)==0);
+            assert(found3%11==0 ? p==p3d : p==array[found3%11-1]);
+            found3++;
+        });
+        assert(first.unserializeUnknown(tp)==0);
+        assert(writer.serialize(p2d)>0 && writer.serialize(md)>0);
+        assert(writer.serialize(p3d)>0 && writer.serializeArray(array,10)>0);
+        char record[64];
+        int size=serialize(record,sizeof(record),p2d);
+        assert(writer.write(record,size)==size);
+
+        int result, records=0, unknown=0;
+        while((result=first.unserializeUnknown(tp))!=0)
+        {
+            if(result==UnknownType) unknown++; //MiscData, skipped anyway
+            else records++;
+        }
+        assert(records==4 && unknown==1 && first.pending()==0);
+        assert(found2==2 && found3==11);
+        assert(second.pending()>0);
+        while(second.unserializeUnknown(tp)!=0) ;
+        assert(found2==4 && found3==22);
+    }
+
+    //Wrapping around, the writer drops records when a reader is behind
+    {
+        ShmRingWriter writer(name,4096);
+        ShmRingReader reader(name);
+        TypePoolBuffer tp;
+        int next=0;
+        tp.registerType<Point3d>([&](Point3d& p) { assert(p.x==next); next++; });
+        int written=0;
+        for(int i=0;i<5000;i++)
+        {
+            assert(writer.serialize(Point3d(written,0,0))>0);
+            written++;
+            if(i%3==0) while(reader.unserializeUnknown(tp)!=0) ;
+        }
+        while(reader.unserializeUnknown(tp)!=0) ;
+        assert(next==written && writer.dropped()==0);
+
+        int accepted=0;
+        for(int i=0;i<1000;i++)
+            if(writer.serialize(Point3d(written+accepted,0,0))>0) accepted++;
+        assert(accepted>0 && accepted<1000);
+        assert(writer.dropped()==static_cast<uint64_t>(1000-accepted));
+        while(reader.unserializeUnknown(tp)!=0) ;
+        assert(next==written+accepted);
+        assert(writer.serialize(Point3d(next,0,0))>0);
+        assert(reader.unserializeUnknown(tp)>0);
+
+        //Larger than the ring
+        vector<char> large(8192);
+        assert(writer.write(large.data(),large.size())==BufferTooSmall);
+    }
+
+    //Other processes, a reader that terminates without detaching is
+    //released once the ring is full
+    {
+        ShmRingWriter writer(name,4096);
+        pid_t dead=fork();
+        if(dead==0)
+        {
+            new ShmRingReader(name);
+            _exit(0);
+        }
+        assert(waitpid(dead,nullptr,0)==dead);
+        assert(writer.readers()==1);
+
+        const int n=10000;
+        pid_t child=fork();
+        if(child==0)
+        {
+            {
+                ShmRingReader reader(name);
+                TypePoolBuffer tp;
+                int next=0;
+                tp.registerType<Point3d>([&](Point3d& p) {
+                    if(p.x!=next || p.y!=next+1) _exit(1);
+                    next++;
+                });
+                while(next<n) reader.unserializeUnknown(tp);
+            }
+            _exit(0);
+        }
+        while(writer.readers()<2) usleep(1000);
+        for(int i=0;i<n;)
+            if(writer.serialize(Point3d(i,i+1,i+2))>0) i++;
+        int status;
+        assert(waitpid(child,&status,0)==child);
+        assert(WIFEXITED(status) && WEXITSTATUS(status)==0);
+        assert(writer.readers()==0);
+    }
+
+    //Errors
+    {
+        unique_ptr<ShmRingReader> reader;
+        {
+            ShmRingWriter writer(name,4096);
+            reader.reset(new ShmRingReader(name));
+            vector<unique_ptr<ShmRingReader>> readers;
+            for(int i=1;i<ShmRingReader::maxReaders;i++)
+                readers.emplace_back(new ShmRingReader(name));
+            try {
+                ShmRingReader tooMany(name);
+                assert(false);
+            } catch(system_error& e) {
+                assert(e.code().value()==EBUSY);
+            }
+            assert(writer.serialize(p2d)>0);
+            assert(reader->closed()==false);
+        }
+        assert(reader->closed());
+        TypePoolBuffer tp;
+        tp.registerType<Point2d>([&](Point2d& p) { assert(p==p2d); });
+        assert(reader->unserializeUnknown(tp)>0);
+        assert(reader->unserializeUnknown(tp)==0);
+    }
+    try {
+        ShmRingReader reader(name);
+        assert(false);
+    } catch(system_error&) {}
+    try {
+        ShmRingWriter writer(name,100);
+        assert(false);
+    } catch(invalid_argument&) {}
+
+    cout<<"Test passed"<<endl;
+    return 0;
+}
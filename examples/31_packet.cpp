@@ -0,0 +1,155 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cassert>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <tscpp/buffer.h>
+#include <tscpp/packet.h>
+#include "types.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace tscpp;
+
+int main()
+{
+    Point2d p2d(1,2);
+    Point3d p3d(3,4,5);
+    MiscData md(p2d,p3d,6,7.5f);
+    Point3d array[10];
+    for(int i=0;i<10;i++) array[i]=Point3d(i,i+1,i+2);
+
+    //Datagram sockets, full packets are sent four at a time
+    for(auto format : {FullNameHeader,CompactHeader})
+    {
+        int fds[2];
+        assert(socketpair(AF_UNIX,SOCK_DGRAM,0,fds)==0);
+        fcntl(fds[1],F_SETFL,O_NONBLOCK);
+        const int n=500;
+        int total=0;
+        {
+            PacketWriter writer(fds[0],256,seconds(10),4,true,format);
+            for(int i=0;i<n;i++)
+            {
+                assert(writer.serialize(Point3d(i,i+1,i+2))>0);
+                total++;
+                if(i%50==0)
+                {
+                    assert(writer.serialize(md)>0);
+                    assert(writer.serializeArray(array,10)>0);
+                }
+            }
+            assert(writer.sent()%4==0);
+            Point3d large[30];
+            assert(writer.serializeArray(large,30)==BufferTooSmall);
+            writer.flush();
+            assert(writer.sent()>=static_cast<uint64_t>(n*12/256));
+        }
+        TypePoolBuffer tp;
+        int next=0, misc=0, arrays=0;
+        tp.registerType<Point3d>([&](Point3d& p) {
+            if(p.x==next && p.y==next+1) next++;
+            else { assert(p==array[arrays%10]); arrays++; }
+        });
+        tp.registerType<MiscData>([&](MiscData& m) { assert(m==md); misc++; });
+        PacketReader reader(fds[1],256,8);
+        int types=0, result;
+        while((result=reader.receive(tp))>0) types+=result;
+        assert(next==n && misc==10 && arrays==100);
+        assert(types==n+10+10 && reader.dropped()==0);
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    //The delay is bounded, by serialize() and by poll()
+    {
+        int fds[2];
+        assert(socketpair(AF_UNIX,SOCK_DGRAM,0,fds)==0);
+        PacketWriter writer(fds[0],1472,milliseconds(20));
+        writer.serialize(p2d);
+        assert(writer.poll()==false && writer.sent()==0);
+        this_thread::sleep_for(milliseconds(30));
+        assert(writer.poll() && writer.sent()==1);
+        assert(writer.poll()==false);
+
+        writer.serialize(p2d);
+        this_thread::sleep_for(milliseconds(30));
+        writer.serialize(p3d);
+        assert(writer.sent()==2);
+
+        PacketWriter immediate(fds[0],1472,microseconds(0));
+        for(int i=0;i<5;i++) immediate.serialize(p2d);
+        assert(immediate.sent()==5);
+
+        TypePoolBuffer tp;
+        int found=0;
+        tp.registerType<Point2d>([&](Point2d& p) { assert(p==p2d); found++; });
+        tp.registerType<Point3d>([&](Point3d& p) { assert(p==p3d); found++; });
+        PacketReader reader(fds[1]);
+        int types=0;
+        while(types<8) types+=reader.receive(tp);
+        assert(types==8 && found==8 && reader.received()==7);
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    //Serial links, lost and damaged packets don't affect the others
+    {
+        vector<vector<char>> packets;
+        {
+            PacketWriter writer([&](const char *data, int size) {
+                packets.emplace_back(data,data+size);
+            },64,seconds(10),1);
+            for(int i=0;i<20;i++) writer.serialize(Point3d(i,i+1,i+2));
+        }
+        assert(packets.size()>3);
+        for(auto& p : packets) assert(p.size()<=64);
+        packets[2][20]^=1;
+        TypePoolBuffer tp;
+        vector<int> found;
+        tp.registerType<Point3d>([&](Point3d& p) { found.push_back(p.x); });
+        PacketReader reader(-1);
+        for(size_t i=1;i<packets.size();i++)
+        {
+            int result=reader.unserializePacket(tp,packets[i].data(),
+                                                packets[i].size());
+            assert(i==2 ? result==BufferTooSmall : result>0);
+        }
+        assert(reader.received()==packets.size()-1 && reader.dropped()==1);
+        int perPacket=found.front();
+        assert(static_cast<int>(found.size())==20-2*perPacket);
+        for(size_t i=1;i<found.size();i++) assert(found[i]>found[i-1]);
+
+        TypePoolBuffer empty;
+        assert(reader.unserializePacket(empty,packets[0].data(),
+                                        packets[0].size())==UnknownType);
+        assert(reader.dropped()==2);
+    }
+
+    //Errors
+    try {
+        PacketWriter writer(-1,12);
+        assert(false);
+    } catch(invalid_argument&) {}
+    try {
+        PacketReader reader(-1,1472,0);
+        assert(false);
+    } catch(invalid_argument&) {}
+    {
+        PacketWriter writer(-1);
+        writer.serialize(p2d);
+        try {
+            writer.flush();
+            assert(false);
+        } catch(system_error&) {}
+        writer.flush();
+    }
+
+    cout<<"Test passed"<<endl;
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <iostream>
+#include <sstream>
+#include <cassert>
+#include <tscpp/buffer.h>
+#include <tscpp/stream.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+int main()
+{
+    //Declare some types
+    Point2d p2d(1,2);
+    Point3d p3d(3,4,5);
+    
+    //Compact stream, the name is written only the first time
+    {
+        stringstream ss;
+        OutputArchive oa(ss,CompactHeader);
+        oa<<p3d;
+        int firstSize=ss.str().size();
+        oa<<p3d<<p2d<<p3d;
+        assert(ss.str().size()==firstSize+1+sizeof(p3d)+
+               2+strlen(typeid(p2d).name())+1+sizeof(p2d)+1+sizeof(p3d));
+        
+        InputArchive ia(ss);
+        Point3d q;
+        ia>>q;
+        assert(q==p3d);
+        q=Point3d();
+        ia>>q;
+        assert(q==p3d);
+        
+        //Wrong type on a type id reference
+        Point2d r;
+        ia>>r;
+        assert(r==p2d);
+        try {
+            ia>>r;
+            assert(false);
+        } catch(TscppException& ex) {
+            assert(string(ex.what())=="wrong type");
+            assert(ex.name()==typeid(p3d).name());
+        }
+        ia>>q;
+        assert(q==p3d);
+    }
+    
+    //The unknown archive decodes both formats
+    {
+        int found=0;
+        TypePoolStream tp;
+        tp.registerType<Point2d>([&](Point2d& t) { assert(t==p2d); found++; });
+        tp.registerType<Point3d>([&](Point3d& t) { assert(t==p3d); found++; });
+        
+        stringstream ss;
+        OutputArchive oa(ss,CompactHeader);
+        oa<<p2d<<p3d<<p2d;
+        OutputArchive oa2(ss);
+        oa2<<p3d;
+        
+        UnknownInputArchive ia(ss,tp);
+        for(int i=0;i<4;i++) ia.unserialize();
+        assert(found==4);
+        try {
+            ia.unserialize();
+            assert(false);
+        } catch(TscppException& ex) {
+            assert(string(ex.what())=="eof");
+        }
+    }
+    
+    //Compact buffer, interchangeable with the stream API
+    {
+        TypeDictionary wd;
+        char buffer[1024];
+        int writeSize=0;
+        for(int i=0;i<3;i++)
+        {
+            int result=serialize(wd,buffer+writeSize,sizeof(buffer)-writeSize,p2d);
+            assert(result>0);
+            writeSize+=result;
+        }
+        assert(writeSize==3*(1+(int)sizeof(p2d))+1+(int)strlen(typeid(p2d).name())+1);
+        
+        //A reference to an undefined id is reported without a dictionary
+        TypeDictionary rd;
+        Point2d q;
+        int definitionSize=writeSize-2*(1+sizeof(p2d));
+        assert(unserialize(rd,q,buffer+definitionSize,writeSize)==WrongType);
+        
+        int readSize=0;
+        assert(peekTypeName(rd,buffer,writeSize)==typeid(p2d).name());
+        Point3d r;
+        assert(unserialize(rd,r,buffer,writeSize)==WrongType);
+        int result=unserialize(rd,q,buffer,writeSize);
+        assert(result==definitionSize && q==p2d);
+        readSize+=result;
+        assert(peekTypeName(rd,buffer+readSize,writeSize-readSize)==typeid(p2d).name());
+        
+        int found=0;
+        TypePoolBuffer tp;
+        tp.registerType<Point2d>([&](Point2d& t) { assert(t==p2d); found++; });
+        while(readSize<writeSize)
+        {
+            result=unserializeUnknown(tp,rd,buffer+readSize,writeSize-readSize);
+            assert(result==1+(int)sizeof(p2d));
+            readSize+=result;
+        }
+        assert(found==2);
+        
+        stringstream ss(string(buffer,writeSize));
+        InputArchive ia(ss);
+        for(int i=0;i<3;i++)
+        {
+            q=Point2d();
+            ia>>q;
+            assert(q==p2d);
+        }
+    }
+    
+    cout<<"Test passed"<<endl;
+}
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <sstream>
+#include <cassert>
+#include <cstdint>
+#include <tscpp/buffer.h>
+#include <tscpp/stream.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+static bool inside(const void *p, const char *buffer, int size)
+{
+    return p>=buffer && p<buffer+size;
+}
+
+int main()
+{
+    Point2d p2d(1,2);
+    Point3d p3d(3,4,5);
+    
+    alignas(8) char buffer[1024];
+    int writeSize=1; //Start misaligned on purpose
+    
+    int result=serializeAligned(buffer+writeSize,sizeof(buffer)-writeSize,p3d);
+    assert(result>0);
+    writeSize+=result;
+    result=serializeAligned(buffer+writeSize,sizeof(buffer)-writeSize,p2d);
+    assert(result>0);
+    writeSize+=result;
+    result=serialize(buffer+writeSize,sizeof(buffer)-writeSize,p3d);
+    assert(result>0);
+    writeSize+=result;
+    
+    //Aligned types are accessed in place
+    {
+        int readSize=1;
+        const Point3d *p;
+        Point3d copy;
+        result=unserializeView(p,copy,buffer+readSize,writeSize-readSize);
+        assert(result>0 && *p==p3d && p!=&copy);
+        assert(inside(p,buffer,writeSize));
+        assert(reinterpret_cast<uintptr_t>(p)%alignof(Point3d)==0);
+        readSize+=result;
+        
+        const Point2d *q;
+        Point2d copy2;
+        assert(unserializeView(q,copy2,buffer+readSize,writeSize-readSize)>0);
+        assert(*q==p2d && q!=&copy2);
+    }
+    
+    //Padding is skipped also when copying
+    {
+        Point3d p;
+        assert(unserialize(p,buffer+1,writeSize-1)>0);
+        assert(p==p3d);
+        assert(peekTypeName(buffer+1,writeSize-1)==typeid(p3d).name());
+    }
+    
+    //Type pool callbacks get a reference into the buffer when aligned
+    {
+        int inPlace=0, copied=0;
+        TypePoolBuffer tp;
+        tp.registerTypeView<Point3d>([&](const Point3d& t)
+        {
+            assert(t==p3d);
+            if(inside(&t,buffer,writeSize)) inPlace++; else copied++;
+        });
+        tp.registerTypeView<Point2d>([&](const Point2d& t)
+        {
+            assert(t==p2d);
+            if(inside(&t,buffer,writeSize)) inPlace++; else copied++;
+        });
+        int readSize=1;
+        while(readSize<writeSize)
+        {
+            result=unserializeUnknown(tp,buffer+readSize,writeSize-readSize);
+            assert(result>0);
+            readSize+=result;
+        }
+        assert(inPlace+copied==3 && inPlace>=2);
+    }
+    
+    //Compact header
+    {
+        alignas(8) char buffer2[1024];
+        TypeDictionary wd, rd;
+        int size=3;
+        for(int i=0;i<2;i++)
+        {
+            result=serializeAligned(wd,buffer2+size,sizeof(buffer2)-size,p3d);
+            assert(result>0);
+            size+=result;
+        }
+        int readSize=3;
+        for(int i=0;i<2;i++)
+        {
+            const Point3d *p;
+            Point3d copy;
+            result=unserializeView(rd,p,copy,buffer2+readSize,size-readSize);
+            assert(result>0 && *p==p3d && p!=&copy);
+            readSize+=result;
+        }
+        assert(readSize==size);
+    }
+    
+    //The stream API skips the padding too
+    {
+        stringstream ss(string(buffer+1,writeSize-1));
+        InputArchive ia(ss);
+        Point3d p;
+        Point2d q;
+        try {
+            ia>>p>>p;
+            assert(false);
+        } catch(TscppException& ex) {
+            assert(string(ex.what())=="wrong type");
+            assert(ex.name()==typeid(p2d).name());
+        }
+        ia>>q>>p;
+        assert(q==p2d && p==p3d);
+    }
+    
+    cout<<"Test passed"<<endl;
+}
@@ -0,0 +1,160 @@
+#include <iostream>
+#include <sstream>
+#include <cassert>
+#include <tscpp/buffer.h>
+#include <tscpp/stream.h>
+#include "types.h"
+
+using namespace std;
+using namespace tscpp;
+
+int main()
+{
+    //Declare some types
+    const int n=100;
+    Point3d samples[n];
+    for(int i=0;i<n;i++) samples[i]=Point3d(i,2*i,3*i);
+    Point2d p2d(1,2);
+    
+    //Serialize to buffer, one header for the whole array
+    char buffer[4096];
+    int writeSize=0;
+    int result=serializeArray(buffer,sizeof(buffer),samples,n);
+    assert(result>0 && result<n*(int)sizeof(Point3d)+32);
+    writeSize+=result;
+    result=serialize(buffer+writeSize,sizeof(buffer)-writeSize,p2d);
+    assert(result>0);
+    writeSize+=result;
+    
+    //Unserialize a known array
+    {
+        Point3d read[n];
+        int count=n-1;
+        assert(unserializeArray(read,count,buffer,writeSize)==BufferTooSmall);
+        count=n;
+        Point2d q;
+        assert(unserializeArray(&q,count,buffer,writeSize)==WrongType);
+        Point3d p;
+        assert(unserialize(p,buffer,writeSize)==WrongType);
+        assert(unserializeArray(read,count,buffer,writeSize-result-1)==BufferTooSmall);
+        assert(unserializeArray(read,count,buffer,writeSize)==writeSize-result);
+        assert(count==n);
+        for(int i=0;i<n;i++) assert(read[i]==samples[i]);
+        
+        //Single objects are accepted as arrays of one
+        count=1;
+        assert(unserializeArray(&q,count,buffer+writeSize-result,result)==result);
+        assert(count==1 && q==p2d);
+    }
+    
+    //Unserialize with a type pool
+    {
+        int found=0, calls=0;
+        TypePoolBuffer tp;
+        tp.registerTypeArray<Point3d>([&](const Point3d *t, int count)
+        {
+            for(int i=0;i<count;i++) assert(t[i]==samples[found+i]);
+            found+=count;
+            calls++;
+        });
+        tp.registerType<Point2d>([&](Point2d& t) { assert(t==p2d); found++; });
+        int readSize=0;
+        while(readSize<writeSize)
+        {
+            result=unserializeUnknown(tp,buffer+readSize,writeSize-readSize);
+            assert(result>0);
+            readSize+=result;
+        }
+        assert(found==n+1 && calls==1);
+        
+        //Misaligned arrays are copied in chunks
+        alignas(8) char misaligned[4096];
+        memcpy(misaligned+1,buffer,writeSize);
+        found=calls=0;
+        readSize=1;
+        while(readSize<writeSize+1)
+        {
+            result=unserializeUnknown(tp,misaligned+readSize,writeSize+1-readSize);
+            assert(result>0);
+            readSize+=result;
+        }
+        assert(found==n+1 && calls>1);
+        
+        //Types registered one at a time get a call per object
+        found=0;
+        TypePoolBuffer tp2;
+        tp2.registerType<Point3d>([&](Point3d& t) { assert(t==samples[found++]); });
+        assert(unserializeUnknown(tp2,buffer,writeSize)>0);
+        assert(found==n);
+        
+        //Truncated array
+        assert(unserializeUnknown(tp2,buffer,100)==BufferTooSmall);
+    }
+    
+    //Compact header
+    {
+        TypeDictionary wd, rd;
+        int size=0;
+        for(int i=0;i<2;i++)
+        {
+            result=serializeArray(wd,buffer+size,sizeof(buffer)-size,samples+i*n/2,n/2);
+            assert(result>0);
+            size+=result;
+        }
+        Point3d read[n];
+        int readSize=0;
+        for(int i=0;i<2;i++)
+        {
+            int count=n;
+            result=unserializeArray(rd,read+i*n/2,count,buffer+readSize,size-readSize);
+            assert(result>0 && count==n/2);
+            readSize+=result;
+        }
+        assert(readSize==size);
+        for(int i=0;i<n;i++) assert(read[i]==samples[i]);
+    }
+    
+    //Stream API, interchangeable with the buffer API
+    {
+        stringstream ss;
+        OutputArchive oa(ss,CompactHeader);
+        oa.writeBatch(samples,n);
+        oa<<p2d;
+        oa.writeBatch(samples,n);
+        ss.write(buffer,writeSize);
+        
+        InputArchive ia(ss);
+        Point3d read[n];
+        assert(ia.readBatch(read,n)==n);
+        for(int i=0;i<n;i++) assert(read[i]==samples[i]);
+        Point2d q;
+        assert(ia.readBatch(&q,1)==1 && q==p2d);
+        try {
+            ia.readBatch(read,n-1);
+            assert(false);
+        } catch(TscppException& ex) {
+            assert(string(ex.what())=="batch too large");
+        }
+        Point3d p;
+        try {
+            ia>>p;
+            assert(false);
+        } catch(TscppException& ex) {
+            assert(string(ex.what())=="wrong type");
+            assert(ex.name()==typeid(p).name());
+        }
+        assert(ia.readBatch(read,n)==n);
+        
+        //The rest of the stream was serialized with the buffer API
+        int found=0;
+        TypePoolStream tp;
+        tp.registerType<Point3d>([&](Point3d& t) { assert(t==samples[found%n]); found++; });
+        tp.registerType<Point2d>([&](Point2d& t) { assert(t==p2d); });
+        UnknownInputArchive uia(ss,tp);
+        uia.unserialize();
+        uia.unserialize();
+        assert(found==n);
+    }
+    
+    cout<<"Test passed"<<endl;
+}
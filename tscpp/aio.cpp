@@ -0,0 +1,502 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+#include "aio.h"
+
+#ifndef _MIOSIX
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(TSCPP_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define TSCPP_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+using namespace std;
+
+namespace tscpp
+{
+
+//
+// class AsyncBlockWriter::IoUring
+//
+
+/**
+ * Minimal io_uring, used through the system calls so that liburing is not
+ * needed. Writes are submitted and reaped only by the thread using the
+ * writer, so the rings need no locking.
+ */
+class AsyncBlockWriter::IoUring
+{
+public:
+#ifdef TSCPP_IO_URING
+    /**
+     * \return 0, or the error setting up the ring.
+     */
+    int setup(unsigned entries);
+
+    /**
+     * \return 0, or the error submitting the write.
+     */
+    int write(int file, const char *data, int size, uint64_t offset,
+              int slot);
+
+    /**
+     * \return true and the slot and result of a completed write, or false if
+     * none has completed.
+     */
+    bool peek(int &slot, int &result);
+
+    /**
+     * Wait for at least one write to complete.
+     */
+    void wait();
+
+    ~IoUring();
+
+private:
+    int fd             = -1;
+    void *sq           = nullptr;
+    void *cq           = nullptr;
+    size_t sqSize      = 0;
+    size_t cqSize      = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqesSize    = 0;
+    unsigned *sqTail   = nullptr;
+    unsigned *sqMask   = nullptr;
+    unsigned *sqArray  = nullptr;
+    unsigned *cqHead   = nullptr;
+    unsigned *cqTail   = nullptr;
+    unsigned *cqMask   = nullptr;
+    io_uring_cqe *cqes = nullptr;
+#else   // TSCPP_IO_URING
+    int setup(unsigned) { return ENOSYS; }
+    int write(int, const char *, int, uint64_t, int) { return ENOSYS; }
+    bool peek(int &, int &) { return false; }
+    void wait() {}
+#endif  // TSCPP_IO_URING
+};
+
+#ifdef TSCPP_IO_URING
+
+int AsyncBlockWriter::IoUring::setup(unsigned entries)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0)
+        return errno;
+
+    sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sqSize = cqSize = max(sqSize, cqSize);
+    sq = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+    {
+        sq = nullptr;
+        return errno;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        cq = sq;
+    }
+    else
+    {
+        cq = mmap(nullptr, cqSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+        {
+            cq = nullptr;
+            return errno;
+        }
+    }
+    sqesSize  = p.sq_entries * sizeof(io_uring_sqe);
+    void *mem = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (mem == MAP_FAILED)
+        return errno;
+    sqes = reinterpret_cast<io_uring_sqe *>(mem);
+
+    char *s = reinterpret_cast<char *>(sq);
+    char *c = reinterpret_cast<char *>(cq);
+    sqTail  = reinterpret_cast<unsigned *>(s + p.sq_off.tail);
+    sqMask  = reinterpret_cast<unsigned *>(s + p.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned *>(s + p.sq_off.array);
+    cqHead  = reinterpret_cast<unsigned *>(c + p.cq_off.head);
+    cqTail  = reinterpret_cast<unsigned *>(c + p.cq_off.tail);
+    cqMask  = reinterpret_cast<unsigned *>(c + p.cq_off.ring_mask);
+    cqes    = reinterpret_cast<io_uring_cqe *>(c + p.cq_off.cqes);
+    return 0;
+}
+
+int AsyncBlockWriter::IoUring::write(int file, const char *data, int size,
+                                     uint64_t offset, int slot)
+{
+    // At most one write per slot is in flight, so the ring is never full
+    unsigned tail     = *sqTail;
+    unsigned index    = tail & *sqMask;
+    io_uring_sqe &sqe = sqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode     = IORING_OP_WRITE;
+    sqe.fd         = file;
+    sqe.addr       = reinterpret_cast<uintptr_t>(data);
+    sqe.len        = size;
+    sqe.off        = offset;
+    sqe.user_data  = slot;
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    for (;;)
+    {
+        if (syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0) >= 0)
+            return 0;
+        if (errno != EINTR)
+        {
+            // The kernel only consumes entries in io_uring_enter(), so the
+            // failed one can be taken back
+            __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+            return errno;
+        }
+    }
+}
+
+bool AsyncBlockWriter::IoUring::peek(int &slot, int &result)
+{
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+        return false;
+    const io_uring_cqe &cqe = cqes[head & *cqMask];
+    slot                    = cqe.user_data;
+    result                  = cqe.res;
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void AsyncBlockWriter::IoUring::wait()
+{
+    syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr,
+            0);
+}
+
+AsyncBlockWriter::IoUring::~IoUring()
+{
+    if (sqes)
+        munmap(sqes, sqesSize);
+    if (cq && cq != sq)
+        munmap(cq, cqSize);
+    if (sq)
+        munmap(sq, sqSize);
+    if (fd >= 0)
+        ::close(fd);
+}
+
+#endif  // TSCPP_IO_URING
+
+//
+// class AsyncBlockWriter
+//
+
+const int AsyncBlockWriter::alignment;
+
+AsyncBlockWriter::AsyncBlockWriter(const string &path, int blockSize,
+                                   int queueDepth, bool direct,
+                                   AsyncBackend backend)
+    : blockBytes(blockSize), direct(direct)
+{
+    if (blockSize <= 0 || queueDepth <= 0 ||
+        (direct && blockSize % alignment != 0))
+        throw invalid_argument("invalid async writer size");
+
+    blockStride = (blockSize + alignment - 1) / alignment * alignment;
+    void *memory;
+    if (posix_memalign(&memory, alignment,
+                       static_cast<size_t>(blockStride) * queueDepth) != 0)
+        throw bad_alloc();
+    storage.reset(reinterpret_cast<char *>(memory));
+    slots.resize(queueDepth);
+    for (int i = 0; i < queueDepth; i++)
+    {
+        slots[i].data = storage.get() + static_cast<size_t>(i) * blockStride;
+        freeSlots.push_back(queueDepth - 1 - i);
+    }
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if (direct)
+        flags |= O_DIRECT;
+#else   // O_DIRECT
+    if (direct)
+        throw system_error(make_error_code(errc::not_supported), path);
+#endif  // O_DIRECT
+    fd = open(path.c_str(), flags, 0644);
+    if (fd < 0)
+        throw system_error(errno, system_category(), path);
+
+    if (backend != ThreadBackend)
+    {
+        ring.reset(new IoUring);
+        int error = ring->setup(queueDepth);
+        if (error == 0)
+        {
+            usedBackend = IoUringBackend;
+        }
+        else
+        {
+            ring.reset();
+            if (backend == IoUringBackend)
+            {
+                ::close(fd);
+                throw system_error(error, system_category(), "io_uring");
+            }
+        }
+    }
+    if (usedBackend == ThreadBackend)
+        for (int i = 0; i < min(queueDepth, 4); i++)
+            threads.emplace_back(&AsyncBlockWriter::run, this);
+}
+
+char *AsyncBlockWriter::acquire()
+{
+    for (;;)
+    {
+        char *block = tryAcquire();
+        if (block)
+            return block;
+        if (ring)
+        {
+            ring->wait();  // Completions are reaped by tryAcquire()
+            continue;
+        }
+        unique_lock<std::mutex> lock(stateMutex);
+        doneCv.wait(lock, [this] { return freeSlots.empty() == false; });
+    }
+}
+
+char *AsyncBlockWriter::tryAcquire()
+{
+    reap();
+    lock_guard<std::mutex> lock(stateMutex);
+    if (freeSlots.empty())
+        return nullptr;
+    int slot = freeSlots.back();
+    freeSlots.pop_back();
+    return slots[slot].data;
+}
+
+void AsyncBlockWriter::submit(char *block, int size)
+{
+    int slot   = (block - storage.get()) / blockStride;
+    Slot &s    = slots[slot];
+    int padded = size;
+    if (direct)
+    {
+        padded = (size + alignment - 1) / alignment * alignment;
+        memset(block + size, 0, padded - size);
+    }
+    if (padded == 0)
+    {
+        lock_guard<std::mutex> lock(stateMutex);
+        freeSlots.push_back(slot);
+        return;
+    }
+
+    s.offset = nextOffset;
+    s.size   = padded;
+    s.done   = 0;
+    nextOffset += padded;
+    fileSize = s.offset + size;
+    {
+        lock_guard<std::mutex> lock(stateMutex);
+        pending++;
+    }
+    start(slot);
+}
+
+bool AsyncBlockWriter::write(const char *data, int size)
+{
+    while (size > 0)
+    {
+        int n       = min(size, blockBytes);
+        char *block = acquire();
+        memcpy(block, data, n);
+        submit(block, n);
+        data += n;
+        size -= n;
+    }
+    return !error();
+}
+
+bool AsyncBlockWriter::flush()
+{
+    if (ring)
+    {
+        for (;;)
+        {
+            reap();
+            if (inFlight() == 0)
+                break;
+            ring->wait();
+        }
+    }
+    else
+    {
+        unique_lock<std::mutex> lock(stateMutex);
+        doneCv.wait(lock, [this] { return pending == 0; });
+    }
+    return !error();
+}
+
+int AsyncBlockWriter::inFlight() const
+{
+    lock_guard<std::mutex> lock(stateMutex);
+    return pending;
+}
+
+uint64_t AsyncBlockWriter::completed() const
+{
+    lock_guard<std::mutex> lock(stateMutex);
+    return completedBytes;
+}
+
+error_code AsyncBlockWriter::error() const
+{
+    lock_guard<std::mutex> lock(stateMutex);
+    return firstError;
+}
+
+AsyncBlockWriter::~AsyncBlockWriter()
+{
+    flush();
+    {
+        lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    workCv.notify_all();
+    for (auto &t : threads)
+        t.join();
+
+    // Remove the padding of the last block, errors can't be reported here
+    if (fileSize < nextOffset && ftruncate(fd, fileSize) != 0)
+    {
+    }
+    ::close(fd);
+}
+
+void AsyncBlockWriter::start(int slot)
+{
+    Slot &s = slots[slot];
+    if (ring)
+    {
+        int error = ring->write(fd, s.data + s.done, s.size - s.done,
+                                s.offset + s.done, slot);
+        if (error)
+            complete(slot, -error);
+        return;
+    }
+    {
+        lock_guard<std::mutex> lock(stateMutex);
+        work.push_back(slot);
+    }
+    workCv.notify_one();
+}
+
+void AsyncBlockWriter::complete(int slot, int result)
+{
+    Slot &s = slots[slot];
+    if (result == -EINTR || result == -EAGAIN)
+    {
+        start(slot);
+        return;
+    }
+    if (result > 0 && s.done + result < s.size)
+    {
+        // Partial write, continue from where it stopped
+        s.done += result;
+        start(slot);
+        return;
+    }
+
+    int error = result < 0 ? -result : result == 0 ? EIO : 0;
+    if (completion)
+        completion(s.offset, s.size, error);
+    lock_guard<std::mutex> lock(stateMutex);
+    if (error && !firstError)
+        firstError = error_code(error, system_category());
+    if (error == 0)
+        completedBytes += s.size;
+    freeSlots.push_back(slot);
+    pending--;
+    doneCv.notify_all();
+}
+
+void AsyncBlockWriter::reap()
+{
+    if (ring == nullptr)
+        return;
+    int slot, result;
+    while (ring->peek(slot, result))
+        complete(slot, result);
+}
+
+void AsyncBlockWriter::run()
+{
+    for (;;)
+    {
+        int slot;
+        {
+            unique_lock<std::mutex> lock(stateMutex);
+            workCv.wait(lock,
+                        [this] { return stopping || work.empty() == false; });
+            if (work.empty())
+                return;
+            slot = work.front();
+            work.pop_front();
+        }
+        Slot &s   = slots[slot];
+        ssize_t n = pwrite(fd, s.data + s.done, s.size - s.done,
+                           s.offset + s.done);
+        complete(slot, n < 0 ? -errno : static_cast<int>(n));
+    }
+}
+
+}  // namespace tscpp
+
+#endif  // _MIOSIX
@@ -0,0 +1,251 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file aio.h
+ *
+ * @brief Asynchronous writer of aligned blocks, for logs written while
+ * receiving data.
+ *
+ * Only available on POSIX systems, io_uring is used on Linux unless
+ * TSCPP_NO_IO_URING is defined.
+ */
+
+#pragma once
+
+#ifndef _MIOSIX
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace tscpp
+{
+
+/**
+ * Backends of AsyncBlockWriter.
+ */
+enum AsyncBackend
+{
+    AutoBackend,     ///< io_uring if available, otherwise ThreadBackend
+    IoUringBackend,  ///< io_uring, Linux only
+    ThreadBackend    ///< pwrite() from a pool of threads
+};
+
+/**
+ * @brief Writes blocks to a file keeping several writes in flight, so that
+ * the thread producing the blocks does not wait for the storage.
+ *
+ * The writer owns queueDepth aligned blocks. A block is acquired, filled,
+ * and submitted to be written at the end of the file, after which it is
+ * reused once its write completes. When all the blocks are in flight the
+ * producer is pushed back: acquire() waits while tryAcquire() fails.
+ *
+ * write() copies data in a block and submits it, so the writer can be used
+ * as the sink callback of BufferedOutputArchive, LogPipeline and
+ * ShardedLogPipeline:
+ *
+ * \code
+ * AsyncBlockWriter writer("log.dat", 4096);
+ * LogPipeline pipeline([&](const char *block, int size) {
+ *     writer.write(block, size);
+ * }, 8, 4096);
+ * \endcode
+ *
+ * Blocks must be acquired and submitted by one thread at a time. Write
+ * errors are not thrown, the first one is kept and reported by error().
+ */
+class AsyncBlockWriter
+{
+public:
+    /// Alignment of the blocks, and of the writes with O_DIRECT
+    static const int alignment = 4096;
+
+    /**
+     * \param path Path of the file to write, truncated if it exists.
+     * \param blockSize Size of each block, with direct a multiple of
+     * alignment.
+     * \param queueDepth Number of blocks, and maximum number of writes in
+     * flight.
+     * \param direct If true, the file is opened with O_DIRECT so that writes
+     * bypass the page cache. Blocks not a multiple of alignment are padded
+     * with '\0', which is skipped when unserializing, so they should only be
+     * written at record boundaries, such as the flushes of a
+     * BufferedOutputArchive. The padding after the last block is removed
+     * when the writer is destroyed.
+     * \param backend Backend used for the writes.
+     * \throws std::invalid_argument if blockSize or queueDepth are not valid.
+     * \throws std::system_error if the file can't be opened, or if the
+     * IoUringBackend is requested and can't be set up.
+     */
+    AsyncBlockWriter(const std::string &path, int blockSize,
+                     int queueDepth = 8, bool direct = false,
+                     AsyncBackend backend = AutoBackend);
+
+    /**
+     * @brief Get a free block, waiting for a write to complete if all the
+     * blocks are in flight.
+     *
+     * \return A block of blockSize() bytes, to be passed to submit().
+     */
+    char *acquire();
+
+    /**
+     * @brief Get a free block without waiting.
+     *
+     * \return A block of blockSize() bytes, or nullptr if all the blocks are
+     * in flight.
+     */
+    char *tryAcquire();
+
+    /**
+     * @brief Write a block at the end of the file, without waiting for the
+     * write to complete.
+     *
+     * \param block Block returned by acquire() or tryAcquire(). Must not be
+     * used after this call.
+     * \param size Number of bytes of the block to write, up to blockSize().
+     */
+    void submit(char *block, int size);
+
+    /**
+     * @brief Copy data in as many blocks as needed and submit them, waiting
+     * for free blocks.
+     *
+     * \param data Data to write.
+     * \param size Data size.
+     * \return false if a write has failed, see error().
+     */
+    bool write(const char *data, int size);
+
+    /**
+     * @brief Wait for all the writes in flight to complete.
+     *
+     * \return false if a write has failed, see error().
+     */
+    bool flush();
+
+    /**
+     * @brief Set a callback called as each write completes, with the offset
+     * and size of the block and 0 or the error. With ThreadBackend it is
+     * called by the writing threads.
+     */
+    void setCompletion(std::function<void(uint64_t, int, int)> completion)
+    {
+        this->completion = completion;
+    }
+
+    /**
+     * \return The number of writes submitted and not yet completed.
+     */
+    int inFlight() const;
+
+    /**
+     * \return The number of bytes whose write has completed, including the
+     * padding added with O_DIRECT.
+     */
+    uint64_t completed() const;
+
+    /**
+     * \return The first write error, or an empty error code.
+     */
+    std::error_code error() const;
+
+    /**
+     * \return The backend in use, IoUringBackend or ThreadBackend.
+     */
+    AsyncBackend backend() const { return usedBackend; }
+
+    /**
+     * \return The size of each block.
+     */
+    int blockSize() const { return blockBytes; }
+
+    /**
+     * Waits for the writes in flight and closes the file.
+     */
+    ~AsyncBlockWriter();
+
+private:
+    AsyncBlockWriter(const AsyncBlockWriter &)            = delete;
+    AsyncBlockWriter &operator=(const AsyncBlockWriter &) = delete;
+
+    class IoUring;
+
+    /**
+     * A block and the state of its write.
+     */
+    class Slot
+    {
+    public:
+        char *data      = nullptr;
+        uint64_t offset = 0;  ///< Offset in the file
+        int size        = 0;  ///< Bytes to write, including the padding
+        int done        = 0;  ///< Bytes already written
+    };
+
+    void start(int slot);
+    void complete(int slot, int result);
+    void reap();
+    void run();
+
+    int fd;
+    int blockBytes;
+    int blockStride;  ///< Distance between blocks, to keep them aligned
+    bool direct;
+    AsyncBackend usedBackend = ThreadBackend;
+    std::unique_ptr<char, void (*)(void *)> storage{nullptr, free};
+    std::vector<Slot> slots;
+    std::function<void(uint64_t, int, int)> completion;
+    uint64_t nextOffset = 0;  ///< Offset of the next block submitted
+    uint64_t fileSize   = 0;  ///< File size, excluding the last padding
+
+    mutable std::mutex stateMutex;  ///< Protects the members below
+    std::condition_variable doneCv;
+    std::vector<int> freeSlots;
+    int pending             = 0;
+    uint64_t completedBytes = 0;
+    std::error_code firstError;
+
+    std::unique_ptr<IoUring> ring;
+    std::condition_variable workCv;  ///< Used by ThreadBackend
+    std::deque<int> work;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+};
+
+}  // namespace tscpp
+
+#endif  // _MIOSIX
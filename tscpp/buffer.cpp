@@ -27,82 +27,894 @@
 
 #include "buffer.h"
 
+#include "scan.h"
+
+#include <cstddef>
+
+#ifdef __GNUC__
+#define TSCPP_NOINLINE __attribute__((noinline))
+#else
+#define TSCPP_NOINLINE
+#endif
+
 using namespace std;
 
 namespace tscpp
 {
 
-int TypePoolBuffer::unserializeUnknownImpl(const char *name, const void *buffer,
-                                           int bufSize) const
+/**
+ * Header of a serialized type, as parsed from a buffer.
+ */
+class Header
 {
-    auto it = types.find(name);
-    if (it == types.end())
-        return UnknownType;
+public:
+    const char *name;  ///< Serialized type name, not '\0' terminated
+    int nameSize;      ///< Serialized type name length
+    uint32_t hash;     ///< Name hash, if requested
+    int definedId;  ///< Type id the caller should store in the dictionary or -1
+    int count;      ///< Number of serialized objects, or -1 if not a batch
+    bool delta;     ///< True if the object is delta encoded
+    uint32_t fingerprint;  ///< Fingerprint of the type, or 0 if absent
+};
+
+/**
+ * \return The number of padding bytes at the start of the buffer.
+ */
+static int paddingSize(const char *buf, int bufSize)
+{
+    return bufSize > 0 ? skipByte(buf, bufSize, '\0') : 0;
+}
 
-    if (it->second.size > bufSize)
+/**
+ * \return The length of the '\0' terminated name at the start of the buffer,
+ * or bufSize if the terminator is not found.
+ */
+static int nameLength(const char *buf, int bufSize)
+{
+    return bufSize > 0 ? findByte(buf, bufSize, '\0') : 0;
+}
+
+/**
+ * \return The number of padding bytes to add before a header so that the data
+ * following it is aligned.
+ */
+static int alignmentPadding(const void *buffer, int headerSize, int alignment)
+{
+    uintptr_t data = reinterpret_cast<uintptr_t>(buffer) + headerSize;
+    return (alignment - data % alignment) % alignment;
+}
+
+/**
+ * Parse the header of a serialized type, skipping the padding before it.
+ *
+ * \param td Type dictionary used to resolve compact headers, or nullptr to
+ * only accept the full name header.
+ * \param buf Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \param h Set to the parsed header.
+ * \param needHash If true, also compute the name hash.
+ * \return The header size, including the padding, or
+ * TscppError::BufferTooSmall if the header is truncated or
+ * TscppError::UnknownType if the type id has not been defined.
+ */
+static int parseHeader(const TypeDictionary *td, const char *buf, int bufSize,
+                       Header &h, bool needHash)
+{
+    h.definedId = -1;
+    h.count     = -1;
+    h.delta       = false;
+    h.fingerprint = 0;
+    int padding   = paddingSize(buf, bufSize);
+    if (bufSize - padding >= 1 && buf[padding] == FingerprintPrefix)
+    {
+        if (bufSize - padding < fingerprintPrefixSize)
+            return BufferTooSmall;
+        h.fingerprint = loadLittleEndian32(buf + padding + 1);
+        padding += fingerprintPrefixSize;
+    }
+    if (bufSize - padding >= 1 && buf[padding] == DeltaPrefix)
+    {
+        h.delta = true;
+        padding++;
+    }
+    else if (bufSize - padding >= 1 && buf[padding] == BatchPrefix)
+    {
+        if (bufSize - padding < batchPrefixSize)
+            return BufferTooSmall;
+        h.count = loadLittleEndian32(buf + padding + 1);
+        if (h.count < 0)
+            return BufferTooSmall;
+        padding += batchPrefixSize;
+    }
+    buf += padding;
+    bufSize -= padding;
+    if (bufSize < 1)
         return BufferTooSmall;
 
-    it->second.usc(buffer);
-    return it->second.size;
+    unsigned char marker = buf[0];
+    if (td && marker >= TypeIdReference)
+    {
+        int id          = marker & ~TypeIdReference;
+        const string *n = td->name(id);
+        if (n == nullptr)
+            return UnknownType;
+        h.name     = n->c_str();
+        h.nameSize = n->size();
+        if (needHash)
+            h.hash = td->hash(id);
+        return padding + 1;
+    }
+
+    if (td && marker == TypeIdDefinition)
+    {
+        if (bufSize < 2)
+            return BufferTooSmall;
+        h.nameSize = nameLength(buf + 2, bufSize - 2);
+        if (h.nameSize >= bufSize - 2)
+            return BufferTooSmall;
+        h.name      = buf + 2;
+        h.definedId = static_cast<unsigned char>(buf[1]);
+        if (h.definedId >= TypeDictionary::maxTypes)
+            return UnknownType;
+        if (needHash)
+            h.hash = hashTypeName(h.name, h.nameSize);
+        return padding + h.nameSize + 3;
+    }
+
+    h.nameSize = nameLength(buf, bufSize);
+    if (h.nameSize >= bufSize)
+        return BufferTooSmall;
+    h.name = buf;
+    if (needHash)
+        h.hash = hashTypeName(h.name, h.nameSize);
+    return padding + h.nameSize + 1;
 }
 
-int serializeImpl(void *buffer, int bufSize, const char *name, const void *data,
-                  int size)
+/**
+ * Choose the header of a type.
+ *
+ * \param td Type dictionary to use the compact header format, or nullptr to
+ * use the full name header.
+ * \param name Type name.
+ * \param id Set to the type id to reference, or -1.
+ * \param define Set to true if a type id has to be defined.
+ * \return The header size, excluding any prefix.
+ */
+static int chooseHeader(const TypeDictionary *td, const TypeName &name,
+                        int &id, bool &define)
 {
-    int nameSize       = strlen(name);
-    int serializedSize = nameSize + 1 + size;
+    id     = td ? td->find(name.str) : -1;
+    define = td && id < 0 && td->full() == false;
+    if (id >= 0)
+        return 1;
+    if (define)
+        return 2 + name.size + 1;
+    return name.size + 1;
+}
+
+/**
+ * Write a header previously chosen by chooseHeader().
+ *
+ * \return The pointer past the header.
+ */
+static char *writeHeader(TypeDictionary *td, char *buf, const TypeName &name,
+                         int id, bool define)
+{
+    if (id >= 0)
+    {
+        *buf++ = TypeIdReference | id;
+        return buf;
+    }
+    if (define)
+    {
+        *buf++ = TypeIdDefinition;
+        *buf++ = td->define(name.str);
+    }
+    memcpy(buf, name.str, name.size + 1);  // Copy also the \0
+    return buf + name.size + 1;
+}
+
+/**
+ * Serialize one object or a batch of objects of the same type.
+ *
+ * \param td Type dictionary to use the compact header format, or nullptr to
+ * use the full name header.
+ * \param buffer Pointer to the memory buffer where to serialize the type.
+ * \param bufSize Buffer size.
+ * \param name Type name.
+ * \param data Type data.
+ * \param size Size of one object.
+ * \param count Number of objects, or -1 to serialize one object without the
+ * batch prefix.
+ * \param alignment Alignment of the data within the buffer.
+ * \param withFingerprint If true and the fingerprint of the type is known,
+ * write it before the header.
+ * \return The serialized size, or TscppError::BufferTooSmall.
+ */
+static int serializeRecord(TypeDictionary *td, void *buffer, int bufSize,
+                           const TypeName &name, const void *data, int size,
+                           int count, int alignment,
+                           bool withFingerprint = false)
+{
+    int id;
+    bool define;
+    int headerSize = chooseHeader(td, name, id, define);
+    if (count >= 0)
+        headerSize += batchPrefixSize;
+    withFingerprint = withFingerprint && name.fingerprint != 0;
+    if (withFingerprint)
+        headerSize += fingerprintPrefixSize;
+
+    int padding = alignmentPadding(buffer, headerSize, alignment);
+    if (count > (bufSize - padding - headerSize) / size)
+        return BufferTooSmall;
+    int dataSize       = count >= 0 ? count * size : size;
+    int serializedSize = padding + headerSize + dataSize;
     if (serializedSize > bufSize)
         return BufferTooSmall;
 
     char *buf = reinterpret_cast<char *>(buffer);
-    memcpy(buf, name, nameSize + 1);  // Copy also the \0
-    memcpy(buf + nameSize + 1, data, size);
+    memset(buf, 0, padding);
+    buf += padding;
+    if (withFingerprint)
+    {
+        buf[0] = FingerprintPrefix;
+        storeLittleEndian32(buf + 1, name.fingerprint);
+        buf += fingerprintPrefixSize;
+    }
+    if (count >= 0)
+    {
+        buf[0] = BatchPrefix;
+        storeLittleEndian32(buf + 1, count);
+        buf += batchPrefixSize;
+    }
+    buf = writeHeader(td, buf, name, id, define);
+    memcpy(buf, data, dataSize);
     return serializedSize;
 }
 
-int unserializeImpl(const char *name, void *data, int size, const void *buffer,
-                    int bufSize)
+/**
+ * Serialize one object, delta encoded if its type is enabled in the state.
+ *
+ * \return The serialized size, or TscppError::BufferTooSmall.
+ */
+static int serializeDelta(DeltaState &ds, TypeDictionary *td, void *buffer,
+                          int bufSize, const TypeName &name, const void *data,
+                          int size)
 {
-    int nameSize       = strlen(name);
-    int serializedSize = nameSize + 1 + size;
-    if (serializedSize > bufSize)
+    int id;
+    bool define;
+    int headerSize = 1 + chooseHeader(td, name, id, define);
+    if (headerSize >= bufSize)
         return BufferTooSmall;
 
-    const char *buf = reinterpret_cast<const char *>(buffer);
-    if (memcmp(buf, name, nameSize + 1))
+    // The object is encoded first, so that a buffer too small leaves both
+    // the dictionary and the state untouched
+    char *buf   = reinterpret_cast<char *>(buffer);
+    int encoded = ds.encode(name.str, data, size, buf + headerSize,
+                            bufSize - headerSize);
+    if (encoded == 0)
+        return serializeRecord(td, buffer, bufSize, name, data, size, -1, 1);
+    if (encoded < 0)
+        return BufferTooSmall;
+    buf[0] = DeltaPrefix;
+    writeHeader(td, buf + 1, name, id, define);
+    return headerSize + encoded;
+}
+
+/**
+ * Find the data of a known type in a buffer.
+ *
+ * \param td Type dictionary used to resolve compact headers, or nullptr to
+ * only accept the full name header.
+ * \param name Expected type name.
+ * \param size Expected type size.
+ * \param buf Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \param data Set to point to the type data within the buffer.
+ * \param count If nullptr, only one object is expected, otherwise set to the
+ * number of objects found, batch or not.
+ * \return The serialized size, or TscppError::WrongType or
+ * TscppError::BufferTooSmall.
+ */
+static int findData(TypeDictionary *td, const TypeName &name, int size,
+                    const char *buf, int bufSize, const char *&data,
+                    int *count)
+{
+    int nameSize = name.size;
+    int padding  = paddingSize(buf, bufSize);
+    if (td == nullptr && count == nullptr &&
+        (padding >= bufSize || buf[padding] != FingerprintPrefix))
+    {
+        // Full name header, the expected name can be compared directly
+        int serializedSize = padding + nameSize + 1 + size;
+        if (serializedSize > bufSize)
+            return BufferTooSmall;
+        if (memcmp(buf + padding, name.str, nameSize + 1))
+            return WrongType;
+
+        data = buf + padding + nameSize + 1;
+        return serializedSize;
+    }
+
+    Header h;
+    int headerSize = parseHeader(td, buf, bufSize, h, false);
+    if (headerSize == UnknownType)
+        return WrongType;
+    if (headerSize < 0)
+        return headerSize;
+    if (td && h.definedId >= 0)
+        td->define(h.definedId, h.name, h.nameSize);
+
+    int n = h.count >= 0 ? h.count : 1;
+    if ((count == nullptr && h.count >= 0) || h.delta)
+        return WrongType;
+    if (h.fingerprint != 0 && name.fingerprint != 0 &&
+        h.fingerprint != name.fingerprint)
+        return WrongType;
+    if (n > (bufSize - headerSize) / size)
+        return BufferTooSmall;
+    if (h.nameSize != nameSize || memcmp(h.name, name.str, nameSize))
+        return WrongType;
+
+    data = buf + headerSize;
+    if (count)
+        *count = n;
+    return headerSize + n * size;
+}
+
+TypePoolBuffer::DeserializerImpl *TypePoolBuffer::registered(const char *name)
+{
+    int nameSize = strlen(name);
+    int i        = types.index(name, nameSize, hashTypeName(name, nameSize));
+    return i >= 0 ? &types.at(i) : nullptr;
+}
+
+int TypePoolBuffer::unserializeUnknownImpl(const char *name, const void *buffer,
+                                           int bufSize) const
+{
+    int nameSize = strlen(name);
+    return unserializeUnknownImpl(name, nameSize, hashTypeName(name, nameSize),
+                                  buffer, bufSize, -1);
+}
+
+int TypePoolBuffer::unserializeUnknownImpl(const char *name, int nameSize,
+                                           uint32_t hash, const void *buffer,
+                                           int bufSize, int count,
+                                           uint32_t fingerprint) const
+{
+    const DeserializerImpl *d = types.find(name, nameSize, hash);
+    if (d == nullptr)
+        return UnknownType;
+    if (fingerprint != 0 && d->fingerprint != 0 &&
+        fingerprint != d->fingerprint)
+        return upgrade(*d, fingerprint, buffer, bufSize, count);
+
+    if (d->size <= 0)
+        return UnknownType;
+    int n = count < 0 ? 1 : count;
+    if (n > bufSize / d->size)
+        return BufferTooSmall;
+
+    dispatch(*d, buffer, count);
+    return n * d->size;
+}
+
+int TypePoolBuffer::scanUnknownImpl(const char *name, int nameSize,
+                                    uint32_t hash, int bufSize, int count,
+                                    int &type, uint32_t fingerprint) const
+{
+    type = types.index(name, nameSize, hash);
+    if (type < 0)
+        return UnknownType;
+
+    const DeserializerImpl &d = types.at(type);
+    if (fingerprint != 0 && d.fingerprint != 0 &&
+        fingerprint != d.fingerprint)
         return WrongType;
+    if (d.size <= 0)
+        return UnknownType;
+    int n = count < 0 ? 1 : count;
+    if (n > bufSize / d.size)
+        return BufferTooSmall;
+    return n * d.size;
+}
+
+void TypePoolBuffer::unserializeScanned(const ScannedType &st,
+                                        const void *buffer) const
+{
+    dispatch(types.at(st.type),
+             reinterpret_cast<const char *>(buffer) + st.dataOffset, st.count);
+}
+
+int TypePoolBuffer::unserializeDeltaImpl(DeltaState &ds, const char *name,
+                                         int nameSize, uint32_t hash,
+                                         const void *buffer, int bufSize,
+                                         uint32_t fingerprint) const
+{
+    const DeserializerImpl *d = types.find(name, nameSize, hash);
+    if (d == nullptr)
+        return UnknownType;
+    if (fingerprint != 0 && d->fingerprint != 0 &&
+        fingerprint != d->fingerprint)
+        return WrongType;
+
+    const char *mask = reinterpret_cast<const char *>(buffer);
+    int maskSize     = deltaMaskSize(d->size);
+    if (maskSize > bufSize ||
+        DeltaState::changedBytes(mask, d->size) > bufSize - maskSize)
+        return BufferTooSmall;
+    if (d->usc == nullptr)  // Skipped, the previous object is not needed
+        return maskSize + DeltaState::changedBytes(mask, d->size);
+
+    const void *object = ds.decode(name, nameSize, d->size, mask);
+    if (object)
+        dispatch(*d, object, -1);
+    return maskSize + DeltaState::changedBytes(mask, d->size);
+}
+
+int TypePoolBuffer::upgrade(const DeserializerImpl &d, uint32_t fingerprint,
+                            const void *buffer, int bufSize, int count) const
+{
+    for (auto &u : d.upgrades)
+    {
+        if (u.fingerprint != fingerprint)
+            continue;
+        int n = count < 0 ? 1 : count;
+        if (n > bufSize / u.size)
+            return BufferTooSmall;
+        if (d.usc == nullptr)
+            return n * u.size;  // Skipped type
+        const char *buf = reinterpret_cast<const char *>(buffer);
+        for (int i = 0; i < n; i++)
+            u.convert(buf + i * u.size, d.usc);
+        return n * u.size;
+    }
+    return WrongType;
+}
+
+void TypePoolBuffer::dispatch(const DeserializerImpl &d, const void *buffer,
+                              int count) const
+{
+    if (d.usc == nullptr)
+        return;  // Skipped type
+    if (byteSwap == false || d.layout.empty())
+    {
+        deliver(d, buffer, count);
+        return;
+    }
+
+    swapAndDeliver(d, buffer, count);
+}
+
+// Not inlined, so that the chunk only enlarges the stack when swapping. The
+// chunk is not a member as the pool may be shared by threads, such as those
+// of a ParallelDecoder
+TSCPP_NOINLINE void TypePoolBuffer::swapAndDeliver(
+    const DeserializerImpl &d, const void *buffer, int count) const
+{
+    const int maxChunkSize = 512;
+    alignas(max_align_t) char chunk[maxChunkSize];
+    const char *buf = reinterpret_cast<const char *>(buffer);
+    int n           = count < 0 ? 1 : count;
+    if (d.size > maxChunkSize)
+    {
+        // Types larger than the chunk are swapped on the heap, in a copy
+        // reused by each thread so that it is allocated once
+#ifndef _MIOSIX
+        static thread_local vector<char> copy;
+#else
+        vector<char> copy;
+#endif
+        if (static_cast<int>(copy.size()) < d.size)
+            copy.resize(d.size);
+        for (int i = 0; i < n; i++)
+        {
+            memcpy(copy.data(), buf + i * d.size, d.size);
+            d.layout.swap(copy.data(), 1, d.size);
+            deliver(d, copy.data(), count < 0 ? -1 : 1);
+        }
+        return;
+    }
+
+    int chunkCount = min(n, maxChunkSize / d.size);
+    for (int i = 0; i < n; i += chunkCount)
+    {
+        int c = min(chunkCount, n - i);
+        memcpy(chunk, buf + i * d.size, c * d.size);
+        d.layout.swap(chunk, c, d.size);
+        deliver(d, chunk, count < 0 ? -1 : c);
+    }
+}
+
+void TypePoolBuffer::deliver(const DeserializerImpl &d, const void *buffer,
+                             int count) const
+{
+    if (count < 0)
+    {
+        d.usc(buffer);
+    }
+    else if (d.uscArray)
+    {
+        d.uscArray(buffer, count);
+    }
+    else
+    {
+        const char *buf = reinterpret_cast<const char *>(buffer);
+        for (int i = 0; i < count; i++)
+            d.usc(buf + i * d.size);
+    }
+}
+
+int serializeImpl(void *buffer, int bufSize, const TypeName &name,
+                  const void *data, int size)
+{
+    return serializeRecord(nullptr, buffer, bufSize, name, data, size, -1, 1);
+}
+
+int serializeImpl(TypeDictionary &td, void *buffer, int bufSize,
+                  const TypeName &name, const void *data, int size)
+{
+    return serializeRecord(&td, buffer, bufSize, name, data, size, -1, 1);
+}
+
+int serializeWithFingerprintImpl(void *buffer, int bufSize,
+                                 const TypeName &name, const void *data,
+                                 int size)
+{
+    return serializeRecord(nullptr, buffer, bufSize, name, data, size, -1, 1,
+                           true);
+}
+
+int serializeWithFingerprintImpl(TypeDictionary &td, void *buffer,
+                                 int bufSize, const TypeName &name,
+                                 const void *data, int size)
+{
+    return serializeRecord(&td, buffer, bufSize, name, data, size, -1, 1,
+                           true);
+}
+
+int serializeImpl(void *buffer, int bufSize, const TypeName &name,
+                  const void *data, int size, int alignment)
+{
+    return serializeRecord(nullptr, buffer, bufSize, name, data, size, -1,
+                           alignment);
+}
+
+int serializeImpl(TypeDictionary &td, void *buffer, int bufSize,
+                  const TypeName &name, const void *data, int size,
+                  int alignment)
+{
+    return serializeRecord(&td, buffer, bufSize, name, data, size, -1,
+                           alignment);
+}
+
+int serializeImpl(DeltaState &ds, void *buffer, int bufSize,
+                  const TypeName &name, const void *data, int size)
+{
+    return serializeDelta(ds, nullptr, buffer, bufSize, name, data, size);
+}
+
+int serializeImpl(TypeDictionary &td, DeltaState &ds, void *buffer,
+                  int bufSize, const TypeName &name, const void *data,
+                  int size)
+{
+    return serializeDelta(ds, &td, buffer, bufSize, name, data, size);
+}
+
+int serializeArrayImpl(void *buffer, int bufSize, const TypeName &name,
+                       const void *data, int size, int count, int alignment)
+{
+    return serializeRecord(nullptr, buffer, bufSize, name, data, size, count,
+                           alignment);
+}
+
+int serializeArrayImpl(TypeDictionary &td, void *buffer, int bufSize,
+                       const TypeName &name, const void *data, int size,
+                       int count, int alignment)
+{
+    return serializeRecord(&td, buffer, bufSize, name, data, size, count,
+                           alignment);
+}
+
+/**
+ * Serialize the header of one object or of a batch.
+ *
+ * \return The header size, or TscppError::BufferTooSmall.
+ */
+static int serializeHeaderImpl(TypeDictionary *td, void *buffer, int bufSize,
+                               const TypeName &name, int count)
+{
+    int id;
+    bool define;
+    int headerSize = chooseHeader(td, name, id, define);
+    if (count >= 0)
+        headerSize += batchPrefixSize;
+    if (headerSize > bufSize)
+        return BufferTooSmall;
+
+    char *buf = reinterpret_cast<char *>(buffer);
+    if (count >= 0)
+    {
+        buf[0] = BatchPrefix;
+        storeLittleEndian32(buf + 1, count);
+        buf += batchPrefixSize;
+    }
+    writeHeader(td, buf, name, id, define);
+    return headerSize;
+}
+
+int serializeHeader(void *buffer, int bufSize, const TypeName &name, int count)
+{
+    return serializeHeaderImpl(nullptr, buffer, bufSize, name, count);
+}
+
+int serializeHeader(TypeDictionary &td, void *buffer, int bufSize,
+                    const TypeName &name, int count)
+{
+    return serializeHeaderImpl(&td, buffer, bufSize, name, count);
+}
+
+int unserializeImpl(const TypeName &name, void *data, int size,
+                    const void *buffer, int bufSize)
+{
+    const char *serializedData;
+    int result =
+        findData(nullptr, name, size, reinterpret_cast<const char *>(buffer),
+                 bufSize, serializedData, nullptr);
+    if (result < 0)
+        return result;
 
     // NOTE: we are writing on top of a constructed type without calling its
     // destructor. However, since it is trivially copyable, we at least aren't
     // overwriting pointers to allocated memory.
-    memcpy(data, buf + nameSize + 1, size);
-    return serializedSize;
+    memcpy(data, serializedData, size);
+    return result;
+}
+
+int unserializeImpl(TypeDictionary &td, const TypeName &name, void *data,
+                    int size, const void *buffer, int bufSize)
+{
+    const char *serializedData;
+    int result =
+        findData(&td, name, size, reinterpret_cast<const char *>(buffer),
+                 bufSize, serializedData, nullptr);
+    if (result < 0)
+        return result;
+
+    // NOTE: we are writing on top of a constructed type without calling its
+    // destructor. However, since it is trivially copyable, we at least aren't
+    // overwriting pointers to allocated memory.
+    memcpy(data, serializedData, size);
+    return result;
+}
+
+int unserializeViewImpl(const TypeName &name, int size, const void *buffer,
+                        int bufSize, const void *&data)
+{
+    const char *serializedData;
+    int result =
+        findData(nullptr, name, size, reinterpret_cast<const char *>(buffer),
+                 bufSize, serializedData, nullptr);
+    if (result >= 0)
+        data = serializedData;
+    return result;
+}
+
+int unserializeViewImpl(TypeDictionary &td, const TypeName &name, int size,
+                        const void *buffer, int bufSize, const void *&data)
+{
+    const char *serializedData;
+    int result =
+        findData(&td, name, size, reinterpret_cast<const char *>(buffer),
+                 bufSize, serializedData, nullptr);
+    if (result >= 0)
+        data = serializedData;
+    return result;
+}
+
+/**
+ * Implementation of unserializeArrayImpl, with or without a dictionary.
+ */
+static int unserializeArray(TypeDictionary *td, const TypeName &name,
+                            void *data, int size, int &count,
+                            const void *buffer, int bufSize)
+{
+    const char *serializedData;
+    int serializedCount;
+    int result =
+        findData(td, name, size, reinterpret_cast<const char *>(buffer),
+                 bufSize, serializedData, &serializedCount);
+    if (result < 0)
+        return result;
+    if (serializedCount > count)
+        return BufferTooSmall;
+
+    // NOTE: we are writing on top of constructed types without calling their
+    // destructors. However, since they are trivially copyable, we at least
+    // aren't overwriting pointers to allocated memory.
+    memcpy(data, serializedData, serializedCount * size);
+    count = serializedCount;
+    return result;
+}
+
+int unserializeArrayImpl(const TypeName &name, void *data, int size, int &count,
+                         const void *buffer, int bufSize)
+{
+    return unserializeArray(nullptr, name, data, size, count, buffer, bufSize);
+}
+
+int unserializeArrayImpl(TypeDictionary &td, const TypeName &name, void *data,
+                         int size, int &count, const void *buffer, int bufSize)
+{
+    return unserializeArray(&td, name, data, size, count, buffer, bufSize);
+}
+
+/**
+ * Count an error returned by the buffer API.
+ *
+ * \return The error.
+ */
+static int countError(Stats &stats, int error)
+{
+    if (error == BufferTooSmall)
+        stats.error(BufferTooSmallError);
+    else if (error == WrongType)
+        stats.error(WrongTypeError);
+    else
+        stats.error(UnknownTypeError);
+    return error;
+}
+
+/**
+ * Implementation of unserializeUnknown, with or without a dictionary and a
+ * delta state.
+ */
+static int unserializeUnknown(const TypePoolBuffer &tp, TypeDictionary *td,
+                              DeltaState *ds, const void *buffer, int bufSize)
+{
+    Stats &stats    = tp.stats();
+    uint64_t start  = stats.start();
+    const char *buf = reinterpret_cast<const char *>(buffer);
+    Header h;
+    int headerSize = parseHeader(td, buf, bufSize, h, true);
+    if (headerSize < 0)
+        return countError(stats, headerSize);
+    if (h.delta && ds == nullptr)
+        return countError(stats, UnknownType);
+    if (td && h.definedId >= 0)
+        td->define(h.definedId, h.name, h.nameSize);
+
+    int result;
+    if (h.delta)
+        result = tp.unserializeDeltaImpl(*ds, h.name, h.nameSize, h.hash,
+                                         buf + headerSize,
+                                         bufSize - headerSize, h.fingerprint);
+    else
+        result = tp.unserializeUnknownImpl(h.name, h.nameSize, h.hash,
+                                           buf + headerSize,
+                                           bufSize - headerSize, h.count,
+                                           h.fingerprint);
+    if (result < 0)
+        return countError(stats, result);
+    stats.record(h.name, h.nameSize, h.hash, h.count < 0 ? 1 : h.count,
+                 result + headerSize, start);
+    return result + headerSize;
 }
 
 int unserializeUnknown(const TypePoolBuffer &tp, const void *buffer,
                        int bufSize)
+{
+    return unserializeUnknown(tp, nullptr, nullptr, buffer, bufSize);
+}
+
+int unserializeUnknown(const TypePoolBuffer &tp, TypeDictionary &td,
+                       const void *buffer, int bufSize)
+{
+    return unserializeUnknown(tp, &td, nullptr, buffer, bufSize);
+}
+
+int unserializeUnknown(const TypePoolBuffer &tp, DeltaState &ds,
+                       const void *buffer, int bufSize)
+{
+    return unserializeUnknown(tp, nullptr, &ds, buffer, bufSize);
+}
+
+int unserializeUnknown(const TypePoolBuffer &tp, TypeDictionary &td,
+                       DeltaState &ds, const void *buffer, int bufSize)
+{
+    return unserializeUnknown(tp, &td, &ds, buffer, bufSize);
+}
+
+/**
+ * Implementation of scanUnknown, with or without a dictionary.
+ */
+static int scanUnknown(const TypePoolBuffer &tp, TypeDictionary *td,
+                       const void *buffer, int bufSize, ScannedType &st)
 {
     const char *buf = reinterpret_cast<const char *>(buffer);
-    int nameSize    = strnlen(buf, bufSize);
-    if (nameSize >= bufSize)
-        return BufferTooSmall;
+    Header h;
+    int headerSize = parseHeader(td, buf, bufSize, h, true);
+    if (headerSize < 0)
+        return headerSize;
+    if (h.delta)
+        return UnknownType;  // Deltas can only be decoded in order
+    if (td && h.definedId >= 0)
+        td->define(h.definedId, h.name, h.nameSize);
 
-    const char *name = buf;
-    buf += nameSize + 1;
-    bufSize -= nameSize + 1;
-    auto result = tp.unserializeUnknownImpl(name, buf, bufSize);
+    int result =
+        tp.scanUnknownImpl(h.name, h.nameSize, h.hash, bufSize - headerSize,
+                           h.count, st.type, h.fingerprint);
     if (result < 0)
         return result;
-    return result + nameSize + 1;
+    st.dataOffset = headerSize;
+    st.count      = h.count;
+    return result + headerSize;
+}
+
+int scanUnknown(const TypePoolBuffer &tp, const void *buffer, int bufSize,
+                ScannedType &st)
+{
+    return scanUnknown(tp, nullptr, buffer, bufSize, st);
+}
+
+int scanUnknown(const TypePoolBuffer &tp, TypeDictionary &td,
+                const void *buffer, int bufSize, ScannedType &st)
+{
+    return scanUnknown(tp, &td, buffer, bufSize, st);
 }
 
 string peekTypeName(const void *buffer, int bufSize)
 {
-    const char *buf = reinterpret_cast<const char *>(buffer);
-    int nameSize    = strnlen(buf, bufSize);
-    if (nameSize >= bufSize)
+    Header h;
+    if (parseHeader(nullptr, reinterpret_cast<const char *>(buffer), bufSize, h,
+                    false) < 0)
+        return "";
+    return string(h.name, h.nameSize);
+}
+
+string peekTypeName(const TypeDictionary &td, const void *buffer, int bufSize)
+{
+    Header h;
+    if (parseHeader(&td, reinterpret_cast<const char *>(buffer), bufSize, h,
+                    false) < 0)
         return "";
-    return buf;
+    return string(h.name, h.nameSize);
+}
+
+/**
+ * Implementation of parseRecordHeader, with or without a dictionary.
+ */
+static int parseRecordHeader(TypeDictionary *td, const void *buffer,
+                             int bufSize, RecordHeader &h)
+{
+    Header header;
+    int headerSize = parseHeader(td, reinterpret_cast<const char *>(buffer),
+                                 bufSize, header, true);
+    if (headerSize < 0)
+        return headerSize;
+    if (td && header.definedId >= 0)
+        td->define(header.definedId, header.name, header.nameSize);
+
+    h.name        = header.name;
+    h.nameSize    = header.nameSize;
+    h.hash        = header.hash;
+    h.count       = header.count;
+    h.delta       = header.delta;
+    h.fingerprint = header.fingerprint;
+    h.size        = headerSize;
+    return headerSize;
+}
+
+int parseRecordHeader(const void *buffer, int bufSize, RecordHeader &h)
+{
+    return parseRecordHeader(nullptr, buffer, bufSize, h);
+}
+
+int parseRecordHeader(TypeDictionary &td, const void *buffer, int bufSize,
+                      RecordHeader &h)
+{
+    return parseRecordHeader(&td, buffer, bufSize, h);
 }
 
 }  // namespace tscpp
@@ -27,11 +27,17 @@
 
 #pragma once
 
+#include <cstdint>
 #include <cstring>
 #include <functional>
-#include <map>
 #include <string>
 #include <type_traits>
+#include <vector>
+
+#include "format.h"
+#include "registry.h"
+#include "stats.h"
+#include "swap.h"
 
 /**
  * \file buffer.h
@@ -59,6 +65,33 @@ enum TscppError
     UnknownType = -3  ///< While deserializing the type wasn't found in the pool
 };
 
+/**
+ * @brief A serialized type found by scanUnknown(), which can be unserialized
+ * later with TypePoolBuffer::unserializeScanned().
+ */
+class ScannedType
+{
+public:
+    int type;        ///< Index of the type in the type pool
+    int dataOffset;  ///< Offset of the data from the start of the buffer
+    int count;       ///< Number of objects in a batch, or -1 if not a batch
+};
+
+/**
+ * @brief The header of a serialized type, found by parseRecordHeader().
+ */
+class RecordHeader
+{
+public:
+    const char *name;      ///< Serialized type name, not '\0' terminated
+    int nameSize;          ///< Serialized type name length
+    uint32_t hash;         ///< Name hash, see hashTypeName()
+    int count;             ///< Number of objects in a batch, or -1
+    bool delta;            ///< True if the object is delta encoded
+    uint32_t fingerprint;  ///< Fingerprint of the type, or 0 if absent
+    int size;  ///< Size of the header, including the padding before it
+};
+
 /**
  * @brief Type pool for the TSCPP buffer API.
  *
@@ -78,24 +111,278 @@ public:
     template <typename T>
     void registerType(std::function<void(T &t)> callback);
 
+    /**
+     * @brief Register a type and the associated callback, which receives a
+     * reference to the type directly within the buffer.
+     *
+     * The type is copied only if it is not suitably aligned within the
+     * buffer. Serialize with serializeAligned() to avoid the copy.
+     *
+     * \tparam T Type to be registered.
+     * \param callback Callback used when the given type is unserialized. The
+     * reference is valid only for the duration of the call.
+     */
+    template <typename T>
+    void registerTypeView(std::function<void(const T &t)> callback);
+
+    /**
+     * @brief Register a type and the associated callback, which receives all
+     * the objects of a batch serialized with serializeArray() at once.
+     *
+     * If the objects are not suitably aligned within the buffer, they are
+     * copied in chunks and the callback is called once per chunk. Objects
+     * serialized one at a time are passed with a count of one.
+     *
+     * \tparam T Type to be registered.
+     * \param callback Callback used when the given type is unserialized. The
+     * pointer is valid only for the duration of the call.
+     */
+    template <typename T>
+    void registerTypeArray(std::function<void(const T *t, int count)> callback);
+
+    /**
+     * @brief Register a converter from an old version of a registered type,
+     * so that objects serialized with the old layout are upgraded and passed
+     * to the callback of the type.
+     *
+     * The old version is recognized by its fingerprint, so it is enough to
+     * keep its definition under another name:
+     *
+     * \code
+     * struct FooV1 { int a; };   // Foo before field b was added
+     * tp.registerType<Foo>(callback);
+     * tp.registerUpgrade<Foo, FooV1>([](const FooV1& old, Foo& foo) {
+     *     foo.a = old.a;
+     *     foo.b = 0;
+     * });
+     * \endcode
+     *
+     * Only objects serialized with a fingerprint, such as with
+     * serializeWithFingerprint(), can be upgraded. Register the upgrades after
+     * the type, registering the type again removes them.
+     *
+     * \tparam T Registered type.
+     * \tparam Old Type with the layout of the old version of T.
+     * \param upgrade Function converting the old version to T.
+     * \return false if T is not registered.
+     */
+    template <typename T, typename Old>
+    bool registerUpgrade(std::function<void(const Old &old, T &t)> upgrade);
+
+    /**
+     * @brief Register a type that is not wanted, so that its objects are
+     * skipped without calling any callback.
+     *
+     * The objects of a type that is not registered can't be skipped, as
+     * their size is not known, and unserializeUnknown() returns
+     * TscppError::UnknownType. Those of a skipped type are stepped over, and
+     * their size is returned as if they had been unserialized.
+     *
+     * \tparam T Type to be skipped.
+     */
+    template <typename T>
+    void registerSkip()
+    {
+        types.insert(typeid(T).name()) =
+            DeserializerImpl(sizeof(T), fingerprint<T>(), nullptr);
+    }
+
+    /**
+     * @brief Register a type that is not wanted by its name and size, for
+     * example as found in a log index, when the type itself is not known.
+     *
+     * The fingerprint of the type is not known, so it is not checked.
+     *
+     * \param name Mangled type name.
+     * \param size Size of the type.
+     * \return false if size is not positive.
+     */
+    bool registerSkip(const std::string &name, int size)
+    {
+        if (size <= 0)
+            return false;
+        types.insert(name.c_str()) = DeserializerImpl(size, 0, nullptr);
+        return true;
+    }
+
+    /**
+     * @brief Set the layout of the fields of a registered type, used to swap
+     * its bytes when byte swapping is enabled.
+     *
+     * Set the layout after registering the type, registering the type again
+     * removes it.
+     *
+     * \code
+     * tp.registerType<Foo>(callback);
+     * tp.setLayout<Foo>({TSCPP_FIELD(Foo, a), TSCPP_FIELD(Foo, b)});
+     * \endcode
+     *
+     * \tparam T Registered type.
+     * \param layout Layout of the fields of T.
+     * \return false if T is not registered.
+     */
+    template <typename T>
+    bool setLayout(const FieldLayout &layout)
+    {
+        DeserializerImpl *d = registered(typeid(T).name());
+        if (d == nullptr)
+            return false;
+        d->layout = layout;
+        return true;
+    }
+
+    /**
+     * @brief Enable byte swapping, to unserialize buffers written on a
+     * machine with the opposite endianness.
+     *
+     * Objects are swapped in a copy, according to the layout of their type
+     * set with setLayout(), before calling the callback. Types without a
+     * layout are passed unchanged.
+     *
+     * \param enabled True to swap the bytes.
+     */
+    void setByteSwap(bool enabled) { byteSwap = enabled; }
+
     int unserializeUnknownImpl(const char *name, const void *buffer,
                                int bufSize) const;
 
+    /**
+     * @brief Unserialize the type with the given name, which has already been
+     * measured and hashed while parsing the header.
+     *
+     * \param name Mangled type name, not necessarily '\0' terminated.
+     * \param nameSize Length of the name.
+     * \param hash Hash of the name, as returned by hashTypeName().
+     * \param buffer Pointer to buffer where the serialized type data is.
+     * \param bufSize Buffer size.
+     * \param count Number of objects in a batch, or -1 for a single object.
+     * \param fingerprint Fingerprint found in the header, or 0 if absent.
+     * \return The size of the type data, or TscppError::UnknownType or
+     * TscppError::BufferTooSmall, or TscppError::WrongType if the fingerprint
+     * does not match the type nor any of its upgrades.
+     */
+    int unserializeUnknownImpl(const char *name, int nameSize, uint32_t hash,
+                               const void *buffer, int bufSize, int count = -1,
+                               uint32_t fingerprint = 0) const;
+
+    /**
+     * @brief Unserialize a delta encoded object of the type with the given
+     * name, rebuilding it from the previous one.
+     *
+     * \param ds Delta state of the serialization session.
+     * \param name Mangled type name, not necessarily '\0' terminated.
+     * \param nameSize Length of the name.
+     * \param hash Hash of the name, as returned by hashTypeName().
+     * \param buffer Pointer to buffer where the encoded object is.
+     * \param bufSize Buffer size.
+     * \param fingerprint Fingerprint found in the header, or 0 if absent.
+     * \return The size of the encoded object, or TscppError::UnknownType or
+     * TscppError::BufferTooSmall or TscppError::WrongType. The callback is not
+     * called if no keyframe of the type has been found yet.
+     */
+    int unserializeDeltaImpl(DeltaState &ds, const char *name, int nameSize,
+                             uint32_t hash, const void *buffer, int bufSize,
+                             uint32_t fingerprint = 0) const;
+
+    /**
+     * @brief Find the size of the data of the type with the given name,
+     * without unserializing it.
+     *
+     * \param name Mangled type name, not necessarily '\0' terminated.
+     * \param nameSize Length of the name.
+     * \param hash Hash of the name, as returned by hashTypeName().
+     * \param bufSize Size of the buffer after the header.
+     * \param count Number of objects in a batch, or -1 for a single object.
+     * \param type Set to the index of the type in the pool.
+     * \param fingerprint Fingerprint found in the header, or 0 if absent.
+     * \return The size of the type data, or TscppError::UnknownType or
+     * TscppError::BufferTooSmall, or TscppError::WrongType if the fingerprint
+     * does not match, as upgrades are not supported while scanning.
+     */
+    int scanUnknownImpl(const char *name, int nameSize, uint32_t hash,
+                        int bufSize, int count, int &type,
+                        uint32_t fingerprint = 0) const;
+
+    /**
+     * @brief Unserialize a type previously found by scanUnknown(), calling
+     * the registered callback. Can be called concurrently from many threads,
+     * provided the callbacks allow it.
+     *
+     * \param st Type found by scanUnknown().
+     * \param buffer The same buffer pointer passed to scanUnknown().
+     */
+    void unserializeScanned(const ScannedType &st, const void *buffer) const;
+
+    /**
+     * \return The number of registered types.
+     */
+    int registeredTypes() const { return types.size(); }
+
+    /**
+     * \param type Index of a type, from 0 to registeredTypes() - 1, such as
+     * ScannedType::type.
+     * \return The mangled name of the type.
+     */
+    const std::string &registeredName(int type) const
+    {
+        return types.name(type);
+    }
+
+    /**
+     * @brief Counters of the types unserialized by unserializeUnknown() and
+     * of its errors, compiled only with TSCPP_ENABLE_STATS, see Stats.
+     *
+     * They are updated through the const reference taken by
+     * unserializeUnknown(), so they are returned modifiable even from a const
+     * pool. scanUnknown() and unserializeScanned() are not counted, as they
+     * can be called from many threads at once.
+     */
+    Stats &stats() const { return statistics; }
+
 private:
+    class UpgradeImpl
+    {
+    public:
+        uint32_t fingerprint;  ///< Fingerprint of the old version
+        int size;              ///< Size of the old version
+        ///< Converts an old object and calls the usc of the type with it
+        std::function<void(const void *,
+                           const std::function<void(const void *)> &)>
+            convert;
+    };
+
     class DeserializerImpl
     {
     public:
-        DeserializerImpl() : size(0) {}
-        DeserializerImpl(int size, std::function<void(const void *)> usc)
-            : size(size), usc(usc)
+        DeserializerImpl() : size(0), fingerprint(0) {}
+        DeserializerImpl(int size, uint32_t fingerprint,
+                         std::function<void(const void *)> usc)
+            : size(size), fingerprint(fingerprint), usc(usc)
         {
         }
 
         int size;
+        uint32_t fingerprint;
         std::function<void(const void *)> usc;
+        ///< Optional, called for batches instead of calling usc for each
+        std::function<void(const void *, int)> uscArray;
+        std::vector<UpgradeImpl> upgrades;  ///< Old versions of the type
+        FieldLayout layout;  ///< Fields swapped when byteSwap is true
     };
 
-    std::map<std::string, DeserializerImpl> types;  ///< Registered types
+    DeserializerImpl *registered(const char *name);
+    void dispatch(const DeserializerImpl &d, const void *buffer,
+                  int count) const;
+    void swapAndDeliver(const DeserializerImpl &d, const void *buffer,
+                        int count) const;
+    void deliver(const DeserializerImpl &d, const void *buffer,
+                 int count) const;
+    int upgrade(const DeserializerImpl &d, uint32_t fingerprint,
+                const void *buffer, int bufSize, int count) const;
+
+    TypeRegistry<DeserializerImpl> types;  ///< Registered types
+    bool byteSwap = false;
+    mutable Stats statistics;
 };
 
 template <typename T>
@@ -105,8 +392,8 @@ void TypePoolBuffer::registerType(std::function<void(T &t)> callback)
     static_assert(std::is_trivially_copyable<T>::value,
                   "Type is not trivially copyable");
 #endif
-    types[typeid(T).name()] =
-        DeserializerImpl(sizeof(T),
+    types.insert(typeid(T).name()) =
+        DeserializerImpl(sizeof(T), fingerprint<T>(),
                          [=](const void *buffer)
                          {
                              // NOTE: We copy the buffer to respect
@@ -126,8 +413,99 @@ void TypePoolBuffer::registerType(std::function<void(T &t)> callback)
                          });
 }
 
-int serializeImpl(void *buffer, int bufSize, const char *name, const void *data,
-                  int size);
+template <typename T>
+void TypePoolBuffer::registerTypeView(std::function<void(const T &t)> callback)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    types.insert(typeid(T).name()) = DeserializerImpl(
+        sizeof(T), fingerprint<T>(),
+        [=](const void *buffer)
+        {
+            if (reinterpret_cast<uintptr_t>(buffer) % alignof(T) == 0)
+            {
+                callback(*reinterpret_cast<const T *>(buffer));
+            }
+            else
+            {
+                T t;
+                memcpy(&t, buffer, sizeof(T));
+                callback(t);
+            }
+        });
+}
+
+template <typename T>
+void TypePoolBuffer::registerTypeArray(
+    std::function<void(const T *t, int count)> callback)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    DeserializerImpl d(sizeof(T), fingerprint<T>(),
+                       [=](const void *buffer)
+                       {
+                           T t;
+                           memcpy(&t, buffer, sizeof(T));
+                           callback(&t, 1);
+                       });
+    d.uscArray = [=](const void *buffer, int count)
+    {
+        if (reinterpret_cast<uintptr_t>(buffer) % alignof(T) == 0)
+        {
+            callback(reinterpret_cast<const T *>(buffer), count);
+            return;
+        }
+
+        // Copy in chunks to use a bounded amount of stack
+        const int chunkSize = sizeof(T) < 256 ? 256 / sizeof(T) : 1;
+        T chunk[chunkSize];
+        const char *buf = reinterpret_cast<const char *>(buffer);
+        for (int i = 0; i < count; i += chunkSize)
+        {
+            int n = count - i < chunkSize ? count - i : chunkSize;
+            memcpy(chunk, buf + i * sizeof(T), n * sizeof(T));
+            callback(chunk, n);
+        }
+    };
+    types.insert(typeid(T).name()) = d;
+}
+
+template <typename T, typename Old>
+bool TypePoolBuffer::registerUpgrade(
+    std::function<void(const Old &old, T &t)> upgrade)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+    static_assert(std::is_trivially_copyable<Old>::value,
+                  "Type is not trivially copyable");
+#endif
+    DeserializerImpl *d = registered(typeid(T).name());
+    if (d == nullptr)
+        return false;
+    UpgradeImpl u;
+    u.fingerprint = fingerprint<Old>();
+    u.size        = sizeof(Old);
+
+    u.convert = [=](const void *buffer,
+                    const std::function<void(const void *)> &usc)
+    {
+        Old old;
+        memcpy(&old, buffer, sizeof(Old));
+        T t;
+        upgrade(old, t);
+        usc(&t);
+    };
+    d->upgrades.push_back(u);
+    return true;
+}
+
+int serializeImpl(void *buffer, int bufSize, const TypeName &name,
+                  const void *data, int size);
 
 /**
  * @brief Serialize a type to a memory buffer.
@@ -146,11 +524,303 @@ int serialize(void *buffer, int bufSize, const T &t)
     static_assert(std::is_trivially_copyable<T>::value,
                   "Type is not trivially copyable");
 #endif
-    return serializeImpl(buffer, bufSize, typeid(t).name(), &t, sizeof(t));
+    // The header is just the name, so the common case is two fixed size
+    // copies that can be inlined
+    const TypeName &name = typeName<T>();
+    int serializedSize   = name.size + 1 + sizeof(T);
+    if (serializedSize > bufSize)
+        return BufferTooSmall;
+    char *buf = reinterpret_cast<char *>(buffer);
+    memcpy(buf, name.str, name.size + 1);  // Copy also the \0
+    memcpy(buf + name.size + 1, &t, sizeof(T));
+    return serializedSize;
+}
+
+int serializeImpl(TypeDictionary &td, void *buffer, int bufSize,
+                  const TypeName &name, const void *data, int size);
+
+/**
+ * @brief Serialize a type to a memory buffer using the compact header format.
+ *
+ * The first time a type is serialized in a session its name is written
+ * together with a type id, afterwards only the one byte id is written. The
+ * buffers have to be unserialized in the same order they were serialized,
+ * sharing the same TypeDictionary. If more than TypeDictionary::maxTypes types
+ * are serialized, the exceeding ones are serialized with their full name.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param buffer Pointer to the memory buffer where to serialize the type.
+ * \param bufSize Buffer size.
+ * \param t Type to serialize.
+ * \return The size of the serialized type (which is larger than sizeof(T) due
+ * to serialization overhead), or TscppError::BufferTooSmall if the given
+ * buffer is too small
+ */
+template <typename T>
+int serialize(TypeDictionary &td, void *buffer, int bufSize, const T &t)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return serializeImpl(td, buffer, bufSize, typeName<T>(), &t, sizeof(t));
+}
+
+int serializeImpl(DeltaState &ds, void *buffer, int bufSize,
+                  const TypeName &name, const void *data, int size);
+
+/**
+ * @brief Serialize a type to a memory buffer, delta encoded against the
+ * previous object of the same type if the type is enabled in the state.
+ *
+ * Types not enabled in the state are serialized as with serialize(). The
+ * buffers have to be unserialized in the same order they were serialized,
+ * with unserializeUnknown() and a DeltaState of their own.
+ *
+ * \param ds Delta state of the serialization session.
+ * \param buffer Pointer to the memory buffer where to serialize the type.
+ * \param bufSize Buffer size.
+ * \param t Type to serialize.
+ * \return The size of the serialized type, or TscppError::BufferTooSmall if
+ * the given buffer is too small
+ */
+template <typename T>
+int serialize(DeltaState &ds, void *buffer, int bufSize, const T &t)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return serializeImpl(ds, buffer, bufSize, typeName<T>(), &t, sizeof(t));
+}
+
+int serializeImpl(TypeDictionary &td, DeltaState &ds, void *buffer,
+                  int bufSize, const TypeName &name, const void *data,
+                  int size);
+
+/**
+ * @brief Serialize a type to a memory buffer using the compact header format,
+ * delta encoded if the type is enabled in the state.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param ds Delta state of the serialization session.
+ * \param buffer Pointer to the memory buffer where to serialize the type.
+ * \param bufSize Buffer size.
+ * \param t Type to serialize.
+ * \return The size of the serialized type, or TscppError::BufferTooSmall if
+ * the given buffer is too small
+ */
+template <typename T>
+int serialize(TypeDictionary &td, DeltaState &ds, void *buffer, int bufSize,
+              const T &t)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return serializeImpl(td, ds, buffer, bufSize, typeName<T>(), &t,
+                         sizeof(t));
+}
+
+int serializeWithFingerprintImpl(void *buffer, int bufSize,
+                                 const TypeName &name, const void *data,
+                                 int size);
+
+/**
+ * @brief Serialize a type to a memory buffer, prefixed by its fingerprint.
+ *
+ * Readers compare the fingerprint with the one of the type they have, so that
+ * a type whose layout changed is reported as TscppError::WrongType instead of
+ * being unserialized as garbage, or is converted by an upgrade registered
+ * with TypePoolBuffer::registerUpgrade().
+ *
+ * \param buffer Pointer to the memory buffer where to serialize the type.
+ * \param bufSize Buffer size.
+ * \param t Type to serialize.
+ * \return The size of the serialized type, or TscppError::BufferTooSmall if
+ * the given buffer is too small
+ */
+template <typename T>
+int serializeWithFingerprint(void *buffer, int bufSize, const T &t)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return serializeWithFingerprintImpl(buffer, bufSize, typeName<T>(), &t,
+                                        sizeof(t));
+}
+
+int serializeWithFingerprintImpl(TypeDictionary &td, void *buffer,
+                                 int bufSize, const TypeName &name,
+                                 const void *data, int size);
+
+/**
+ * @brief Serialize a type to a memory buffer using the compact header format,
+ * prefixed by its fingerprint.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param buffer Pointer to the memory buffer where to serialize the type.
+ * \param bufSize Buffer size.
+ * \param t Type to serialize.
+ * \return The size of the serialized type, or TscppError::BufferTooSmall if
+ * the given buffer is too small
+ */
+template <typename T>
+int serializeWithFingerprint(TypeDictionary &td, void *buffer, int bufSize,
+                             const T &t)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return serializeWithFingerprintImpl(td, buffer, bufSize, typeName<T>(), &t,
+                                        sizeof(t));
+}
+
+int serializeImpl(void *buffer, int bufSize, const TypeName &name,
+                  const void *data, int size, int alignment);
+
+/**
+ * @brief Serialize a type to a memory buffer, so that the type is suitably
+ * aligned within the buffer.
+ *
+ * Padding is added before the type name as needed, so that the serialized
+ * type can then be accessed in place with unserializeView() or a type pool
+ * callback registered with registerTypeView().
+ *
+ * \param buffer Pointer to the memory buffer where to serialize the type.
+ * \param bufSize Buffer size.
+ * \param t Type to serialize.
+ * \return The size of the serialized type, including the padding, or
+ * TscppError::BufferTooSmall if the given buffer is too small
+ */
+template <typename T>
+int serializeAligned(void *buffer, int bufSize, const T &t)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return serializeImpl(buffer, bufSize, typeName<T>(), &t, sizeof(t),
+                         alignof(T));
+}
+
+int serializeImpl(TypeDictionary &td, void *buffer, int bufSize,
+                  const TypeName &name, const void *data, int size,
+                  int alignment);
+
+/**
+ * @brief Serialize a type to a memory buffer using the compact header format,
+ * so that the type is suitably aligned within the buffer.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param buffer Pointer to the memory buffer where to serialize the type.
+ * \param bufSize Buffer size.
+ * \param t Type to serialize.
+ * \return The size of the serialized type, including the padding, or
+ * TscppError::BufferTooSmall if the given buffer is too small
+ */
+template <typename T>
+int serializeAligned(TypeDictionary &td, void *buffer, int bufSize, const T &t)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return serializeImpl(td, buffer, bufSize, typeName<T>(), &t, sizeof(t),
+                         alignof(T));
 }
 
-int unserializeImpl(const char *name, void *data, int size, const void *buffer,
-                    int bufSize);
+int serializeArrayImpl(void *buffer, int bufSize, const TypeName &name,
+                       const void *data, int size, int count, int alignment);
+
+/**
+ * @brief Serialize an array of objects of the same type to a memory buffer.
+ *
+ * The type name is written only once, followed by the number of objects and
+ * the objects themselves, which are aligned within the buffer.
+ *
+ * \param buffer Pointer to the memory buffer where to serialize the type.
+ * \param bufSize Buffer size.
+ * \param t Pointer to the first object to serialize.
+ * \param count Number of objects to serialize.
+ * \return The size of the serialized array, or TscppError::BufferTooSmall if
+ * the given buffer is too small
+ */
+template <typename T>
+int serializeArray(void *buffer, int bufSize, const T *t, int count)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return serializeArrayImpl(buffer, bufSize, typeName<T>(), t, sizeof(T),
+                              count, alignof(T));
+}
+
+int serializeArrayImpl(TypeDictionary &td, void *buffer, int bufSize,
+                       const TypeName &name, const void *data, int size,
+                       int count, int alignment);
+
+/**
+ * @brief Serialize an array of objects of the same type to a memory buffer
+ * using the compact header format.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param buffer Pointer to the memory buffer where to serialize the type.
+ * \param bufSize Buffer size.
+ * \param t Pointer to the first object to serialize.
+ * \param count Number of objects to serialize.
+ * \return The size of the serialized array, or TscppError::BufferTooSmall if
+ * the given buffer is too small
+ */
+template <typename T>
+int serializeArray(TypeDictionary &td, void *buffer, int bufSize, const T *t,
+                   int count)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return serializeArrayImpl(td, buffer, bufSize, typeName<T>(), t,
+                              sizeof(T), count, alignof(T));
+}
+
+/**
+ * @brief Serialize only the header of a type, for writers that gather the
+ * header and the objects from separate memory, such as GatherSink.
+ *
+ * The header followed by sizeof(T) bytes of the object, or count objects
+ * if count is not -1, is the same as what serialize() or serializeArray()
+ * write, except that arrays are not aligned.
+ *
+ * \param buffer Pointer to the memory buffer where to serialize the header.
+ * \param bufSize Buffer size.
+ * \param name Type name.
+ * \param count Number of objects of an array, or -1 for a single object.
+ * \return The size of the header, or TscppError::BufferTooSmall if the given
+ * buffer is too small
+ */
+int serializeHeader(void *buffer, int bufSize, const TypeName &name,
+                    int count = -1);
+
+/**
+ * @brief Serialize only the header of a type using the compact header format.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param buffer Pointer to the memory buffer where to serialize the header.
+ * \param bufSize Buffer size.
+ * \param name Type name.
+ * \param count Number of objects of an array, or -1 for a single object.
+ * \return The size of the header, or TscppError::BufferTooSmall if the given
+ * buffer is too small
+ */
+int serializeHeader(TypeDictionary &td, void *buffer, int bufSize,
+                    const TypeName &name, int count = -1);
+
+int unserializeImpl(const TypeName &name, void *data, int size,
+                    const void *buffer, int bufSize);
 
 /**
  * @brief Unserialize a known type from a memory buffer.
@@ -170,7 +840,188 @@ int unserialize(T &t, const void *buffer, int bufSize)
     static_assert(std::is_trivially_copyable<T>::value,
                   "Type is not trivially copyable");
 #endif
-    return unserializeImpl(typeid(t).name(), &t, sizeof(t), buffer, bufSize);
+    // Leading padding and fingerprints are handled by unserializeImpl, the
+    // common case of a name at the start of the buffer is handled inline
+    const TypeName &name = typeName<T>();
+    const char *buf      = reinterpret_cast<const char *>(buffer);
+    int serializedSize   = name.size + 1 + sizeof(T);
+    if (bufSize <= 0 || buf[0] == '\0' || buf[0] == FingerprintPrefix)
+        return unserializeImpl(name, &t, sizeof(t), buffer, bufSize);
+    if (serializedSize > bufSize)
+        return BufferTooSmall;
+    if (memcmp(buf, name.str, name.size + 1))
+        return WrongType;
+    memcpy(&t, buf + name.size + 1, sizeof(T));
+    return serializedSize;
+}
+
+int unserializeImpl(TypeDictionary &td, const TypeName &name, void *data,
+                    int size, const void *buffer, int bufSize);
+
+/**
+ * @brief Unserialize a known type from a memory buffer, accepting both the
+ * full name and the compact header format.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param t Type to unserialize.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \return The size of the unserialized type (which is larger than sizeof(T) due
+ * to serialization overhead), or TscppError::WrongType if the buffer does
+ * not contain the given type or TscppError::BufferTooSmall if the type is
+ * truncated, i.e the buffer is smaller tah the serialized type size.
+ */
+template <typename T>
+int unserialize(TypeDictionary &td, T &t, const void *buffer, int bufSize)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return unserializeImpl(td, typeName<T>(), &t, sizeof(t), buffer,
+                           bufSize);
+}
+
+int unserializeArrayImpl(const TypeName &name, void *data, int size, int &count,
+                         const void *buffer, int bufSize);
+
+/**
+ * @brief Unserialize an array of objects of a known type from a memory
+ * buffer.
+ *
+ * Both arrays serialized with serializeArray() and single objects are
+ * accepted.
+ *
+ * \param t Pointer to the first object where to unserialize the array.
+ * \param count Number of objects that fit in t. Set to the number of objects
+ * unserialized.
+ * \param buffer Pointer to buffer where the serialized array is.
+ * \param bufSize Buffer size.
+ * \return The size of the unserialized array, or TscppError::WrongType if the
+ * buffer does not contain the given type or TscppError::BufferTooSmall if the
+ * array is truncated or has more than count objects.
+ */
+template <typename T>
+int unserializeArray(T *t, int &count, const void *buffer, int bufSize)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return unserializeArrayImpl(typeName<T>(), t, sizeof(T), count, buffer,
+                                bufSize);
+}
+
+int unserializeArrayImpl(TypeDictionary &td, const TypeName &name, void *data,
+                         int size, int &count, const void *buffer, int bufSize);
+
+/**
+ * @brief Unserialize an array of objects of a known type from a memory
+ * buffer, accepting both the full name and the compact header format.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param t Pointer to the first object where to unserialize the array.
+ * \param count Number of objects that fit in t. Set to the number of objects
+ * unserialized.
+ * \param buffer Pointer to buffer where the serialized array is.
+ * \param bufSize Buffer size.
+ * \return The size of the unserialized array, or TscppError::WrongType or
+ * TscppError::BufferTooSmall.
+ */
+template <typename T>
+int unserializeArray(TypeDictionary &td, T *t, int &count, const void *buffer,
+                     int bufSize)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return unserializeArrayImpl(td, typeName<T>(), t, sizeof(T), count,
+                                buffer, bufSize);
+}
+
+int unserializeViewImpl(const TypeName &name, int size, const void *buffer,
+                        int bufSize, const void *&data);
+
+int unserializeViewImpl(TypeDictionary &td, const TypeName &name, int size,
+                        const void *buffer, int bufSize, const void *&data);
+
+/**
+ * \return data if it is suitably aligned for T, or copy after copying data
+ * into it.
+ */
+template <typename T>
+const T *viewOrCopy(const void *data, T &copy)
+{
+    if (reinterpret_cast<uintptr_t>(data) % alignof(T) == 0)
+        return reinterpret_cast<const T *>(data);
+    memcpy(&copy, data, sizeof(T));
+    return &copy;
+}
+
+/**
+ * @brief Unserialize a known type from a memory buffer without copying it,
+ * if possible.
+ *
+ * \code
+ * const Foo *f;
+ * Foo copy;
+ * auto result=unserializeView(f,copy,buffer,size);
+ * if(result>0) cout<<f->x<<endl;
+ * \endcode
+ *
+ * \param t Set to point to the type within the buffer if it is suitably
+ * aligned, or to copy otherwise.
+ * \param copy Storage where the type is copied if it is not aligned.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \return The size of the unserialized type (which is larger than sizeof(T) due
+ * to serialization overhead), or TscppError::WrongType if the buffer does
+ * not contain the given type or TscppError::BufferTooSmall if the type is
+ * truncated, i.e the buffer is smaller tah the serialized type size.
+ */
+template <typename T>
+int unserializeView(const T *&t, T &copy, const void *buffer, int bufSize)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    const void *data;
+    int result =
+        unserializeViewImpl(typeName<T>(), sizeof(T), buffer, bufSize, data);
+    if (result >= 0)
+        t = viewOrCopy(data, copy);
+    return result;
+}
+
+/**
+ * @brief Unserialize a known type from a memory buffer without copying it,
+ * if possible, accepting both the full name and the compact header format.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param t Set to point to the type within the buffer if it is suitably
+ * aligned, or to copy otherwise.
+ * \param copy Storage where the type is copied if it is not aligned.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \return The size of the unserialized type, or TscppError::WrongType or
+ * TscppError::BufferTooSmall.
+ */
+template <typename T>
+int unserializeView(TypeDictionary &td, const T *&t, T &copy,
+                    const void *buffer, int bufSize)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    const void *data;
+    int result = unserializeViewImpl(td, typeName<T>(), sizeof(T), buffer,
+                                     bufSize, data);
+    if (result >= 0)
+        t = viewOrCopy(data, copy);
+    return result;
 }
 
 /**
@@ -187,6 +1038,96 @@ int unserialize(T &t, const void *buffer, int bufSize)
 int unserializeUnknown(const TypePoolBuffer &tp, const void *buffer,
                        int bufSize);
 
+/**
+ * @brief Unserialize an unknown type from a memory buffer, accepting both the
+ * full name and the compact header format.
+ *
+ * \param tp Type pool where possible serialized types are registered.
+ * \param td Type dictionary of the serialization session.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \return The size of the unserialized type (which is larger than sizeof(T) due
+ * to serialization overhead), or TscppError::UnknownType if the pool does
+ * not contain the type found in the buffer or the type id has not been defined
+ * or TscppError::BufferTooSmall if the type is truncated, i.e the buffer is
+ * smaller tah the serialized type size.
+ */
+int unserializeUnknown(const TypePoolBuffer &tp, TypeDictionary &td,
+                       const void *buffer, int bufSize);
+
+/**
+ * @brief Unserialize an unknown type from a memory buffer, rebuilding delta
+ * encoded objects.
+ *
+ * Delta encoded objects found before the first keyframe of their type are
+ * skipped without calling the callback, and counted by DeltaState::missing().
+ *
+ * \param tp Type pool where possible serialized types are registered.
+ * \param ds Delta state of the serialization session.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \return The size of the unserialized type, or TscppError::UnknownType or
+ * TscppError::BufferTooSmall.
+ */
+int unserializeUnknown(const TypePoolBuffer &tp, DeltaState &ds,
+                       const void *buffer, int bufSize);
+
+/**
+ * @brief Unserialize an unknown type from a memory buffer, accepting both the
+ * full name and the compact header format and rebuilding delta encoded
+ * objects.
+ *
+ * \param tp Type pool where possible serialized types are registered.
+ * \param td Type dictionary of the serialization session.
+ * \param ds Delta state of the serialization session.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \return The size of the unserialized type, or TscppError::UnknownType or
+ * TscppError::BufferTooSmall.
+ */
+int unserializeUnknown(const TypePoolBuffer &tp, TypeDictionary &td,
+                       DeltaState &ds, const void *buffer, int bufSize);
+
+/**
+ * @brief Find the type at the start of a memory buffer and its size, without
+ * unserializing it.
+ *
+ * This allows to quickly build an index of the types in a buffer, and to
+ * unserialize them later, possibly in parallel.
+ *
+ * \param tp Type pool where possible serialized types are registered.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \param st Set to the type found, to be passed to
+ * TypePoolBuffer::unserializeScanned().
+ * \return The size of the serialized type, or TscppError::UnknownType if the
+ * pool does not contain the type found in the buffer or the type is delta
+ * encoded, or TscppError::BufferTooSmall if the type is truncated.
+ */
+int scanUnknown(const TypePoolBuffer &tp, const void *buffer, int bufSize,
+                ScannedType &st);
+
+/**
+ * @brief Find the type at the start of a memory buffer and its size, without
+ * unserializing it, accepting both the full name and the compact header
+ * format.
+ *
+ * Type ids are resolved while scanning, so the types found can be
+ * unserialized in any order.
+ *
+ * \param tp Type pool where possible serialized types are registered.
+ * \param td Type dictionary of the serialization session.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \param st Set to the type found, to be passed to
+ * TypePoolBuffer::unserializeScanned().
+ * \return The size of the serialized type, or TscppError::UnknownType if the
+ * pool does not contain the type found in the buffer or the type id has not
+ * been defined or TscppError::BufferTooSmall if the type is truncated.
+ */
+int scanUnknown(const TypePoolBuffer &tp, TypeDictionary &td,
+                const void *buffer, int bufSize, ScannedType &st);
+
 /**
  * @brief Given a buffer where a type has been serialized, return the C++
  * mangled name of the serialized type.
@@ -210,4 +1151,43 @@ int unserializeUnknown(const TypePoolBuffer &tp, const void *buffer,
  */
 std::string peekTypeName(const void *buffer, int bufSize);
 
+/**
+ * @brief Given a buffer where a type has been serialized, possibly with the
+ * compact header format, return the C++ mangled name of the serialized type.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \return The serialized type name, or "" if the buffer doesn't contain a name
+ * or the type id has not been defined.
+ */
+std::string peekTypeName(const TypeDictionary &td, const void *buffer,
+                         int bufSize);
+
+/**
+ * @brief Parse the header of a serialized type, for type pools other than
+ * TypePoolBuffer such as StaticTypePoolBuffer.
+ *
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \param h Set to the parsed header.
+ * \return The header size, or TscppError::BufferTooSmall if the header is
+ * truncated.
+ */
+int parseRecordHeader(const void *buffer, int bufSize, RecordHeader &h);
+
+/**
+ * @brief Parse the header of a serialized type, possibly with the compact
+ * header format. A type id defined by the header is added to td.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \param h Set to the parsed header.
+ * \return The header size, or TscppError::BufferTooSmall if the header is
+ * truncated or TscppError::UnknownType if the type id has not been defined.
+ */
+int parseRecordHeader(TypeDictionary &td, const void *buffer, int bufSize,
+                      RecordHeader &h);
+
 }  // namespace tscpp
@@ -0,0 +1,304 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+#include "columns.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if !defined(TSCPP_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define TSCPP_COLUMNS_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace tscpp
+{
+
+/**
+ * Copy count scalars of the given size, found every stride bytes, to a
+ * contiguous array. The size is a constant in each loop, so that the copies
+ * compile to a single load and store.
+ */
+static void gather(char *dst, const char *src, int stride, int size,
+                   size_t count)
+{
+    switch (size)
+    {
+        case 1:
+            for (size_t i = 0; i < count; i++)
+                dst[i] = src[i * stride];
+            break;
+        case 2:
+            for (size_t i = 0; i < count; i++)
+                memcpy(dst + 2 * i, src + i * stride, 2);
+            break;
+        case 4:
+            for (size_t i = 0; i < count; i++)
+                memcpy(dst + 4 * i, src + i * stride, 4);
+            break;
+        default:
+            for (size_t i = 0; i < count; i++)
+                memcpy(dst + 8 * i, src + i * stride, 8);
+            break;
+    }
+}
+
+#ifdef TSCPP_COLUMNS_SSE2
+
+/**
+ * Transpose four contiguous columns of four byte scalars, four rows at a
+ * time: the 16 bytes of each row are the rows of a 4x4 matrix, whose columns
+ * are stored to the four arrays.
+ *
+ * \return The number of rows transposed, the rest is left to the caller.
+ */
+static size_t transpose4(char *const *dst, const char *src, int stride,
+                         size_t count)
+{
+    size_t n = count / 4 * 4;
+    for (size_t i = 0; i < n; i += 4)
+    {
+        const char *row = src + i * stride;
+        __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row));
+        __m128i r1 =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + stride));
+        __m128i r2 = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(row + 2 * stride));
+        __m128i r3 = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(row + 3 * stride));
+        __m128i t0 = _mm_unpacklo_epi32(r0, r1);  // a0 a1 b0 b1
+        __m128i t1 = _mm_unpacklo_epi32(r2, r3);  // a2 a3 b2 b3
+        __m128i t2 = _mm_unpackhi_epi32(r0, r1);  // c0 c1 d0 d1
+        __m128i t3 = _mm_unpackhi_epi32(r2, r3);  // c2 c3 d2 d3
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst[0] + 4 * i),
+                         _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst[1] + 4 * i),
+                         _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst[2] + 4 * i),
+                         _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst[3] + 4 * i),
+                         _mm_unpackhi_epi64(t2, t3));
+    }
+    return n;
+}
+
+#endif  // TSCPP_COLUMNS_SSE2
+
+const char *arrowFormat(ColumnType type)
+{
+    switch (type)
+    {
+        case Int8Column:
+            return "c";
+        case UInt8Column:
+            return "C";
+        case Int16Column:
+            return "s";
+        case UInt16Column:
+            return "S";
+        case Int32Column:
+            return "i";
+        case UInt32Column:
+            return "I";
+        case Int64Column:
+            return "l";
+        case UInt64Column:
+            return "L";
+        case Float32Column:
+            return "f";
+        default:
+            return "g";
+    }
+}
+
+//
+// class ColumnLayout
+//
+
+void ColumnLayout::add(const Field &f)
+{
+    for (int i = 0; i < f.count; i++)
+    {
+        Column c;
+        c.name = f.name;
+        if (f.count > 1)
+            c.name += "[" + to_string(i) + "]";
+        c.offset = f.offset + i * f.size;
+        c.size   = f.size;
+        c.type   = f.type;
+        cols.push_back(c);
+    }
+}
+
+//
+// class ColumnTable
+//
+
+/// Alignment of the arrays, as recommended for Arrow buffers
+static const int columnAlignment = 64;
+
+ColumnTable::ColumnTable(const string &name, const ColumnLayout &layout,
+                         int size)
+    : name(name), layout(layout), size(size)
+{
+    auto &cols = layout.columns();
+    for (auto &c : cols)
+        if (c.offset < 0 || c.offset + c.size > size)
+            throw invalid_argument("column outside of the type");
+
+    // Runs of four contiguous columns of four bytes, found greedily
+    int n = cols.size();
+    for (int i = 0; i + 3 < n;)
+    {
+        bool run = true;
+        for (int j = 0; j < 4 && run; j++)
+            run = cols[i + j].size == 4 &&
+                  cols[i + j].offset == cols[i].offset + 4 * j;
+        if (run)
+        {
+            groups.push_back(i);
+            i += 4;
+        }
+        else
+        {
+            i++;
+        }
+    }
+    storage.resize(n);
+    arrays.resize(n, nullptr);
+}
+
+int ColumnTable::find(const string &name) const
+{
+    auto &cols = layout.columns();
+    for (int i = 0; i < static_cast<int>(cols.size()); i++)
+        if (cols[i].name == name)
+            return i;
+    return -1;
+}
+
+void ColumnTable::append(const void *objects, int count)
+{
+    if (count <= 0)
+        return;
+    reserve(rowCount + count);
+    const char *src = reinterpret_cast<const char *>(objects);
+    auto &cols      = layout.columns();
+    size_t g        = 0;
+    for (int i = 0; i < static_cast<int>(cols.size());)
+    {
+        size_t done = 0;
+        int width   = 1;
+        if (g < groups.size() && groups[g] == i)
+        {
+            width = 4;
+            g++;
+#ifdef TSCPP_COLUMNS_SSE2
+            char *dst[4];
+            for (int j = 0; j < 4; j++)
+                dst[j] = arrays[i + j] + rowCount * 4;
+            done = transpose4(dst, src + cols[i].offset, size, count);
+#endif
+        }
+        for (int j = i; j < i + width; j++)
+        {
+            const ColumnLayout::Column &c = cols[j];
+            gather(arrays[j] + (rowCount + done) * c.size,
+                   src + done * size + c.offset, size, c.size, count - done);
+        }
+        i += width;
+    }
+    rowCount += count;
+}
+
+void ColumnTable::reserve(size_t rows)
+{
+    if (rows <= capacity)
+        return;
+    size_t newCapacity = max<size_t>(max<size_t>(rows, 2 * capacity), 64);
+    auto &cols         = layout.columns();
+    for (int i = 0; i < static_cast<int>(cols.size()); i++)
+    {
+        unique_ptr<char[]> s(
+            new char[newCapacity * cols[i].size + columnAlignment - 1]);
+        uintptr_t p = reinterpret_cast<uintptr_t>(s.get());
+        char *a = s.get() + (columnAlignment - p % columnAlignment) %
+                                columnAlignment;
+        if (rowCount > 0)
+            memcpy(a, arrays[i], rowCount * cols[i].size);
+        storage[i] = move(s);
+        arrays[i]  = a;
+    }
+    capacity = newCapacity;
+}
+
+//
+// class ColumnarDecoder
+//
+
+const ColumnTable *ColumnarDecoder::table(const string &name) const
+{
+    for (auto &t : tableList)
+        if (t->typeName() == name)
+            return t.get();
+    return nullptr;
+}
+
+vector<const ColumnTable *> ColumnarDecoder::tables() const
+{
+    vector<const ColumnTable *> result;
+    for (auto &t : tableList)
+        result.push_back(t.get());
+    return result;
+}
+
+void ColumnarDecoder::clear()
+{
+    for (auto &t : tableList)
+        t->clear();
+}
+
+ColumnTable *ColumnarDecoder::add(const char *name, const ColumnLayout &layout,
+                                  int size)
+{
+    unique_ptr<ColumnTable> t(new ColumnTable(name, layout, size));
+    for (auto &old : tableList)
+    {
+        if (old->typeName() == name)
+        {
+            old = move(t);
+            return old.get();
+        }
+    }
+    tableList.push_back(move(t));
+    return tableList.back().get();
+}
+
+}  // namespace tscpp
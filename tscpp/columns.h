@@ -0,0 +1,408 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file columns.h
+ *
+ * @brief Decoding of serialized types into one contiguous array per field,
+ * as wanted by analysis tools, instead of one object at a time.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "buffer.h"
+
+/**
+ * @brief Describe a field of a type for a ColumnLayout, the column takes the
+ * name of the field.
+ *
+ * The field must be a scalar or an array of scalars, an array has a column
+ * per element named as in "accel[0]". Fields of nested types are listed one
+ * by one, as in TSCPP_COLUMN(Foo, bar.x).
+ *
+ * \param type Type containing the field.
+ * \param member Name of the field.
+ */
+#define TSCPP_COLUMN(type, member)                                  \
+    ::tscpp::ColumnLayout::Field::of<decltype(                      \
+        std::declval<type &>().member)>(#member, offsetof(type, member))
+
+namespace tscpp
+{
+
+/**
+ * @brief Type of the values of a column.
+ */
+enum ColumnType
+{
+    Int8Column,
+    UInt8Column,  ///< Also used for bool
+    Int16Column,
+    UInt16Column,
+    Int32Column,
+    UInt32Column,
+    Int64Column,
+    UInt64Column,
+    Float32Column,
+    Float64Column
+};
+
+/**
+ * \param type Type of a column.
+ * \return The format string of the type in the Arrow C data interface, such
+ * as "f" for Float32Column, to export the columns to Arrow.
+ */
+const char *arrowFormat(ColumnType type);
+
+/**
+ * Scalar type stored in the column of a field, the underlying type for enums.
+ */
+template <typename T, bool = std::is_enum<T>::value>
+struct ColumnScalar
+{
+    typedef T type;
+};
+
+template <typename T>
+struct ColumnScalar<T, true>
+{
+    typedef typename std::underlying_type<T>::type type;
+};
+
+/**
+ * \tparam T Scalar type.
+ * \return The ColumnType of T.
+ */
+template <typename T>
+ColumnType columnType()
+{
+    typedef typename ColumnScalar<T>::type Scalar;
+    static_assert(std::is_arithmetic<Scalar>::value,
+                  "Columns must be scalars or arrays of scalars");
+    static_assert(sizeof(Scalar) == 1 || sizeof(Scalar) == 2 ||
+                      sizeof(Scalar) == 4 || sizeof(Scalar) == 8,
+                  "Unsupported scalar size");
+    if (std::is_floating_point<Scalar>::value)
+        return sizeof(Scalar) == 4 ? Float32Column : Float64Column;
+    bool isSigned = std::is_signed<Scalar>::value;
+    switch (sizeof(Scalar))
+    {
+        case 1:
+            return isSigned ? Int8Column : UInt8Column;
+        case 2:
+            return isSigned ? Int16Column : UInt16Column;
+        case 4:
+            return isSigned ? Int32Column : UInt32Column;
+        default:
+            return isSigned ? Int64Column : UInt64Column;
+    }
+}
+
+/**
+ * @brief Columns of a type, usually built with the TSCPP_COLUMN macro.
+ *
+ * \code
+ * ColumnLayout layout{TSCPP_COLUMN(Imu, timestamp), TSCPP_COLUMN(Imu, accel)};
+ * \endcode
+ *
+ * Fields not listed are not decoded.
+ */
+class ColumnLayout
+{
+public:
+    /**
+     * @brief A column, or an array field expanded to one column per element.
+     */
+    class Field
+    {
+    public:
+        Field(const char *name, int offset, int size, int count,
+              ColumnType type)
+            : name(name), offset(offset), size(size), count(count), type(type)
+        {
+        }
+
+        /**
+         * \tparam M Type of a field, a scalar or an array of scalars.
+         * \param name Name of the field.
+         * \param offset Offset of the field within its type.
+         * \return The description of the field.
+         */
+        template <typename M>
+        static Field of(const char *name, size_t offset)
+        {
+            typedef typename std::remove_reference<M>::type Member;
+            typedef typename std::remove_all_extents<Member>::type Element;
+            return Field(name, offset, sizeof(Element),
+                         sizeof(Member) / sizeof(Element),
+                         columnType<Element>());
+        }
+
+        const char *name;
+        int offset;  ///< Offset of the first scalar
+        int size;    ///< Size of each scalar
+        int count;   ///< Number of scalars, more than one for arrays
+        ColumnType type;
+    };
+
+    /**
+     * @brief A single column.
+     */
+    class Column
+    {
+    public:
+        std::string name;
+        int offset;  ///< Offset of the scalar within its type
+        int size;    ///< Size of the scalar
+        ColumnType type;
+    };
+
+    ColumnLayout() {}
+
+    /**
+     * \param fields Fields of the type, usually built with TSCPP_COLUMN.
+     */
+    ColumnLayout(std::initializer_list<Field> fields)
+    {
+        for (auto &f : fields)
+            add(f);
+    }
+
+    /**
+     * @brief Add a field, with one column per element if it is an array.
+     *
+     * \param f Field to add.
+     */
+    void add(const Field &f);
+
+    /**
+     * \return The columns, in the order they were added.
+     */
+    const std::vector<Column> &columns() const { return cols; }
+
+private:
+    std::vector<Column> cols;
+};
+
+/**
+ * @brief The decoded objects of a type, one contiguous array per column.
+ *
+ * Each array starts at a multiple of 64 bytes and holds the values with the
+ * endianness of the machine and no validity bitmap, which is also the layout
+ * of the buffers of an Arrow primitive array without nulls.
+ */
+class ColumnTable
+{
+public:
+    /**
+     * \param name Mangled name of the type.
+     * \param layout Columns of the type.
+     * \param size Size of the type.
+     */
+    ColumnTable(const std::string &name, const ColumnLayout &layout,
+                int size);
+
+    /**
+     * \return The mangled name of the type.
+     */
+    const std::string &typeName() const { return name; }
+
+    /**
+     * \return The number of rows, the objects decoded.
+     */
+    size_t rows() const { return rowCount; }
+
+    /**
+     * \return The number of columns.
+     */
+    int columns() const { return layout.columns().size(); }
+
+    /**
+     * \param i Index of a column, from 0 to columns() - 1.
+     * \return The name, type and size of the column.
+     */
+    const ColumnLayout::Column &column(int i) const
+    {
+        return layout.columns()[i];
+    }
+
+    /**
+     * \param name Name of a column.
+     * \return The index of the column, or -1 if not found.
+     */
+    int find(const std::string &name) const;
+
+    /**
+     * \param i Index of a column, from 0 to columns() - 1.
+     * \return The rows() values of the column.
+     */
+    const void *data(int i) const { return arrays[i]; }
+
+    /**
+     * \tparam V Type of the values of the column, of the same size.
+     * \param i Index of a column, from 0 to columns() - 1.
+     * \return The rows() values of the column, or nullptr if V has a
+     * different size.
+     */
+    template <typename V>
+    const V *values(int i) const
+    {
+        if (static_cast<int>(sizeof(V)) != column(i).size)
+            return nullptr;
+        return reinterpret_cast<const V *>(data(i));
+    }
+
+    /**
+     * @brief Append objects, transposing them into the columns.
+     *
+     * \param objects Pointer to the first object, with no alignment
+     * requirement.
+     * \param count Number of objects.
+     */
+    void append(const void *objects, int count);
+
+    /**
+     * @brief Remove all the rows, keeping the memory allocated.
+     */
+    void clear() { rowCount = 0; }
+
+private:
+    ColumnTable(const ColumnTable &) = delete;
+    ColumnTable &operator=(const ColumnTable &) = delete;
+
+    void reserve(size_t rows);
+
+    std::string name;
+    ColumnLayout layout;
+    int size;                 ///< Size of the type
+    std::vector<int> groups;  ///< First of four columns transposed together
+    std::vector<std::unique_ptr<char[]>> storage;  ///< Allocated arrays
+    std::vector<char *> arrays;  ///< Values of each column, aligned
+    size_t rowCount = 0;
+    size_t capacity = 0;  ///< Rows that fit in the arrays
+};
+
+/**
+ * @brief Decoder that transposes the serialized types into a ColumnTable per
+ * type, through the callbacks it registers in a TypePoolBuffer.
+ *
+ * \code
+ * ColumnarDecoder cd;
+ * cd.registerType<Imu>({TSCPP_COLUMN(Imu, timestamp),
+ *                       TSCPP_COLUMN(Imu, accel)});
+ * for (int pos = 0, result; pos < size; pos += result)
+ *     if ((result = unserializeUnknown(cd.pool(), buffer + pos,
+ *                                      size - pos)) < 0)
+ *         break;
+ * const ColumnTable *imu = cd.table<Imu>();
+ * const float *x = imu->values<float>(imu->find("accel[0]"));
+ * \endcode
+ *
+ * Batches are transposed all at once, and columns of four byte scalars that
+ * are contiguous in the type are transposed four at a time with SSE2 on x86,
+ * unless TSCPP_NO_SIMD is defined.
+ *
+ * The pool can be passed to the other decoders, but the ones calling the
+ * callbacks from many threads, as ParallelDecoder, must keep all the objects
+ * of a type on one thread, as with ParallelDecoder::TypeOrder.
+ */
+class ColumnarDecoder
+{
+public:
+    ColumnarDecoder() {}
+
+    /**
+     * @brief Register a type with its columns. Registering a type again
+     * replaces its table, and the rows decoded so far.
+     *
+     * \tparam T Type to be registered.
+     * \param layout Columns of the type.
+     * \throws std::invalid_argument if a column is outside of the type.
+     */
+    template <typename T>
+    void registerType(const ColumnLayout &layout);
+
+    /**
+     * \return The type pool to pass to unserializeUnknown(), or to the other
+     * decoders. Other types can also be registered in it.
+     */
+    TypePoolBuffer &pool() { return tp; }
+
+    /**
+     * \return The table of a registered type, or nullptr.
+     */
+    template <typename T>
+    const ColumnTable *table() const
+    {
+        return table(typeid(T).name());
+    }
+
+    /**
+     * \param name Mangled name of a type.
+     * \return The table of the type, or nullptr if not registered.
+     */
+    const ColumnTable *table(const std::string &name) const;
+
+    /**
+     * \return The tables of the registered types, in registration order.
+     */
+    std::vector<const ColumnTable *> tables() const;
+
+    /**
+     * @brief Remove all the rows of all the tables.
+     */
+    void clear();
+
+private:
+    ColumnarDecoder(const ColumnarDecoder &) = delete;
+    ColumnarDecoder &operator=(const ColumnarDecoder &) = delete;
+
+    ColumnTable *add(const char *name, const ColumnLayout &layout, int size);
+
+    TypePoolBuffer tp;
+    ///< Tables, never moved as the callbacks point to them
+    std::vector<std::unique_ptr<ColumnTable>> tableList;
+};
+
+template <typename T>
+void ColumnarDecoder::registerType(const ColumnLayout &layout)
+{
+    ColumnTable *t = add(typeid(T).name(), layout, sizeof(T));
+    tp.registerTypeArray<T>([t](const T *objects, int count)
+                            { t->append(objects, count); });
+}
+
+}  // namespace tscpp
@@ -0,0 +1,424 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+#include "compress.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "format.h"
+#include "stream.h"
+
+using namespace std;
+
+namespace tscpp
+{
+
+static const int minMatch     = 4;   ///< Shortest repeated sequence encoded
+static const int lastLiterals = 5;   ///< Bytes at the end always literals
+static const int matchLimit   = 12;  ///< Last match starts before this
+
+static inline uint32_t load32(const char *p)
+{
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+/**
+ * Write the length extension bytes of a sequence.
+ * \return The pointer past the written bytes, or nullptr if out of space.
+ */
+static char *writeLength(char *op, const char *end, int length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (op >= end)
+            return nullptr;
+        *op++ = static_cast<char>(255);
+    }
+    if (op >= end)
+        return nullptr;
+    *op++ = static_cast<char>(length);
+    return op;
+}
+
+/**
+ * Read the length extension bytes of a sequence.
+ * \return The pointer past the read bytes, or nullptr if out of data.
+ */
+static const char *readLength(const char *ip, const char *end, int &length)
+{
+    for (;;)
+    {
+        if (ip >= end)
+            return nullptr;
+        unsigned char c = *ip++;
+        length += c;
+        if (length > 0x7fffffff - 255)
+            return nullptr;
+        if (c != 255)
+            return ip;
+    }
+}
+
+/**
+ * Write a sequence of literals optionally followed by a match.
+ * \return The pointer past the sequence, or nullptr if out of space.
+ */
+static char *writeSequence(char *op, const char *end, const char *literals,
+                           int literalCount, int offset, int matchSize)
+{
+    if (op >= end)
+        return nullptr;
+    int match   = matchSize > 0 ? matchSize - minMatch : 0;
+    char *token = op++;
+    *token = static_cast<char>((min(literalCount, 15) << 4) | min(match, 15));
+    if (literalCount >= 15 &&
+        (op = writeLength(op, end, literalCount - 15)) == nullptr)
+        return nullptr;
+    if (end - op < literalCount)
+        return nullptr;
+    memcpy(op, literals, literalCount);
+    op += literalCount;
+    if (matchSize == 0)
+        return op;
+    if (end - op < 2)
+        return nullptr;
+    *op++ = static_cast<char>(offset & 0xff);
+    *op++ = static_cast<char>(offset >> 8);
+    if (match >= 15)
+        return writeLength(op, end, match - 15);
+    return op;
+}
+
+/**
+ * Decode data in the LZ4 block format.
+ * \return False if the data is corrupted or does not decode to rawSize bytes.
+ */
+static bool decompressLz(const char *ip, const char *end, char *out,
+                         int rawSize)
+{
+    int op = 0;
+    for (;;)
+    {
+        if (ip >= end)
+            return false;
+        unsigned char token = *ip++;
+        int literalCount    = token >> 4;
+        if (literalCount == 15 &&
+            (ip = readLength(ip, end, literalCount)) == nullptr)
+            return false;
+        if (end - ip < literalCount || rawSize - op < literalCount)
+            return false;
+        memcpy(out + op, ip, literalCount);
+        ip += literalCount;
+        op += literalCount;
+        if (ip == end)
+            break;  // The last sequence has no match
+        if (end - ip < 2)
+            return false;
+        int offset = static_cast<unsigned char>(ip[0]) |
+                     static_cast<unsigned char>(ip[1]) << 8;
+        ip += 2;
+        int matchSize = token & 15;
+        if (matchSize == 15 &&
+            (ip = readLength(ip, end, matchSize)) == nullptr)
+            return false;
+        matchSize += minMatch;
+        if (offset == 0 || offset > op || rawSize - op < matchSize)
+            return false;
+        // Byte at a time, as the match may overlap the data it produces
+        for (int i = 0; i < matchSize; i++, op++)
+            out[op] = out[op - offset];
+    }
+    return op == rawSize;
+}
+
+//
+// class BlockCompressor
+//
+
+int BlockCompressor::compress(const void *src, int srcSize, void *dst,
+                              int dstSize, int deltaStride)
+{
+    if (srcSize < 0 || deltaStride < 0 || deltaStride > 0xffff ||
+        dstSize < blockHeaderSize)
+        return BufferTooSmall;
+    const char *data = reinterpret_cast<const char *>(src);
+    char *out        = reinterpret_cast<char *>(dst);
+    if (deltaStride >= srcSize)
+        deltaStride = 0;
+    if (deltaStride > 0)
+    {
+        scratch.resize(srcSize);
+        memcpy(scratch.data(), data, deltaStride);
+        for (int i = deltaStride; i < srcSize; i++)
+            scratch[i] = data[i] - data[i - deltaStride];
+        data = scratch.data();
+    }
+
+    // A block that does not shrink is stored, without the filter
+    int limit = min(dstSize - blockHeaderSize, srcSize - 1);
+    int size   = BufferTooSmall;
+    int method = codec ? codec->method() : CompressedBlock;
+    if (limit > 0 && codec)
+        size = codec->compress(data, srcSize, out + blockHeaderSize, limit);
+    else if (limit > 0)
+        size = compressLz(data, srcSize, out + blockHeaderSize, limit);
+    if (size < 0 || size > limit)
+    {
+        if (dstSize - blockHeaderSize < srcSize)
+            return BufferTooSmall;
+        memcpy(out + blockHeaderSize, src, srcSize);
+        size      = srcSize;
+        method    = StoredBlock;
+        deltaStride = 0;
+    }
+    storeLittleEndian32(out, size);
+    storeLittleEndian32(out + 4, srcSize);
+    out[8]  = static_cast<char>(deltaStride & 0xff);
+    out[9]  = static_cast<char>(deltaStride >> 8);
+    out[10] = static_cast<char>(method);
+    out[11] = 0;
+    return blockHeaderSize + size;
+}
+
+int BlockCompressor::compressLz(const char *src, int srcSize, char *dst,
+                                int dstSize)
+{
+    char *op        = dst;
+    const char *end = dst + dstSize;
+    int anchor      = 0;
+    fill(table.begin(), table.end(), -1);
+    for (int ip = 0; ip < srcSize - matchLimit;)
+    {
+        uint32_t sequence = load32(src + ip);
+        int hash          = (sequence * 2654435761u) >> (32 - tableBits);
+        int ref           = table[hash];
+        table[hash]       = ip;
+        if (ref < 0 || ip - ref > 0xffff || load32(src + ref) != sequence)
+        {
+            ip++;
+            continue;
+        }
+        int size = minMatch;
+        while (ip + size < srcSize - lastLiterals &&
+               src[ref + size] == src[ip + size])
+            size++;
+        op = writeSequence(op, end, src + anchor, ip - anchor, ip - ref, size);
+        if (op == nullptr)
+            return BufferTooSmall;
+        ip += size;
+        anchor = ip;
+    }
+    op = writeSequence(op, end, src + anchor, srcSize - anchor, 0, 0);
+    if (op == nullptr)
+        return BufferTooSmall;
+    return op - dst;
+}
+
+//
+// Block functions
+//
+
+int blockSize(const void *src, int srcSize, int &rawSize)
+{
+    const char *in = reinterpret_cast<const char *>(src);
+    if (srcSize < blockHeaderSize)
+        return BufferTooSmall;
+    uint32_t stored = loadLittleEndian32(in);
+    uint32_t raw    = loadLittleEndian32(in + 4);
+    if (stored > static_cast<uint32_t>(srcSize - blockHeaderSize) ||
+        raw > 0x7fffffff)
+        return BufferTooSmall;
+    rawSize = raw;
+    return blockHeaderSize + stored;
+}
+
+int decompressBlock(const void *src, int srcSize, void *dst, int dstSize,
+                    const BlockCodec *codec)
+{
+    int rawSize;
+    int size = blockSize(src, srcSize, rawSize);
+    if (size < 0 || rawSize > dstSize)
+        return BufferTooSmall;
+    const char *in  = reinterpret_cast<const char *>(src);
+    char *out       = reinterpret_cast<char *>(dst);
+    int deltaStride = static_cast<unsigned char>(in[8]) |
+                      static_cast<unsigned char>(in[9]) << 8;
+    const char *ip  = in + blockHeaderSize;
+    const char *end = in + size;
+    if (in[10] == StoredBlock)
+    {
+        if (size - blockHeaderSize != rawSize)
+            return BufferTooSmall;
+        memcpy(out, ip, rawSize);
+    }
+    else if (codec && in[10] == codec->method())
+    {
+        if (codec->decompress(ip, end - ip, out, rawSize) != rawSize)
+            return BufferTooSmall;
+    }
+    else if (in[10] == CompressedBlock)
+    {
+        if (decompressLz(ip, end, out, rawSize) == false)
+            return BufferTooSmall;
+    }
+    else
+        return UnknownType;
+
+    for (int i = deltaStride; deltaStride > 0 && i < rawSize; i++)
+        out[i] += out[i - deltaStride];
+    return rawSize;
+}
+
+//
+// class CompressedOutputBuffer
+//
+
+CompressedOutputBuffer::CompressedOutputBuffer(ostream &os, int blockSize,
+                                               int deltaStride,
+                                               BlockCodec *codec)
+    : os(os), deltaStride(deltaStride), compressor(codec)
+{
+    if (blockSize <= 0 || blockSize > 0x7fffffff / 2)
+        throw invalid_argument("invalid block size");
+    if (deltaStride < 0 || deltaStride > 0xffff)
+        throw invalid_argument("invalid delta filter stride");
+    if (codec && (codec->method() < CustomBlock || codec->method() > 255))
+        throw invalid_argument("invalid block codec method");
+    raw.resize(blockSize);
+    block.resize(compressBound(blockSize));
+    setp(raw.data(), raw.data() + raw.size());
+}
+
+CompressedOutputBuffer::~CompressedOutputBuffer() { sync(); }
+
+int CompressedOutputBuffer::overflow(int c)
+{
+    writeBlock();
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+}
+
+int CompressedOutputBuffer::sync()
+{
+    writeBlock();
+    os.flush();
+    return os ? 0 : -1;
+}
+
+void CompressedOutputBuffer::writeBlock()
+{
+    int size = pptr() - pbase();
+    if (size == 0)
+        return;
+    size = compressor.compress(pbase(), size, block.data(), block.size(),
+                               deltaStride);
+    os.write(block.data(), size);
+    setp(raw.data(), raw.data() + raw.size());
+}
+
+//
+// class CompressedInputBuffer
+//
+
+const int CompressedInputBuffer::putbackSize;
+
+CompressedInputBuffer::CompressedInputBuffer(istream &is,
+                                             const BlockCodec *codec)
+    : is(is), codec(codec)
+{
+    if (codec && (codec->method() < CustomBlock || codec->method() > 255))
+        throw invalid_argument("invalid block codec method");
+}
+
+int CompressedInputBuffer::underflow()
+{
+    while (gptr() == egptr())
+    {
+        // Keep the last part of the current block, for seeking back
+        int size = egptr() - eback();
+        int keep = min(size, putbackSize);
+        if (keep > 0)
+            memmove(raw.data(), egptr() - keep, keep);
+        begin += size - keep;
+        setg(raw.data(), raw.data() + keep, raw.data() + keep);
+
+        char header[blockHeaderSize];
+        is.read(header, blockHeaderSize);
+        if (is.gcount() == 0 && is.eof())
+            return traits_type::eof();
+        if (is.gcount() != blockHeaderSize)
+            throw TscppException("truncated block");
+        uint32_t stored  = loadLittleEndian32(header);
+        uint32_t rawSize = loadLittleEndian32(header + 4);
+        if (stored > 0x7fffffff - blockHeaderSize ||
+            rawSize > 0x7fffffff - putbackSize)
+            throw TscppException("corrupted block");
+        block.resize(blockHeaderSize + stored);
+        memcpy(block.data(), header, blockHeaderSize);
+        is.read(block.data() + blockHeaderSize, stored);
+        if (is.gcount() != stored)
+            throw TscppException("truncated block");
+
+        raw.resize(keep + rawSize);
+        if (decompressBlock(block.data(), block.size(), raw.data() + keep,
+                            rawSize, codec) != static_cast<int>(rawSize))
+            throw TscppException("corrupted block");
+        setg(raw.data(), raw.data() + keep, raw.data() + keep + rawSize);
+    }
+    return traits_type::to_int_type(*gptr());
+}
+
+streambuf::pos_type CompressedInputBuffer::seekoff(off_type off,
+                                                   ios_base::seekdir dir,
+                                                   ios_base::openmode which)
+{
+    if (dir == ios_base::beg)
+        return seekpos(off, which);
+    if (dir == ios_base::cur)
+        return seekpos(begin + (gptr() - eback()) + off, which);
+    return pos_type(off_type(-1));
+}
+
+streambuf::pos_type CompressedInputBuffer::seekpos(pos_type pos,
+                                                   ios_base::openmode which)
+{
+    off_type offset = off_type(pos) - begin;
+    if ((which & ios_base::in) == 0 || offset < 0 ||
+        offset > egptr() - eback())
+        return pos_type(off_type(-1));
+    setg(eback(), eback() + offset, egptr());
+    return pos;
+}
+
+}  // namespace tscpp
@@ -0,0 +1,342 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file compress.h
+ *
+ * @brief Block compression of serialized data.
+ *
+ * Data is split in blocks that are compressed independently, so a single
+ * block can be decompressed without reading the preceding ones. Each block
+ * is preceded by a 12 byte header, with all fields little endian:
+ * - 32 bit size of the stored block payload
+ * - 32 bit size of the uncompressed data
+ * - 16 bit stride of the delta filter, 0 if not used
+ * - 8 bit method, see BlockMethod
+ * - 8 bit reserved, set to 0
+ *
+ * Compressed payloads use the LZ4 block format, unless a BlockCodec is given
+ * to the compressor. Before compression, the optional delta filter subtracts
+ * from each byte the byte one stride before. With a stride equal to the
+ * serialized size of a type, see serializedSize(), constant fields of
+ * consecutive objects of that type become zeros and counters or timestamps
+ * with a regular step become repeated sequences, which then compress better.
+ * Fields that change randomly compress worse.
+ *
+ * The stride is the same for the whole stream, as the blocks know nothing of
+ * the records in them. It lines up with the records only if they all have
+ * the same size, such as when a single type dominates the log, otherwise the
+ * filter should be left disabled.
+ *
+ * CompressedOutputStream and CompressedInputStream apply compression to the
+ * stream API transparently.
+ */
+
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+#include "buffer.h"
+
+namespace tscpp
+{
+
+const int blockHeaderSize = 12;  ///< Size of the header of each block
+
+/**
+ * @brief Compression methods of a block.
+ */
+enum BlockMethod
+{
+    StoredBlock     = 0,  ///< Payload is the uncompressed data
+    CompressedBlock = 1,  ///< Payload is in the LZ4 block format
+    CustomBlock     = 2   ///< First method available to a BlockCodec
+};
+
+/**
+ * @brief Compression codec of the blocks, to use another format instead of
+ * the built in LZ4 one.
+ *
+ * The codec is selected by the method stored in the header of each block, so
+ * a stream can only be read with the codec it was written with.
+ */
+class BlockCodec
+{
+public:
+    virtual ~BlockCodec() {}
+
+    /**
+     * \return The method stored in the header of the blocks, from
+     * BlockMethod::CustomBlock to 255.
+     */
+    virtual int method() const = 0;
+
+    /**
+     * \param src Data to compress.
+     * \param srcSize Size of the data to compress.
+     * \param dst Buffer where the compressed data is written.
+     * \param dstSize Size of dst.
+     * \return The size of the compressed data, or TscppError::BufferTooSmall
+     * if it is larger than dstSize, in which case the block is stored.
+     */
+    virtual int compress(const char *src, int srcSize, char *dst,
+                         int dstSize) = 0;
+
+    /**
+     * \param src Compressed data.
+     * \param srcSize Size of the compressed data.
+     * \param dst Buffer where the uncompressed data is written.
+     * \param dstSize Size of the uncompressed data.
+     * \return dstSize, or TscppError::BufferTooSmall if the data is
+     * corrupted.
+     */
+    virtual int decompress(const char *src, int srcSize, char *dst,
+                           int dstSize) const = 0;
+};
+
+/**
+ * \return The size of a type serialized with the full name header, useful as
+ * the delta filter stride.
+ */
+template <typename T>
+int serializedSize()
+{
+    return typeName<T>().size + 1 + sizeof(T);
+}
+
+/**
+ * \param size Size of the data to compress.
+ * \return The maximum size of the compressed block, including its header.
+ */
+inline int compressBound(int size)
+{
+    return blockHeaderSize + size + size / 255 + 16;
+}
+
+/**
+ * @brief Compressor of blocks, which holds the hash table used to find
+ * repeated sequences.
+ */
+class BlockCompressor
+{
+public:
+    /**
+     * \param codec Codec of the blocks, or nullptr for the built in LZ4 one.
+     * It must outlive the compressor.
+     */
+    explicit BlockCompressor(BlockCodec *codec = nullptr)
+        : codec(codec), table(codec ? 0 : tableSize)
+    {
+    }
+
+    /**
+     * \param src Data to compress.
+     * \param srcSize Size of the data to compress, at most 2GB.
+     * \param dst Buffer where the block, including its header, is written.
+     * \param dstSize Size of dst, compressBound(srcSize) is always enough.
+     * \param deltaStride Stride of the delta filter, up to 65535, or 0 to
+     * disable the filter.
+     * \return The size of the block, or TscppError::BufferTooSmall.
+     */
+    int compress(const void *src, int srcSize, void *dst, int dstSize,
+                 int deltaStride = 0);
+
+private:
+    static const int tableBits = 12;
+    static const int tableSize = 1 << tableBits;
+
+    int compressLz(const char *src, int srcSize, char *dst, int dstSize);
+
+    BlockCodec *codec;
+    std::vector<int> table;     ///< Last position of each hashed sequence
+    std::vector<char> scratch;  ///< Data after the delta filter
+};
+
+/**
+ * @brief Get the size of a block from its header.
+ *
+ * \param src Buffer starting with a block.
+ * \param srcSize Buffer size.
+ * \param rawSize Set to the size of the uncompressed data.
+ * \return The size of the block including its header, or
+ * TscppError::BufferTooSmall if the buffer does not contain the whole block.
+ */
+int blockSize(const void *src, int srcSize, int &rawSize);
+
+/**
+ * @brief Decompress a block.
+ *
+ * \param src Buffer starting with a block.
+ * \param srcSize Buffer size.
+ * \param dst Buffer where the uncompressed data is written.
+ * \param dstSize Size of dst.
+ * \param codec Codec of the blocks with its method, or nullptr if only the
+ * built in LZ4 one is used.
+ * \return The size of the uncompressed data, or TscppError::BufferTooSmall
+ * if either buffer is too small or the block is corrupted, or
+ * TscppError::UnknownType if the block uses a method without a codec.
+ */
+int decompressBlock(const void *src, int srcSize, void *dst, int dstSize,
+                    const BlockCodec *codec = nullptr);
+
+/**
+ * @brief Stream buffer which compresses the data written to it in blocks,
+ * and writes them to another stream.
+ */
+class CompressedOutputBuffer : public std::streambuf
+{
+public:
+    /**
+     * \param os Output stream where compressed blocks are written.
+     * \param blockSize Size of the uncompressed data in each block.
+     * \param deltaStride Stride of the delta filter, or 0.
+     * \param codec Codec of the blocks, or nullptr for the built in LZ4 one.
+     * It must outlive the buffer.
+     * \throws std::invalid_argument if blockSize, deltaStride or the method
+     * of the codec are not valid.
+     */
+    CompressedOutputBuffer(std::ostream &os, int blockSize = 65536,
+                           int deltaStride = 0, BlockCodec *codec = nullptr);
+
+    /**
+     * Writes the last block.
+     */
+    ~CompressedOutputBuffer();
+
+protected:
+    int overflow(int c) override;
+    int sync() override;
+
+private:
+    void writeBlock();
+
+    std::ostream &os;
+    int deltaStride;
+    std::vector<char> raw;
+    std::vector<char> block;
+    BlockCompressor compressor;
+};
+
+/**
+ * @brief Stream buffer which reads compressed blocks from another stream and
+ * decompresses them.
+ *
+ * Seeking is possible only to positions in the current block, or in the last
+ * part of the previous one, which is enough for the input archives to report
+ * errors.
+ *
+ * \throws TscppException on corrupted blocks.
+ */
+class CompressedInputBuffer : public std::streambuf
+{
+public:
+    /**
+     * \param is Input stream where compressed blocks are read.
+     * \param codec Codec the blocks were written with, or nullptr for the
+     * built in LZ4 one. It must outlive the buffer.
+     * \throws std::invalid_argument if the method of the codec is not valid.
+     */
+    explicit CompressedInputBuffer(std::istream &is,
+                                   const BlockCodec *codec = nullptr);
+
+protected:
+    int underflow() override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+private:
+    static const int putbackSize = 1024;  ///< Kept from the previous block
+
+    std::istream &is;
+    const BlockCodec *codec;
+    std::vector<char> raw;    ///< Putback area followed by the current block
+    std::vector<char> block;  ///< Current compressed block
+    long long begin = 0;      ///< Stream position of the start of raw
+};
+
+/**
+ * @brief Output stream which compresses the data written to it, to be used
+ * with an OutputArchive.
+ *
+ * \code
+ * ofstream file("log.dat", ios::binary);
+ * CompressedOutputStream os(file);
+ * OutputArchive oa(os);
+ * \endcode
+ */
+class CompressedOutputStream : public std::ostream
+{
+public:
+    /**
+     * \param os Output stream where compressed blocks are written.
+     * \param blockSize Size of the uncompressed data in each block.
+     * \param deltaStride Stride of the delta filter, or 0.
+     * \param codec Codec of the blocks, or nullptr for the built in LZ4 one.
+     */
+    CompressedOutputStream(std::ostream &os, int blockSize = 65536,
+                           int deltaStride = 0, BlockCodec *codec = nullptr)
+        : std::ostream(nullptr), buffer(os, blockSize, deltaStride, codec)
+    {
+        rdbuf(&buffer);
+    }
+
+private:
+    CompressedOutputBuffer buffer;
+};
+
+/**
+ * @brief Input stream which decompresses the data read from another stream,
+ * to be used with an InputArchive or UnknownInputArchive.
+ *
+ * The badbit exception is enabled, so that the TscppException thrown on
+ * corrupted blocks reaches the caller.
+ */
+class CompressedInputStream : public std::istream
+{
+public:
+    /**
+     * \param is Input stream where compressed blocks are read.
+     * \param codec Codec the blocks were written with, or nullptr for the
+     * built in LZ4 one.
+     */
+    explicit CompressedInputStream(std::istream &is,
+                                   const BlockCodec *codec = nullptr)
+        : std::istream(nullptr), buffer(is, codec)
+    {
+        rdbuf(&buffer);
+        exceptions(std::ios_base::badbit);
+    }
+
+private:
+    CompressedInputBuffer buffer;
+};
+
+}  // namespace tscpp
@@ -0,0 +1,624 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file format.h
+ *
+ * @brief TSCPP serialization format definitions.
+ *
+ * This file contains the definitions shared by the buffer and stream API to
+ * read and write the serialization format. It is header-only so that the two
+ * APIs can still be used independently of each other.
+ *
+ * A serialized type starts with a header identifying the type, followed by
+ * the object itself. The default header is the C++ mangled name of the type
+ * followed by a '\0' string terminator. Mangled names are printable strings,
+ * so the other header kinds are told apart by their first byte:
+ *
+ * - TypeIdDefinition, id, name, '\0': compact header assigning an id to a
+ *   type name, used the first time a type is serialized in a session.
+ * - TypeIdReference | id: compact header, a single byte referring to a type
+ *   name previously defined in the same session.
+ *
+ * A header may be preceded by BatchPrefix and a 32 bit little endian count,
+ * in which case it is followed by count objects of the same type instead of
+ * one.
+ *
+ * Any of these may be preceded by FingerprintPrefix and the 32 bit little
+ * endian fingerprint of the type, see fingerprint(), which lets readers
+ * detect in O(1) that the layout of the type changed since it was serialized.
+ *
+ * A header may instead be preceded by DeltaPrefix, in which case the object
+ * is encoded against the previous object of the same type, see DeltaState: a
+ * bitmap of deltaMaskSize() bytes, where bit i % 8 of byte i / 8 is set if
+ * byte i of the object changed, followed by the new value of each changed
+ * byte. A keyframe is an object with all the bits set.
+ *
+ * Any number of '\0' bytes may precede a header. They are skipped when
+ * unserializing, and are used to align the object within the buffer.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+namespace tscpp
+{
+
+/**
+ * @brief Serialized name of a type, together with its length.
+ *
+ * The name of a given type never changes, so the serialization functions get
+ * it through typeName(), which measures it only once per type instead of
+ * calling strlen every time a type is serialized.
+ */
+class TypeName
+{
+public:
+    /**
+     * \param str Mangled type name, must outlive this object.
+     * \param fingerprint Fingerprint of the type, or 0 if not known.
+     */
+    TypeName(const char *str, uint32_t fingerprint = 0)
+        : str(str), size(strlen(str)), fingerprint(fingerprint)
+    {
+    }
+
+    const char *str;       ///< Mangled type name, '\0' terminated
+    int size;              ///< Length of the name, excluding the '\0'
+    uint32_t fingerprint;  ///< Fingerprint of the type, or 0 if not known
+};
+
+/**
+ * @brief Hook to add the layout of the fields of a type to its fingerprint.
+ *
+ * By default only the size and alignment of a type are part of its
+ * fingerprint. Specialize this class to also detect fields that moved:
+ *
+ * \code
+ * template<> struct TypeLayout<Foo>
+ * {
+ *     static const uint32_t value = layoutHash(offsetof(Foo, a),
+ *                                              offsetof(Foo, b));
+ * };
+ * \endcode
+ */
+template <typename T>
+struct TypeLayout
+{
+    static const uint32_t value = 0;
+};
+
+constexpr uint32_t fnvByte(uint32_t h, uint32_t b)
+{
+    return (h ^ b) * 16777619u;
+}
+
+/**
+ * \return The FNV-1a hash h updated with the four bytes of x.
+ */
+constexpr uint32_t fnvUpdate(uint32_t h, uint32_t x)
+{
+    return fnvByte(fnvByte(fnvByte(fnvByte(h, x & 0xff), (x >> 8) & 0xff),
+                           (x >> 16) & 0xff),
+                   x >> 24);
+}
+
+constexpr uint32_t layoutHashImpl(uint32_t h) { return h; }
+
+template <typename... Args>
+constexpr uint32_t layoutHashImpl(uint32_t h, uint32_t x, Args... rest)
+{
+    return layoutHashImpl(fnvUpdate(h, x), rest...);
+}
+
+/**
+ * \param offsets Offsets of the fields of a type.
+ * \return A hash of the offsets, to be used in a TypeLayout specialization.
+ */
+template <typename... Args>
+constexpr uint32_t layoutHash(Args... offsets)
+{
+    return layoutHashImpl(2166136261u, static_cast<uint32_t>(offsets)...);
+}
+
+/**
+ * @brief Fingerprint of the layout of a type, computed at compile time.
+ *
+ * The fingerprint is a hash of sizeof(T), alignof(T) and TypeLayout<T>, never
+ * 0. It does not depend on the name of the type, so an old version of a type
+ * kept under another name has the fingerprint the type used to have, see
+ * TypePoolBuffer::registerUpgrade().
+ *
+ * \return The fingerprint of T.
+ */
+template <typename T>
+constexpr uint32_t fingerprint()
+{
+    return layoutHash(sizeof(T), alignof(T), TypeLayout<T>::value) != 0
+               ? layoutHash(sizeof(T), alignof(T), TypeLayout<T>::value)
+               : 1;
+}
+
+/**
+ * \return The serialized name of type T.
+ */
+template <typename T>
+const TypeName &typeName()
+{
+    static const TypeName name(typeid(T).name(), fingerprint<T>());
+    return name;
+}
+
+/**
+ * @brief Header format used when serializing types.
+ */
+enum HeaderFormat
+{
+    FullNameHeader,  ///< Every type is preceded by its full mangled name
+    CompactHeader    ///< Names are sent once, then a one byte id is used
+};
+
+/**
+ * @brief First byte of the compact header kinds.
+ */
+enum HeaderMarker
+{
+    TypeIdDefinition  = 0x01,  ///< Followed by the type id and name
+    BatchPrefix       = 0x02,  ///< Followed by the count and a header
+    DeltaPrefix       = 0x03,  ///< Followed by a header and a delta
+    FingerprintPrefix = 0x04,  ///< Followed by the fingerprint and a header
+    TypeIdReference   = 0x80   ///< Or'ed with the type id
+};
+
+/**
+ * @brief Size of the batch prefix, including the count.
+ */
+const int batchPrefixSize = 5;
+
+/**
+ * @brief Size of the fingerprint prefix, including the fingerprint.
+ */
+const int fingerprintPrefixSize = 5;
+
+/**
+ * \param size Size of a type.
+ * \return The size of the bitmap of a delta encoded object of that size.
+ */
+inline int deltaMaskSize(int size) { return (size + 7) / 8; }
+
+/**
+ * @brief Store a 32 bit integer in little endian byte order.
+ */
+inline void storeLittleEndian32(char *buf, uint32_t x)
+{
+    buf[0] = x;
+    buf[1] = x >> 8;
+    buf[2] = x >> 16;
+    buf[3] = x >> 24;
+}
+
+/**
+ * @brief Load a 32 bit integer stored in little endian byte order.
+ */
+inline uint32_t loadLittleEndian32(const char *buf)
+{
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(buf);
+    return b[0] | b[1] << 8 | b[2] << 16 | static_cast<uint32_t>(b[3]) << 24;
+}
+
+/**
+ * @brief Hash of a type name, used to look up registered types.
+ *
+ * \param name Mangled type name, not necessarily '\0' terminated.
+ * \param nameSize Length of the name.
+ * \return The 32 bit FNV-1a hash of the name.
+ */
+inline uint32_t hashTypeName(const char *name, int nameSize)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < nameSize; i++)
+    {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Dictionary of the type ids used by the compact header format.
+ *
+ * A dictionary holds the state of a serialization session: the writer assigns
+ * ids to type names as types are serialized for the first time, the reader
+ * learns them as it finds the definitions. The same dictionary must not be
+ * shared between sessions, and a reader must start from an empty dictionary.
+ */
+class TypeDictionary
+{
+public:
+    static const int maxTypes = 128;  ///< Ids must fit in 7 bits
+
+    /**
+     * \param name Mangled type name.
+     * \return The id assigned to the type, or -1 if not found.
+     */
+    int find(const char *name) const
+    {
+        // Type names returned by typeid are usually the same pointer, the
+        // string comparison is only a fallback
+        for (int i = 0; i < static_cast<int>(keys.size()); i++)
+            if (keys[i] == name)
+                return i;
+        for (int i = 0; i < static_cast<int>(names.size()); i++)
+            if (names[i] == name)
+                return i;
+        return -1;
+    }
+
+    /**
+     * @brief Assign the next free id to a type name.
+     *
+     * \param name Mangled type name, must outlive the dictionary.
+     * \return The id assigned to the type, or -1 if the dictionary is full.
+     */
+    int define(const char *name)
+    {
+        int id = static_cast<int>(names.size());
+        if (id >= maxTypes)
+            return -1;
+        keys.push_back(name);
+        names.push_back(name);
+        hashes.push_back(hashTypeName(name, names.back().size()));
+        return id;
+    }
+
+    /**
+     * \return True if no more ids can be assigned.
+     */
+    bool full() const { return names.size() >= maxTypes; }
+
+    /**
+     * @brief Store a definition found while unserializing.
+     *
+     * \param id Type id, redefining an id replaces the previous name.
+     * \param name Mangled type name.
+     * \param nameSize Length of the name.
+     */
+    void define(int id, const char *name, int nameSize)
+    {
+        if (id >= static_cast<int>(names.size()))
+        {
+            names.resize(id + 1);
+            keys.resize(id + 1, nullptr);
+            hashes.resize(id + 1);
+        }
+        names[id].assign(name, nameSize);
+        keys[id]   = nullptr;
+        hashes[id] = hashTypeName(name, nameSize);
+    }
+
+    /**
+     * \param id Type id.
+     * \return The type name associated with the id, or nullptr if the id has
+     * not been defined.
+     */
+    const std::string *name(int id) const
+    {
+        if (id >= static_cast<int>(names.size()) || names[id].empty())
+            return nullptr;
+        return &names[id];
+    }
+
+    /**
+     * \param id Type id, which must have been defined while unserializing.
+     * \return The hash of the type name, so that readers don't have to compute
+     * it again for every serialized type.
+     */
+    uint32_t hash(int id) const { return hashes[id]; }
+
+    /**
+     * @brief Forget all definitions, starting a new session.
+     */
+    void clear()
+    {
+        keys.clear();
+        names.clear();
+        hashes.clear();
+    }
+
+private:
+    std::vector<const char *> keys;  ///< Name pointers passed to define()
+    std::vector<std::string> names;  ///< Type names indexed by id
+    std::vector<uint32_t> hashes;    ///< Definitions name hashes
+};
+
+/**
+ * @brief State of the delta encoding of a serialization session.
+ *
+ * Delta encoding is enabled per type on the writer side. Each object of such
+ * a type is then serialized with DeltaPrefix, storing only the bytes that
+ * changed since the previous object of the same type, which suits slowly
+ * changing samples. Every keyframeInterval objects, and for the first one, all
+ * the bytes are stored, so that a reader starting in the middle of a log can
+ * resynchronize.
+ *
+ * The reader side needs no configuration, it rebuilds each object from the
+ * previous one. Deltas found before the first keyframe of their type cannot
+ * be decoded, and are skipped.
+ *
+ * As with TypeDictionary, a state holds either the writer or the reader side
+ * of a single session, and objects have to be unserialized in the order they
+ * were serialized.
+ */
+class DeltaState
+{
+public:
+    /**
+     * @brief Enable the delta encoding of a type.
+     *
+     * \tparam T Type to delta encode.
+     * \param keyframeInterval Number of objects from one keyframe to the next,
+     * 1 means every object is a keyframe.
+     * \throws std::invalid_argument if keyframeInterval is less than 1.
+     */
+    template <typename T>
+    void enable(int keyframeInterval)
+    {
+        enable(typeName<T>().str, sizeof(T), keyframeInterval);
+    }
+
+    /**
+     * @brief Enable the delta encoding of a type.
+     *
+     * \param name Mangled type name, must outlive the state.
+     * \param size Size of the type.
+     * \param keyframeInterval Number of objects from one keyframe to the next.
+     * \throws std::invalid_argument if size is not positive or if
+     * keyframeInterval is less than 1.
+     */
+    void enable(const char *name, int size, int keyframeInterval)
+    {
+        if (size <= 0)
+            throw std::invalid_argument("invalid delta encoded type size");
+        if (keyframeInterval < 1)
+            throw std::invalid_argument("invalid keyframe interval");
+        Entry *e = find(name);
+        if (e == nullptr)
+        {
+            entries.emplace_back();
+            e       = &entries.back();
+            e->name = name;
+        }
+        e->key      = name;
+        e->size     = size;
+        e->interval = keyframeInterval;
+        e->count    = 0;
+        encoding    = true;
+    }
+
+    /**
+     * \return True if the delta encoding of at least one type is enabled.
+     */
+    bool enabled() const { return encoding; }
+
+    /**
+     * @brief Delta encode an object, if its type is enabled.
+     *
+     * The state is updated only if the object is encoded.
+     *
+     * \param name Mangled type name.
+     * \param data Object to encode.
+     * \param size Size of the object.
+     * \param out Buffer where the bitmap and the changed bytes are written,
+     * deltaMaskSize(size) + size bytes are always enough.
+     * \param outSize Size of out.
+     * \return The size of the encoded object, 0 if the type is not delta
+     * encoded or -1 if out is too small.
+     */
+    int encode(const char *name, const void *data, int size, char *out,
+               int outSize)
+    {
+        Entry *e = find(name);
+        if (e == nullptr || e->interval == 0 || e->size != size)
+            return 0;
+        return encode(*e, data, size, out, outSize);
+    }
+
+    /**
+     * @brief Delta encode an object in a buffer of the state, if its type is
+     * enabled.
+     *
+     * \param name Mangled type name.
+     * \param data Object to encode.
+     * \param size Size of the object.
+     * \param encodedSize Set to the size of the encoded object.
+     * \return The encoded object, valid until the next call, or nullptr if
+     * the type is not delta encoded.
+     */
+    const char *encode(const char *name, const void *data, int size,
+                       int &encodedSize)
+    {
+        Entry *e = find(name);
+        if (e == nullptr || e->interval == 0 || e->size != size)
+            return nullptr;
+        int maxSize = deltaMaskSize(size) + size;
+        char *out   = scratch(maxSize);
+        encodedSize = encode(*e, data, size, out, maxSize);
+        return out;
+    }
+
+    /**
+     * \param mask Bitmap of a delta encoded object.
+     * \param size Size of the object.
+     * \return The number of changed bytes following the bitmap.
+     */
+    static int changedBytes(const char *mask, int size)
+    {
+        int changed = 0;
+        for (int i = 0; i < size; i++)
+            changed += (mask[i / 8] >> (i % 8)) & 1;
+        return changed;
+    }
+
+    /**
+     * @brief Rebuild a delta encoded object.
+     *
+     * \param name Mangled type name, not necessarily '\0' terminated.
+     * \param nameSize Length of the name.
+     * \param size Size of the type.
+     * \param mask Bitmap of the object, followed by the changed bytes.
+     * \return The rebuilt object, valid until the next call, or nullptr if no
+     * keyframe of the type has been found yet.
+     */
+    const void *decode(const char *name, int nameSize, int size,
+                       const char *mask)
+    {
+        Entry *e = find(name, nameSize);
+        if (e == nullptr)
+        {
+            entries.emplace_back();
+            e = &entries.back();
+            e->name.assign(name, nameSize);
+        }
+        if (e->size != size)
+        {
+            e->size  = size;
+            e->count = 0;
+            e->previous.resize(size);
+        }
+
+        int changed = changedBytes(mask, size);
+        if (changed != size && e->count == 0)
+        {
+            missingDeltas++;
+            return nullptr;
+        }
+        const char *bytes = mask + deltaMaskSize(size);
+        for (int i = 0; i < size; i++)
+            if ((mask[i / 8] >> (i % 8)) & 1)
+                e->previous[i] = *bytes++;
+        e->count++;
+        return e->previous.data();
+    }
+
+    /**
+     * \return A buffer of at least the given size, reused by the stream
+     * readers to read encoded objects.
+     */
+    char *scratch(int size)
+    {
+        if (static_cast<int>(scratchBuffer.size()) < size)
+            scratchBuffer.resize(size);
+        return scratchBuffer.data();
+    }
+
+    /**
+     * \return The number of deltas skipped because no keyframe of their type
+     * had been found.
+     */
+    uint64_t missing() const { return missingDeltas; }
+
+    /**
+     * @brief Forget the previous objects, for example after seeking in a log.
+     *
+     * The writer starts again with keyframes, the types enabled stay enabled.
+     */
+    void reset()
+    {
+        for (auto &e : entries)
+            e.count = 0;
+    }
+
+private:
+    class Entry
+    {
+    public:
+        const char *key = nullptr;  ///< Name pointer passed to enable()
+        std::string name;
+        int size     = 0;
+        int interval = 0;  ///< Keyframe interval, 0 on the reader side
+        int count    = 0;  ///< Objects since the last keyframe, 0 if none
+        std::vector<char> previous;
+    };
+
+    int encode(Entry &e, const void *data, int size, char *out, int outSize)
+    {
+        int maskSize = deltaMaskSize(size);
+        if (outSize < maskSize)
+            return -1;
+
+        const char *object = reinterpret_cast<const char *>(data);
+        bool keyframe      = e.count % e.interval == 0;
+        memset(out, 0, maskSize);
+        int changed = maskSize;
+        for (int i = 0; i < size; i++)
+        {
+            if (keyframe == false && object[i] == e.previous[i])
+                continue;
+            if (changed == outSize)
+                return -1;
+            out[i / 8] |= 1 << (i % 8);
+            out[changed++] = object[i];
+        }
+        e.previous.assign(object, object + size);
+        e.count = keyframe ? 1 : e.count + 1;
+        return changed;
+    }
+
+    Entry *find(const char *name)
+    {
+        // As with TypeDictionary, the pointer comparison is the common case
+        for (auto &e : entries)
+            if (e.key == name)
+                return &e;
+        for (auto &e : entries)
+            if (e.name == name)
+                return &e;
+        return nullptr;
+    }
+
+    Entry *find(const char *name, int nameSize)
+    {
+        for (auto &e : entries)
+            if (static_cast<int>(e.name.size()) == nameSize &&
+                memcmp(e.name.data(), name, nameSize) == 0)
+                return &e;
+        return nullptr;
+    }
+
+    std::vector<Entry> entries;
+    std::vector<char> scratchBuffer;
+    uint64_t missingDeltas = 0;
+    bool encoding          = false;  ///< True if a type has been enabled
+};
+
+}  // namespace tscpp
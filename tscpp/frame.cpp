@@ -0,0 +1,231 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+#include "frame.h"
+
+#include "scan.h"
+
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+namespace tscpp
+{
+
+/**
+ * Table for the byte at a time CRC32 computation.
+ */
+class CrcTable
+{
+public:
+    CrcTable()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int j = 0; j < 8; j++)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+
+    uint32_t table[256];
+};
+
+uint32_t crc32(const void *data, int size, uint32_t crc)
+{
+    static const CrcTable t;
+    const unsigned char *d = reinterpret_cast<const unsigned char *>(data);
+    crc                    = ~crc;
+    for (int i = 0; i < size; i++)
+        crc = t.table[(crc ^ d[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+//
+// class FrameWriter
+//
+
+FrameWriter::FrameWriter(ostream &os, void *buffer, int bufSize, bool crc,
+                         HeaderFormat format)
+    : FrameWriter([&os](const char *data, int size) { os.write(data, size); },
+                  buffer, bufSize, crc, format)
+{
+}
+
+FrameWriter::FrameWriter(function<void(const char *, int)> sink, void *buffer,
+                         int bufSize, bool crc, HeaderFormat format)
+    : sink(sink), buffer(reinterpret_cast<char *>(buffer)), bufSize(bufSize),
+      crc(crc), format(format)
+{
+    if (bufSize <= frameHeaderSize)
+        throw invalid_argument("frame buffer too small");
+}
+
+int FrameWriter::serializeImpl(const TypeName &name, const void *data,
+                               int size, int count)
+{
+    int result = serializeInFrame(name, data, size, count);
+    if (result != BufferTooSmall || used == 0)
+        return result;
+
+    flush();
+    return serializeInFrame(name, data, size, count);
+}
+
+void FrameWriter::flush()
+{
+    if (used == 0)
+        return;
+
+    char *payload = buffer + frameHeaderSize;
+    storeLittleEndian32(buffer, frameSync);
+    storeLittleEndian32(buffer + 4, used | (crc ? frameCrcPresent : 0));
+    storeLittleEndian32(buffer + 8, crc ? crc32(payload, used) : 0);
+    sink(buffer, frameHeaderSize + used);
+    used = 0;
+    td.clear();
+}
+
+FrameWriter::~FrameWriter() { flush(); }
+
+int FrameWriter::serializeInFrame(const TypeName &name, const void *data,
+                                  int size, int count)
+{
+    char *p      = buffer + frameHeaderSize + used;
+    int space    = bufSize - frameHeaderSize - used;
+    bool compact = format == CompactHeader;
+    int result;
+    if (count < 0 && compact)
+        result = tscpp::serializeImpl(td, p, space, name, data, size);
+    else if (count < 0)
+        result = tscpp::serializeImpl(p, space, name, data, size);
+    else if (compact)
+        result = serializeArrayImpl(td, p, space, name, data, size, count, 1);
+    else
+        result = serializeArrayImpl(p, space, name, data, size, count, 1);
+    if (result > 0)
+        used += result;
+    return result;
+}
+
+//
+// class FrameReader
+//
+
+bool FrameReader::nextFrame(const char *&payload, int &payloadSize)
+{
+    const char first = frameSync & 0xff;
+    bool damaged     = false;
+    while (pos < bufSize)
+    {
+        int length = validFrame(pos);
+        if (length >= 0)
+        {
+            payload     = begin + pos + frameHeaderSize;
+            payloadSize = length;
+            pos += frameHeaderSize + length;
+            return true;
+        }
+
+        // Padding after a valid frame is not counted as damage
+        if (damaged == false && begin[pos] == '\0')
+        {
+            pos++;
+            continue;
+        }
+
+        // Resynchronize on the next candidate sync word
+        damaged       = true;
+        size_t next = pos + 1 + findByte(begin + pos + 1, bufSize - pos - 1,
+                                         first);
+        skippedSize += next - pos;
+        pos = next;
+    }
+    return false;
+}
+
+int FrameReader::unserializeFrame(const TypePoolBuffer &tp)
+{
+    const char *payload;
+    int payloadSize;
+    do
+    {
+        if (nextFrame(payload, payloadSize) == false)
+            return 0;
+    } while (payloadSize == 0);
+
+    td.clear();
+    int count    = 0;
+    int readSize = 0;
+    while (readSize < payloadSize)
+    {
+        int result = unserializeUnknown(tp, td, payload + readSize,
+                                        payloadSize - readSize);
+        if (result < 0)
+            return result;
+        readSize += result;
+        count++;
+    }
+    return count;
+}
+
+int FrameReader::validFrame(size_t offset) const
+{
+    if (bufSize - offset < static_cast<size_t>(frameHeaderSize))
+        return -1;
+    const char *header = begin + offset;
+    if (loadLittleEndian32(header) != frameSync)
+        return -1;
+
+    uint32_t length = loadLittleEndian32(header + 4);
+    bool hasCrc     = length & frameCrcPresent;
+    length &= ~frameCrcPresent;
+    if (length > bufSize - offset - frameHeaderSize || length > INT_MAX)
+        return -1;
+
+    const char *payload = header + frameHeaderSize;
+    if (hasCrc)
+    {
+        if (crc32(payload, length) != loadLittleEndian32(header + 8))
+            return -1;
+        return length;
+    }
+
+    // Without CRC, check that the frame is followed by another one, or only
+    // by padding till the end of the buffer
+    size_t next = offset + frameHeaderSize + length;
+    if (bufSize - next >= 4 && loadLittleEndian32(begin + next) == frameSync)
+        return length;
+    if (skipByte(begin + next, bufSize - next, '\0') != bufSize - next)
+        return -1;
+    return length;
+}
+
+}  // namespace tscpp
@@ -0,0 +1,232 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file frame.h
+ *
+ * @brief Framing of serialized types, to recover logs after corruption.
+ *
+ * A frame contains whole serialized types and starts with a 12 byte header:
+ * a 32 bit sync word, the 32 bit payload length, whose most significant bit
+ * tells whether the CRC is present, and the CRC32 of the payload. All fields
+ * are little endian. With the compact header format the type dictionary is
+ * reset at each frame, so frames can be unserialized independently.
+ *
+ * When a frame is damaged, FrameReader skips to the next sync word whose
+ * frame is valid, losing only the damaged frame.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+
+#include "buffer.h"
+
+namespace tscpp
+{
+
+const uint32_t frameSync       = 0x3cc35aa5;  ///< Sync word, little endian
+const int frameHeaderSize      = 12;          ///< Sync, length and CRC
+const uint32_t frameCrcPresent = 0x80000000;  ///< Flag in the length field
+
+/**
+ * \param data Data whose CRC is computed.
+ * \param size Data size.
+ * \param crc CRC of the preceding data, to compute it in parts.
+ * \return The CRC32 (IEEE 802.3) of the data.
+ */
+uint32_t crc32(const void *data, int size, uint32_t crc = 0);
+
+/**
+ * @brief Serializes types into frames, using a caller provided buffer.
+ *
+ * Types are packed in the buffer until the next one does not fit, then the
+ * frame is written out to an ostream or a write callback.
+ */
+class FrameWriter
+{
+public:
+    /**
+     * \param os Output stream where frames are written.
+     * \param buffer Buffer where frames are packed, it must outlive the
+     * writer. Its size is the maximum frame size, including the header.
+     * \param bufSize Buffer size.
+     * \param crc If true, a CRC32 of the payload is stored in each frame.
+     * \param format Header format of the serialized types.
+     */
+    FrameWriter(std::ostream &os, void *buffer, int bufSize, bool crc = true,
+                HeaderFormat format = FullNameHeader);
+
+    /**
+     * \param sink Callback called with each frame and its size.
+     * \param buffer Buffer where frames are packed, it must outlive the
+     * writer. Its size is the maximum frame size, including the header.
+     * \param bufSize Buffer size.
+     * \param crc If true, a CRC32 of the payload is stored in each frame.
+     * \param format Header format of the serialized types.
+     */
+    FrameWriter(std::function<void(const char *, int)> sink, void *buffer,
+                int bufSize, bool crc = true,
+                HeaderFormat format = FullNameHeader);
+
+    /**
+     * @brief Serialize a type into the current frame, writing out the frame
+     * first if the type does not fit.
+     *
+     * \param t Type to serialize.
+     * \return The size of the serialized type, or TscppError::BufferTooSmall
+     * if the type does not fit even in an empty frame.
+     */
+    template <typename T>
+    int serialize(const T &t);
+
+    /**
+     * @brief Serialize an array of objects of the same type into the current
+     * frame, writing out the frame first if the array does not fit.
+     *
+     * \param t Pointer to the first object to serialize.
+     * \param count Number of objects to serialize.
+     * \return The size of the serialized array, or TscppError::BufferTooSmall
+     * if the array does not fit even in an empty frame.
+     */
+    template <typename T>
+    int serializeArray(const T *t, int count);
+
+    int serializeImpl(const TypeName &name, const void *data, int size,
+                      int count);
+
+    /**
+     * @brief Write out the current frame, if not empty.
+     */
+    void flush();
+
+    /**
+     * Calls flush().
+     */
+    ~FrameWriter();
+
+private:
+    FrameWriter(const FrameWriter &)            = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    int serializeInFrame(const TypeName &name, const void *data, int size,
+                         int count);
+
+    std::function<void(const char *, int)> sink;
+    char *buffer;
+    int bufSize;
+    int used = 0;  ///< Payload bytes in the current frame
+    bool crc;
+    HeaderFormat format;
+    TypeDictionary td;  ///< Reset at each frame
+};
+
+template <typename T>
+int FrameWriter::serialize(const T &t)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return serializeImpl(typeName<T>(), &t, sizeof(T), -1);
+}
+
+template <typename T>
+int FrameWriter::serializeArray(const T *t, int count)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return serializeImpl(typeName<T>(), t, sizeof(T), count);
+}
+
+/**
+ * @brief Reads frames written by FrameWriter from a memory buffer, such as a
+ * file mapped with MmapReader, skipping damaged frames.
+ *
+ * Without CRC, a frame is considered valid if it fits in the buffer and is
+ * followed by another sync word, or only by '\0' padding till the end of the
+ * buffer. Thus damage to the sync word of a frame also causes the preceding
+ * frame to be skipped.
+ */
+class FrameReader
+{
+public:
+    /**
+     * \param buffer Buffer where the frames are.
+     * \param bufSize Buffer size.
+     */
+    FrameReader(const void *buffer, size_t bufSize)
+        : begin(reinterpret_cast<const char *>(buffer)), bufSize(bufSize)
+    {
+    }
+
+    /**
+     * @brief Find the next valid frame.
+     *
+     * \param payload Set to the start of the frame payload.
+     * \param payloadSize Set to the payload size.
+     * \return true if a frame was found, false at the end of the buffer.
+     */
+    bool nextFrame(const char *&payload, int &payloadSize);
+
+    /**
+     * @brief Unserialize all the types in the next valid frame.
+     *
+     * \param tp Type pool where possible serialized types are registered.
+     * \return The number of types unserialized, 0 at the end of the buffer,
+     * or TscppError::UnknownType if a type in the frame is not in the pool.
+     * In this case the rest of the frame is skipped, and the following frames
+     * can still be unserialized.
+     */
+    int unserializeFrame(const TypePoolBuffer &tp);
+
+    /**
+     * \return The offset of the next frame to be read.
+     */
+    size_t position() const { return pos; }
+
+    /**
+     * \return The number of bytes skipped so far because of damaged frames.
+     */
+    size_t skipped() const { return skippedSize; }
+
+private:
+    int validFrame(size_t offset) const;
+
+    const char *begin;
+    size_t bufSize;
+    size_t pos         = 0;
+    size_t skippedSize = 0;
+    TypeDictionary td;  ///< Reset at each frame
+};
+
+}  // namespace tscpp
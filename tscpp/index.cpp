@@ -0,0 +1,163 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+#include "index.h"
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+using namespace std;
+
+namespace tscpp
+{
+
+//
+// class LogIndexWriter
+//
+
+LogIndexWriter::LogIndexWriter(OutputArchive &oa, ostream &os,
+                               int granularity, uint64_t baseOffset)
+    : oa(oa), index(os, CompactHeader), granularity(granularity),
+      baseOffset(baseOffset)
+{
+    if (granularity < 1)
+        throw invalid_argument("invalid index granularity");
+    IndexInfo info;
+    info.version     = 1;
+    info.granularity = granularity;
+    index << info;
+    oa.setListener(this);
+}
+
+void LogIndexWriter::serialized(const TypeName &name, uint64_t offset,
+                                int definedId, const void *data)
+{
+    int i = types.index(name.str, name.size, hashTypeName(name.str, name.size));
+    TypeState &t = i >= 0 ? types.at(i) : types.insert(name.str);
+    offset += baseOffset;
+    uint64_t block = offset / granularity;
+    if (t.type < 0)
+    {
+        t.type = typeCount++;
+        IndexType it;
+        it.type             = t.type;
+        it.compactId        = definedId;
+        it.definitionOffset = offset;
+        index.writeBatch(name.str, name.size);
+        index << it;
+    }
+    else if (block == t.lastBlock)
+    {
+        return;
+    }
+    t.lastBlock = block;
+
+    IndexEntry e;
+    e.offset = offset;
+    e.key    = t.key ? t.key(data) : 0;
+    e.type   = t.type;
+    e.hasKey = t.key ? 1 : 0;
+    index << e;
+}
+
+LogIndexWriter::~LogIndexWriter() { oa.setListener(nullptr); }
+
+//
+// class LogIndex
+//
+
+const uint64_t LogIndex::npos;
+
+LogIndex::LogIndex(istream &is)
+{
+    string name;
+    TypePoolStream tp;
+    tp.registerType<char>([&](char &c) { name += c; });
+    tp.registerType<IndexInfo>([&](IndexInfo &info)
+                               { blockSize = info.granularity; });
+    tp.registerType<IndexType>(
+        [&](IndexType &it)
+        {
+            if (it.type != typeInfos.size())
+                throw TscppException("invalid index");
+            TypeInfo ti;
+            ti.name             = name;
+            ti.compactId        = it.compactId;
+            ti.definitionOffset = it.definitionOffset;
+            typeInfos.push_back(ti);
+            typeNumbers.insert(name.c_str()) = it.type;
+            name.clear();
+        });
+    tp.registerType<IndexEntry>(
+        [&](IndexEntry &e)
+        {
+            if (e.type >= typeInfos.size())
+                throw TscppException("invalid index");
+            typeInfos[e.type].offsets.push_back(e.offset);
+            typeInfos[e.type].keys.push_back(e.key);
+        });
+
+    UnknownInputArchive ia(is, tp);
+    while (is.peek() != EOF)
+        ia.unserialize();
+}
+
+const vector<uint64_t> &LogIndex::offsets(const string &name) const
+{
+    const TypeInfo *ti = info(name);
+    return ti ? ti->offsets : none;
+}
+
+uint64_t LogIndex::find(const string &name, uint64_t key) const
+{
+    const TypeInfo *ti = info(name);
+    if (ti == nullptr || ti->offsets.empty())
+        return npos;
+
+    // Objects after the last entry with a key not larger than the searched
+    // one may have a larger key, but the ones before it can't
+    auto it = upper_bound(ti->keys.begin(), ti->keys.end(), key);
+    if (it == ti->keys.begin())
+        return ti->offsets.front();
+    return ti->offsets[it - ti->keys.begin() - 1];
+}
+
+void LogIndex::prepare(TypeDictionary &td, uint64_t offset) const
+{
+    for (auto &ti : typeInfos)
+        if (ti.compactId >= 0 && ti.definitionOffset < offset)
+            td.define(ti.compactId, ti.name.c_str(), ti.name.size());
+}
+
+const LogIndex::TypeInfo *LogIndex::info(const string &name) const
+{
+    const int *number = typeNumbers.find(name.c_str());
+    return number ? &typeInfos[*number] : nullptr;
+}
+
+}  // namespace tscpp
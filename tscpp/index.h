@@ -0,0 +1,244 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file index.h
+ *
+ * @brief Sidecar index allowing random access into logs written with the
+ * stream API.
+ *
+ * While an OutputArchive writes a log, a LogIndexWriter writes to a separate
+ * stream, for each type, the offset of its first occurrence in each block of
+ * the log. Optionally a key, such as a timestamp, is extracted from the indexed
+ * objects. The index is itself serialized with TSCPP, as a sequence of
+ * IndexInfo, IndexType (each preceded by a batch of char with the type name)
+ * and IndexEntry objects, and LogIndex reads it back.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "format.h"
+#include "registry.h"
+#include "stream.h"
+
+namespace tscpp
+{
+
+/**
+ * @brief First object of an index.
+ */
+class IndexInfo
+{
+public:
+    uint32_t version;      ///< Index format version
+    uint32_t granularity;  ///< Block size of the log, in bytes
+};
+
+/**
+ * @brief Serialized the first time a type is found in the log, just after a
+ * batch of char with the type name.
+ */
+class IndexType
+{
+public:
+    uint32_t type;              ///< Type number used by the entries
+    int32_t compactId;          ///< Compact format type id, or -1
+    uint64_t definitionOffset;  ///< Offset where the type id is defined
+};
+
+/**
+ * @brief Offset of the first occurrence of a type in a block of the log.
+ */
+class IndexEntry
+{
+public:
+    uint64_t offset;  ///< Offset of the header of the indexed object
+    uint64_t key;     ///< Key of the indexed object, or 0
+    uint32_t type;    ///< Type number, as in IndexType
+    uint32_t hasKey;  ///< 1 if a key has been extracted
+};
+
+/**
+ * @brief Writes a sidecar index of the types serialized by an OutputArchive,
+ * including a BufferedOutputArchive.
+ */
+class LogIndexWriter : public OutputArchiveListener
+{
+public:
+    /**
+     * \param oa Archive to index, until this object is destroyed.
+     * \param os Output stream where the index is written.
+     * \param granularity An entry is written for the first occurrence of each
+     * type in each block of this size.
+     * \param baseOffset Offset in the log where oa started writing, added
+     * to all the offsets in the index.
+     * \throws std::invalid_argument if granularity is less than 1.
+     */
+    LogIndexWriter(OutputArchive &oa, std::ostream &os,
+                   int granularity = 4096, uint64_t baseOffset = 0);
+
+    /**
+     * @brief Extract a key from the indexed objects of a type.
+     *
+     * If keys are to be searched with LogIndex::find(), they must not decrease
+     * as objects are serialized.
+     *
+     * \param key Function extracting the key from an object.
+     */
+    template <typename T>
+    void registerKey(std::function<uint64_t(const T &t)> key);
+
+    void serialized(const TypeName &name, uint64_t offset, int definedId,
+                    const void *data) override;
+
+    /**
+     * Detaches from the archive.
+     */
+    ~LogIndexWriter();
+
+private:
+    LogIndexWriter(const LogIndexWriter &)            = delete;
+    LogIndexWriter &operator=(const LogIndexWriter &) = delete;
+
+    class TypeState
+    {
+    public:
+        int type = -1;  ///< Type number, -1 until written in the index
+        uint64_t lastBlock = 0;  ///< Last block where the type was indexed
+        std::function<uint64_t(const void *)> key;  ///< Optional
+    };
+
+    OutputArchive &oa;
+    OutputArchive index;
+    uint64_t granularity;
+    uint64_t baseOffset;
+    int typeCount = 0;
+    TypeRegistry<TypeState> types;
+};
+
+template <typename T>
+void LogIndexWriter::registerKey(std::function<uint64_t(const T &t)> key)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    // The listener is given a pointer to the object being serialized, which
+    // is suitably aligned
+    types.insert(typeid(T).name()).key = [=](const void *data)
+    { return key(*reinterpret_cast<const T *>(data)); };
+}
+
+/**
+ * @brief An index written by LogIndexWriter.
+ */
+class LogIndex
+{
+public:
+    /**
+     * Returned by find() if the type is not in the index.
+     */
+    static const uint64_t npos = ~0ull;
+
+    /**
+     * \param is Input stream where the index is read.
+     * \throws TscppException if the index is not valid.
+     */
+    explicit LogIndex(std::istream &is);
+
+    /**
+     * \return The block size of the log, in bytes.
+     */
+    int granularity() const { return blockSize; }
+
+    /**
+     * \param name Mangled type name.
+     * \return The offsets of the first object of the type in each block where
+     * it was found, in increasing order.
+     */
+    const std::vector<uint64_t> &offsets(const std::string &name) const;
+
+    template <typename T>
+    const std::vector<uint64_t> &offsets() const
+    {
+        return offsets(typeName<T>().str);
+    }
+
+    /**
+     * @brief Find where to start unserializing to find the first object of a
+     * type with a key larger than the given one.
+     *
+     * \param name Mangled type name.
+     * \param key Key to search.
+     * \return The offset of the last indexed object of the type whose key is
+     * not larger than key, the first indexed object if there is none, or npos
+     * if the type is not in the index.
+     */
+    uint64_t find(const std::string &name, uint64_t key) const;
+
+    template <typename T>
+    uint64_t find(uint64_t key) const
+    {
+        return find(typeName<T>().str, key);
+    }
+
+    /**
+     * @brief Define in a dictionary all the type ids defined by the compact
+     * header format before an offset, to start unserializing from there.
+     *
+     * \param td Type dictionary to use to unserialize.
+     * \param offset Offset where to start unserializing.
+     */
+    void prepare(TypeDictionary &td, uint64_t offset) const;
+
+private:
+    class TypeInfo
+    {
+    public:
+        std::string name;
+        int compactId;
+        uint64_t definitionOffset;
+        std::vector<uint64_t> offsets;
+        std::vector<uint64_t> keys;
+    };
+
+    const TypeInfo *info(const std::string &name) const;
+
+    int blockSize = 0;
+    std::vector<TypeInfo> typeInfos;  ///< Indexed by type number
+    TypeRegistry<int> typeNumbers;    ///< Type number from its name
+    std::vector<uint64_t> none;       ///< Returned for types not found
+};
+
+}  // namespace tscpp
@@ -0,0 +1,131 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+#include "mmap.h"
+
+#ifndef _MIOSIX
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <system_error>
+
+using namespace std;
+
+namespace tscpp
+{
+
+MmapReader::MmapReader(const string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw system_error(errno, system_category(), path);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        int error = errno;
+        close(fd);
+        throw system_error(error, system_category(), path);
+    }
+
+    // Mapping an empty file fails, leave it unmapped
+    fileSize = st.st_size;
+    if (fileSize > 0)
+    {
+        void *p = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            int error = errno;
+            close(fd);
+            throw system_error(error, system_category(), path);
+        }
+        madvise(p, fileSize, MADV_SEQUENTIAL);
+        begin = reinterpret_cast<const char *>(p);
+    }
+    close(fd);  // The mapping keeps the file open
+}
+
+int MmapReader::unserializeUnknown(const TypePoolBuffer &tp)
+{
+    if (pos >= fileSize)
+        return 0;
+    return advance(tscpp::unserializeUnknown(tp, begin + pos, remaining()));
+}
+
+int MmapReader::unserializeUnknown(const TypePoolBuffer &tp,
+                                   TypeDictionary &td)
+{
+    if (pos >= fileSize)
+        return 0;
+    return advance(tscpp::unserializeUnknown(tp, td, begin + pos, remaining()));
+}
+
+MmapReader::~MmapReader()
+{
+    if (begin)
+        munmap(const_cast<char *>(begin), fileSize);
+}
+
+int MmapReader::remaining() const
+{
+    // The buffer API takes int sizes, files larger than that are decoded
+    // through a sliding window
+    size_t result = fileSize - pos;
+    return result > INT_MAX ? INT_MAX : result;
+}
+
+int MmapReader::advance(int result)
+{
+    if (result > 0)
+    {
+        pos += result;
+        return result;
+    }
+
+    // Only '\0' padding left at the end of the file
+    if (result == BufferTooSmall)
+    {
+        size_t i = pos;
+        while (i < fileSize && begin[i] == '\0')
+            i++;
+        if (i == fileSize)
+        {
+            pos = fileSize;
+            return 0;
+        }
+    }
+    return result;
+}
+
+}  // namespace tscpp
+
+#endif  // _MIOSIX
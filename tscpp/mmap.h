@@ -0,0 +1,136 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file mmap.h
+ *
+ * @brief Memory mapped reader for log files, based on the buffer API.
+ *
+ * Only available on POSIX systems.
+ */
+
+#pragma once
+
+#ifndef _MIOSIX
+
+#include <cstddef>
+#include <string>
+
+#include "buffer.h"
+
+namespace tscpp
+{
+
+/**
+ * @brief Reader that maps a whole file in memory and unserializes the types
+ * it contains using a TypePoolBuffer.
+ *
+ * Serialized types are decoded directly from the mapped memory, so walking
+ * the file requires no system call per object.
+ *
+ * \code
+ * TypePoolBuffer tp;
+ * tp.registerType<Foo>([](Foo& f) { ... });
+ * MmapReader reader("log.dat");
+ * int result;
+ * while ((result = reader.unserializeUnknown(tp)) > 0) ;
+ * \endcode
+ */
+class MmapReader
+{
+public:
+    /**
+     * \param path Path of the file to map.
+     * \throws std::system_error if the file can't be opened or mapped.
+     */
+    explicit MmapReader(const std::string &path);
+
+    /**
+     * @brief Unserialize the next type in the file.
+     *
+     * \param tp Type pool where possible serialized types are registered.
+     * \return The size of the unserialized type, 0 if the end of the file has
+     * been reached, or TscppError::UnknownType if the pool does not contain
+     * the type found or TscppError::BufferTooSmall if the type is truncated.
+     * On error the position is not advanced.
+     */
+    int unserializeUnknown(const TypePoolBuffer &tp);
+
+    /**
+     * @brief Unserialize the next type in the file, accepting both the full
+     * name and the compact header format.
+     *
+     * \param tp Type pool where possible serialized types are registered.
+     * \param td Type dictionary of the serialization session.
+     * \return The size of the unserialized type, 0 if the end of the file has
+     * been reached, or TscppError::UnknownType if the pool does not contain
+     * the type found or the type id has not been defined or
+     * TscppError::BufferTooSmall if the type is truncated.
+     * On error the position is not advanced.
+     */
+    int unserializeUnknown(const TypePoolBuffer &tp, TypeDictionary &td);
+
+    /**
+     * \return Pointer to the mapped file.
+     */
+    const char *data() const { return begin; }
+
+    /**
+     * \return The file size.
+     */
+    size_t size() const { return fileSize; }
+
+    /**
+     * \return The offset of the next type to unserialize.
+     */
+    size_t position() const { return pos; }
+
+    /**
+     * \param position Offset where the next type to unserialize starts.
+     */
+    void seek(size_t position) { pos = position; }
+
+    /**
+     * Unmaps the file.
+     */
+    ~MmapReader();
+
+private:
+    MmapReader(const MmapReader &)            = delete;
+    MmapReader &operator=(const MmapReader &) = delete;
+
+    int remaining() const;
+    int advance(int result);
+
+    const char *begin = nullptr;
+    size_t fileSize   = 0;
+    size_t pos        = 0;
+};
+
+}  // namespace tscpp
+
+#endif  // _MIOSIX
@@ -0,0 +1,320 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+#include "packet.h"
+
+#ifndef _MIOSIX
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace tscpp
+{
+
+//
+// class PacketWriter
+//
+
+PacketWriter::PacketWriter(int fd, int packetSize, microseconds maxDelay,
+                           int maxPackets, bool crc, HeaderFormat format)
+    : PacketWriter(nullptr, packetSize, maxDelay, maxPackets, crc, format)
+{
+    this->fd = fd;
+}
+
+PacketWriter::PacketWriter(function<void(const char *, int)> sink,
+                           int packetSize, microseconds maxDelay,
+                           int maxPackets, bool crc, HeaderFormat format)
+    : sink(sink), packetSize(packetSize), maxDelay(maxDelay),
+      maxPackets(maxPackets), crc(crc), format(format)
+{
+    if (packetSize <= frameHeaderSize || maxPackets < 1)
+        throw invalid_argument("invalid packet size");
+    packets.resize(static_cast<size_t>(packetSize) * maxPackets);
+    sizes.resize(maxPackets);
+#ifdef __linux__
+    messages.resize(maxPackets);
+    vectors.resize(maxPackets);
+#endif
+}
+
+int PacketWriter::serializeImpl(const TypeName &name, const void *data,
+                                int size, int count)
+{
+    // The clock is read once per type, both to start the delay of the first
+    // type of a batch and to check it
+    auto now = steady_clock::now();
+    if (full == 0 && used == 0)
+        deadline = now + maxDelay;
+    int result = serializeInPacket(name, data, size, count);
+    if (result == BufferTooSmall && used > 0)
+    {
+        closePacket();
+        if (full == 0)
+            deadline = now + maxDelay;
+        result = serializeInPacket(name, data, size, count);
+    }
+    if ((full > 0 || used > 0) && now >= deadline)
+        flush();
+    return result;
+}
+
+bool PacketWriter::poll()
+{
+    if ((full == 0 && used == 0) || steady_clock::now() < deadline)
+        return false;
+    flush();
+    return true;
+}
+
+void PacketWriter::flush()
+{
+    if (used > 0)
+        closePacket();
+    if (full > 0)
+        send();
+}
+
+PacketWriter::~PacketWriter()
+{
+    // Destructors must not throw, a failing send loses the last packets
+    try
+    {
+        flush();
+    }
+    catch (...)
+    {
+    }
+}
+
+int PacketWriter::serializeInPacket(const TypeName &name, const void *data,
+                                    int size, int count)
+{
+    char *packet = &packets[static_cast<size_t>(full) * packetSize];
+    char *p      = packet + frameHeaderSize + used;
+    int space    = packetSize - frameHeaderSize - used;
+    bool compact = format == CompactHeader;
+    int result;
+    if (count < 0 && compact)
+        result = tscpp::serializeImpl(td, p, space, name, data, size);
+    else if (count < 0)
+        result = tscpp::serializeImpl(p, space, name, data, size);
+    else if (compact)
+        result = serializeArrayImpl(td, p, space, name, data, size, count, 1);
+    else
+        result = serializeArrayImpl(p, space, name, data, size, count, 1);
+    if (result > 0)
+        used += result;
+    return result;
+}
+
+void PacketWriter::closePacket()
+{
+    char *packet  = &packets[static_cast<size_t>(full) * packetSize];
+    char *payload = packet + frameHeaderSize;
+    storeLittleEndian32(packet, frameSync);
+    storeLittleEndian32(packet + 4, used | (crc ? frameCrcPresent : 0));
+    storeLittleEndian32(packet + 8, crc ? crc32(payload, used) : 0);
+    sizes[full++] = frameHeaderSize + used;
+    used          = 0;
+    td.clear();
+    if (full == maxPackets)
+        send();
+}
+
+void PacketWriter::send()
+{
+    // The packets are discarded also if sending fails
+    int count = full;
+    full      = 0;
+    if (sink)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            sink(&packets[static_cast<size_t>(i) * packetSize], sizes[i]);
+            writtenSize += sizes[i];
+        }
+        sentPackets += count;
+        return;
+    }
+
+#ifdef __linux__
+    for (int i = 0; i < count; i++)
+    {
+        vectors[i].iov_base = &packets[static_cast<size_t>(i) * packetSize];
+        vectors[i].iov_len  = sizes[i];
+        memset(&messages[i], 0, sizeof(mmsghdr));
+        messages[i].msg_hdr.msg_iov    = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (int first = 0; first < count;)
+    {
+        int n = sendmmsg(fd, messages.data() + first, count - first, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw system_error(errno, system_category(), "sendmmsg");
+        }
+        for (int i = first; i < first + n; i++)
+            writtenSize += sizes[i];
+        sentPackets += n;
+        first += n;
+    }
+#else
+    for (int i = 0; i < count; i++)
+    {
+        const char *packet = &packets[static_cast<size_t>(i) * packetSize];
+        ssize_t n;
+        while ((n = ::send(fd, packet, sizes[i], 0)) < 0 && errno == EINTR)
+            ;
+        if (n < 0)
+            throw system_error(errno, system_category(), "send");
+        writtenSize += sizes[i];
+        sentPackets++;
+    }
+#endif
+}
+
+//
+// class PacketReader
+//
+
+PacketReader::PacketReader(int fd, int packetSize, int maxPackets)
+    : fd(fd), packetSize(packetSize), maxPackets(maxPackets)
+{
+    if (packetSize <= frameHeaderSize || maxPackets < 1)
+        throw invalid_argument("invalid packet size");
+    packets.resize(static_cast<size_t>(packetSize) * maxPackets);
+#ifdef __linux__
+    messages.resize(maxPackets);
+    vectors.resize(maxPackets);
+#endif
+}
+
+int PacketReader::receive(const TypePoolBuffer &tp)
+{
+    int count = 0;
+#ifdef __linux__
+    for (int i = 0; i < maxPackets; i++)
+    {
+        vectors[i].iov_base = &packets[static_cast<size_t>(i) * packetSize];
+        vectors[i].iov_len  = packetSize;
+        memset(&messages[i], 0, sizeof(mmsghdr));
+        messages[i].msg_hdr.msg_iov    = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    int n;
+    while ((n = recvmmsg(fd, messages.data(), maxPackets, MSG_WAITFORONE,
+                         nullptr)) < 0 &&
+           errno == EINTR)
+        ;
+    if (n < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        throw system_error(errno, system_category(), "recvmmsg");
+    }
+    for (int i = 0; i < n; i++)
+    {
+        const char *packet = &packets[static_cast<size_t>(i) * packetSize];
+        int size           = messages[i].msg_len;
+        if (messages[i].msg_hdr.msg_flags & MSG_TRUNC)
+            size = 0;  // Dropped as damaged
+        int result = unserializePacket(tp, packet, size);
+        if (result > 0)
+            count += result;
+    }
+#else
+    ssize_t n;
+    while ((n = recv(fd, packets.data(), packetSize, 0)) < 0 && errno == EINTR)
+        ;
+    if (n < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        throw system_error(errno, system_category(), "recv");
+    }
+    int result = unserializePacket(tp, packets.data(), n);
+    if (result > 0)
+        count += result;
+#endif
+    return count;
+}
+
+int PacketReader::unserializePacket(const TypePoolBuffer &tp,
+                                    const void *packet, int size)
+{
+    receivedPackets++;
+    const char *header = reinterpret_cast<const char *>(packet);
+    uint32_t length    = 0;
+    bool valid =
+        size >= frameHeaderSize && loadLittleEndian32(header) == frameSync;
+    if (valid)
+    {
+        length      = loadLittleEndian32(header + 4);
+        bool hasCrc = length & frameCrcPresent;
+        length &= ~frameCrcPresent;
+        valid = length <= static_cast<uint32_t>(size - frameHeaderSize) &&
+                (hasCrc == false ||
+                 crc32(header + frameHeaderSize, length) ==
+                     loadLittleEndian32(header + 8));
+    }
+    if (valid == false)
+    {
+        droppedPackets++;
+        return BufferTooSmall;
+    }
+
+    td.clear();
+    const char *payload = header + frameHeaderSize;
+    int count           = 0;
+    for (int readSize = 0; readSize < static_cast<int>(length); count++)
+    {
+        int result = unserializeUnknown(tp, td, payload + readSize,
+                                        length - readSize);
+        if (result < 0)
+        {
+            droppedPackets++;
+            return result;
+        }
+        readSize += result;
+    }
+    return count;
+}
+
+}  // namespace tscpp
+
+#endif  // _MIOSIX
@@ -0,0 +1,295 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file packet.h
+ *
+ * @brief Packing of serialized types into packets for datagram sockets and
+ * radio links, based on the buffer API.
+ *
+ * Each packet holds one frame, as written by FrameWriter, filled with as
+ * many types as fit. With the compact header format the type dictionary is
+ * reset at each packet, so packets can be unserialized independently and
+ * losing one does not affect the others.
+ *
+ * Only available on POSIX systems, on Linux packets are sent and received
+ * in batches with sendmmsg() and recvmmsg().
+ */
+
+#pragma once
+
+#ifndef _MIOSIX
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "buffer.h"
+#include "frame.h"
+
+namespace tscpp
+{
+
+/**
+ * @brief Packs serialized types into packets, sent when they are full or
+ * when a type has been waiting for longer than a maximum delay.
+ *
+ * Full packets are gathered and sent together, so that the cost of a system
+ * call is shared by several packets. The delay is checked as types are
+ * serialized: when no more types are serialized for a while, poll() has to
+ * be called to keep the delay bounded.
+ *
+ * \code
+ * int fd = socket(AF_INET, SOCK_DGRAM, 0);
+ * connect(fd, ...);
+ * PacketWriter writer(fd, 1472, std::chrono::milliseconds(5));
+ * writer.serialize(foo);
+ * \endcode
+ */
+class PacketWriter
+{
+public:
+    /**
+     * \param fd Socket where packets are sent, connected to the destination.
+     * It is not closed by the writer.
+     * \param packetSize Maximum size of a packet, including the frame
+     * header, such as the MTU less the IP and UDP headers.
+     * \param maxDelay Maximum time from when a type is serialized to when its
+     * packet is sent.
+     * \param maxPackets Number of full packets gathered before they are sent.
+     * \param crc If true, a CRC32 of the payload is stored in each packet.
+     * \param format Header format of the serialized types.
+     * \throws std::invalid_argument if packetSize is not larger than
+     * frameHeaderSize or maxPackets is less than 1.
+     */
+    PacketWriter(int fd, int packetSize = 1472,
+                 std::chrono::microseconds maxDelay =
+                     std::chrono::milliseconds(10),
+                 int maxPackets = 16, bool crc = true,
+                 HeaderFormat format = CompactHeader);
+
+    /**
+     * \param sink Callback called with each packet and its size, for example
+     * to write it to a serial radio.
+     * \param packetSize Maximum size of a packet.
+     * \param maxDelay Maximum time from serialization to sending.
+     * \param maxPackets Number of full packets gathered before they are sent.
+     * \param crc If true, a CRC32 of the payload is stored in each packet.
+     * \param format Header format of the serialized types.
+     * \throws std::invalid_argument if packetSize or maxPackets are not valid.
+     */
+    PacketWriter(std::function<void(const char *, int)> sink,
+                 int packetSize = 1472,
+                 std::chrono::microseconds maxDelay =
+                     std::chrono::milliseconds(10),
+                 int maxPackets = 16, bool crc = true,
+                 HeaderFormat format = CompactHeader);
+
+    /**
+     * @brief Serialize a type into the current packet, starting a new one if
+     * the type does not fit.
+     *
+     * \param t Type to serialize.
+     * \return The size of the serialized type, or TscppError::BufferTooSmall
+     * if the type does not fit even in an empty packet.
+     * \throws std::system_error if sending the packets fails.
+     */
+    template <typename T>
+    int serialize(const T &t);
+
+    /**
+     * @brief Serialize an array of objects of the same type into the current
+     * packet, starting a new one if the array does not fit.
+     *
+     * \param t Pointer to the first object to serialize.
+     * \param count Number of objects to serialize.
+     * \return The size of the serialized array, or TscppError::BufferTooSmall
+     * if the array does not fit even in an empty packet.
+     * \throws std::system_error if sending the packets fails.
+     */
+    template <typename T>
+    int serializeArray(const T *t, int count);
+
+    int serializeImpl(const TypeName &name, const void *data, int size,
+                      int count);
+
+    /**
+     * @brief Send the packets if the oldest type waiting has reached the
+     * maximum delay, to be called periodically when types are serialized
+     * less often than the delay.
+     *
+     * \return True if packets were sent.
+     * \throws std::system_error if sending the packets fails.
+     */
+    bool poll();
+
+    /**
+     * @brief Send the current packet, if not empty, and the full ones.
+     *
+     * \throws std::system_error if sending fails, in which case the packets
+     * are discarded.
+     */
+    void flush();
+
+    /**
+     * \return The number of packets sent.
+     */
+    uint64_t sent() const { return sentPackets; }
+
+    /**
+     * \return The number of bytes sent, including the frame headers.
+     */
+    uint64_t written() const { return writtenSize; }
+
+    /**
+     * Sends the last packets, errors are ignored.
+     */
+    ~PacketWriter();
+
+private:
+    PacketWriter(const PacketWriter &)            = delete;
+    PacketWriter &operator=(const PacketWriter &) = delete;
+
+    int serializeInPacket(const TypeName &name, const void *data, int size,
+                          int count);
+    void closePacket();
+    void send();
+
+    int fd = -1;
+    std::function<void(const char *, int)> sink;  ///< If empty, sent to fd
+    int packetSize;
+    std::chrono::microseconds maxDelay;
+    int maxPackets;
+    bool crc;
+    HeaderFormat format;
+    std::vector<char> packets;  ///< maxPackets buffers of packetSize bytes
+    std::vector<int> sizes;     ///< Sizes of the full packets
+    int full = 0;               ///< Full packets, the current one follows
+    int used = 0;               ///< Payload bytes of the current packet
+    std::chrono::steady_clock::time_point deadline;  ///< Of the oldest type
+    TypeDictionary td;  ///< Reset at each packet
+#ifdef __linux__
+    std::vector<mmsghdr> messages;  ///< Reused by sendmmsg()
+    std::vector<iovec> vectors;
+#endif
+    uint64_t sentPackets = 0;
+    uint64_t writtenSize = 0;
+};
+
+template <typename T>
+int PacketWriter::serialize(const T &t)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+    return serializeImpl(typeName<T>(), &t, sizeof(T), -1);
+}
+
+template <typename T>
+int PacketWriter::serializeArray(const T *t, int count)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+    return serializeImpl(typeName<T>(), t, sizeof(T), count);
+}
+
+/**
+ * @brief Receives packets written by PacketWriter and unserializes their
+ * types.
+ *
+ * Damaged packets, and the rest of packets containing types not in the pool,
+ * are skipped and counted by dropped().
+ */
+class PacketReader
+{
+public:
+    /**
+     * \param fd Socket where packets are received, not closed by the reader.
+     * \param packetSize Maximum size of a packet, larger ones are truncated
+     * and dropped.
+     * \param maxPackets Maximum number of packets received at once.
+     * \throws std::invalid_argument if packetSize or maxPackets are not valid.
+     */
+    explicit PacketReader(int fd, int packetSize = 1472, int maxPackets = 16);
+
+    /**
+     * @brief Receive the packets available, waiting for the first one if the
+     * socket is blocking, and unserialize their types.
+     *
+     * \param tp Type pool where possible serialized types are registered.
+     * \return The number of types unserialized, 0 if the socket is non
+     * blocking and no packet was available.
+     * \throws std::system_error if receiving fails.
+     */
+    int receive(const TypePoolBuffer &tp);
+
+    /**
+     * @brief Unserialize the types in a packet received by other means.
+     *
+     * \param tp Type pool where possible serialized types are registered.
+     * \param packet The packet.
+     * \param size Packet size.
+     * \return The number of types unserialized, or TscppError::BufferTooSmall
+     * if the packet is damaged or TscppError::UnknownType if a type is not in
+     * the pool, in which case the rest of the packet is skipped.
+     */
+    int unserializePacket(const TypePoolBuffer &tp, const void *packet,
+                          int size);
+
+    /**
+     * \return The number of packets received, including the dropped ones.
+     */
+    uint64_t received() const { return receivedPackets; }
+
+    /**
+     * \return The number of packets damaged or with types not in the pool.
+     */
+    uint64_t dropped() const { return droppedPackets; }
+
+private:
+    PacketReader(const PacketReader &)            = delete;
+    PacketReader &operator=(const PacketReader &) = delete;
+
+    int fd;
+    int packetSize;
+    int maxPackets;
+    std::vector<char> packets;  ///< maxPackets buffers of packetSize bytes
+    TypeDictionary td;          ///< Reset at each packet
+#ifdef __linux__
+    std::vector<mmsghdr> messages;  ///< Reused by recvmmsg()
+    std::vector<iovec> vectors;
+#endif
+    uint64_t receivedPackets = 0;
+    uint64_t droppedPackets  = 0;
+};
+
+}  // namespace tscpp
+
+#endif  // _MIOSIX
@@ -0,0 +1,162 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <thread>
+
+using namespace std;
+
+namespace tscpp
+{
+
+int ParallelDecoder::scan(const void *buffer, size_t bufSize)
+{
+    return scan(nullptr, buffer, bufSize);
+}
+
+int ParallelDecoder::scan(TypeDictionary &td, const void *buffer,
+                          size_t bufSize)
+{
+    return scan(&td, buffer, bufSize);
+}
+
+void ParallelDecoder::decode(int threads, Order order, int chunkSize) const
+{
+    if (threads <= 1)
+    {
+        for (auto &r : records)
+            tp.unserializeScanned(r.st, buffer + r.offset);
+        return;
+    }
+
+    vector<vector<const Record *>> owned;
+    if (order == TypeOrder)
+        owned = partition(threads);
+
+    atomic<size_t> next(0);
+    auto worker = [&](int id)
+    {
+        if (order == TypeOrder)
+        {
+            for (auto r : owned[id])
+                tp.unserializeScanned(r->st, buffer + r->offset);
+            return;
+        }
+
+        for (;;)
+        {
+            size_t begin = next.fetch_add(chunkSize);
+            if (begin >= records.size())
+                return;
+            size_t end = min(begin + chunkSize, records.size());
+            for (size_t i = begin; i < end; i++)
+            {
+                const Record &r = records[i];
+                tp.unserializeScanned(r.st, buffer + r.offset);
+            }
+        }
+    };
+
+    vector<thread> pool;
+    for (int i = 1; i < threads; i++)
+        pool.emplace_back(worker, i);
+    worker(0);
+    for (auto &t : pool)
+        t.join();
+}
+
+vector<vector<const ParallelDecoder::Record *>> ParallelDecoder::partition(
+    int threads) const
+{
+    // Objects of each type, batches count as the objects in them
+    vector<size_t> weights(tp.registeredTypes(), 0);
+    for (auto &r : records)
+        weights[r.st.type] += r.st.count < 0 ? 1 : r.st.count;
+
+    // Types with the most objects first, each to the least loaded thread
+    vector<int> types;
+    for (size_t i = 0; i < weights.size(); i++)
+        if (weights[i] > 0)
+            types.push_back(i);
+    sort(types.begin(), types.end(),
+         [&](int a, int b) { return weights[a] > weights[b]; });
+    vector<size_t> loads(threads, 0);
+    vector<int> owners(weights.size(), 0);
+    for (int type : types)
+    {
+        int owner = min_element(loads.begin(), loads.end()) - loads.begin();
+        owners[type] = owner;
+        loads[owner] += weights[type];
+    }
+
+    vector<vector<const Record *>> owned(threads);
+    for (auto &r : records)
+        owned[owners[r.st.type]].push_back(&r);
+    return owned;
+}
+
+int ParallelDecoder::scan(TypeDictionary *td, const void *buffer,
+                          size_t bufSize)
+{
+    this->buffer = reinterpret_cast<const char *>(buffer);
+    scanned      = 0;
+    records.clear();
+    while (scanned < bufSize)
+    {
+        // The buffer API takes int sizes
+        size_t remaining = bufSize - scanned;
+        int size         = remaining > INT_MAX ? INT_MAX : remaining;
+        Record r;
+        r.offset = scanned;
+        int result;
+        if (td)
+            result = scanUnknown(tp, *td, this->buffer + scanned, size, r.st);
+        else
+            result = scanUnknown(tp, this->buffer + scanned, size, r.st);
+        if (result < 0)
+        {
+            // Only '\0' padding left at the end of the buffer
+            if (result == BufferTooSmall &&
+                all_of(this->buffer + scanned, this->buffer + bufSize,
+                       [](char c) { return c == '\0'; }))
+            {
+                scanned = bufSize;
+                return 0;
+            }
+            return result;
+        }
+        records.push_back(r);
+        scanned += result;
+    }
+    return 0;
+}
+
+}  // namespace tscpp
@@ -0,0 +1,152 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file parallel.h
+ *
+ * @brief Multi-threaded unserialization of large buffers, such as log files
+ * mapped with MmapReader.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "buffer.h"
+
+namespace tscpp
+{
+
+/**
+ * @brief Decoder that unserializes a buffer in two phases: a sequential scan
+ * finds where each serialized type starts using the sizes registered in the
+ * type pool, then a pool of threads calls the callbacks.
+ *
+ * Delta encoded objects can't be decoded out of order, as each one is built
+ * from the previous one, so the scan stops at the first one.
+ *
+ * \code
+ * MmapReader reader("log.dat");
+ * ParallelDecoder pd(tp);
+ * if (pd.scan(reader.data(), reader.size()) == 0)
+ *     pd.decode(std::thread::hardware_concurrency());
+ * \endcode
+ */
+class ParallelDecoder
+{
+public:
+    /**
+     * @brief Order in which the callbacks are called by decode().
+     */
+    enum Order
+    {
+        /// Any order, callbacks may be called concurrently also for the same
+        /// type, and must be thread safe
+        AnyOrder,
+        /// All the objects of a type are unserialized by the same thread, in
+        /// the order they were serialized. Types are spread across the
+        /// threads by number of objects, so a type with most of the objects
+        /// keeps one thread busy for longer than the others
+        TypeOrder
+    };
+
+    /**
+     * \param tp Type pool where possible serialized types are registered, it
+     * must not be modified while the decoder is in use.
+     */
+    explicit ParallelDecoder(const TypePoolBuffer &tp) : tp(tp) {}
+
+    /**
+     * @brief Find all the types in a buffer, without unserializing them.
+     *
+     * \param buffer Pointer to buffer where the serialized types are, it must
+     * remain valid until decode() returns.
+     * \param bufSize Buffer size.
+     * \return 0 on success, or TscppError::UnknownType or
+     * TscppError::BufferTooSmall for the type at scannedSize(). Types found
+     * before the error are still decoded by decode(). Delta encoded objects
+     * are reported as TscppError::UnknownType.
+     */
+    int scan(const void *buffer, size_t bufSize);
+
+    /**
+     * @brief Find all the types in a buffer, without unserializing them,
+     * accepting both the full name and the compact header format.
+     *
+     * \param td Type dictionary of the serialization session.
+     * \param buffer Pointer to buffer where the serialized types are, it must
+     * remain valid until decode() returns.
+     * \param bufSize Buffer size.
+     * \return 0 on success, or TscppError::UnknownType or
+     * TscppError::BufferTooSmall for the type at scannedSize(). Delta
+     * encoded objects are reported as TscppError::UnknownType.
+     */
+    int scan(TypeDictionary &td, const void *buffer, size_t bufSize);
+
+    /**
+     * \return The number of bytes scanned, equal to the buffer size if the
+     * scan succeeded.
+     */
+    size_t scannedSize() const { return scanned; }
+
+    /**
+     * \return The number of serialized types found, batches count as one.
+     */
+    size_t size() const { return records.size(); }
+
+    /**
+     * @brief Unserialize all the types found by scan().
+     *
+     * \param threads Number of threads to use, if 1 the types are
+     * unserialized by the calling thread in the order they were serialized.
+     * \param order Order in which the callbacks are called.
+     * \param chunkSize Number of types each thread unserializes at once.
+     */
+    void decode(int threads, Order order = AnyOrder,
+                int chunkSize = 1024) const;
+
+private:
+    int scan(TypeDictionary *td, const void *buffer, size_t bufSize);
+
+    class Record
+    {
+    public:
+        size_t offset;
+        ScannedType st;
+    };
+
+    /// The records unserialized by each thread with TypeOrder
+    std::vector<std::vector<const Record *>> partition(int threads) const;
+
+    const TypePoolBuffer &tp;
+    const char *buffer = nullptr;
+    size_t scanned     = 0;
+    std::vector<Record> records;  ///< Types found, in serialization order
+};
+
+}  // namespace tscpp
@@ -0,0 +1,414 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+#include "pipeline.h"
+
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+
+namespace tscpp
+{
+
+LogPipeline::LogPipeline(ostream &os, int bufferCount, int bufferSize)
+    : LogPipeline([&os](const char *data, int size) { os.write(data, size); },
+                  bufferCount, bufferSize)
+{
+}
+
+LogPipeline::LogPipeline(function<void(const char *, int)> sink,
+                         int bufferCount, int bufferSize)
+    : sink(sink), bufferCount(bufferCount), bufferSize(bufferSize),
+      current(0), freeBuffers(bufferCount), fullBuffers(bufferCount)
+{
+    if (bufferCount < 2 || bufferSize <= 0)
+        throw invalid_argument("invalid buffer pool");
+
+    storage.reset(new char[bufferCount * bufferSize]);
+    buffers.reset(new Buffer[bufferCount]);
+    for (int i = 0; i < bufferCount; i++)
+    {
+        // All buffers but the current one start sealed
+        buffers[i].reserved.store(i == 0 ? 0 : bufferSize + 1);
+        buffers[i].committed.store(0);
+        if (i > 0)
+            freeBuffers.push(i);
+    }
+    writer = thread(&LogPipeline::run, this);
+}
+
+void LogPipeline::flush()
+{
+    int c = current.load(memory_order_acquire);
+    if (c < 0 || buffers[c].reserved.load(memory_order_relaxed) == 0)
+        return;
+
+    // Reserve more than the whole buffer, so that it gets sealed. If another
+    // thread sealed it in the meantime there is nothing to do
+    int old = buffers[c].reserved.fetch_add(bufferSize + 1);
+    if (old <= bufferSize)
+        seal(c, old);
+}
+
+void LogPipeline::stop()
+{
+    if (writer.joinable() == false)
+        return;
+    flush();
+    stopping.store(true);
+    writerCv.notify_one();
+    writer.join();
+}
+
+LogPipeline::~LogPipeline() { stop(); }
+
+bool LogPipeline::reserve(int size, char *&data, int &buffer)
+{
+    if (size > bufferSize)
+    {
+        dropCount.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    for (;;)
+    {
+        int c = current.load(memory_order_acquire);
+        if (c < 0)
+        {
+            // All buffers were full when the last one was sealed, try to
+            // install one that has been written in the meantime
+            int f;
+            if (freeBuffers.pop(f) == false)
+            {
+                dropCount.fetch_add(1, memory_order_relaxed);
+                return false;
+            }
+            if (current.compare_exchange_strong(c, f))
+                buffers[f].reserved.store(0, memory_order_release);
+            else
+                freeBuffers.push(f);
+            continue;
+        }
+
+        // Producers still holding a stale index fail here, as buffers that
+        // are not current are sealed
+        int old = buffers[c].reserved.fetch_add(size);
+        if (old + size <= bufferSize)
+        {
+            data   = storage.get() + c * bufferSize + old;
+            buffer = c;
+            return true;
+        }
+        // The first producer not fitting in the buffer seals it
+        if (old <= bufferSize)
+            seal(c, old);
+    }
+}
+
+void LogPipeline::seal(int buffer, int used)
+{
+    memset(storage.get() + buffer * bufferSize + used, 0, bufferSize - used);
+
+    // Install the next buffer while the sealed one is still sealed, and only
+    // then open it, so that stale producers can't reserve in it
+    int f;
+    if (freeBuffers.pop(f))
+    {
+        current.store(f, memory_order_release);
+        buffers[f].reserved.store(0, memory_order_release);
+    }
+    else
+    {
+        current.store(-1, memory_order_release);
+    }
+
+    // The extra byte tells a complete buffer apart from one that has been
+    // exactly filled but not yet sealed
+    commit(buffer, bufferSize - used + 1);
+}
+
+void LogPipeline::commit(int buffer, int size)
+{
+    Buffer &b = buffers[buffer];
+    if (b.committed.fetch_add(size, memory_order_acq_rel) + size !=
+        bufferSize + 1)
+        return;
+
+    b.committed.store(0, memory_order_relaxed);
+    int p = pending.fetch_add(1) + 1;
+    int h = highWater.load(memory_order_relaxed);
+    while (p > h && highWater.compare_exchange_weak(h, p) == false)
+        ;
+    fullBuffers.push(buffer);
+    writerCv.notify_one();
+}
+
+bool LogPipeline::writeOne()
+{
+    int b;
+    if (fullBuffers.pop(b) == false)
+        return false;
+    sink(storage.get() + b * bufferSize, bufferSize);
+    freeBuffers.push(b);
+    pending.fetch_sub(1);
+    return true;
+}
+
+void LogPipeline::run()
+{
+    for (;;)
+    {
+        if (writeOne())
+            continue;
+        if (stopping.load())
+        {
+            while (writeOne())
+                ;
+            return;
+        }
+
+        // Producers notify without taking the mutex, so a wakeup may be
+        // missed, the timeout bounds the resulting latency
+        unique_lock<mutex> l(writerMutex);
+        writerCv.wait_for(l, chrono::milliseconds(10));
+    }
+}
+
+//
+// class LogProducer
+//
+
+void *LogProducer::operator new[](size_t size)
+{
+    // The distance from the start of the allocation, from 1 to cacheLine, is
+    // stored in the byte before the array
+    char *raw = static_cast<char *>(::operator new(size + cacheLine));
+    int skip  = cacheLine - reinterpret_cast<uintptr_t>(raw) % cacheLine;
+    raw[skip - 1] = skip;
+    return raw + skip;
+}
+
+void LogProducer::operator delete[](void *p)
+{
+    unsigned char *array = static_cast<unsigned char *>(p);
+    ::operator delete(array - array[-1]);
+}
+
+char *LogProducer::reserve(int entrySize)
+{
+    unsigned int aligned = (entrySize + 7) & ~7;
+    unsigned int pos     = nextTail;  // Equal to tail, without reading it
+    unsigned int index   = pos & (size - 1);
+    unsigned int needed  = aligned;
+    if (aligned > size - index)
+        needed += size - index;  // Skip the end of the ring
+    if (needed > size - (pos - cachedHead))
+    {
+        // Only read the consumer cache line when the ring seems full
+        cachedHead = head.load(memory_order_acquire);
+        if (needed > size - (pos - cachedHead))
+            return nullptr;
+    }
+
+    if (needed != aligned)
+    {
+        memset(data.get() + index, 0, 4);  // Wrap marker
+        index = 0;
+    }
+    char *entry         = data.get() + index;
+    uint32_t recordSize = entrySize - headerSize;
+    memcpy(entry, &aligned, 4);
+    memcpy(entry + 4, &recordSize, 4);
+    nextTail = pos + needed;
+    return entry;
+}
+
+const char *LogProducer::front()
+{
+    unsigned int pos = head.load(memory_order_relaxed);
+    for (;;)
+    {
+        if (pos == tail.load(memory_order_acquire))
+            return nullptr;
+        unsigned int index = pos & (size - 1);
+        uint32_t entrySize;
+        memcpy(&entrySize, data.get() + index, 4);
+        if (entrySize != 0)
+            return data.get() + index;
+
+        pos += size - index;
+        head.store(pos, memory_order_release);
+    }
+}
+
+void LogProducer::pop()
+{
+    unsigned int pos = head.load(memory_order_relaxed);
+    uint32_t entrySize;
+    memcpy(&entrySize, data.get() + (pos & (size - 1)), 4);
+    head.store(pos + entrySize, memory_order_release);
+}
+
+//
+// class ShardedLogPipeline
+//
+
+ShardedLogPipeline::ShardedLogPipeline(ostream &os, int maxProducers,
+                                       int ringSize, int blockSize)
+    : ShardedLogPipeline([&os](const char *data, int size)
+                         { os.write(data, size); },
+                         maxProducers, ringSize, blockSize)
+{
+}
+
+ShardedLogPipeline::ShardedLogPipeline(function<void(const char *, int)> sink,
+                                       int maxProducers, int ringSize,
+                                       int blockSize)
+    : sink(sink), maxProducers(maxProducers), blockSize(blockSize)
+{
+    if (maxProducers <= 0 || ringSize <= 0 || blockSize <= 0)
+        throw invalid_argument("invalid ring size");
+
+    unsigned int size = 64;
+    while (size < static_cast<unsigned int>(ringSize))
+        size *= 2;
+    producers.reset(new LogProducer[maxProducers]);
+    for (int i = 0; i < maxProducers; i++)
+    {
+        producers[i].data.reset(new char[size]);
+        producers[i].size = size;
+    }
+    block.reset(new char[blockSize]);
+    writer = thread(&ShardedLogPipeline::run, this);
+}
+
+LogProducer *ShardedLogPipeline::producer()
+{
+    int i = producerCount.load();
+    do
+    {
+        if (i >= maxProducers)
+            return nullptr;
+    } while (producerCount.compare_exchange_weak(i, i + 1) == false);
+    return &producers[i];
+}
+
+void ShardedLogPipeline::stop()
+{
+    if (writer.joinable() == false)
+        return;
+    stopping.store(true);
+    writer.join();
+}
+
+unsigned int ShardedLogPipeline::drops() const
+{
+    unsigned int result = 0;
+    for (int i = 0; i < maxProducers; i++)
+        result += producers[i].drops();
+    return result;
+}
+
+ShardedLogPipeline::~ShardedLogPipeline() { stop(); }
+
+bool ShardedLogPipeline::drain()
+{
+    // Merge the entries currently in the rings, oldest first
+    int count   = producerCount.load();
+    bool result = false;
+    for (;;)
+    {
+        LogProducer *oldest = nullptr;
+        const char *entry   = nullptr;
+        uint64_t oldestKey  = numeric_limits<uint64_t>::max();
+        for (int i = 0; i < count; i++)
+        {
+            const char *e = producers[i].front();
+            if (e == nullptr)
+                continue;
+            uint64_t key;
+            memcpy(&key, e + 8, sizeof(key));
+            if (oldest == nullptr || key < oldestKey)
+            {
+                oldest    = &producers[i];
+                entry     = e;
+                oldestKey = key;
+            }
+        }
+        if (oldest == nullptr)
+            return result;
+
+        uint32_t recordSize;
+        memcpy(&recordSize, entry + 4, 4);
+        append(entry + LogProducer::headerSize, recordSize);
+        oldest->pop();
+        result = true;
+    }
+}
+
+void ShardedLogPipeline::append(const char *data, int size)
+{
+    while (size > 0)
+    {
+        int n = min(size, blockSize - used);
+        memcpy(block.get() + used, data, n);
+        used += n;
+        data += n;
+        size -= n;
+        if (used == blockSize)
+        {
+            sink(block.get(), blockSize);
+            used = 0;
+        }
+    }
+}
+
+void ShardedLogPipeline::run()
+{
+    for (;;)
+    {
+        if (drain())
+            continue;
+        if (stopping.load())
+        {
+            drain();
+            if (used > 0)
+                sink(block.get(), used);
+            used = 0;
+            return;
+        }
+
+        // Producers don't notify the writer, to keep their hot path free of
+        // shared state, so it polls
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+}  // namespace tscpp
@@ -0,0 +1,329 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file pipeline.h
+ *
+ * @brief Lock-free logging pipeline built on the buffer API.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+#include "buffer.h"
+#include "queue.h"
+
+namespace tscpp
+{
+
+/**
+ * @brief Logger where many threads serialize objects into a pool of buffers,
+ * and a background thread writes the full buffers out.
+ *
+ * Producers reserve space in the current buffer with a single atomic
+ * increment and serialize into it with the buffer API format, so log()
+ * never takes a lock and never waits for the writer. When no buffer is
+ * available the object is dropped and counted.
+ *
+ * Buffers are always written whole, the unused tail of each buffer is filled
+ * with '\0', which is skipped as padding when unserializing.
+ */
+class LogPipeline
+{
+public:
+    /**
+     * \param os Output stream where full buffers are written.
+     * \param bufferCount Number of buffers in the pool, at least 2.
+     * \param bufferSize Size of each buffer, must fit the largest object.
+     */
+    LogPipeline(std::ostream &os, int bufferCount, int bufferSize);
+
+    /**
+     * \param sink Callback called by the writer thread with each full buffer
+     * and its size. It must not throw.
+     * \param bufferCount Number of buffers in the pool, at least 2.
+     * \param bufferSize Size of each buffer, must fit the largest object.
+     */
+    LogPipeline(std::function<void(const char *, int)> sink, int bufferCount,
+                int bufferSize);
+
+    /**
+     * @brief Serialize an object into the pipeline, can be called
+     * concurrently by many threads.
+     *
+     * \param t Object to serialize.
+     * \return true if the object was logged, false if it was dropped because
+     * all buffers are waiting to be written.
+     */
+    template <typename T>
+    bool log(const T &t);
+
+    /**
+     * @brief Hand the partially filled buffer, if any, to the writer thread.
+     */
+    void flush();
+
+    /**
+     * @brief Flush, write all pending buffers and stop the writer thread.
+     * Producers must not be logging anymore.
+     */
+    void stop();
+
+    /**
+     * \return The number of objects dropped so far.
+     */
+    unsigned int drops() const { return dropCount.load(); }
+
+    /**
+     * \return The maximum number of buffers that have been waiting to be
+     * written at the same time. If it reaches the pool size the writer is
+     * too slow and objects are being dropped.
+     */
+    int highWaterMark() const { return highWater.load(); }
+
+    /**
+     * Calls stop().
+     */
+    ~LogPipeline();
+
+private:
+    LogPipeline(const LogPipeline &)            = delete;
+    LogPipeline &operator=(const LogPipeline &) = delete;
+
+    bool reserve(int size, char *&data, int &buffer);
+    void seal(int buffer, int used);
+    void commit(int buffer, int size);
+    bool writeOne();
+    void run();
+
+    class Buffer
+    {
+    public:
+        /// Bytes reserved by producers, more than the buffer size once sealed
+        std::atomic<int> reserved;
+        /// Bytes serialized, the buffer is complete at bufferSize + 1
+        std::atomic<int> committed;
+    };
+
+    std::function<void(const char *, int)> sink;
+    int bufferCount;
+    int bufferSize;
+    std::unique_ptr<char[]> storage;
+    std::unique_ptr<Buffer[]> buffers;
+    std::atomic<int> current;  ///< Buffer being filled, -1 if none
+    MpmcQueue<int> freeBuffers;
+    MpmcQueue<int> fullBuffers;
+    std::atomic<int> pending{0};  ///< Buffers waiting to be written
+    std::atomic<int> highWater{0};
+    std::atomic<unsigned int> dropCount{0};
+    std::atomic<bool> stopping{false};
+    std::mutex writerMutex;  ///< Only used by the writer thread to sleep
+    std::condition_variable writerCv;
+    std::thread writer;
+};
+
+template <typename T>
+bool LogPipeline::log(const T &t)
+{
+    const TypeName &name = typeName<T>();
+    int size             = name.size + 1 + sizeof(T);
+    char *data;
+    int buffer;
+    if (reserve(size, data, buffer) == false)
+        return false;
+    serialize(data, size, t);
+    commit(buffer, size);
+    return true;
+}
+
+/**
+ * @brief Single producer ring of serialized objects, one per producer thread
+ * of a ShardedLogPipeline.
+ *
+ * Each entry is an 8 byte aligned header with the entry size and an ordering
+ * key, followed by the object serialized with the buffer API format. An
+ * entry size of zero tells the consumer to wrap to the start of the ring.
+ */
+class LogProducer
+{
+public:
+    /**
+     * @brief Serialize an object into the ring, must only be called by the
+     * thread that owns this producer.
+     *
+     * \param t Object to serialize.
+     * \return true if the object was logged, false if it was dropped because
+     * the ring is full.
+     */
+    template <typename T>
+    bool log(const T &t);
+
+    /**
+     * \return The number of objects dropped so far.
+     */
+    unsigned int drops() const { return dropCount.load(); }
+
+    // Before C++17 new ignores the alignment of the type, so the array of
+    // producers is aligned by hand. Public only for the array deleter
+    static void *operator new[](std::size_t size);
+    static void operator delete[](void *p);
+
+private:
+    LogProducer() = default;
+    LogProducer(const LogProducer &)            = delete;
+    LogProducer &operator=(const LogProducer &) = delete;
+
+    static const int headerSize = 16;  ///< Entry size, padding and key
+    static const int cacheLine  = 64;
+
+    char *reserve(int size);
+    void publish() { tail.store(nextTail, std::memory_order_release); }
+    const char *front();
+    void pop();
+
+    // Read by both sides, only written before the producer is handed out
+    alignas(cacheLine) std::unique_ptr<char[]> data;
+    unsigned int size = 0;  ///< Ring size, a power of two
+
+    // Producer side, nextTail is the tail after the last reserved entry
+    alignas(cacheLine) unsigned int nextTail = 0;
+    unsigned int cachedHead = 0;  ///< Last head read by the producer
+    std::atomic<unsigned int> dropCount{0};
+
+    alignas(cacheLine) std::atomic<unsigned int> tail{0};  ///< By the producer
+    alignas(cacheLine) std::atomic<unsigned int> head{0};  ///< By the consumer
+
+    friend class ShardedLogPipeline;
+};
+
+/**
+ * @brief Logger where each producer thread serializes objects into its own
+ * ring, and a background thread merges the rings and writes them out.
+ *
+ * Unlike LogPipeline producers share no state on the hot path, so logging
+ * scales with the number of cores. Each object is tagged with a steady clock
+ * timestamp, and the writer thread merges the objects available in all the
+ * rings in timestamp order. Objects are written in blocks of the given size,
+ * an object may span two blocks.
+ */
+class ShardedLogPipeline
+{
+public:
+    /**
+     * \param os Output stream where blocks are written.
+     * \param maxProducers Maximum number of producer threads.
+     * \param ringSize Size of the ring of each producer, rounded up to a
+     * power of two.
+     * \param blockSize Size of the blocks written.
+     */
+    ShardedLogPipeline(std::ostream &os, int maxProducers, int ringSize,
+                       int blockSize = 4096);
+
+    /**
+     * \param sink Callback called by the writer thread with each block and
+     * its size. All blocks are blockSize bytes except the last one. It must
+     * not throw.
+     * \param maxProducers Maximum number of producer threads.
+     * \param ringSize Size of the ring of each producer, rounded up to a
+     * power of two.
+     * \param blockSize Size of the blocks written.
+     */
+    ShardedLogPipeline(std::function<void(const char *, int)> sink,
+                       int maxProducers, int ringSize, int blockSize = 4096);
+
+    /**
+     * @brief Get a new producer, to be called once by each producer thread.
+     *
+     * \return The producer, or nullptr if maxProducers have already been
+     * created. It is owned by the pipeline.
+     */
+    LogProducer *producer();
+
+    /**
+     * @brief Write all the logged objects and stop the writer thread.
+     * Producers must not be logging anymore.
+     */
+    void stop();
+
+    /**
+     * \return The number of objects dropped so far by all producers.
+     */
+    unsigned int drops() const;
+
+    /**
+     * Calls stop().
+     */
+    ~ShardedLogPipeline();
+
+private:
+    ShardedLogPipeline(const ShardedLogPipeline &)            = delete;
+    ShardedLogPipeline &operator=(const ShardedLogPipeline &) = delete;
+
+    bool drain();
+    void append(const char *data, int size);
+    void run();
+
+    std::function<void(const char *, int)> sink;
+    int maxProducers;
+    std::unique_ptr<LogProducer[]> producers;
+    std::atomic<int> producerCount{0};
+    std::unique_ptr<char[]> block;
+    int blockSize;
+    int used = 0;  ///< Bytes of block already filled
+    std::atomic<bool> stopping{false};
+    std::thread writer;
+};
+
+template <typename T>
+bool LogProducer::log(const T &t)
+{
+    const TypeName &name = typeName<T>();
+    int recordSize       = name.size + 1 + sizeof(T);
+    char *entry          = reserve(headerSize + recordSize);
+    if (entry == nullptr)
+    {
+        dropCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    uint64_t key = std::chrono::steady_clock::now().time_since_epoch().count();
+    memcpy(entry + 8, &key, sizeof(key));
+    serialize(entry + headerSize, recordSize, t);
+    publish();
+    return true;
+}
+
+}  // namespace tscpp
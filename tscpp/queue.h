@@ -0,0 +1,152 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file queue.h
+ *
+ * @brief Lock-free bounded queues used to pass buffers between threads.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+namespace tscpp
+{
+
+/**
+ * @brief Bounded multi-producer multi-consumer lock-free queue.
+ *
+ * Each slot has a sequence number which tells producers and consumers whether
+ * the slot is free or full in the current lap over the ring, so push and pop
+ * only need a compare and swap on the respective index. Neither operation
+ * ever blocks, they fail if the queue is full or empty.
+ *
+ * \tparam T Type of the queued elements, should be cheap to copy.
+ */
+template <typename T>
+class MpmcQueue
+{
+public:
+    /**
+     * \param capacity Minimum number of elements the queue can hold, it is
+     * rounded up to a power of two.
+     */
+    explicit MpmcQueue(int capacity)
+    {
+        while (size < static_cast<unsigned int>(capacity))
+            size *= 2;
+        slots.reset(new Slot[size]);
+        for (unsigned int i = 0; i < size; i++)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /**
+     * \param t Element to add to the queue.
+     * \return true on success, false if the queue is full.
+     */
+    bool push(const T &t)
+    {
+        unsigned int pos = tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot &s          = slots[pos & (size - 1)];
+            unsigned int seq = s.sequence.load(std::memory_order_acquire);
+            int diff         = static_cast<int>(seq - pos);
+            if (diff == 0)
+            {
+                if (tail.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+                {
+                    s.value = t;
+                    s.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * \param t Element removed from the queue.
+     * \return true on success, false if the queue is empty.
+     */
+    bool pop(T &t)
+    {
+        unsigned int pos = head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot &s          = slots[pos & (size - 1)];
+            unsigned int seq = s.sequence.load(std::memory_order_acquire);
+            int diff         = static_cast<int>(seq - (pos + 1));
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+                {
+                    t = s.value;
+                    s.sequence.store(pos + size, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    MpmcQueue(const MpmcQueue &)            = delete;
+    MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+    class Slot
+    {
+    public:
+        std::atomic<unsigned int> sequence;
+        T value;
+    };
+
+    unsigned int size = 1;  ///< Number of slots, a power of two
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<unsigned int> head{0};  ///< Next slot to pop
+    std::atomic<unsigned int> tail{0};  ///< Next slot to push
+};
+
+}  // namespace tscpp
@@ -0,0 +1,193 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file registry.h
+ *
+ * @brief Hash table of the types registered in a type pool.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "format.h"
+
+namespace tscpp
+{
+
+/**
+ * @brief Associative container from type names to values, used by the type
+ * pools.
+ *
+ * Entries are stored in a flat array, indexed by an open addressing hash table
+ * of the name hashes. Lookups take the name as a pointer and length, so they
+ * can be performed directly on the serialized bytes without allocating.
+ *
+ * \tparam V Type of the value associated to each type name.
+ */
+template <typename V>
+class TypeRegistry
+{
+public:
+    /**
+     * @brief Return the value associated to a type name, adding a default
+     * constructed value if the name is not present.
+     *
+     * \param name Mangled type name.
+     * \return The associated value.
+     */
+    V &insert(const char *name)
+    {
+        int nameSize  = strlen(name);
+        uint32_t hash = hashTypeName(name, nameSize);
+        int slot      = findSlot(name, nameSize, hash);
+        if (buckets.empty() == false && buckets[slot] >= 0)
+            return entries[buckets[slot]].value;
+
+        Entry e;
+        e.name.assign(name, nameSize);
+        e.hash = hash;
+        entries.push_back(e);
+        // Keep the load factor below one half
+        if (2 * entries.size() > buckets.size())
+            rehash(buckets.empty() ? 16 : 2 * buckets.size());
+        else
+            buckets[slot] = entries.size() - 1;
+        return entries.back().value;
+    }
+
+    /**
+     * \param name Mangled type name, not necessarily '\0' terminated.
+     * \param nameSize Length of the name.
+     * \param hash Hash of the name, as returned by hashTypeName().
+     * \return The associated value, or nullptr if the name is not present.
+     */
+    const V *find(const char *name, int nameSize, uint32_t hash) const
+    {
+        int i = index(name, nameSize, hash);
+        return i >= 0 ? &entries[i].value : nullptr;
+    }
+
+    /**
+     * \param name Mangled type name, not necessarily '\0' terminated.
+     * \param nameSize Length of the name.
+     * \param hash Hash of the name, as returned by hashTypeName().
+     * \return The index of the name, which can be passed to at(), or -1 if
+     * the name is not present. Indices are assigned in insertion order.
+     */
+    int index(const char *name, int nameSize, uint32_t hash) const
+    {
+        if (buckets.empty())
+            return -1;
+        return buckets[findSlot(name, nameSize, hash)];
+    }
+
+    /**
+     * \param index Index of a name, as returned by index().
+     * \return The associated value.
+     */
+    const V &at(int index) const { return entries[index].value; }
+
+    /**
+     * \param index Index of a name, as returned by index().
+     * \return The associated value.
+     */
+    V &at(int index) { return entries[index].value; }
+
+    /**
+     * \param index Index of a name, as returned by index().
+     * \return The name.
+     */
+    const std::string &name(int index) const { return entries[index].name; }
+
+    /**
+     * \param name Mangled type name.
+     * \return The associated value, or nullptr if the name is not present.
+     */
+    const V *find(const char *name) const
+    {
+        int nameSize = strlen(name);
+        return find(name, nameSize, hashTypeName(name, nameSize));
+    }
+
+    /**
+     * \return The number of registered types.
+     */
+    int size() const { return entries.size(); }
+
+private:
+    class Entry
+    {
+    public:
+        std::string name;
+        uint32_t hash;
+        V value;
+    };
+
+    /**
+     * \return The bucket where the name is, or the empty bucket where it
+     * should be inserted.
+     */
+    int findSlot(const char *name, int nameSize, uint32_t hash) const
+    {
+        if (buckets.empty())
+            return 0;
+        int mask = buckets.size() - 1;
+        for (int i = hash & mask;; i = (i + 1) & mask)
+        {
+            int index = buckets[i];
+            if (index < 0)
+                return i;
+            const Entry &e = entries[index];
+            if (e.hash == hash && static_cast<int>(e.name.size()) == nameSize &&
+                memcmp(e.name.data(), name, nameSize) == 0)
+                return i;
+        }
+    }
+
+    void rehash(int size)
+    {
+        buckets.assign(size, -1);
+        int mask = size - 1;
+        for (int index = 0; index < static_cast<int>(entries.size()); index++)
+        {
+            int i = entries[index].hash & mask;
+            while (buckets[i] >= 0)
+                i = (i + 1) & mask;
+            buckets[i] = index;
+        }
+    }
+
+    std::vector<Entry> entries;  ///< Registered types, in insertion order
+    std::vector<int> buckets;    ///< Indices into entries, -1 if empty
+};
+
+}  // namespace tscpp
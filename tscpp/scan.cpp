@@ -0,0 +1,132 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+#include "scan.h"
+
+#include <algorithm>
+#include <climits>
+
+using namespace std;
+
+namespace tscpp
+{
+
+RecordIterator::RecordIterator(const TypePoolBuffer &tp, const void *buffer,
+                               size_t bufSize, bool resync)
+    : tp(tp), td(nullptr), begin(reinterpret_cast<const char *>(buffer)),
+      bufSize(bufSize), resync(resync)
+{
+    memset(firstChars, 0, sizeof(firstChars));
+    for (int i = 0; i < tp.registeredTypes(); i++)
+    {
+        const string &name = tp.registeredName(i);
+        if (find(nameSizes.begin(), nameSizes.end(), name.size()) ==
+            nameSizes.end())
+            nameSizes.push_back(name.size());
+        firstChars[static_cast<unsigned char>(name[0])] = true;
+    }
+}
+
+RecordIterator::RecordIterator(const TypePoolBuffer &tp, TypeDictionary &td,
+                               const void *buffer, size_t bufSize,
+                               bool resync)
+    : RecordIterator(tp, buffer, bufSize, resync)
+{
+    this->td = &td;
+}
+
+int RecordIterator::next()
+{
+    size_t pos = start + recordSize;
+    for (;;)
+    {
+        // Skip padding here too, to detect the end of the buffer
+        pos += skipByte(begin + pos, bufSize - pos, '\0');
+        if (pos >= bufSize)
+        {
+            start      = bufSize;
+            recordSize = 0;
+            return 0;
+        }
+
+        int result = scan(td, pos, st);
+        if (result > 0)
+        {
+            start      = pos;
+            recordSize = result;
+            return 1;
+        }
+        if (resync == false)
+            return result;
+
+        size_t candidate = findCandidate(pos + 1);
+        skippedSize += candidate - pos;
+        pos = candidate;
+    }
+}
+
+int RecordIterator::scan(TypeDictionary *d, size_t offset,
+                         ScannedType &s) const
+{
+    // The buffer API takes int sizes
+    size_t remaining = bufSize - offset;
+    int size         = remaining > INT_MAX ? INT_MAX : remaining;
+    if (d)
+        return scanUnknown(tp, *d, begin + offset, size, s);
+    return scanUnknown(tp, begin + offset, size, s);
+}
+
+size_t RecordIterator::findCandidate(size_t from) const
+{
+    // Names are followed by a '\0', so look for the registered names ending
+    // at each '\0' found
+    for (size_t end = from; end < bufSize; end++)
+    {
+        end += findByte(begin + end, bufSize - end, '\0');
+        if (end >= bufSize)
+            break;
+        for (int nameSize : nameSizes)
+        {
+            if (end - from < static_cast<size_t>(nameSize))
+                continue;
+            size_t name = end - nameSize;
+            if (firstChars[static_cast<unsigned char>(begin[name])] == false)
+                continue;
+
+            ScannedType s;
+            size_t batch = name - batchPrefixSize;
+            if (name >= from + batchPrefixSize && begin[batch] == BatchPrefix &&
+                scan(nullptr, batch, s) > 0)
+                return batch;
+            if (scan(nullptr, name, s) > 0)
+                return name;
+        }
+    }
+    return bufSize;
+}
+
+}  // namespace tscpp
@@ -0,0 +1,326 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file scan.h
+ *
+ * @brief Vectorized kernels to scan serialized data, and an iterator over the
+ * types in a buffer.
+ *
+ * The kernels use SSE2 on x86, with AVX2 selected at runtime if available,
+ * NEON on AArch64, and a scalar fallback elsewhere or if TSCPP_NO_SIMD is
+ * defined. They never read outside of the given buffer.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "buffer.h"
+
+#ifndef TSCPP_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64)
+#define TSCPP_SCAN_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TSCPP_SCAN_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define TSCPP_SCAN_NEON
+#include <arm_neon.h>
+#endif
+#endif  // TSCPP_NO_SIMD
+
+namespace tscpp
+{
+
+/**
+ * \return The index of the first byte equal to c, or size if not found.
+ */
+inline size_t findByteScalar(const char *buf, size_t size, char c)
+{
+    const void *p = memchr(buf, c, size);
+    return p ? reinterpret_cast<const char *>(p) - buf : size;
+}
+
+/**
+ * \return The index of the first byte not equal to c, or size if not found.
+ */
+inline size_t skipByteScalar(const char *buf, size_t size, char c)
+{
+    size_t i = 0;
+    while (i < size && buf[i] == c)
+        i++;
+    return i;
+}
+
+#if defined(TSCPP_SCAN_SSE2) || defined(TSCPP_SCAN_AVX2)
+
+/**
+ * \return The index of the least significant bit set, mask must not be 0.
+ */
+inline int firstSetBit(unsigned int mask)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while ((mask & 1) == 0)
+    {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+/**
+ * \param skip If true, find the first byte not equal to c.
+ */
+inline size_t scanSse2(const char *buf, size_t size, char c, bool skip)
+{
+    const __m128i v = _mm_set1_epi8(c);
+    size_t i        = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(d, v));
+        if (skip)
+            mask ^= 0xffff;
+        if (mask)
+            return i + firstSetBit(mask);
+    }
+    return i + (skip ? skipByteScalar(buf + i, size - i, c)
+                     : findByteScalar(buf + i, size - i, c));
+}
+
+#endif  // TSCPP_SCAN_SSE2
+
+#ifdef TSCPP_SCAN_AVX2
+
+__attribute__((target("avx2"))) inline size_t scanAvx2(const char *buf,
+                                                         size_t size, char c,
+                                                         bool skip)
+{
+    const __m256i v = _mm256_set1_epi8(c);
+    size_t i        = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i d =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(buf + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(d, v));
+        if (skip)
+            mask = ~mask;
+        if (mask)
+            return i + firstSetBit(mask);
+    }
+    return i + scanSse2(buf + i, size - i, c, skip);
+}
+
+/**
+ * \return true if the CPU supports AVX2, checked only once.
+ */
+inline bool hasAvx2()
+{
+    static const bool result = []
+    {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+    return result;
+}
+
+#endif  // TSCPP_SCAN_AVX2
+
+#ifdef TSCPP_SCAN_NEON
+
+/**
+ * \param skip If true, find the first byte not equal to c.
+ */
+inline size_t scanNeon(const char *buf, size_t size, char c, bool skip)
+{
+    const uint8x16_t v = vdupq_n_u8(c);
+    size_t i           = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        uint8x16_t d  = vld1q_u8(reinterpret_cast<const uint8_t *>(buf + i));
+        uint8x16_t eq = vceqq_u8(d, v);
+        bool found    = skip ? vminvq_u8(eq) == 0 : vmaxvq_u8(eq) != 0;
+        if (found)
+            break;  // The scalar loop finds the byte within the chunk
+    }
+    return i + (skip ? skipByteScalar(buf + i, size - i, c)
+                     : findByteScalar(buf + i, size - i, c));
+}
+
+#endif  // TSCPP_SCAN_NEON
+
+/**
+ * @brief Find the first occurrence of a byte, for example the '\0' at the
+ * end of a type name.
+ *
+ * \param buf Buffer to scan.
+ * \param size Buffer size.
+ * \param c Byte to find.
+ * \return The index of the first byte equal to c, or size if not found.
+ */
+inline size_t findByte(const char *buf, size_t size, char c)
+{
+#if defined(TSCPP_SCAN_AVX2)
+    if (size >= 64 && hasAvx2())
+        return scanAvx2(buf, size, c, false);
+#endif
+#if defined(TSCPP_SCAN_SSE2)
+    return scanSse2(buf, size, c, false);
+#elif defined(TSCPP_SCAN_NEON)
+    return scanNeon(buf, size, c, false);
+#else
+    return findByteScalar(buf, size, c);
+#endif
+}
+
+/**
+ * @brief Find the first byte different from the given one, for example to
+ * skip '\0' padding.
+ *
+ * \param buf Buffer to scan.
+ * \param size Buffer size.
+ * \param c Byte to skip.
+ * \return The index of the first byte not equal to c, or size if not found.
+ */
+inline size_t skipByte(const char *buf, size_t size, char c)
+{
+    // Most of the times there is nothing to skip
+    if (size == 0 || buf[0] != c)
+        return 0;
+#if defined(TSCPP_SCAN_AVX2)
+    if (size >= 64 && hasAvx2())
+        return scanAvx2(buf, size, c, true);
+#endif
+#if defined(TSCPP_SCAN_SSE2)
+    return scanSse2(buf, size, c, true);
+#elif defined(TSCPP_SCAN_NEON)
+    return scanNeon(buf, size, c, true);
+#else
+    return skipByteScalar(buf, size, c);
+#endif
+}
+
+/**
+ * @brief Iterator over the serialized types in a buffer, such as a file
+ * mapped with MmapReader, which finds each type and its size without
+ * unserializing it.
+ *
+ * Optionally, when something that is not a registered type is found, the
+ * iterator skips to the next registered type name, so that damaged buffers
+ * can be read. Only types with the full name header are recognized when
+ * resynchronizing.
+ *
+ * \code
+ * RecordIterator it(tp, reader.data(), reader.size());
+ * while (it.next() > 0)
+ *     it.unserialize();
+ * \endcode
+ */
+class RecordIterator
+{
+public:
+    /**
+     * \param tp Type pool where possible serialized types are registered, it
+     * must not be modified while the iterator is in use.
+     * \param buffer Buffer where the serialized types are.
+     * \param bufSize Buffer size.
+     * \param resync If true, skip what is not a registered type.
+     */
+    RecordIterator(const TypePoolBuffer &tp, const void *buffer,
+                   size_t bufSize, bool resync = false);
+
+    /**
+     * \param tp Type pool where possible serialized types are registered, it
+     * must not be modified while the iterator is in use.
+     * \param td Type dictionary, to accept the compact header format.
+     * \param buffer Buffer where the serialized types are.
+     * \param bufSize Buffer size.
+     * \param resync If true, skip what is not a registered type.
+     */
+    RecordIterator(const TypePoolBuffer &tp, TypeDictionary &td,
+                   const void *buffer, size_t bufSize, bool resync = false);
+
+    /**
+     * @brief Move to the next type.
+     *
+     * \return 1 if a type was found, 0 at the end of the buffer or, if not
+     * resynchronizing, TscppError::UnknownType or TscppError::BufferTooSmall.
+     */
+    int next();
+
+    /**
+     * \return The offset of the current type, including its header.
+     */
+    size_t offset() const { return start; }
+
+    /**
+     * \return The size of the current type, including its header.
+     */
+    int size() const { return recordSize; }
+
+    /**
+     * \return The current type.
+     */
+    const ScannedType &type() const { return st; }
+
+    /**
+     * @brief Unserialize the current type, calling its callback.
+     */
+    void unserialize() const { tp.unserializeScanned(st, begin + start); }
+
+    /**
+     * \return The number of bytes skipped so far while resynchronizing.
+     */
+    size_t skipped() const { return skippedSize; }
+
+private:
+    int scan(TypeDictionary *d, size_t offset, ScannedType &s) const;
+    size_t findCandidate(size_t from) const;
+
+    const TypePoolBuffer &tp;
+    TypeDictionary *td;
+    const char *begin;
+    size_t bufSize;
+    bool resync;
+    size_t start       = 0;
+    int recordSize     = 0;
+    size_t skippedSize = 0;
+    ScannedType st;
+    std::vector<int> nameSizes;  ///< Distinct registered name lengths
+    bool firstChars[256];        ///< Bytes registered names start with
+};
+
+}  // namespace tscpp
@@ -0,0 +1,348 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+#include "shm.h"
+
+#ifndef _MIOSIX
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+
+using namespace std;
+
+namespace tscpp
+{
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "Shared memory atomics must be lock free");
+
+static const uint32_t ringMagic  = 0x72707374;  ///< "tspr", little endian
+static const uint32_t wrapMarker = 0xffffffff;  ///< Size of a skipped end
+static const int sizePrefix      = 4;           ///< Size before each record
+static const size_t headerBytes  = 4096;        ///< Space before the ring
+
+/**
+ * Control block at the start of the shared memory object. Fields written by
+ * different processes are in different cache lines.
+ */
+class ShmRingHeader
+{
+public:
+    class Reader
+    {
+    public:
+        alignas(64) atomic<uint64_t> cursor;  ///< Bytes read
+        atomic<int32_t> pid;                  ///< Owner, or 0 if free
+    };
+
+    explicit ShmRingHeader(uint64_t capacity)
+        : magic(0), capacity(capacity), closed(0), head(0)
+    {
+        for (auto &r : readers)
+        {
+            r.cursor.store(0);
+            r.pid.store(0);
+        }
+    }
+
+    atomic<uint32_t> magic;  ///< Set last, once the ring is ready
+    uint64_t capacity;
+    atomic<uint32_t> closed;
+    alignas(64) atomic<uint64_t> head;  ///< Bytes written
+    Reader readers[ShmRingReader::maxReaders];
+};
+
+static_assert(sizeof(ShmRingHeader) <= headerBytes, "Header too large");
+
+/**
+ * \return The bytes used in the ring by a record, with its size prefix and
+ * the padding that keeps the next one 8 byte aligned.
+ */
+static uint64_t recordBytes(int size)
+{
+    return (sizePrefix + static_cast<uint64_t>(size) + 7) & ~uint64_t(7);
+}
+
+//
+// class ShmRingWriter
+//
+
+ShmRingWriter::ShmRingWriter(const string &name, int capacity) : name(name)
+{
+    if (capacity < 4096 || capacity > (1 << 30))
+        throw invalid_argument("invalid ring capacity");
+    uint64_t size = 4096;
+    while (size < static_cast<uint64_t>(capacity))
+        size <<= 1;
+
+    // Readers of a previous ring keep their mapping, and see it closed
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        throw system_error(errno, system_category(), name);
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, headerBytes + size) == 0)
+        p = mmap(nullptr, headerBytes + size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        int error = errno;
+        close(fd);
+        shm_unlink(name.c_str());
+        throw system_error(error, system_category(), name);
+    }
+    close(fd);  // The mapping keeps the object open
+
+    header = new (p) ShmRingHeader(size);
+    header->magic.store(ringMagic, memory_order_release);
+    ring  = static_cast<char *>(p) + headerBytes;
+    mask  = size - 1;
+    limit = size;
+}
+
+int ShmRingWriter::serializeImpl(const TypeName &name, const void *data,
+                                 int size, int count, int alignment)
+{
+    // Upper bound of the serialized size, the actual one is known only
+    // after the padding for the alignment has been chosen
+    uint64_t objects = static_cast<uint64_t>(size) * (count < 0 ? 1 : count);
+    uint64_t bound   = fingerprintPrefixSize + batchPrefixSize + name.size +
+                     1 + alignment + objects;
+    if (bound > mask + 1 - sizePrefix)
+    {
+        droppedCount++;
+        return BufferTooSmall;
+    }
+    char *buffer = reserve(bound);
+    if (buffer == nullptr)
+        return BufferTooSmall;
+    int result = count < 0 ? tscpp::serializeImpl(buffer, bound, name, data,
+                                                  size, alignment)
+                           : serializeArrayImpl(buffer, bound, name, data,
+                                                size, count, alignment);
+    if (result > 0)
+        commit(result);
+    return result;
+}
+
+int ShmRingWriter::write(const void *record, int size)
+{
+    if (size < 0 || static_cast<uint64_t>(size) > mask + 1 - sizePrefix)
+    {
+        droppedCount++;
+        return BufferTooSmall;
+    }
+    char *buffer = reserve(size);
+    if (buffer == nullptr)
+        return BufferTooSmall;
+    memcpy(buffer, record, size);
+    commit(size);
+    return size;
+}
+
+int ShmRingWriter::readers() const
+{
+    int result = 0;
+    for (auto &r : header->readers)
+        if (r.pid.load(memory_order_relaxed) != 0)
+            result++;
+    return result;
+}
+
+ShmRingWriter::~ShmRingWriter()
+{
+    header->closed.store(1, memory_order_release);
+    munmap(header, headerBytes + mask + 1);
+    shm_unlink(name.c_str());
+}
+
+char *ShmRingWriter::reserve(int size)
+{
+    // Records are contiguous, if one does not fit before the end of the ring
+    // the end is skipped
+    uint64_t bytes  = recordBytes(size);
+    uint64_t offset = head & mask;
+    uint64_t start  = head;
+    if (mask + 1 - offset < bytes)
+        start += mask + 1 - offset;
+    if (start + bytes > limit && updateLimit(start + bytes) == false)
+    {
+        droppedCount++;
+        return nullptr;
+    }
+    if (start != head)
+        memcpy(ring + offset, &wrapMarker, sizePrefix);
+    reserved = start;
+    return ring + (start & mask) + sizePrefix;
+}
+
+void ShmRingWriter::commit(int size)
+{
+    uint32_t prefix = size;
+    memcpy(ring + (reserved & mask), &prefix, sizePrefix);
+    head = reserved + recordBytes(size);
+    header->head.store(head, memory_order_release);
+}
+
+bool ShmRingWriter::updateLimit(uint64_t end)
+{
+    // The cursors are read only when the cached limit is reached, as they
+    // are in cache lines written by the readers
+    uint64_t oldest = head;
+    for (auto &r : header->readers)
+    {
+        int32_t pid = r.pid.load(memory_order_acquire);
+        if (pid == 0)
+            continue;
+        uint64_t cursor = r.cursor.load(memory_order_acquire);
+        // Release a reader in the way whose process has terminated without
+        // detaching
+        if (end > cursor + mask + 1 && kill(pid, 0) < 0 && errno == ESRCH &&
+            r.pid.compare_exchange_strong(pid, 0))
+            continue;
+        if (cursor < oldest)
+            oldest = cursor;
+    }
+    limit = oldest + mask + 1;
+    return end <= limit;
+}
+
+//
+// class ShmRingReader
+//
+
+ShmRingReader::ShmRingReader(const string &name)
+{
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        throw system_error(errno, system_category(), name);
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        int error = errno;
+        close(fd);
+        throw system_error(error, system_category(), name);
+    }
+    if (st.st_size <= static_cast<off_t>(headerBytes))
+    {
+        close(fd);
+        throw invalid_argument("not a ring");
+    }
+    mappedSize = st.st_size;
+    void *p    = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+    if (p == MAP_FAILED)
+    {
+        int error = errno;
+        close(fd);
+        throw system_error(error, system_category(), name);
+    }
+    close(fd);  // The mapping keeps the object open
+
+    header = static_cast<ShmRingHeader *>(p);
+    if (header->magic.load(memory_order_acquire) != ringMagic ||
+        header->capacity + headerBytes != mappedSize)
+    {
+        munmap(p, mappedSize);
+        throw invalid_argument("not a ring");
+    }
+    ring = static_cast<const char *>(p) + headerBytes;
+    mask = header->capacity - 1;
+
+    // Claim a slot, then publish the position. Until then the writer sees
+    // the position of the previous owner, which is behind and only makes it
+    // more cautious
+    for (slot = 0; slot < maxReaders; slot++)
+    {
+        int32_t expected = 0;
+        if (header->readers[slot].pid.compare_exchange_strong(expected,
+                                                              getpid()))
+            break;
+    }
+    if (slot == maxReaders)
+    {
+        munmap(p, mappedSize);
+        throw system_error(EBUSY, system_category(), name);
+    }
+    cursor = header->head.load(memory_order_acquire);
+    header->readers[slot].cursor.store(cursor, memory_order_release);
+    available = cursor;
+}
+
+int ShmRingReader::unserializeUnknown(const TypePoolBuffer &tp)
+{
+    // The head is in a cache line written by the writer, it is read only
+    // when the records known to be available have all been read
+    if (cursor == available)
+    {
+        available = header->head.load(memory_order_acquire);
+        if (cursor == available)
+            return 0;
+    }
+    uint32_t size;
+    memcpy(&size, ring + (cursor & mask), sizePrefix);
+    if (size == wrapMarker)
+    {
+        cursor = (cursor | mask) + 1;
+        memcpy(&size, ring, sizePrefix);
+    }
+    int result = tscpp::unserializeUnknown(tp, ring + (cursor & mask) +
+                                                   sizePrefix, size);
+    cursor += recordBytes(size);
+    header->readers[slot].cursor.store(cursor, memory_order_release);
+    return result < 0 ? result : static_cast<int>(size);
+}
+
+uint64_t ShmRingReader::pending() const
+{
+    return header->head.load(memory_order_acquire) - cursor;
+}
+
+bool ShmRingReader::closed() const
+{
+    return header->closed.load(memory_order_acquire) != 0;
+}
+
+ShmRingReader::~ShmRingReader()
+{
+    header->readers[slot].pid.store(0, memory_order_release);
+    munmap(header, mappedSize);
+}
+
+}  // namespace tscpp
+
+#endif  // _MIOSIX
@@ -0,0 +1,254 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file shm.h
+ *
+ * @brief Broadcast of serialized types from one process to many through a
+ * ring in POSIX shared memory, based on the buffer API.
+ *
+ * The writer serializes types directly in the ring and readers unserialize
+ * them directly from it with a TypePoolBuffer, so a record is never copied
+ * and no system call is made per record. Each record is preceded by its
+ * 32 bit size, so that readers can skip the types they did not register.
+ * Records use the full name header, so readers can attach at any time.
+ *
+ * Only available on POSIX systems, on Linux programs using it may need to be
+ * linked with -lrt.
+ */
+
+#pragma once
+
+#ifndef _MIOSIX
+
+#include <cstdint>
+#include <string>
+
+#include "buffer.h"
+
+namespace tscpp
+{
+
+class ShmRingHeader;
+
+/**
+ * @brief Writer of a shared memory ring, see ShmRingReader.
+ *
+ * The writer never waits: a record is dropped when a reader still has to
+ * read the bytes it would overwrite, and the drop is counted by dropped().
+ * Readers of processes that terminated without detaching are released the
+ * first time the ring is full. Only one thread may write at a time.
+ *
+ * \code
+ * ShmRingWriter writer("/telemetry", 1 << 20);
+ * writer.serialize(foo);
+ * \endcode
+ */
+class ShmRingWriter
+{
+public:
+    /**
+     * \param name Name of the shared memory object, starting with '/'. An
+     * object with the same name is replaced, readers attached to it keep
+     * reading the old one until they see closed().
+     * \param capacity Size of the ring in bytes, rounded up to a power of
+     * two. A record can use at most capacity bytes.
+     * \throws std::invalid_argument if capacity is less than 4096 or more
+     * than 1GiB.
+     * \throws std::system_error if the object can't be created or mapped.
+     */
+    ShmRingWriter(const std::string &name, int capacity);
+
+    /**
+     * @brief Serialize a type in the ring, aligned as with serializeAligned().
+     *
+     * \param t Type to serialize.
+     * \return The size of the serialized type, or TscppError::BufferTooSmall
+     * if it was dropped.
+     */
+    template <typename T>
+    int serialize(const T &t);
+
+    /**
+     * @brief Serialize an array of objects of the same type in the ring.
+     *
+     * \param t Pointer to the first object to serialize.
+     * \param count Number of objects to serialize.
+     * \return The size of the serialized array, or TscppError::BufferTooSmall
+     * if it was dropped.
+     */
+    template <typename T>
+    int serializeArray(const T *t, int count);
+
+    /**
+     * @brief Actual implementation of the serialization.
+     *
+     * \param name Type name.
+     * \param data Pointer to the first object.
+     * \param size Size of one object.
+     * \param count Number of objects of an array, or -1 for a single object.
+     * \param alignment Alignment of the objects in the ring.
+     * \return The serialized size, or TscppError::BufferTooSmall.
+     */
+    int serializeImpl(const TypeName &name, const void *data, int size,
+                      int count, int alignment);
+
+    /**
+     * @brief Copy in the ring a type already serialized with the buffer API
+     * using the full name header, for example one received from a link.
+     *
+     * \param record Serialized type.
+     * \param size Size of the serialized type.
+     * \return size, or TscppError::BufferTooSmall if it was dropped.
+     */
+    int write(const void *record, int size);
+
+    /**
+     * \return The number of records dropped because the ring was full.
+     */
+    uint64_t dropped() const { return droppedCount; }
+
+    /**
+     * \return The number of readers attached.
+     */
+    int readers() const;
+
+    /**
+     * Marks the ring as closed for the readers and removes its name.
+     */
+    ~ShmRingWriter();
+
+private:
+    ShmRingWriter(const ShmRingWriter &)            = delete;
+    ShmRingWriter &operator=(const ShmRingWriter &) = delete;
+
+    char *reserve(int size);
+    void commit(int size);
+    bool updateLimit(uint64_t end);
+
+    std::string name;
+    ShmRingHeader *header = nullptr;
+    char *ring            = nullptr;  ///< Records, after the header
+    uint64_t mask         = 0;        ///< Ring capacity minus one
+    uint64_t head         = 0;        ///< Bytes written, as published
+    uint64_t reserved     = 0;        ///< Start of the record being written
+    uint64_t limit        = 0;        ///< Bytes that can be written, cached
+    uint64_t droppedCount = 0;
+};
+
+template <typename T>
+int ShmRingWriter::serialize(const T &t)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+    return serializeImpl(typeName<T>(), &t, sizeof(T), -1, alignof(T));
+}
+
+template <typename T>
+int ShmRingWriter::serializeArray(const T *t, int count)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+    return serializeImpl(typeName<T>(), t, sizeof(T), count, alignof(T));
+}
+
+/**
+ * @brief Reader of a shared memory ring written by ShmRingWriter.
+ *
+ * Each reader keeps its own position, starting at the records written after
+ * it attached, and publishes it in the ring for the writer. Up to maxReaders
+ * readers can be attached at the same time, from any process. Readers poll
+ * the ring, there is no notification of new records.
+ *
+ * \code
+ * TypePoolBuffer tp;
+ * tp.registerType<Foo>([](Foo& f) { ... });
+ * ShmRingReader reader("/telemetry");
+ * for (;;)
+ *     if (reader.unserializeUnknown(tp) == 0) ... // Nothing new, wait
+ * \endcode
+ */
+class ShmRingReader
+{
+public:
+    /// Maximum number of readers attached to a ring
+    static const int maxReaders = 16;
+
+    /**
+     * \param name Name of the shared memory object of the writer.
+     * \throws std::invalid_argument if the object is not a ring.
+     * \throws std::system_error if the object can't be opened or mapped, or
+     * with EBUSY if maxReaders readers are already attached.
+     */
+    explicit ShmRingReader(const std::string &name);
+
+    /**
+     * @brief Unserialize the next record, calling the callback registered in
+     * the pool directly on the shared memory.
+     *
+     * The record is consumed even if it can't be unserialized, so that the
+     * writer is not stalled by types the reader is not interested in.
+     *
+     * \param tp Type pool where possible serialized types are registered.
+     * \return The size of the record, 0 if no new record has been written,
+     * or TscppError::UnknownType if the pool does not contain its type.
+     */
+    int unserializeUnknown(const TypePoolBuffer &tp);
+
+    /**
+     * \return The number of bytes written and not yet read by this reader.
+     */
+    uint64_t pending() const;
+
+    /**
+     * \return True if the writer has been destroyed. The records written
+     * before can still be read, a new writer has to be attached to with a
+     * new reader.
+     */
+    bool closed() const;
+
+    /**
+     * Detaches from the ring.
+     */
+    ~ShmRingReader();
+
+private:
+    ShmRingReader(const ShmRingReader &)            = delete;
+    ShmRingReader &operator=(const ShmRingReader &) = delete;
+
+    ShmRingHeader *header = nullptr;
+    const char *ring      = nullptr;  ///< Records, after the header
+    size_t mappedSize     = 0;
+    uint64_t mask         = 0;  ///< Ring capacity minus one
+    uint64_t cursor       = 0;  ///< Bytes read
+    uint64_t available    = 0;  ///< Bytes written, as last read
+    int slot              = 0;  ///< Slot of the reader in the header
+};
+
+}  // namespace tscpp
+
+#endif  // _MIOSIX
@@ -0,0 +1,199 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+#include "sink.h"
+
+#ifndef _MIOSIX
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+using namespace std;
+
+namespace tscpp
+{
+
+GatherSink::GatherSink(int fd, int maxVectors, int copySize)
+    : fd(fd), maxVectors(min(maxVectors, IOV_MAX))
+{
+    if (maxVectors < 1 || copySize < 1)
+        throw invalid_argument("invalid gather sink size");
+    vectors.reserve(this->maxVectors);
+    copies.resize(copySize);
+}
+
+void GatherSink::append(const void *data, int size)
+{
+    push(reinterpret_cast<const char *>(data), size);
+}
+
+void GatherSink::appendCopy(const void *data, int size)
+{
+    if (size <= 0)
+        return;
+    if (size > static_cast<int>(copies.size()))
+    {
+        // Too large to be copied, it is written before the call returns
+        flush();
+        append(data, size);
+        flush();
+        return;
+    }
+
+    // Flush first, so that the copy is never overwritten before being written
+    if (copied + size > static_cast<int>(copies.size()) ||
+        static_cast<int>(vectors.size()) == maxVectors)
+        flush();
+    memcpy(copies.data() + copied, data, size);
+    push(copies.data() + copied, size);
+    copied += size;
+}
+
+int GatherSink::serializeImpl(TypeDictionary *td, const TypeName &name,
+                              const void *data, int size, int count)
+{
+    int maxHeaderSize = batchPrefixSize + 2 + name.size + 1;
+    if (copied + maxHeaderSize > static_cast<int>(copies.size()) ||
+        static_cast<int>(vectors.size()) == maxVectors)
+        flush();
+
+    int headerSize;
+    if (maxHeaderSize <= static_cast<int>(copies.size()))
+    {
+        // Serialize the header directly in the copy buffer
+        char *header = copies.data() + copied;
+        headerSize   = td ? serializeHeader(*td, header, maxHeaderSize, name,
+                                            count)
+                          : serializeHeader(header, maxHeaderSize, name, count);
+        push(header, headerSize);
+        copied += headerSize;
+    }
+    else
+    {
+        vector<char> header(maxHeaderSize);
+        headerSize = td ? serializeHeader(*td, header.data(), maxHeaderSize,
+                                          name, count)
+                        : serializeHeader(header.data(), maxHeaderSize, name,
+                                          count);
+        appendCopy(header.data(), headerSize);
+    }
+
+    int dataSize = count >= 0 ? count * size : size;
+    append(data, dataSize);
+    return headerSize + dataSize;
+}
+
+void GatherSink::flush()
+{
+    size_t first = 0;
+    while (first < vectors.size())
+    {
+        ssize_t n = writev(fd, vectors.data() + first, vectors.size() - first);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            int error = errno;
+            vectors.clear();
+            copied      = 0;
+            pendingSize = 0;
+            throw system_error(error, system_category(), "writev");
+        }
+
+        // Skip what has been written, partial writes resume mid vector
+        writtenSize += n;
+        pendingSize -= n;
+        while (n > 0)
+        {
+            iovec &v = vectors[first];
+            if (static_cast<size_t>(n) < v.iov_len)
+            {
+                v.iov_base = reinterpret_cast<char *>(v.iov_base) + n;
+                v.iov_len -= n;
+                break;
+            }
+            n -= v.iov_len;
+            first++;
+        }
+    }
+    vectors.clear();
+    copied = 0;
+}
+
+GatherSink::~GatherSink()
+{
+    // Destructors must not throw, a failing write loses the last batch
+    try
+    {
+        flush();
+    }
+    catch (...)
+    {
+    }
+}
+
+void GatherSink::write(const char *data, int size, bool stable)
+{
+    if (stable)
+        append(data, size);
+    else
+        appendCopy(data, size);
+}
+
+void GatherSink::push(const char *data, int size)
+{
+    if (size <= 0)
+        return;
+    if (vectors.empty() == false)
+    {
+        // Contiguous parts, such as the pieces of a header, are merged
+        iovec &last = vectors.back();
+        if (reinterpret_cast<char *>(last.iov_base) + last.iov_len == data)
+        {
+            last.iov_len += size;
+            pendingSize += size;
+            return;
+        }
+    }
+    if (static_cast<int>(vectors.size()) == maxVectors)
+        flush();
+    iovec v;
+    v.iov_base = const_cast<char *>(data);
+    v.iov_len  = size;
+    vectors.push_back(v);
+    pendingSize += size;
+}
+
+}  // namespace tscpp
+
+#endif  // _MIOSIX
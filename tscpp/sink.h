@@ -0,0 +1,234 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file sink.h
+ *
+ * @brief Scatter-gather output of serialized types to a file descriptor.
+ *
+ * Only available on POSIX systems.
+ */
+
+#pragma once
+
+#ifndef _MIOSIX
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "buffer.h"
+#include "stream.h"
+
+namespace tscpp
+{
+
+/**
+ * @brief Collects headers and objects as an iovec batch, and writes them to
+ * a file descriptor with a single writev() call.
+ *
+ * Headers are copied in a small internal buffer, while objects are only
+ * referenced, so they go from their original memory to the kernel without
+ * an intermediate copy. The objects must stay valid and unchanged until the
+ * batch is written, which happens when flush() is called, when the batch is
+ * full or when the sink is destroyed.
+ *
+ * The sink can be used directly with the buffer API functions below, or as
+ * the destination of an OutputArchive.
+ *
+ * \code
+ * GatherSink sink(fd);
+ * serialize(sink, foo);
+ * OutputArchive oa(sink);
+ * oa << bar;
+ * oa.flush();
+ * \endcode
+ */
+class GatherSink : public OutputSink
+{
+public:
+    /**
+     * \param fd File descriptor where data is written, not closed by the sink.
+     * \param maxVectors Number of parts collected before the batch is written,
+     * limited to IOV_MAX.
+     * \param copySize Size of the buffer for headers and other copied data.
+     * \throws std::invalid_argument if maxVectors or copySize are less than 1.
+     */
+    explicit GatherSink(int fd, int maxVectors = 64, int copySize = 4096);
+
+    /**
+     * @brief Add data to the batch, by reference.
+     *
+     * \param data Data to write, must stay valid until the batch is written.
+     * \param size Data size.
+     * \throws std::system_error if the batch is full and writing it fails.
+     */
+    void append(const void *data, int size);
+
+    /**
+     * @brief Add data to the batch, by copying it.
+     *
+     * \param data Data to write, can be reused as soon as the call returns.
+     * \param size Data size.
+     * \throws std::system_error if the batch has to be written and writing it
+     * fails.
+     */
+    void appendCopy(const void *data, int size);
+
+    /**
+     * @brief Serialize one object or an array, copying the header and
+     * referencing the objects.
+     *
+     * \param td Type dictionary to use the compact header format, or nullptr
+     * to use the full name header.
+     * \param name Type name.
+     * \param data Pointer to the first object.
+     * \param size Size of one object.
+     * \param count Number of objects of an array, or -1 for a single object.
+     * \return The serialized size.
+     * \throws std::system_error if writing the batch fails.
+     */
+    int serializeImpl(TypeDictionary *td, const TypeName &name,
+                      const void *data, int size, int count);
+
+    /**
+     * @brief Write the batch with as few writev() calls as possible, retrying
+     * after partial writes.
+     *
+     * \throws std::system_error if writing fails, in which case the batch is
+     * discarded.
+     */
+    void flush() override;
+
+    /**
+     * \return The number of bytes collected and not yet written.
+     */
+    int pending() const { return pendingSize; }
+
+    /**
+     * \return The number of bytes written to the file descriptor.
+     */
+    uint64_t written() const { return writtenSize; }
+
+    /**
+     * Writes the last batch, errors are ignored.
+     */
+    ~GatherSink();
+
+private:
+    GatherSink(const GatherSink &)            = delete;
+    GatherSink &operator=(const GatherSink &) = delete;
+
+    void write(const char *data, int size, bool stable) override;
+    void push(const char *data, int size);
+
+    int fd;
+    int maxVectors;
+    std::vector<iovec> vectors;  ///< Parts of the batch
+    std::vector<char> copies;    ///< Copied parts of the batch
+    int copied           = 0;    ///< Bytes of copies used
+    int pendingSize      = 0;
+    uint64_t writtenSize = 0;
+};
+
+/**
+ * @brief Serialize a type to a GatherSink.
+ *
+ * \param sink Sink where to serialize the type.
+ * \param t Type to serialize, must stay valid until the batch is written.
+ * \return The size of the serialized type.
+ * \throws std::system_error if writing the batch fails.
+ */
+template <typename T>
+int serialize(GatherSink &sink, const T &t)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+    return sink.serializeImpl(nullptr, typeName<T>(), &t, sizeof(T), -1);
+}
+
+/**
+ * @brief Serialize a type to a GatherSink using the compact header format.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param sink Sink where to serialize the type.
+ * \param t Type to serialize, must stay valid until the batch is written.
+ * \return The size of the serialized type.
+ * \throws std::system_error if writing the batch fails.
+ */
+template <typename T>
+int serialize(TypeDictionary &td, GatherSink &sink, const T &t)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+    return sink.serializeImpl(&td, typeName<T>(), &t, sizeof(T), -1);
+}
+
+/**
+ * @brief Serialize an array of objects of the same type to a GatherSink.
+ *
+ * Unlike serializeArray() to a memory buffer, the objects are not aligned.
+ *
+ * \param sink Sink where to serialize the array.
+ * \param t Pointer to the first object, must stay valid until the batch is
+ * written.
+ * \param count Number of objects to serialize.
+ * \return The size of the serialized array.
+ * \throws std::system_error if writing the batch fails.
+ */
+template <typename T>
+int serializeArray(GatherSink &sink, const T *t, int count)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+    return sink.serializeImpl(nullptr, typeName<T>(), t, sizeof(T), count);
+}
+
+/**
+ * @brief Serialize an array of objects of the same type to a GatherSink using
+ * the compact header format.
+ *
+ * \param td Type dictionary of the serialization session.
+ * \param sink Sink where to serialize the array.
+ * \param t Pointer to the first object, must stay valid until the batch is
+ * written.
+ * \param count Number of objects to serialize.
+ * \return The size of the serialized array.
+ * \throws std::system_error if writing the batch fails.
+ */
+template <typename T>
+int serializeArray(TypeDictionary &td, GatherSink &sink, const T *t, int count)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+    return sink.serializeImpl(&td, typeName<T>(), t, sizeof(T), count);
+}
+
+}  // namespace tscpp
+
+#endif  // _MIOSIX
@@ -0,0 +1,328 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file static_pool.h
+ *
+ * @brief Type pool with a fixed capacity that never allocates, for real-time
+ * code that can't use the heap after initialization.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "buffer.h"
+
+namespace tscpp
+{
+
+/**
+ * @brief Type pool for the buffer API with room for N types, stored inline.
+ *
+ * Unlike TypePoolBuffer, registering a type allocates nothing: the names
+ * point to the strings returned by typeid, with no copy, and each callback is
+ * a function pointer plus a context pointer. Types are found through an open
+ * addressing table of indices that lives in the pool.
+ *
+ * Delta encoded objects are not supported, as their state needs the heap,
+ * and neither are upgrade converters or byte swapping. Objects with a
+ * fingerprint different from the registered type are reported as
+ * TscppError::WrongType.
+ *
+ * \code
+ * StaticTypePoolBuffer<8> tp;
+ * tp.registerType<Foo>(onFoo, &context);
+ * auto onBar = [&](Bar &b) { ... };
+ * tp.registerType<Bar>(onBar);  // Must outlive the pool
+ * int result = unserializeUnknown(tp, buffer, size);
+ * \endcode
+ *
+ * \tparam N Maximum number of types, up to 32767.
+ */
+template <int N>
+class StaticTypePoolBuffer
+{
+public:
+    static_assert(N > 0 && N < 32768, "Invalid type pool capacity");
+
+    /**
+     * @brief Register a type with a callback and its context. Registering a
+     * type again replaces its callback.
+     *
+     * \param callback Function called with each object of the type found.
+     * \param context Pointer passed to the callback.
+     * \return false if the pool already contains N types.
+     */
+    template <typename T>
+    bool registerType(void (*callback)(T &t, void *context),
+                      void *context = nullptr);
+
+    /**
+     * @brief Register a type with a callable object, such as a lambda, which
+     * is referenced and not copied so it must outlive the pool.
+     *
+     * \param callable Object called with each object of the type found.
+     * \return false if the pool already contains N types.
+     */
+    template <typename T, typename F>
+    bool registerType(F &callable);
+
+    /**
+     * \return The number of registered types.
+     */
+    int registeredTypes() const { return count; }
+
+    /**
+     * @brief Used by unserializeUnknown(), unserialize the data following a
+     * header.
+     *
+     * \param h Parsed header.
+     * \param buffer Pointer to the data after the header.
+     * \param bufSize Size of the data.
+     * \return The size of the data, or TscppError::UnknownType if the type is
+     * not registered or delta encoded, TscppError::WrongType if the
+     * fingerprint differs, or TscppError::BufferTooSmall.
+     */
+    int unserializeUnknownImpl(const RecordHeader &h, const char *buffer,
+                               int bufSize) const;
+
+private:
+    /**
+     * A registered type.
+     */
+    class Entry
+    {
+    public:
+        uint32_t hash;
+        int nameSize;
+        const char *name;  ///< The typeid name, not copied
+        int size;
+        uint32_t fingerprint;
+        void (*invoke)(const Entry &e, const void *object);
+        void (*function)();  ///< Callback, cast back by invoke
+        void *context;
+    };
+
+    template <typename T>
+    static void invokeFunction(const Entry &e, const void *object);
+
+    template <typename T, typename F>
+    static void invokeCallable(const Entry &e, const void *object);
+
+    template <typename T>
+    bool add(void (*invoke)(const Entry &, const void *), void (*function)(),
+             void *context);
+
+    int findSlot(const char *name, int nameSize, uint32_t hash) const;
+
+    /// Power of two with at least twice the slots as types
+    static const int slotCount = N <= 4       ? 8
+                                 : N <= 8     ? 16
+                                 : N <= 16    ? 32
+                                 : N <= 32    ? 64
+                                 : N <= 64    ? 128
+                                 : N <= 128   ? 256
+                                 : N <= 256   ? 512
+                                 : N <= 512   ? 1024
+                                 : N <= 1024  ? 2048
+                                 : N <= 2048  ? 4096
+                                 : N <= 4096  ? 8192
+                                 : N <= 8192  ? 16384
+                                 : N <= 16384 ? 32768
+                                              : 65536;
+
+    Entry entries[N];
+    int16_t slots[slotCount] = {};  ///< Index of an entry plus one, or 0
+    int count                = 0;
+};
+
+template <int N>
+template <typename T>
+bool StaticTypePoolBuffer<N>::registerType(void (*callback)(T &t,
+                                                            void *context),
+                                           void *context)
+{
+    return add<T>(&invokeFunction<T>, reinterpret_cast<void (*)()>(callback),
+                  context);
+}
+
+template <int N>
+template <typename T, typename F>
+bool StaticTypePoolBuffer<N>::registerType(F &callable)
+{
+    return add<T>(&invokeCallable<T, F>, nullptr, &callable);
+}
+
+template <int N>
+int StaticTypePoolBuffer<N>::unserializeUnknownImpl(const RecordHeader &h,
+                                                    const char *buffer,
+                                                    int bufSize) const
+{
+    if (h.delta)
+        return UnknownType;
+    int slot = slots[findSlot(h.name, h.nameSize, h.hash)];
+    if (slot == 0)
+        return UnknownType;
+    const Entry &e = entries[slot - 1];
+    if (h.fingerprint != 0 && h.fingerprint != e.fingerprint)
+        return WrongType;
+
+    int n = h.count < 0 ? 1 : h.count;
+    if (n > bufSize / e.size)
+        return BufferTooSmall;
+    for (int i = 0; i < n; i++)
+        e.invoke(e, buffer + i * e.size);
+    return n * e.size;
+}
+
+template <int N>
+template <typename T>
+void StaticTypePoolBuffer<N>::invokeFunction(const Entry &e,
+                                             const void *object)
+{
+    // NOTE: The object is copied since the buffer may not be aligned
+    T t;
+    memcpy(&t, object, sizeof(T));
+    reinterpret_cast<void (*)(T &, void *)>(e.function)(t, e.context);
+}
+
+template <int N>
+template <typename T, typename F>
+void StaticTypePoolBuffer<N>::invokeCallable(const Entry &e,
+                                             const void *object)
+{
+    T t;
+    memcpy(&t, object, sizeof(T));
+    (*reinterpret_cast<F *>(e.context))(t);
+}
+
+template <int N>
+template <typename T>
+bool StaticTypePoolBuffer<N>::add(void (*invoke)(const Entry &, const void *),
+                                  void (*function)(), void *context)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    const TypeName &name = typeName<T>();
+    uint32_t hash        = hashTypeName(name.str, name.size);
+    int slot             = findSlot(name.str, name.size, hash);
+    if (slots[slot] == 0)
+    {
+        if (count == N)
+            return false;
+        slots[slot] = ++count;
+    }
+
+    Entry &e      = entries[slots[slot] - 1];
+    e.hash        = hash;
+    e.nameSize    = name.size;
+    e.name        = name.str;
+    e.size        = sizeof(T);
+    e.fingerprint = name.fingerprint;
+    e.invoke      = invoke;
+    e.function    = function;
+    e.context     = context;
+    return true;
+}
+
+template <int N>
+int StaticTypePoolBuffer<N>::findSlot(const char *name, int nameSize,
+                                      uint32_t hash) const
+{
+    // Linear probing, the table is never more than half full
+    for (int i = hash & (slotCount - 1);; i = (i + 1) & (slotCount - 1))
+    {
+        if (slots[i] == 0)
+            return i;
+        const Entry &e = entries[slots[i] - 1];
+        if (e.hash == hash && e.nameSize == nameSize &&
+            memcmp(e.name, name, nameSize) == 0)
+            return i;
+    }
+}
+
+/**
+ * @brief Unserialize a type from a memory buffer, calling the callback
+ * registered in a StaticTypePoolBuffer.
+ *
+ * \param tp Type pool where possible serialized types are registered.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \return The size of the unserialized type, or TscppError::UnknownType if
+ * the pool does not contain the type found, TscppError::WrongType if its
+ * fingerprint differs, or TscppError::BufferTooSmall.
+ */
+template <int N>
+int unserializeUnknown(const StaticTypePoolBuffer<N> &tp, const void *buffer,
+                       int bufSize)
+{
+    RecordHeader h;
+    int headerSize = parseRecordHeader(buffer, bufSize, h);
+    if (headerSize < 0)
+        return headerSize;
+    int result = tp.unserializeUnknownImpl(
+        h, reinterpret_cast<const char *>(buffer) + headerSize,
+        bufSize - headerSize);
+    return result < 0 ? result : result + headerSize;
+}
+
+/**
+ * @brief Unserialize a type from a memory buffer, possibly with the compact
+ * header format, calling the callback registered in a StaticTypePoolBuffer.
+ *
+ * The dictionary copies the names of the types it defines, so it allocates
+ * the first time each type is found.
+ *
+ * \param tp Type pool where possible serialized types are registered.
+ * \param td Type dictionary of the serialization session.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \return The size of the unserialized type, or TscppError::UnknownType if
+ * the pool does not contain the type found or the type id has not been
+ * defined, TscppError::WrongType if its fingerprint differs, or
+ * TscppError::BufferTooSmall.
+ */
+template <int N>
+int unserializeUnknown(const StaticTypePoolBuffer<N> &tp, TypeDictionary &td,
+                       const void *buffer, int bufSize)
+{
+    RecordHeader h;
+    int headerSize = parseRecordHeader(td, buffer, bufSize, h);
+    if (headerSize < 0)
+        return headerSize;
+    int result = tp.unserializeUnknownImpl(
+        h, reinterpret_cast<const char *>(buffer) + headerSize,
+        bufSize - headerSize);
+    return result < 0 ? result : result + headerSize;
+}
+
+}  // namespace tscpp
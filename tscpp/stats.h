@@ -0,0 +1,324 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file stats.h
+ *
+ * @brief Optional counters of the types serialized and unserialized by the
+ * archives and type pools, and of the errors found.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef TSCPP_ENABLE_STATS
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#endif
+
+#include "format.h"
+#include "registry.h"
+
+namespace tscpp
+{
+
+/**
+ * @brief Kinds of errors counted by Stats.
+ */
+enum StatsError
+{
+    BufferTooSmallError,   ///< TscppError::BufferTooSmall, or eof of a stream
+    WrongTypeError,        ///< TscppError::WrongType, or "wrong type" thrown
+    UnknownTypeError,      ///< TscppError::UnknownType, or "unknown type"
+    MissingKeyframeError,  ///< Delta encoded object before any keyframe
+    BatchTooLargeError     ///< Batch larger than the array to read it into
+};
+
+/**
+ * @brief Counters of one type, in a StatsSnapshot.
+ */
+class TypeStats
+{
+public:
+    std::string name;      ///< Mangled type name
+    uint64_t records = 0;  ///< Headers found or written, a batch is one
+    uint64_t objects = 0;  ///< Objects, counting each one of a batch
+    uint64_t bytes   = 0;  ///< Serialized size, headers included
+    uint64_t time    = 0;  ///< Nanoseconds spent, if timing is enabled
+};
+
+/**
+ * @brief Copy of the counters of a Stats, to be exported for example to
+ * telemetry.
+ */
+class StatsSnapshot
+{
+public:
+    static const int errorTypes     = 5;   ///< Number of StatsError values
+    static const int latencyBuckets = 32;  ///< Entries of latency
+
+    std::vector<TypeStats> types;  ///< Types in order of first appearance
+    uint64_t errors[errorTypes] = {};  ///< Errors, indexed by StatsError
+    /// Histogram of the time per record, if timing is enabled: entry i
+    /// counts the records that took less than 2^i ns and at least half that
+    uint64_t latency[latencyBuckets] = {};
+};
+
+/**
+ * @brief Counters of the records and errors of an archive or a type pool.
+ *
+ * Counting is compiled only if TSCPP_ENABLE_STATS is defined, for all the
+ * translation units of a program, otherwise all the member functions do
+ * nothing and snapshot() returns zeros.
+ *
+ * The counters are updated only by the thread using the archive or the type
+ * pool, with relaxed atomic loads and stores that cost the same as plain
+ * ones, so snapshot() can be called from any thread. A type seen for the
+ * first time allocates its counters, under a mutex shared with snapshot().
+ *
+ * Copies of a Stats start from zero.
+ */
+class Stats
+{
+public:
+#ifdef TSCPP_ENABLE_STATS
+    static const bool enabled = true;
+#else
+    static const bool enabled = false;
+#endif
+
+    Stats() {}
+    Stats(const Stats &) {}
+    Stats &operator=(const Stats &) { return *this; }
+
+    /**
+     * @brief Enable measuring the time spent per record, callbacks included,
+     * which costs two reads of the clock per record.
+     *
+     * \param enabled True to measure the time.
+     */
+    void setTiming(bool enabled)
+    {
+#ifdef TSCPP_ENABLE_STATS
+        timing.store(enabled, std::memory_order_relaxed);
+#else
+        (void)enabled;
+#endif
+    }
+
+    /**
+     * \return The time to pass to record(), or 0 if timing is disabled.
+     */
+    uint64_t start() const
+    {
+#ifdef TSCPP_ENABLE_STATS
+        if (timing.load(std::memory_order_relaxed))
+            return now();
+#endif
+        return 0;
+    }
+
+    /**
+     * @brief Count a record.
+     *
+     * \param name Mangled type name, not necessarily '\0' terminated.
+     * \param nameSize Length of the name.
+     * \param hash Hash of the name, as returned by hashTypeName().
+     * \param objects Number of objects in the record.
+     * \param bytes Serialized size of the record.
+     * \param startTime Value returned by start() before processing the
+     * record.
+     */
+    void record(const char *name, int nameSize, uint32_t hash, int objects,
+                uint64_t bytes, uint64_t startTime)
+    {
+#ifdef TSCPP_ENABLE_STATS
+        int i = names.index(name, nameSize, hash);
+        if (i < 0)
+            i = add(name, nameSize);
+        Counters &c = counters[i];
+        increment(c.records, 1);
+        increment(c.objects, objects);
+        increment(c.bytes, bytes);
+        if (startTime == 0)
+            return;
+        uint64_t elapsed = now() - startTime;
+        increment(c.time, elapsed);
+        int bucket = 0;
+        while (elapsed > 0 && bucket < StatsSnapshot::latencyBuckets - 1)
+        {
+            elapsed >>= 1;
+            bucket++;
+        }
+        increment(latency[bucket], 1);
+#else
+        (void)name;
+        (void)nameSize;
+        (void)hash;
+        (void)objects;
+        (void)bytes;
+        (void)startTime;
+#endif
+    }
+
+    /**
+     * @brief Count a record of a type known at compile time.
+     */
+    void record(const TypeName &name, int objects, uint64_t bytes,
+                uint64_t startTime)
+    {
+        if (enabled)
+            record(name.str, name.size, hashTypeName(name.str, name.size),
+                   objects, bytes, startTime);
+    }
+
+    /**
+     * @brief Count an error.
+     *
+     * \param e Kind of error.
+     */
+    void error(StatsError e)
+    {
+#ifdef TSCPP_ENABLE_STATS
+        increment(errors[e], 1);
+#else
+        (void)e;
+#endif
+    }
+
+    /**
+     * \return A copy of the counters.
+     */
+    StatsSnapshot snapshot() const
+    {
+        StatsSnapshot s;
+#ifdef TSCPP_ENABLE_STATS
+        std::lock_guard<std::mutex> l(mutex);
+        for (int i = 0; i < static_cast<int>(counters.size()); i++)
+        {
+            TypeStats t;
+            t.name    = names.name(i);
+            t.records = counters[i].records.load(std::memory_order_relaxed);
+            t.objects = counters[i].objects.load(std::memory_order_relaxed);
+            t.bytes   = counters[i].bytes.load(std::memory_order_relaxed);
+            t.time    = counters[i].time.load(std::memory_order_relaxed);
+            s.types.push_back(t);
+        }
+        for (int i = 0; i < StatsSnapshot::errorTypes; i++)
+            s.errors[i] = errors[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < StatsSnapshot::latencyBuckets; i++)
+            s.latency[i] = latency[i].load(std::memory_order_relaxed);
+#endif
+        return s;
+    }
+
+    /**
+     * @brief Set all the counters to zero. Updates made at the same time by
+     * another thread may be lost.
+     */
+    void reset()
+    {
+#ifdef TSCPP_ENABLE_STATS
+        std::lock_guard<std::mutex> l(mutex);
+        for (auto &c : counters)
+        {
+            c.records.store(0, std::memory_order_relaxed);
+            c.objects.store(0, std::memory_order_relaxed);
+            c.bytes.store(0, std::memory_order_relaxed);
+            c.time.store(0, std::memory_order_relaxed);
+        }
+        for (auto &e : errors)
+            e.store(0, std::memory_order_relaxed);
+        for (auto &b : latency)
+            b.store(0, std::memory_order_relaxed);
+#endif
+    }
+
+#ifdef TSCPP_ENABLE_STATS
+private:
+#ifdef _MIOSIX
+    typedef uint32_t Count;  // 64 bit atomics are not lock free on Cortex-M
+#else
+    typedef uint64_t Count;
+#endif
+
+    class Counters
+    {
+    public:
+        std::atomic<Count> records{0};
+        std::atomic<Count> objects{0};
+        std::atomic<Count> bytes{0};
+        std::atomic<Count> time{0};
+    };
+
+    /**
+     * Only one thread updates the counters, so there is no need for an
+     * atomic read-modify-write.
+     */
+    static void increment(std::atomic<Count> &c, uint64_t n)
+    {
+        c.store(c.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+    }
+
+    static uint64_t now()
+    {
+        using namespace std::chrono;
+        // Never 0, which means that timing is disabled
+        return duration_cast<nanoseconds>(
+                   steady_clock::now().time_since_epoch())
+                   .count() |
+               1;
+    }
+
+    class Seen  ///< Nothing to store in names, only the index is used
+    {
+    };
+
+    int add(const char *name, int nameSize)
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        names.insert(std::string(name, nameSize).c_str());
+        counters.emplace_back();
+        return counters.size() - 1;
+    }
+
+    TypeRegistry<Seen> names;       ///< Index of the counters of each type
+    std::deque<Counters> counters;  ///< Never moved, unlike a vector
+    std::atomic<Count> errors[StatsSnapshot::errorTypes] = {};
+    std::atomic<Count> latency[StatsSnapshot::latencyBuckets] = {};
+    std::atomic<bool> timing{false};
+    mutable std::mutex mutex;  ///< Protects names and counters from snapshot
+#endif
+};
+
+}  // namespace tscpp
@@ -27,7 +27,8 @@
 
 #include "stream.h"
 
-#include <memory>
+#include <algorithm>
+#include <cstdlib>
 #if defined(__GNUC__) && !defined(_MIOSIX)
 #include <cxxabi.h>
 #endif
@@ -37,64 +38,688 @@ using namespace std;
 namespace tscpp
 {
 
-void TypePoolStream::unserializeUnknownImpl(const string& name, istream& is,
-                                            streampos pos) const
+/**
+ * Read a compact header from the stream, storing type id definitions in the
+ * dictionary.
+ *
+ * \param scratch String used to read definitions, reused across calls so that
+ * no allocation is needed once it has grown to the longest name.
+ * \param headerSize Set to the number of bytes read from the stream.
+ * \param name Set to the type name, or nullptr if the type id has not been
+ * defined.
+ * \return False if the stream eof is found.
+ */
+static bool readCompactHeader(istream& is, TypeDictionary& dict,
+                              string& scratch, streamoff& headerSize,
+                              const string*& name)
 {
-    auto it = types.find(name);
-    if (it == types.end())
+    int marker = is.get();
+    if (marker >= TypeIdReference)
+    {
+        headerSize = 1;
+        name       = dict.name(marker & ~TypeIdReference);
+        return true;
+    }
+
+    int id = is.get();
+    getline(is, scratch, '\0');
+    if (is.eof())
+        return false;
+    headerSize = 2 + scratch.size() + 1;
+    name       = nullptr;
+    if (id >= TypeDictionary::maxTypes)
+        return true;
+
+    dict.define(id, scratch.data(), scratch.size());
+    name = dict.name(id);
+    return true;
+}
+
+/**
+ * Append to name the characters up to the next '\0', which is read but not
+ * appended. If the stream eof is found its state is cleared, so that the
+ * stream can be rewound.
+ *
+ * \return The number of bytes read from the stream.
+ */
+static streamoff appendName(istream& is, string& name)
+{
+    for (streamoff size = 1;; size++)
+    {
+        int c = is.get();
+        if (c == istream::traits_type::eof())
+        {
+            is.clear();
+            return size - 1;
+        }
+        if (c == '\0')
+            return size;
+        name.push_back(c);
+    }
+}
+
+/**
+ * Skip the padding before a header.
+ *
+ * \return The number of padding bytes skipped.
+ */
+static streamoff skipPadding(istream& is)
+{
+    streamoff padding = 0;
+    while (is.peek() == '\0')
+    {
+        is.ignore();
+        padding++;
+    }
+    return padding;
+}
+
+/**
+ * Skip the padding before a header and read the fingerprint and the batch or
+ * delta prefix, if present.
+ *
+ * \param prefixSize Set to the number of bytes read from the stream.
+ * \param isDelta Set to true if the object is delta encoded.
+ * \param fingerprint Set to the fingerprint, or 0 if absent.
+ * \param count Set to the number of objects in the batch, or -1 if not a
+ * batch.
+ * \return False if the stream eof is found.
+ */
+static bool readPrefix(istream& is, streamoff& prefixSize, bool& isDelta,
+                       uint32_t& fingerprint, int& count)
+{
+    prefixSize  = skipPadding(is);
+    fingerprint = 0;
+    count       = -1;
+    if (is.peek() == FingerprintPrefix)
+    {
+        char prefix[fingerprintPrefixSize];
+        is.read(prefix, fingerprintPrefixSize);
+        if (is.eof())
+            return false;
+        prefixSize += fingerprintPrefixSize;
+        fingerprint = loadLittleEndian32(prefix + 1);
+    }
+    isDelta = is.peek() == DeltaPrefix;
+    if (isDelta)
+    {
+        is.ignore();
+        prefixSize++;
+    }
+    if (isDelta || is.peek() != BatchPrefix)
+        return true;
+
+    char prefix[batchPrefixSize];
+    is.read(prefix, batchPrefixSize);
+    if (is.eof())
+        return false;
+    prefixSize += batchPrefixSize;
+    count = loadLittleEndian32(prefix + 1);
+    return true;
+}
+
+/**
+ * Read a delta encoded object and rebuild it.
+ *
+ * \param encodedSize Set to the number of bytes read from the stream.
+ * \param object Set to the rebuilt object, or nullptr if no keyframe of the
+ * type has been found yet.
+ * \return False if the stream eof is found.
+ */
+static bool readDelta(istream& is, DeltaState& ds, const char* name,
+                      int nameSize, int size, streamoff& encodedSize,
+                      const void*& object)
+{
+    int maskSize = deltaMaskSize(size);
+    char* mask   = ds.scratch(maskSize + size);
+    is.read(mask, maskSize);
+    if (is.eof())
+        return false;
+    int changed = DeltaState::changedBytes(mask, size);
+    is.read(mask + maskSize, changed);
+    if (is.eof())
+        return false;
+    encodedSize = maskSize + changed;
+    object      = ds.decode(name, nameSize, size, mask);
+    return true;
+}
+
+/**
+ * Count an error of the input archives.
+ *
+ * \return The same result.
+ */
+static ArchiveResult countError(Stats& stats, const ArchiveResult& result)
+{
+    static const StatsError errors[] = {
+        BufferTooSmallError, WrongTypeError, UnknownTypeError,
+        MissingKeyframeError, BatchTooLargeError};
+    if (result.error != ArchiveOk)
+        stats.error(errors[result.error - ArchiveEof]);
+    return result;
+}
+
+/**
+ * Throw the TscppException corresponding to an error.
+ */
+static void throwError(const ArchiveResult& result)
+{
+    throw TscppException(result.what(),
+                         string(result.name, result.nameSize));
+}
+
+static bool isCompactHeader(int marker)
+{
+    return marker == TypeIdDefinition ||
+           (marker >= TypeIdReference && marker != istream::traits_type::eof());
+}
+
+const char* ArchiveResult::what() const
+{
+    static const char* const messages[] = {"",
+                                           "eof",
+                                           "wrong type",
+                                           "unknown type",
+                                           "missing keyframe",
+                                           "batch too large"};
+    return messages[error];
+}
+
+void TypePoolStream::registerSkip(const char* name, int size,
+                                  uint32_t fingerprint)
+{
+    if (size <= 0)
+        throw invalid_argument("invalid skipped type size");
+    DeserializerImpl d;
+    d.size        = size;
+    d.fingerprint = fingerprint;
+    d.read        = [=](istream& is, int count)
+    {
+        is.ignore(static_cast<streamsize>(size) * (count < 0 ? 1 : count));
+        return is.eof() == false;
+    };
+    types.insert(name) = d;
+}
+
+ArchiveError TypePoolStream::unserializeUnknownImpl(const string& name,
+                                                    istream& is,
+                                                    streampos pos,
+                                                    bool& skipped, int count,
+                                                    DeltaState* delta,
+                                                    uint32_t fingerprint) const
+{
+    auto d = types.find(name.data(), name.size(),
+                        hashTypeName(name.data(), name.size()));
+    if (d == nullptr)
+    {
+        is.seekg(pos);
+        return ArchiveUnknownType;
+    }
+    if (fingerprint != 0 && d->fingerprint != 0 &&
+        fingerprint != d->fingerprint)
     {
         is.seekg(pos);
-        throw TscppException("unknown type", name);
+        return ArchiveWrongType;
     }
 
-    it->second(is);
+    skipped = d->usc == nullptr;
+    if (delta == nullptr)
+        return d->read(is, count) ? ArchiveOk : ArchiveEof;
+    if (skipped)
+    {
+        // The previous object is not needed
+        char* mask = delta->scratch(deltaMaskSize(d->size));
+        is.read(mask, deltaMaskSize(d->size));
+        is.ignore(DeltaState::changedBytes(mask, d->size));
+        return is.eof() ? ArchiveEof : ArchiveOk;
+    }
+    streamoff encodedSize;
+    const void* object;
+    if (readDelta(is, *delta, name.data(), name.size(), d->size, encodedSize,
+                  object) == false)
+        return ArchiveEof;
+    if (object)
+        d->usc(object);
+    return ArchiveOk;
+}
+
+void OutputArchive::serializeImpl(const TypeName& name, const void* data,
+                                  int size)
+{
+    uint64_t start  = statistics.start();
+    uint64_t offset = writtenSize;
+    int definedId;
+    int encodedSize;
+    const char* encoded = nullptr;
+    if (delta.enabled())
+        encoded = delta.encode(name.str, data, size, encodedSize);
+    if (encoded)
+    {
+        definedId = writeHeader(name, -1, true);
+        write(encoded, encodedSize);
+    }
+    else
+    {
+        definedId = writeHeader(name, -1);
+        writeObjects(reinterpret_cast<const char*>(data), size);
+    }
+    if (listener)
+        listener->serialized(name, offset, definedId, data);
+    statistics.record(name, 1, writtenSize - offset, start);
 }
 
-void OutputArchive::serializeImpl(const char* name, const void* data, int size)
+void OutputArchive::serializeArrayImpl(const TypeName& name, const void* data,
+                                       int size, int count)
 {
-    int nameSize = strlen(name);
-    os.write(name, nameSize + 1);
-    os.write(reinterpret_cast<const char*>(data), size);
+    uint64_t start  = statistics.start();
+    uint64_t offset = writtenSize;
+    int definedId   = writeHeader(name, count);
+    writeObjects(reinterpret_cast<const char*>(data), size * count);
+    if (listener && count > 0)
+        listener->serialized(name, offset, definedId, data);
+    statistics.record(name, count, writtenSize - offset, start);
 }
 
-void InputArchive::unserializeImpl(const char* name, void* data, int size)
+OutputArchive::OutputArchive(std::ostream* os,
+                             function<void(const char*, int)> sink,
+                             char* block, int blockSize, HeaderFormat format)
+    : os(os), format(format), sink(sink), block(block), blockSize(blockSize)
 {
-    auto pos     = is.tellg();
-    int nameSize = strlen(name);
-    unique_ptr<char[]> unserializedName(new char[nameSize + 1]);
-    is.read(unserializedName.get(), nameSize + 1);
+    if (block == nullptr || blockSize <= 0)
+        throw TscppException("invalid block");
+}
+
+void OutputArchive::flush()
+{
+    flushBlock();
+    if (os)
+        os->flush();
+    else if (gather)
+        gather->flush();
+}
+
+void OutputArchive::flushBlock()
+{
+    if (used == 0)
+        return;
+    writeOut(block, used);
+    used = 0;
+}
+
+int OutputArchive::writeHeader(const TypeName& name, int count, bool isDelta)
+{
+    if (fingerprints && name.fingerprint != 0)
+    {
+        char prefix[fingerprintPrefixSize];
+        prefix[0] = FingerprintPrefix;
+        storeLittleEndian32(prefix + 1, name.fingerprint);
+        write(prefix, sizeof(prefix));
+    }
+    if (isDelta)
+    {
+        char prefix = DeltaPrefix;
+        write(&prefix, 1);
+    }
+    if (count >= 0)
+    {
+        char prefix[batchPrefixSize];
+        prefix[0] = BatchPrefix;
+        storeLittleEndian32(prefix + 1, count);
+        write(prefix, sizeof(prefix));
+    }
+
+    int id = -1;
+    if (format == CompactHeader)
+    {
+        id = dict.find(name.str);
+        if (id >= 0)
+        {
+            char reference = static_cast<char>(TypeIdReference | id);
+            write(&reference, 1);
+            return -1;
+        }
+        id = dict.define(name.str);  // If full, fall back to the full name
+    }
+
+    if (id >= 0)
+    {
+        char definition[] = {TypeIdDefinition, static_cast<char>(id)};
+        write(definition, sizeof(definition));
+    }
+    write(name.str, name.size + 1);
+    return id;
+}
+
+void OutputArchive::write(const char* data, int size)
+{
+    writtenSize += size;
+    if (gather)
+    {
+        gather->write(data, size, false);
+        return;
+    }
+    if (block == nullptr)
+    {
+        os->write(data, size);
+        return;
+    }
+
+    while (size > 0)
+    {
+        int n = min(size, blockSize - used);
+        memcpy(block + used, data, n);
+        used += n;
+        data += n;
+        size -= n;
+        if (used == blockSize)
+            flushBlock();
+    }
+}
+
+void OutputArchive::writeObjects(const char* data, int size)
+{
+    if (gather == nullptr)
+    {
+        write(data, size);
+        return;
+    }
+    writtenSize += size;
+    gather->write(data, size, true);
+}
+
+void OutputArchive::writeOut(const char* data, int size)
+{
+    if (os)
+        os->write(data, size);
+    else
+        sink(data, size);
+}
+
+
+BufferedOutputArchive::~BufferedOutputArchive()
+{
+    // Destructors must not throw, a failing sink loses the last block
+    try
+    {
+        flush();
+    }
+    catch (...)
+    {
+    }
+}
+
+void InputArchive::unserializeImpl(const TypeName& name, void* data, int size)
+{
+    ArchiveResult result = tryUnserializeImpl(name, data, size);
+    if (!result)
+        throwError(result);
+}
+
+ArchiveResult InputArchive::tryUnserializeImpl(const TypeName& name,
+                                               void* data, int size)
+{
+    uint64_t start = statistics.start();
+    streamoff headerSize;
+    bool isDelta;
+    int count;
+    ArchiveResult result = readHeader(name, headerSize, isDelta, count);
+    if (!result)
+        return countError(statistics, result);
+    if (count >= 0)  // Batch found instead of a single object
+        return countError(statistics,
+                          wrongType(headerSize, name.str, name.size));
+    streamoff dataSize = size;
+    if (isDelta)
+    {
+        result = unserializeDelta(name, data, size, dataSize);
+        if (!result)
+            return countError(statistics, result);
+    }
+    else
+    {
+        // NOTE: We are writing on top of a constructed type without calling
+        // its destructor. However, since it is trivially copyable, we at
+        // least aren't overwriting pointers to allocated memory.
+        is.read(reinterpret_cast<char*>(data), size);
+        if (is.eof())
+            return countError(statistics, ArchiveResult(ArchiveEof));
+    }
+    swap(name, data, size, 1);
+    statistics.record(name, 1, headerSize + dataSize, start);
+    return result;
+}
+
+int InputArchive::unserializeArrayImpl(const TypeName& name, void* data,
+                                       int size, int maxCount)
+{
+    int count;
+    ArchiveResult result =
+        tryUnserializeArrayImpl(name, data, size, maxCount, count);
+    if (!result)
+        throwError(result);
+    return count;
+}
+
+ArchiveResult InputArchive::tryUnserializeArrayImpl(const TypeName& name,
+                                                    void* data, int size,
+                                                    int maxCount, int& count)
+{
+    uint64_t start = statistics.start();
+    streamoff headerSize;
+    bool isDelta;
+    count                = 0;
+    int found            = 0;
+    ArchiveResult result = readHeader(name, headerSize, isDelta, found);
+    if (!result)
+        return countError(statistics, result);
+    if (isDelta)
+    {
+        streamoff dataSize;
+        result = unserializeDelta(name, data, size, dataSize);
+        if (!result)
+            return countError(statistics, result);
+        swap(name, data, size, 1);
+        statistics.record(name, 1, headerSize + dataSize, start);
+        count = 1;
+        return result;
+    }
+    if (found < 0)
+        found = 1;
+    if (found > maxCount)
+    {
+        is.seekg(-headerSize, ios_base::cur);
+        return countError(statistics, ArchiveResult(ArchiveBatchTooLarge,
+                                                    name.str, name.size));
+    }
+
+    // NOTE: We are writing on top of constructed types without calling
+    // their destructors. However, since they are trivially copyable, we
+    // at least aren't overwriting pointers to allocated memory.
+    is.read(reinterpret_cast<char*>(data), size * found);
     if (is.eof())
-        throw TscppException("eof");
+        return countError(statistics, ArchiveResult(ArchiveEof));
+    swap(name, data, size, found);
+    statistics.record(name, found, headerSize + size * found, start);
+    count = found;
+    return result;
+}
+
+ArchiveResult InputArchive::readHeader(const TypeName& name,
+                                       streamoff& headerSize, bool& isDelta,
+                                       int& count)
+{
+    // NOTE: the position is not saved with tellg, which is costly on file
+    // streams. If the type is wrong we seek back by the bytes read instead.
+    streamoff prefixSize;
+    uint32_t fingerprint;
+    if (readPrefix(is, prefixSize, isDelta, fingerprint, count) == false)
+        return ArchiveResult(ArchiveEof);
+    if (fingerprint != 0 && name.fingerprint != 0 &&
+        fingerprint != name.fingerprint)
+        return wrongType(prefixSize);
+    if (isCompactHeader(is.peek()))
+    {
+        const string* unserializedName;
+        if (readCompactHeader(is, dict, nameBuffer, headerSize,
+                              unserializedName) == false)
+            return ArchiveResult(ArchiveEof);
+        headerSize += prefixSize;
+        if (unserializedName == nullptr)
+            return wrongType(headerSize, "", 0);
+        if (unserializedName->compare(0, string::npos, name.str, name.size))
+            return wrongType(headerSize, unserializedName->c_str(),
+                             unserializedName->size());
+        return ArchiveResult();
+    }
+
+    // Compare the name in chunks, to avoid allocating a buffer as large as
+    // the name
+    int nameSize = name.size;
+    char chunk[32];
+    for (int compared = 0; compared < nameSize + 1;)
+    {
+        int chunkSize = min<int>(sizeof(chunk), nameSize + 1 - compared);
+        is.read(chunk, chunkSize);
+        if (is.eof())
+            return ArchiveResult(ArchiveEof);
+
+        compared += chunkSize;
+        if (memcmp(chunk, name.str + compared - chunkSize, chunkSize) == 0)
+            continue;
+
+        // The name found starts with the bytes compared so far, read the
+        // rest of it without going back to the start of the header
+        foundName.assign(name.str, compared - chunkSize);
+        const void* end = memchr(chunk, '\0', chunkSize);
+        streamoff read  = prefixSize + compared;
+        if (end)
+        {
+            foundName.append(chunk, static_cast<const char*>(end) - chunk);
+        }
+        else
+        {
+            foundName.append(chunk, chunkSize);
+            read += appendName(is, foundName);
+        }
+        return wrongType(read, foundName.c_str(), foundName.size());
+    }
+    headerSize = prefixSize + nameSize + 1;
+    return ArchiveResult();
+}
+
+ArchiveResult InputArchive::wrongType(streamoff headerSize, const char* found,
+                                      int foundSize)
+{
+    is.seekg(-headerSize, ios_base::cur);
+    return ArchiveResult(ArchiveWrongType, found, foundSize);
+}
+
+ArchiveResult InputArchive::wrongType(streamoff prefixSize)
+{
+    // Only the prefix has been read, read the name to report it
+    if (isCompactHeader(is.peek()))
+    {
+        streamoff headerSize;
+        const string* found;
+        if (readCompactHeader(is, dict, nameBuffer, headerSize, found) == false)
+            return ArchiveResult(ArchiveEof);
+        if (found == nullptr)
+            return wrongType(prefixSize + headerSize, "", 0);
+        return wrongType(prefixSize + headerSize, found->c_str(),
+                         found->size());
+    }
+    foundName.clear();
+    streamoff read = appendName(is, foundName);
+    return wrongType(prefixSize + read, foundName.c_str(), foundName.size());
+}
 
-    if (memcmp(unserializedName.get(), name, nameSize + 1))
-        wrongType(pos);
+ArchiveResult InputArchive::unserializeDelta(const TypeName& name, void* data,
+                                             int size, streamoff& encodedSize)
+{
+    const void* object;
+    if (readDelta(is, delta, name.str, name.size, size, encodedSize,
+                  object) == false)
+        return ArchiveResult(ArchiveEof);
+    if (object == nullptr)
+        return ArchiveResult(ArchiveMissingKeyframe, name.str, name.size);
 
     // NOTE: We are writing on top of a constructed type without calling its
     // destructor. However, since it is trivially copyable, we at least aren't
     // overwriting pointers to allocated memory.
-    is.read(reinterpret_cast<char*>(data), size);
-    if (is.eof())
-        throw TscppException("eof");
+    memcpy(data, object, size);
+    return ArchiveResult();
 }
 
-void InputArchive::wrongType(streampos pos)
+void InputArchive::swap(const TypeName& name, void* data, int size, int count)
 {
-    is.seekg(pos);
-    string name;
-    getline(is, name, '\0');
-    is.seekg(pos);
-    throw TscppException("wrong type", name);
+    if (byteSwap == false)
+        return;
+    const FieldLayout* layout = layouts.find(name.str);
+    if (layout)
+        layout->swap(data, count, size);
 }
 
 void UnknownInputArchive::unserialize()
 {
-    auto pos = is.tellg();
-    string name;
-    getline(is, name, '\0');
-    if (is.eof())
-        throw TscppException("eof");
+    ArchiveResult result = tryUnserialize();
+    if (!result)
+        throwError(result);
+}
+
+ArchiveResult UnknownInputArchive::tryUnserialize()
+{
+    uint64_t start = statistics.start();
+    auto pos       = is.tellg();
+    streamoff prefixSize;
+    bool isDelta;
+    uint32_t fingerprint;
+    int count;
+    if (readPrefix(is, prefixSize, isDelta, fingerprint, count) == false)
+        return countError(statistics, ArchiveResult(ArchiveEof));
+    DeltaState* ds = isDelta ? &delta : nullptr;
+    const string* name;
+    if (isCompactHeader(is.peek()))
+    {
+        streamoff headerSize;
+        if (readCompactHeader(is, dict, nameBuffer, headerSize, name) == false)
+            return countError(statistics, ArchiveResult(ArchiveEof));
+        if (name == nullptr)
+        {
+            is.seekg(pos);
+            return countError(statistics, ArchiveResult(ArchiveUnknownType));
+        }
+    }
+    else
+    {
+        getline(is, fullName, '\0');
+        if (is.eof())
+            return countError(statistics, ArchiveResult(ArchiveEof));
+        name = &fullName;
+    }
 
-    tp.unserializeUnknownImpl(name, is, pos);
+    bool skipped;
+    ArchiveError error =
+        tp.unserializeUnknownImpl(*name, is, pos, skipped, count, ds,
+                                  fingerprint);
+    if (error == ArchiveEof)
+        return countError(statistics, ArchiveResult(error));
+    if (error != ArchiveOk)
+        return countError(statistics, ArchiveResult(error, name->c_str(),
+                                                    name->size()));
+    if (skipped)
+        skippedCount++;
+    record(*name, count, pos, start);
+    return ArchiveResult();
+}
+
+void UnknownInputArchive::record(const string& name, int count,
+                                 streampos pos, uint64_t start)
+{
+    if (Stats::enabled == false)
+        return;
+    statistics.record(name.data(), name.size(),
+                      hashTypeName(name.data(), name.size()),
+                      count < 0 ? 1 : count, is.tellg() - pos, start);
 }
 
 string demangle(const string& name)
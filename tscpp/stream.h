@@ -32,7 +32,8 @@
  *
  * This file contains classes to serialize types to std
  * streams. These classes provide a high level API compatible with the C++ stl.
- * Error reporting is performed through exceptions.
+ * Error reporting is performed through exceptions, or through ArchiveResult by
+ * the member functions whose name starts with try.
  *
  * NOTE: The serialization format between the buffer and stream API is
  * interchangeable, so you can for example serialize using the buffer API and
@@ -44,12 +45,16 @@
 #include <cstring>
 #include <functional>
 #include <istream>
-#include <map>
 #include <ostream>
 #include <stdexcept>
 #include <string>
 #include <type_traits>
 
+#include "format.h"
+#include "registry.h"
+#include "stats.h"
+#include "swap.h"
+
 namespace tscpp
 {
 
@@ -95,6 +100,60 @@ private:
     std::string n;
 };
 
+/**
+ * Errors reported by the input archives, see ArchiveResult.
+ */
+enum ArchiveError
+{
+    ArchiveOk,               ///< No error
+    ArchiveEof,              ///< The stream eof was found
+    ArchiveWrongType,        ///< A different type or fingerprint was found
+    ArchiveUnknownType,      ///< The type found was not registered
+    ArchiveMissingKeyframe,  ///< A delta was found before any keyframe
+    ArchiveBatchTooLarge     ///< The batch found does not fit the array
+};
+
+/**
+ * @brief Result of the input archive member functions that do not throw.
+ *
+ * It holds the same information as a TscppException, but the name of the type
+ * found is a view into a buffer of the archive, or into its type dictionary,
+ * and is valid only until the next call to the archive. No memory is
+ * allocated to report an error.
+ *
+ * \code
+ * InputArchive ia(is);
+ * Foo f;
+ * ArchiveResult r = ia.tryRead(f);
+ * if(!r && r.error==ArchiveWrongType)
+ *     cerr << "Expected Foo, found " << demangle(r.name) << endl;
+ * \endcode
+ */
+class ArchiveResult
+{
+public:
+    ArchiveResult(ArchiveError error = ArchiveOk, const char* name = "",
+                  int nameSize = 0)
+        : error(error), name(name), nameSize(nameSize)
+    {
+    }
+
+    /**
+     * \return True if there was no error.
+     */
+    explicit operator bool() const { return error == ArchiveOk; }
+
+    /**
+     * \return The message of the TscppException thrown for the same error,
+     * such as "wrong type", or "" if there was no error.
+     */
+    const char* what() const;
+
+    ArchiveError error;  ///< Error found
+    const char* name;    ///< Mangled type name, null terminated, or ""
+    int nameSize;        ///< Size of name, without the terminator
+};
+
 /**
  * @brief Type pool for the TSCPP stream API.
  *
@@ -116,12 +175,66 @@ public:
     template <typename T>
     void registerType(std::function<void(T& t)> callback);
 
-    void unserializeUnknownImpl(const std::string& name, std::istream& is,
-                                std::streampos pos) const;
+    /**
+     * @brief Register a type that is not wanted, so that its objects are
+     * skipped by UnknownInputArchive::unserialize() instead of throwing.
+     *
+     * \tparam T Type to be skipped.
+     */
+    template <typename T>
+    void registerSkip()
+    {
+        registerSkip(typeid(T).name(), sizeof(T), fingerprint<T>());
+    }
+
+    /**
+     * @brief Register a type that is not wanted by its name and size, when
+     * the type itself is not known. Its fingerprint is not checked.
+     *
+     * \param name Mangled type name.
+     * \param size Size of the type.
+     * \throws std::invalid_argument if size is not positive.
+     */
+    void registerSkip(const std::string& name, int size)
+    {
+        registerSkip(name.c_str(), size, 0);
+    }
+
+    /**
+     * \param name Serialized type name.
+     * \param is Input stream, positioned after the header.
+     * \param pos Position of the header, restored if the type is unknown.
+     * \param skipped Set to true if the type was registered with
+     * registerSkip() and its objects were skipped.
+     * \param count Number of objects in a batch, or -1 for a single object.
+     * \param delta If the object is delta encoded, the delta state of the
+     * session, otherwise nullptr.
+     * \param fingerprint Fingerprint found in the header, or 0 if absent.
+     * \return ArchiveOk, or the error found.
+     */
+    ArchiveError unserializeUnknownImpl(const std::string& name,
+                                        std::istream& is, std::streampos pos,
+                                        bool& skipped, int count = -1,
+                                        DeltaState* delta    = nullptr,
+                                        uint32_t fingerprint = 0) const;
 
 private:
-    ///< Registered types serialized name and callback function
-    std::map<std::string, std::function<void(std::istream&)>> types;
+    void registerSkip(const char* name, int size, uint32_t fingerprint);
+
+    class DeserializerImpl
+    {
+    public:
+        int size             = 0;
+        uint32_t fingerprint = 0;
+        ///< Unserializes the given number of objects or a single one if -1,
+        ///< returns false if the stream eof is found
+        std::function<bool(std::istream&, int)> read;
+        ///< Calls the callback with an object already rebuilt in memory, or
+        ///< nullptr if the type is skipped
+        std::function<void(const void*)> usc;
+    };
+
+    TypeRegistry<DeserializerImpl> types;  ///< Registered types
 };
 
 template <typename T>
@@ -131,7 +244,10 @@ void TypePoolStream::registerType(std::function<void(T& t)> callback)
     static_assert(std::is_trivially_copyable<T>::value,
                   "Type is not trivially copyable");
 #endif
-    types[typeid(T).name()] = [=](std::istream& is)
+    DeserializerImpl d;
+    d.size        = sizeof(T);
+    d.fingerprint = fingerprint<T>();
+    d.read        = [=](std::istream& is, int count) -> bool
     {
         // NOTE: We copy the buffer to respect alignment requirements.
         // The buffer may not be suitably aligned for the unserialized type
@@ -140,13 +256,77 @@ void TypePoolStream::registerType(std::function<void(T& t)> callback)
         // its destructor. However, since it is trivially copyable, we at
         // least aren't overwriting pointers to allocated memory.
         T t;
-        is.read(reinterpret_cast<char*>(&t), sizeof(T));
-        if (is.eof())
-            throw TscppException("eof");
+        for (int i = 0; i < (count < 0 ? 1 : count); i++)
+        {
+            is.read(reinterpret_cast<char*>(&t), sizeof(T));
+            if (is.eof())
+                return false;
+            callback(t);
+        }
+        return true;
+    };
+    d.usc = [=](const void* data)
+    {
+        T t;
+        memcpy(&t, data, sizeof(T));
         callback(t);
     };
+    types.insert(typeid(T).name()) = d;
 }
 
+/**
+ * @brief Interface to be notified of the types serialized by an
+ * OutputArchive, for example to build an index such as LogIndexWriter.
+ */
+class OutputArchiveListener
+{
+public:
+    /**
+     * @brief Called after a type, or an array, has been serialized.
+     *
+     * \param name Serialized type name.
+     * \param offset Offset where the header starts, as OutputArchive::written()
+     * before the type was serialized.
+     * \param definedId If the compact header defined a type id, the id,
+     * otherwise -1.
+     * \param data Pointer to the serialized object, or to the first one of an
+     * array.
+     */
+    virtual void serialized(const TypeName& name, uint64_t offset,
+                            int definedId, const void* data) = 0;
+
+protected:
+    ~OutputArchiveListener() = default;
+};
+
+/**
+ * @brief Interface for the destinations of an OutputArchive that can reference
+ * the serialized objects instead of copying them, such as GatherSink.
+ */
+class OutputSink
+{
+public:
+    /**
+     * @brief Called with each part of a serialized type, in order.
+     *
+     * \param data Bytes to write.
+     * \param size Number of bytes.
+     * \param stable True if data is a serialized object that the caller keeps
+     * valid and unchanged until flush(), so that it can be referenced, false
+     * if it is a temporary such as a header and has to be copied.
+     */
+    virtual void write(const char* data, int size, bool stable) = 0;
+
+    /**
+     * @brief Called by OutputArchive::flush(), after which the objects
+     * written are no longer referenced.
+     */
+    virtual void flush() = 0;
+
+protected:
+    ~OutputSink() = default;
+};
+
 /**
  * @brief The output archive.
  *
@@ -157,8 +337,27 @@ class OutputArchive
 public:
     /**
      * \param os Output stream where serialized types will be written.
+     * \param format Header format, with CompactHeader the type names are
+     * written only the first time each type is serialized.
      */
-    OutputArchive(std::ostream& os) : os(os) {}
+    OutputArchive(std::ostream& os, HeaderFormat format = FullNameHeader)
+        : os(&os), format(format)
+    {
+    }
+
+    /**
+     * Serialized objects are passed by reference to the sink, which may
+     * submit them to the kernel without copying them: objects serialized,
+     * except delta encoded ones, must stay valid and unchanged until flush().
+     *
+     * \param sink Destination of the serialized types, must outlive the
+     * archive.
+     * \param format Header format.
+     */
+    OutputArchive(OutputSink& sink, HeaderFormat format = FullNameHeader)
+        : os(nullptr), format(format), gather(&sink)
+    {
+    }
 
     /**
      * @brief Actual implementation of the serialization.
@@ -169,15 +368,174 @@ public:
      * @param data Type data
      * @param size Size of the data
      */
-    void serializeImpl(const char* name, const void* data, int size);
+    void serializeImpl(const TypeName& name, const void* data, int size);
+
+    /**
+     * @brief Serialize an array of objects of the same type.
+     *
+     * The type name is written only once, followed by the number of objects
+     * and the objects themselves.
+     *
+     * \param t Pointer to the first object to serialize.
+     * \param count Number of objects to serialize.
+     */
+    template <typename T>
+    void writeBatch(const T* t, int count);
+
+    /**
+     * @brief Actual implementation of the array serialization.
+     *
+     * @param name Type name saved before the data.
+     * @param data Type data
+     * @param size Size of one object
+     * @param count Number of objects
+     */
+    void serializeArrayImpl(const TypeName& name, const void* data, int size,
+                            int count);
+
+    /**
+     * @brief Write out the data serialized so far.
+     *
+     * Flushes the ostream or the OutputSink and, if the archive is buffered,
+     * writes the partially filled block.
+     */
+    void flush();
+
+    /**
+     * \return The number of bytes serialized since the archive was created.
+     */
+    uint64_t written() const { return writtenSize; }
+
+    /**
+     * @brief Enable the delta encoding of a type, see DeltaState.
+     *
+     * Objects of the type serialized with the << operator are then stored as
+     * the bytes changed since the previous one, with a keyframe every
+     * keyframeInterval objects. Arrays are not delta encoded.
+     *
+     * \tparam T Type to delta encode.
+     * \param keyframeInterval Number of objects from one keyframe to the next.
+     * \throws std::invalid_argument if keyframeInterval is less than 1.
+     */
+    template <typename T>
+    void enableDelta(int keyframeInterval)
+    {
+        delta.enable<T>(keyframeInterval);
+    }
+
+    /**
+     * @brief Write the fingerprint of each type before its header, so that
+     * readers detect types whose layout changed, see fingerprint().
+     *
+     * \param enabled True to write the fingerprints.
+     */
+    void setFingerprints(bool enabled) { fingerprints = enabled; }
+
+    /**
+     * \param listener Listener notified of each type serialized, or nullptr.
+     */
+    void setListener(OutputArchiveListener* listener)
+    {
+        this->listener = listener;
+    }
+
+    /**
+     * \return The counters of the types serialized, compiled only with
+     * TSCPP_ENABLE_STATS, see Stats.
+     */
+    Stats& stats() { return statistics; }
+
+protected:
+    /**
+     * Constructor used by BufferedOutputArchive, records are packed into
+     * block and written out only when the block is full or flushed.
+     */
+    OutputArchive(std::ostream* os,
+                  std::function<void(const char*, int)> sink, char* block,
+                  int blockSize, HeaderFormat format);
 
 private:
     OutputArchive(const OutputArchive&) = delete;
     OutputArchive& operator=(const OutputArchive&) = delete;
 
-    std::ostream& os;
+    int writeHeader(const TypeName& name, int count, bool isDelta = false);
+    void flushBlock();
+    void write(const char* data, int size);
+    void writeObjects(const char* data, int size);
+    void writeOut(const char* data, int size);
+
+    std::ostream* os;  ///< If nullptr, written through gather or sink
+    HeaderFormat format;
+    TypeDictionary dict;  ///< Type ids assigned with the compact format
+    DeltaState delta;     ///< Previous objects of the delta encoded types
+    OutputSink* gather = nullptr;  ///< If not nullptr, objects are referenced
+    std::function<void(const char*, int)> sink;
+    char* block                     = nullptr;  ///< If nullptr, no buffering
+    int blockSize                   = 0;
+    int used                        = 0;  ///< Bytes of block already filled
+    uint64_t writtenSize            = 0;
+    OutputArchiveListener* listener = nullptr;
+    bool fingerprints               = false;
+    Stats statistics;
 };
 
+/**
+ * @brief An output archive that writes whole blocks.
+ *
+ * Serialized records are packed into a caller provided block buffer, and
+ * the block is written to the ostream or to a write callback only once it is
+ * full, saving per record stream overhead. Records may span blocks. The last,
+ * partially filled block is written by flush() or by the destructor.
+ *
+ * Serialize to it with the << operator, as with OutputArchive.
+ */
+class BufferedOutputArchive : public OutputArchive
+{
+public:
+    /**
+     * \param os Output stream where blocks will be written.
+     * \param block Buffer where records are packed, must outlive the archive.
+     * Its alignment is preserved, as blocks are always written whole.
+     * \param blockSize Size of block, for example the sector size of the
+     * storage device.
+     * \param format Header format.
+     */
+    BufferedOutputArchive(std::ostream& os, char* block, int blockSize,
+                          HeaderFormat format = FullNameHeader)
+        : OutputArchive(&os, nullptr, block, blockSize, format)
+    {
+    }
+
+    /**
+     * \param sink Callback called with each block and its size. All blocks
+     * are blockSize bytes except the last one written by flush().
+     * \param block Buffer where records are packed, must outlive the archive.
+     * \param blockSize Size of block.
+     * \param format Header format.
+     */
+    BufferedOutputArchive(std::function<void(const char*, int)> sink,
+                          char* block, int blockSize,
+                          HeaderFormat format = FullNameHeader)
+        : OutputArchive(nullptr, sink, block, blockSize, format)
+    {
+    }
+
+    /**
+     * Calls flush().
+     */
+    ~BufferedOutputArchive();
+};
+
+template <typename T>
+void OutputArchive::writeBatch(const T* t, int count)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    serializeArrayImpl(typeName<T>(), t, sizeof(T), count);
+}
+
 /**
  * @brief Serialize a type.
  *
@@ -191,7 +549,7 @@ OutputArchive& operator<<(OutputArchive& oa, const T& t)
     static_assert(std::is_trivially_copyable<T>::value,
                   "Type is not trivially copyable");
 #endif
-    oa.serializeImpl(typeid(t).name(), &t, sizeof(t));
+    oa.serializeImpl(typeName<T>(), &t, sizeof(t));
     return oa;
 }
 
@@ -200,7 +558,7 @@ OutputArchive& operator<<(OutputArchive& oa, const T& t)
  *
  * This class allows to unserialize types from a stream, as long as you know
  * what types have been serialized in which order. Otherwise have a look at
- * UnknownInputArchive.
+ * UnknownInputArchive. Both header formats are accepted.
  *
  * To unserialize, use the >> operator.
  */
@@ -221,24 +579,163 @@ public:
      * @param data Pointer where to save the type data.
      * @param size Size of the data.
      */
-    void unserializeImpl(const char* name, void* data, int size);
+    void unserializeImpl(const TypeName& name, void* data, int size);
+
+    /**
+     * @brief Unserialize a type without throwing.
+     *
+     * \param t Type to unserialize.
+     * \return ArchiveOk, or the error for which operator>> would throw, in
+     * which case t is unchanged. Type errors leave the stream at the start
+     * of the type found, so that it can be read as a different type.
+     */
+    template <typename T>
+    ArchiveResult tryRead(T& t);
+
+    /**
+     * @brief Actual implementation of tryRead().
+     */
+    ArchiveResult tryUnserializeImpl(const TypeName& name, void* data,
+                                     int size);
+
+    /**
+     * @brief Unserialize an array of objects of the same type.
+     *
+     * Both arrays serialized with OutputArchive::writeBatch() and single
+     * objects are accepted.
+     *
+     * \param t Pointer to the first object where to unserialize the array.
+     * \param maxCount Number of objects that fit in t.
+     * \return The number of objects unserialized.
+     * \throws Throws a TscppException if the type found in the stream is not
+     * the one expected, if the array has more than maxCount objects, or if the
+     * stream eof is found.
+     */
+    template <typename T>
+    int readBatch(T* t, int maxCount);
+
+    /**
+     * @brief Actual implementation of the array deserialization.
+     *
+     * @param name Type name to read before the data.
+     * @param data Pointer where to save the type data.
+     * @param size Size of one object.
+     * @param maxCount Number of objects that fit in data.
+     * @return The number of objects unserialized.
+     */
+    int unserializeArrayImpl(const TypeName& name, void* data, int size,
+                             int maxCount);
+
+    /**
+     * @brief Unserialize an array of objects of the same type without
+     * throwing, see readBatch().
+     *
+     * \param t Pointer to the first object where to unserialize the array.
+     * \param maxCount Number of objects that fit in t.
+     * \param count Set to the number of objects unserialized, 0 on errors.
+     * \return ArchiveOk, or the error for which readBatch() would throw.
+     */
+    template <typename T>
+    ArchiveResult tryReadBatch(T* t, int maxCount, int& count);
+
+    /**
+     * @brief Actual implementation of tryReadBatch().
+     */
+    ArchiveResult tryUnserializeArrayImpl(const TypeName& name, void* data,
+                                          int size, int maxCount, int& count);
+
+    /**
+     * @brief Set the layout of the fields of a type, used to swap its bytes
+     * when byte swapping is enabled.
+     *
+     * \tparam T Type read from the archive.
+     * \param layout Layout of the fields of T.
+     */
+    template <typename T>
+    void setLayout(const FieldLayout& layout)
+    {
+        layouts.insert(typeid(T).name()) = layout;
+    }
+
+    /**
+     * @brief Enable byte swapping, to read streams written on a machine with
+     * the opposite endianness.
+     *
+     * Objects are swapped after being read, according to the layout of their
+     * type set with setLayout(). Types without a layout are left unchanged.
+     *
+     * \param enabled True to swap the bytes.
+     */
+    void setByteSwap(bool enabled) { byteSwap = enabled; }
+
+    /**
+     * \return The counters of the types unserialized and of the errors
+     * thrown, compiled only with TSCPP_ENABLE_STATS, see Stats.
+     */
+    Stats& stats() { return statistics; }
 
 private:
     InputArchive(const InputArchive&) = delete;
     InputArchive& operator=(const InputArchive&) = delete;
 
-    void wrongType(std::streampos pos);
+    ArchiveResult readHeader(const TypeName& name, std::streamoff& headerSize,
+                             bool& isDelta, int& count);
+    ArchiveResult wrongType(std::streamoff headerSize, const char* found,
+                            int foundSize);
+    ArchiveResult wrongType(std::streamoff prefixSize);
+    ArchiveResult unserializeDelta(const TypeName& name, void* data, int size,
+                                   std::streamoff& encodedSize);
+    void swap(const TypeName& name, void* data, int size, int count);
 
     std::istream& is;
+    TypeDictionary dict;     ///< Type ids found with the compact format
+    DeltaState delta;        ///< Previous objects of the delta encoded types
+    std::string nameBuffer;  ///< Reused to read type id definitions
+    std::string foundName;   ///< Reused to read the name of wrong types
+    TypeRegistry<FieldLayout> layouts;  ///< Fields of the swapped types
+    bool byteSwap = false;
+    Stats statistics;
 };
 
+template <typename T>
+int InputArchive::readBatch(T* t, int maxCount)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return unserializeArrayImpl(typeName<T>(), t, sizeof(T), maxCount);
+}
+
+template <typename T>
+ArchiveResult InputArchive::tryRead(T& t)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return tryUnserializeImpl(typeName<T>(), &t, sizeof(t));
+}
+
+template <typename T>
+ArchiveResult InputArchive::tryReadBatch(T* t, int maxCount, int& count)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    return tryUnserializeArrayImpl(typeName<T>(), t, sizeof(T), maxCount,
+                                   count);
+}
+
 /**
  * @brief Unserialize a type.
  *
  * \param ia Archive where the type has been serialized.
  * \param t Type to unserialize.
  * \throws Throws a TscppException if the type found in the stream is not the
- * one expected, or if the stream eof is found.
+ * one expected or has a different fingerprint, if it is delta encoded and no
+ * keyframe has been found yet, or if the stream eof is found.
  */
 template <typename T>
 InputArchive& operator>>(InputArchive& ia, T& t)
@@ -247,7 +744,7 @@ InputArchive& operator>>(InputArchive& ia, T& t)
     static_assert(std::is_trivially_copyable<T>::value,
                   "Type is not trivially copyable");
 #endif
-    ia.unserializeImpl(typeid(t).name(), &t, sizeof(t));
+    ia.unserializeImpl(typeName<T>(), &t, sizeof(t));
     return ia;
 }
 
@@ -255,7 +752,7 @@ InputArchive& operator>>(InputArchive& ia, T& t)
  * @brief The unknown input archive.
  *
  * This class allows to unserialize types from a stream which have been
- * serialized in an unknown order.
+ * serialized in an unknown order. Both header formats are accepted.
  */
 class UnknownInputArchive
 {
@@ -274,17 +771,64 @@ public:
      * @brief Unserialize one type from the input stream, calling the
      * corresponding callback registered in the TypePool.
      *
+     * Arrays serialized with OutputArchive::writeBatch() call the callback
+     * once per object. Delta encoded objects found before the first keyframe
+     * of their type are skipped without calling the callback, as are the
+     * objects of the types registered with TypePoolStream::registerSkip().
+     *
      * \throws Throws a TscppException if the type found in the stream has not
-     * been registred in the TypePool or if the stream eof is found.
+     * been registred in the TypePool or has a different fingerprint, or if the
+     * stream eof is found.
      */
     void unserialize();
 
+    /**
+     * @brief Unserialize one type from the input stream without throwing, see
+     * unserialize().
+     *
+     * Exceptions thrown by the callbacks are not caught.
+     *
+     * \return ArchiveOk, or the error for which unserialize() would throw.
+     * After a type error the stream is at the start of the type found.
+     */
+    ArchiveResult tryUnserialize();
+
+    /**
+     * \return The number of delta encoded objects skipped because no keyframe
+     * of their type had been found.
+     */
+    uint64_t missingDeltas() const { return delta.missing(); }
+
+    /**
+     * \return The number of types skipped, because they were registered
+     * with TypePoolStream::registerSkip(). Batches count as one.
+     */
+    uint64_t skipped() const { return skippedCount; }
+
+    /**
+     * @brief Counters of the types unserialized and of the errors thrown,
+     * compiled only with TSCPP_ENABLE_STATS, see Stats.
+     *
+     * The time of each record includes the callback. With TSCPP_ENABLE_STATS
+     * counting the bytes costs one more tellg() per record.
+     */
+    Stats& stats() { return statistics; }
+
 private:
     UnknownInputArchive(const UnknownInputArchive&) = delete;
     UnknownInputArchive& operator=(const UnknownInputArchive&) = delete;
 
+    void record(const std::string& name, int count, std::streampos pos,
+                uint64_t start);
+
     std::istream& is;
     const TypePoolStream& tp;
+    TypeDictionary dict;     ///< Type ids found with the compact format
+    DeltaState delta;        ///< Previous objects of the delta encoded types
+    std::string nameBuffer;  ///< Reused to read type id definitions
+    std::string fullName;    ///< Reused to read full name headers
+    Stats statistics;
+    uint64_t skippedCount = 0;
 };
 
 /**
@@ -0,0 +1,352 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file swap.h
+ *
+ * @brief Byte swapping of serialized objects, to read logs written on a
+ * machine with the opposite endianness.
+ *
+ * The layout of a type is described by a FieldLayout listing its scalar
+ * fields, usually built with the TSCPP_FIELD macro. Contiguous fields of the
+ * same size, such as arrays, are merged in runs which are swapped with SSE2
+ * on x86 and NEON on AArch64, or with a scalar loop elsewhere or if
+ * TSCPP_NO_SIMD is defined.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef TSCPP_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64)
+#define TSCPP_SWAP_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define TSCPP_SWAP_NEON
+#include <arm_neon.h>
+#endif
+#endif  // TSCPP_NO_SIMD
+
+/**
+ * @brief Describe a field of a type for a FieldLayout.
+ *
+ * The field must be a scalar or an array of scalars. Fields of nested types
+ * are listed one by one, as in TSCPP_FIELD(Foo, bar.x).
+ *
+ * \param type Type containing the field.
+ * \param member Name of the field.
+ */
+#define TSCPP_FIELD(type, member)                                   \
+    ::tscpp::FieldLayout::Field::of<decltype(                       \
+        std::declval<type &>().member)>(offsetof(type, member))
+
+namespace tscpp
+{
+
+/**
+ * Swap the bytes of count 16 bit integers with a scalar loop.
+ */
+inline void swapBytes16Scalar(char *data, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uint16_t x;
+        memcpy(&x, data + 2 * i, 2);
+        x = static_cast<uint16_t>(x << 8 | x >> 8);
+        memcpy(data + 2 * i, &x, 2);
+    }
+}
+
+/**
+ * Swap the bytes of count 32 bit integers with a scalar loop.
+ */
+inline void swapBytes32Scalar(char *data, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t x;
+        memcpy(&x, data + 4 * i, 4);
+        x = x << 24 | (x & 0xff00) << 8 | (x >> 8 & 0xff00) | x >> 24;
+        memcpy(data + 4 * i, &x, 4);
+    }
+}
+
+/**
+ * Swap the bytes of count 64 bit integers with a scalar loop.
+ */
+inline void swapBytes64Scalar(char *data, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t x[2];
+        memcpy(x, data + 8 * i, 8);
+        std::swap(x[0], x[1]);
+        swapBytes32Scalar(reinterpret_cast<char *>(x), 2);
+        memcpy(data + 8 * i, x, 8);
+    }
+}
+
+#ifdef TSCPP_SWAP_SSE2
+
+/**
+ * \return The 16 bit lanes of v with their two bytes swapped.
+ */
+inline __m128i swapLanes16(__m128i v)
+{
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+/**
+ * Swap the bytes of count integers of the given size, 2, 4 or 8 bytes, 16
+ * bytes at a time. SSE2 has no byte shuffle, so the 16 bit lanes are
+ * reordered first and then their bytes are swapped.
+ *
+ * \return The number of integers swapped, the rest is left to the caller.
+ */
+inline size_t swapBytesSse2(char *data, size_t count, int size)
+{
+    size_t n = count * size / 16 * 16 / size;
+    for (size_t i = 0; i < n * size; i += 16)
+    {
+        __m128i *p = reinterpret_cast<__m128i *>(data + i);
+        __m128i v  = _mm_loadu_si128(p);
+        if (size == 4)
+        {
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        }
+        else if (size == 8)
+        {
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+        }
+        _mm_storeu_si128(p, swapLanes16(v));
+    }
+    return n;
+}
+
+#endif  // TSCPP_SWAP_SSE2
+
+#ifdef TSCPP_SWAP_NEON
+
+/**
+ * Swap the bytes of count integers of the given size, 2, 4 or 8 bytes, 16
+ * bytes at a time.
+ *
+ * \return The number of integers swapped, the rest is left to the caller.
+ */
+inline size_t swapBytesNeon(char *data, size_t count, int size)
+{
+    size_t n = count * size / 16 * 16 / size;
+    for (size_t i = 0; i < n * size; i += 16)
+    {
+        uint8_t *p   = reinterpret_cast<uint8_t *>(data + i);
+        uint8x16_t v = vld1q_u8(p);
+        if (size == 2)
+            v = vrev16q_u8(v);
+        else if (size == 4)
+            v = vrev32q_u8(v);
+        else
+            v = vrev64q_u8(v);
+        vst1q_u8(p, v);
+    }
+    return n;
+}
+
+#endif  // TSCPP_SWAP_NEON
+
+/**
+ * @brief Swap the bytes of an array of integers, or floating point numbers,
+ * in place.
+ *
+ * \param data Pointer to the first integer, with no alignment requirement.
+ * \param count Number of integers.
+ * \param size Size of each integer, sizes other than 2, 4 and 8 have their
+ * bytes reversed.
+ */
+inline void swapBytes(char *data, size_t count, int size)
+{
+    if (size == 2 || size == 4 || size == 8)
+    {
+        size_t done = 0;
+#if defined(TSCPP_SWAP_SSE2)
+        done = swapBytesSse2(data, count, size);
+#elif defined(TSCPP_SWAP_NEON)
+        done = swapBytesNeon(data, count, size);
+#endif
+        data += done * size;
+        count -= done;
+    }
+    if (size == 2)
+    {
+        swapBytes16Scalar(data, count);
+    }
+    else if (size == 4)
+    {
+        swapBytes32Scalar(data, count);
+    }
+    else if (size == 8)
+    {
+        swapBytes64Scalar(data, count);
+    }
+    else if (size > 1)
+    {
+        for (size_t i = 0; i < count; i++)
+            std::reverse(data + i * size, data + (i + 1) * size);
+    }
+}
+
+/**
+ * @brief Layout of the scalar fields of a type, used to swap the bytes of
+ * objects serialized on a machine with the opposite endianness.
+ *
+ * \code
+ * FieldLayout layout{TSCPP_FIELD(Foo, a), TSCPP_FIELD(Foo, samples)};
+ * \endcode
+ *
+ * Bytes not covered by any field, such as padding and char arrays, are left
+ * as they are.
+ */
+class FieldLayout
+{
+public:
+    /**
+     * @brief A run of contiguous scalars of the same size.
+     */
+    class Field
+    {
+    public:
+        Field(int offset, int size, int count)
+            : offset(offset), size(size), count(count)
+        {
+        }
+
+        /**
+         * \tparam M Type of a field, a scalar or an array of scalars.
+         * \param offset Offset of the field within its type.
+         * \return The description of the field.
+         */
+        template <typename M>
+        static Field of(size_t offset)
+        {
+            typedef typename std::remove_reference<M>::type Member;
+            typedef typename std::remove_all_extents<Member>::type Element;
+            static_assert(std::is_arithmetic<Element>::value ||
+                              std::is_enum<Element>::value,
+                          "Fields must be scalars or arrays of scalars");
+            return Field(offset, sizeof(Element),
+                         sizeof(Member) / sizeof(Element));
+        }
+
+        int offset;  ///< Offset of the first scalar
+        int size;    ///< Size of each scalar
+        int count;   ///< Number of scalars
+    };
+
+    FieldLayout() {}
+
+    /**
+     * \param fields Fields of the type, usually built with TSCPP_FIELD.
+     */
+    FieldLayout(std::initializer_list<Field> fields)
+    {
+        for (auto &f : fields)
+            add(f.offset, f.size, f.count);
+    }
+
+    /**
+     * @brief Add a field, merging it with the previous one if it is
+     * contiguous and has the same size.
+     *
+     * \param offset Offset of the field within its type.
+     * \param size Size of each scalar, fields of one byte are ignored.
+     * \param count Number of scalars, for arrays.
+     */
+    void add(int offset, int size, int count = 1)
+    {
+        if (size <= 1 || count <= 0)
+            return;
+        if (runs.empty() == false)
+        {
+            Field &last = runs.back();
+            if (last.size == size &&
+                last.offset + last.size * last.count == offset)
+            {
+                last.count += count;
+                return;
+            }
+        }
+        runs.emplace_back(offset, size, count);
+    }
+
+    /**
+     * @brief Swap the bytes of the fields of some objects, in place.
+     *
+     * \param objects Pointer to the first object.
+     * \param count Number of objects.
+     * \param size Size of each object.
+     */
+    void swap(void *objects, int count, int size) const
+    {
+        char *obj = reinterpret_cast<char *>(objects);
+        // An array of a type made only of scalars of the same size, such as a
+        // batch of floats, can be swapped in a single run
+        if (runs.size() == 1 && runs[0].offset == 0 &&
+            runs[0].size * runs[0].count == size)
+        {
+            swapBytes(obj, static_cast<size_t>(count) * runs[0].count,
+                      runs[0].size);
+            return;
+        }
+        for (int i = 0; i < count; i++, obj += size)
+            for (auto &f : runs)
+                swapBytes(obj + f.offset, f.count, f.size);
+    }
+
+    /**
+     * \return The runs of scalars, after merging contiguous fields.
+     */
+    const std::vector<Field> &fields() const { return runs; }
+
+    /**
+     * \return True if there are no fields to swap.
+     */
+    bool empty() const { return runs.empty(); }
+
+private:
+    std::vector<Field> runs;
+};
+
+}  // namespace tscpp
@@ -0,0 +1,267 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Terraneo Federico                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   As a special exception, if other files instantiate templates or use   *
+ *   macros or inline functions from this file, or you compile this file   *
+ *   and link it with other works to produce a work based on this file,    *
+ *   this file does not by itself cause the resulting work to be covered   *
+ *   by the GNU General Public License. However the source code for this   *
+ *   file must still be made available in accordance with the GNU General  *
+ *   Public License. This exception does not invalidate any other reasons  *
+ *   why a work based on this file might be covered by the GNU General     *
+ *   Public License.                                                       *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>   *
+ ***************************************************************************/
+
+/**
+ * \file type_list.h
+ *
+ * @brief Type pool for a set of types known at compile time, decoding each
+ * type with a direct call to a visitor.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "buffer.h"
+
+namespace tscpp
+{
+
+/**
+ * @brief Set of types that unserializeUnknown() can decode, fixed when
+ * compiling.
+ *
+ * Unlike TypePoolBuffer there is nothing to register: the objects found are
+ * passed to overloads of a visitor, which the compiler can inline as each
+ * type is decoded by its own function, selected by the index of the type in
+ * the list instead of through a std::function. Nothing is allocated.
+ *
+ * The names are only known at run time, as they come from typeid, so the
+ * table of their hashes is sorted the first time a list is used, and each
+ * header is then looked up with a binary search.
+ *
+ * \code
+ * struct Visitor
+ * {
+ *     void operator()(Foo &f) { ... }
+ *     void operator()(Bar &b) { ... }
+ * };
+ * TypeList<Foo, Bar> types;
+ * Visitor v;
+ * int result = unserializeUnknown(types, v, buffer, size);
+ * \endcode
+ *
+ * Delta encoded objects, upgrade converters and byte swapping are not
+ * supported, and a type must not be in the list twice.
+ *
+ * \tparam Ts Types in the list, all trivially copyable.
+ */
+template <typename... Ts>
+class TypeList
+{
+public:
+    static const int size = sizeof...(Ts);
+    static_assert(size > 0 && size < 32768, "Invalid type list size");
+
+    /**
+     * \param name Serialized type name.
+     * \param nameSize Length of the name.
+     * \param hash Hash of the name, as returned by hashTypeName().
+     * \return The index of the type in the list, or -1 if not found.
+     */
+    static int find(const char *name, int nameSize, uint32_t hash);
+
+    /**
+     * @brief Used by unserializeUnknown(), unserialize the data following a
+     * header with the visitor.
+     *
+     * \param h Parsed header.
+     * \param visitor Object with an operator() for each type of the list.
+     * \param buffer Pointer to the data after the header.
+     * \param bufSize Size of the data.
+     * \return The size of the data, or TscppError::UnknownType if the type is
+     * not in the list or delta encoded, TscppError::WrongType if the
+     * fingerprint differs, or TscppError::BufferTooSmall.
+     */
+    template <typename Visitor>
+    static int unserializeUnknownImpl(const RecordHeader &h, Visitor &visitor,
+                                      const char *buffer, int bufSize);
+
+private:
+    /**
+     * Hashes of the names, sorted, each with the index of its type
+     */
+    class Table
+    {
+    public:
+        Table();
+
+        const TypeName *names[size];
+        uint32_t hashes[size];
+        int16_t types[size];
+    };
+};
+
+template <typename... Ts>
+const int TypeList<Ts...>::size;
+
+template <typename... Ts>
+int TypeList<Ts...>::find(const char *name, int nameSize, uint32_t hash)
+{
+    static const Table table;
+    int lo = 0, hi = size;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (table.hashes[mid] < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (; lo < size && table.hashes[lo] == hash; lo++)
+    {
+        const TypeName *n = table.names[table.types[lo]];
+        if (n->size == nameSize && memcmp(n->str, name, nameSize) == 0)
+            return table.types[lo];
+    }
+    return -1;
+}
+
+template <typename... Ts>
+TypeList<Ts...>::Table::Table() : names{&typeName<Ts>()...}
+{
+    // Insertion sort, lists are short and this runs only once
+    for (int i = 0; i < size; i++)
+    {
+        uint32_t hash = hashTypeName(names[i]->str, names[i]->size);
+        int j         = i;
+        for (; j > 0 && hashes[j - 1] > hash; j--)
+        {
+            hashes[j] = hashes[j - 1];
+            types[j]  = types[j - 1];
+        }
+        hashes[j] = hash;
+        types[j]  = i;
+    }
+}
+
+/**
+ * Decodes the objects of type T following a header and calls the visitor.
+ */
+template <typename T, typename Visitor>
+int unserializeTypeListImpl(const RecordHeader &h, Visitor &visitor,
+                            const char *buffer, int bufSize)
+{
+#ifndef _MIOSIX
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Type is not trivially copyable");
+#endif
+    if (h.fingerprint != 0 && h.fingerprint != fingerprint<T>())
+        return WrongType;
+
+    int n = h.count < 0 ? 1 : h.count;
+    if (n > bufSize / static_cast<int>(sizeof(T)))
+        return BufferTooSmall;
+    for (int i = 0; i < n; i++)
+    {
+        // NOTE: The object is copied since the buffer may not be aligned
+        T t;
+        memcpy(&t, buffer + i * sizeof(T), sizeof(T));
+        visitor(t);
+    }
+    return n * sizeof(T);
+}
+
+template <typename... Ts>
+template <typename Visitor>
+int TypeList<Ts...>::unserializeUnknownImpl(const RecordHeader &h,
+                                            Visitor &visitor,
+                                            const char *buffer, int bufSize)
+{
+    // One function per type, indexed like a switch, each with the visitor
+    // overload inlined
+    typedef int (*Decoder)(const RecordHeader &, Visitor &, const char *, int);
+    static const Decoder decoders[] = {
+        &unserializeTypeListImpl<Ts, Visitor>...};
+
+    if (h.delta)
+        return UnknownType;
+    int index = find(h.name, h.nameSize, h.hash);
+    if (index < 0)
+        return UnknownType;
+    return decoders[index](h, visitor, buffer, bufSize);
+}
+
+/**
+ * @brief Unserialize a type from a memory buffer, calling the overload of
+ * the visitor for the type found.
+ *
+ * \param types List of the possible serialized types.
+ * \param visitor Object with an operator() for each type of the list,
+ * taking a reference to the type.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \return The size of the unserialized type, or TscppError::UnknownType if
+ * the type found is not in the list, TscppError::WrongType if its
+ * fingerprint differs, or TscppError::BufferTooSmall.
+ */
+template <typename... Ts, typename Visitor>
+int unserializeUnknown(const TypeList<Ts...> &types, Visitor &visitor,
+                       const void *buffer, int bufSize)
+{
+    RecordHeader h;
+    int headerSize = parseRecordHeader(buffer, bufSize, h);
+    if (headerSize < 0)
+        return headerSize;
+    int result = types.unserializeUnknownImpl(
+        h, visitor, reinterpret_cast<const char *>(buffer) + headerSize,
+        bufSize - headerSize);
+    return result < 0 ? result : result + headerSize;
+}
+
+/**
+ * @brief Unserialize a type from a memory buffer, possibly with the compact
+ * header format, calling the overload of the visitor for the type found.
+ *
+ * \param types List of the possible serialized types.
+ * \param td Type dictionary of the serialization session.
+ * \param visitor Object with an operator() for each type of the list,
+ * taking a reference to the type.
+ * \param buffer Pointer to buffer where the serialized type is.
+ * \param bufSize Buffer size.
+ * \return The size of the unserialized type, or TscppError::UnknownType if
+ * the type found is not in the list or the type id has not been defined,
+ * TscppError::WrongType if its fingerprint differs, or
+ * TscppError::BufferTooSmall.
+ */
+template <typename... Ts, typename Visitor>
+int unserializeUnknown(const TypeList<Ts...> &types, TypeDictionary &td,
+                       Visitor &visitor, const void *buffer, int bufSize)
+{
+    RecordHeader h;
+    int headerSize = parseRecordHeader(td, buffer, bufSize, h);
+    if (headerSize < 0)
+        return headerSize;
+    int result = types.unserializeUnknownImpl(
+        h, visitor, reinterpret_cast<const char *>(buffer) + headerSize,
+        bufSize - headerSize);
+    return result < 0 ? result : result + headerSize;
+}
+
+}  // namespace tscpp